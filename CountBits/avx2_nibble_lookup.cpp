@@ -0,0 +1,43 @@
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include <algorithm>
+
+#include "avx2_popcount.hpp"
+
+__attribute__(( target( "avx2" ) ))
+uint64_t
+avx2_nibble_lookup_bytes( const unsigned char * data, std::size_t len )
+{
+    const std::size_t n_vecs = len / 32;
+
+    // per-byte counts go up by at most 8 a time, so they can be
+    // added up 31 times before one could overflow.
+    __m256i total = _mm256_setzero_si256();
+    std::size_t v = 0;
+    while ( v < n_vecs )
+    {
+        const std::size_t stop = std::min< std::size_t >( v + 31, n_vecs );
+        __m256i bytes = _mm256_setzero_si256();
+        for ( ; v < stop; ++v )
+            bytes = _mm256_add_epi8( bytes, count_bits_bytes_avx2( load_avx2( data + v * 32 ) ) );
+        total = _mm256_add_epi64( total, _mm256_sad_epu8( bytes, _mm256_setzero_si256() ) );
+    }
+
+    uint64_t rv = sum_lanes_avx2( total );
+
+    // and then any at the end
+    for ( std::size_t i = n_vecs * 32; i < len; ++i )
+        rv += count_bits_uint8( data[i] );
+
+    return rv;
+}
+
+int
+avx2_nibble_lookup( const uint16_vec & vals )
+{
+    return avx2_nibble_lookup_bytes( bytes_of( vals ), vals.size() * 2 );
+}
+
+#endif
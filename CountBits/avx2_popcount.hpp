@@ -0,0 +1,66 @@
+// helpers shared by the avx2 kernels; only include from code that
+// checks the cpu first.
+
+#include <immintrin.h>
+
+namespace
+{
+
+// 32 bytes from p, of any alignment.
+__attribute__(( target( "avx2" ) ))
+inline
+__m256i
+load_avx2( const unsigned char * p )
+{
+    return _mm256_loadu_si256( static_cast< const __m256i * >( static_cast< const void * >( p ) ) );
+}
+
+// carry-save adder: h:l = a + b + c, bitwise
+__attribute__(( target( "avx2" ) ))
+inline
+void
+csa( __m256i & h, __m256i & l, const __m256i a, const __m256i b, const __m256i c )
+{
+    const __m256i u = _mm256_xor_si256( a, b );
+    h = _mm256_or_si256( _mm256_and_si256( a, b ), _mm256_and_si256( u, c ) );
+    l = _mm256_xor_si256( u, c );
+}
+
+// per-byte bit counts of v, by looking up each nibble with pshufb
+// (Wojciech Mula's method).
+__attribute__(( target( "avx2" ) ))
+inline
+__m256i
+count_bits_bytes_avx2( const __m256i v )
+{
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+    const __m256i low_mask = _mm256_set1_epi8( 0x0f );
+
+    const __m256i lo = _mm256_and_si256( v, low_mask );
+    const __m256i hi = _mm256_and_si256( _mm256_srli_epi16( v, 4 ), low_mask );
+    return _mm256_add_epi8( _mm256_shuffle_epi8( lookup, lo ),
+                            _mm256_shuffle_epi8( lookup, hi ) );
+}
+
+// bit counts of v as four 64-bit lanes.
+__attribute__(( target( "avx2" ) ))
+inline
+__m256i
+count_bits_avx2( const __m256i v )
+{
+    return _mm256_sad_epu8( count_bits_bytes_avx2( v ), _mm256_setzero_si256() );
+}
+
+__attribute__(( target( "avx2" ) ))
+inline
+uint64_t
+sum_lanes_avx2( const __m256i v )
+{
+    uint64_t lanes[4];
+    _mm256_storeu_si256( static_cast< __m256i * >( static_cast< void * >( lanes ) ), v );
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+}
@@ -0,0 +1,46 @@
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include <immintrin.h>
+
+__attribute__(( target( "avx512f,avx512vpopcntdq" ) ))
+uint64_t
+avx512_vpopcntdq_bytes( const unsigned char * data, std::size_t len )
+{
+    const std::size_t n_vecs = len / 64;
+
+    // two accumulators to keep both vector ports busy
+    __m512i sum0 = _mm512_setzero_si512();
+    __m512i sum1 = _mm512_setzero_si512();
+    std::size_t v = 0;
+    for ( ; v + 2 <= n_vecs; v += 2 )
+    {
+        const __m512i a = _mm512_loadu_si512( data + v * 64 );
+        const __m512i b = _mm512_loadu_si512( data + v * 64 + 64 );
+        sum0 = _mm512_add_epi64( sum0, _mm512_popcnt_epi64( a ) );
+        sum1 = _mm512_add_epi64( sum1, _mm512_popcnt_epi64( b ) );
+    }
+    if ( v < n_vecs )
+        sum0 = _mm512_add_epi64( sum0, _mm512_popcnt_epi64( _mm512_loadu_si512( data + v * 64 ) ) );
+
+    uint64_t lanes[8];
+    _mm512_storeu_si512( lanes, _mm512_add_epi64( sum0, sum1 ) );
+    uint64_t rv = 0;
+    for ( int l = 0; l < 8; ++l )
+        rv += lanes[l];
+
+    // and then any at the end
+    for ( std::size_t i = n_vecs * 64; i < len; ++i )
+        rv += count_bits_uint8( data[i] );
+
+    return rv;
+}
+
+int
+avx512_vpopcntdq( const uint16_vec & vals )
+{
+    return avx512_vpopcntdq_bytes( bytes_of( vals ), vals.size() * 2 );
+}
+
+#endif
@@ -0,0 +1,468 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench_harness.hpp"
+#include "bit_counters.hpp"
+#include "popcount.hpp"
+
+// Every kernel at sizes that sit in each cache level and in DRAM:
+// warmups, then repeated trials of enough calls to take a while each,
+// reported as the median and MAD of the per-trial GB/s, with hardware
+// counters per byte where perf_event_open(2) is allowed.  Output is a
+// table, CSV or JSON, tagged with the cpu model so runs from different
+// machines can be put side by side.  The fused and/or/xor/and-not
+// counts are run against doing the op into a third bitmap and then
+// counting that.
+
+namespace // anonymous
+{
+
+typedef std::chrono::steady_clock clock;
+
+struct options
+{
+    options();
+
+    std::vector< std::size_t > sizes;     // bytes; empty for one per cache level
+    std::vector< std::string > kernels;   // names to run; empty for all
+    int warmups;
+    int trials;
+    double min_trial_secs;
+    std::size_t max_bytes;
+    std::string format;
+};
+
+options::options()
+    : warmups( 3 ),
+      trials( 11 ),
+      min_trial_secs( 0.02 ),
+      max_bytes( std::size_t( 1 ) << 30 ),
+      format( "text" )
+{
+}
+
+struct candidate
+{
+    std::string name;
+    std::function< uint64_t ( const uint16_vec & ) > func;
+    bool wide;       // result is 64-bit; the others are int and wrap
+    std::string counts;   // what it counts; those counting the same must agree
+};
+
+struct result
+{
+    std::string kernel;
+    std::size_t bytes;
+    const char * level;
+    uint64_t reps;
+    trial_summary gbps;
+    double cycles_per_byte;
+    double instructions_per_byte;
+    double misses_per_kib;
+    uint64_t bits;
+};
+
+std::size_t
+cache_bytes( const int name, const std::size_t fallback )
+{
+    const long n = sysconf( name );
+    return n > 0 ? static_cast< std::size_t >( n ) : fallback;
+}
+
+const std::size_t l1_bytes = cache_bytes( _SC_LEVEL1_DCACHE_SIZE, 32 << 10 );
+const std::size_t l2_bytes = cache_bytes( _SC_LEVEL2_CACHE_SIZE, 1 << 20 );
+const std::size_t l3_bytes = cache_bytes( _SC_LEVEL3_CACHE_SIZE, 32 << 20 );
+
+const char *
+level_of( const std::size_t bytes )
+{
+    return bytes <= l1_bytes ? "L1" :
+           bytes <= l2_bytes ? "L2" :
+           bytes <= l3_bytes ? "L3" : "DRAM";
+}
+
+// half of each cache, so the input stays put, and then well past the last.
+std::vector< std::size_t >
+default_sizes( const std::size_t max_bytes )
+{
+    std::vector< std::size_t > rv;
+    rv.push_back( l1_bytes / 2 );
+    rv.push_back( l2_bytes / 2 );
+    rv.push_back( l3_bytes / 2 );
+    rv.push_back( std::max< std::size_t >( l3_bytes * 4, 256 << 20 ) );
+    for ( std::size_t & s : rv )
+        s = std::min( s, max_bytes ) & ~std::size_t( 63 );
+    rv.erase( std::unique( rv.begin(), rv.end() ), rv.end() );
+    return rv;
+}
+
+// "4096", "48K", "1M", "2G"
+std::size_t
+parse_size( const std::string & str )
+{
+    std::istringstream iss( str );
+    double n;
+    iss >> n;
+    if ( ! iss )
+        throw std::invalid_argument( str );
+    char unit = 0;
+    iss >> unit;
+    switch ( unit )
+    {
+    case 0:                     break;
+    case 'k': case 'K': n *= 1 << 10; break;
+    case 'm': case 'M': n *= 1 << 20; break;
+    case 'g': case 'G': n *= 1 << 30; break;
+    default: throw std::invalid_argument( str );
+    }
+    return static_cast< std::size_t >( n );
+}
+
+std::vector< std::string >
+split( const std::string & str )
+{
+    std::vector< std::string > rv;
+    std::istringstream iss( str );
+    std::string item;
+    while ( std::getline( iss, item, ',' ) )
+        if ( ! item.empty() )
+            rv.push_back( item );
+    return rv;
+}
+
+// the op into scratch, then a count of that: what the fused counts
+// save.  the op is fixed at compile time so the loop vectorises.
+template < bit_op Op >
+uint64_t
+op_then_popcount( const uint16_vec & v, uint16_vec & scratch )
+{
+    const std::size_t n = v.size() / 2;
+    scratch.resize( n );
+    for ( std::size_t i = 0; i < n; ++i )
+        scratch[i] = combine< Op >( v[i], v[n + i] );
+    return popcount( scratch );
+}
+
+typedef uint64_t ( * unfused_ptr )( const uint16_vec & v, uint16_vec & scratch );
+
+const unfused_ptr unfused_ops[] = { op_then_popcount< op_and >, op_then_popcount< op_or >,
+                                    op_then_popcount< op_xor >, op_then_popcount< op_and_not > };
+
+std::vector< candidate >
+make_candidates( const std::vector< std::string > & only )
+{
+    std::vector< candidate > rv;
+    for ( const bit_counter_kernel & k : bit_counter_kernels() )
+    {
+        if ( ! k.supported )
+            continue;
+        if ( k.bytes )
+        {
+            const byte_counter_ptr bytes = k.bytes;
+            rv.push_back( { k.name, [bytes]( const uint16_vec & v ) { return bytes( bytes_of( v ), v.size() * 2 ); }, true, "bits" } );
+        }
+        else
+        {
+            const bit_counter_ptr func = k.func;
+            rv.push_back( { k.name, [func]( const uint16_vec & v ) { return static_cast< uint64_t >( func( v ) ); }, false, "bits" } );
+        }
+    }
+    rv.push_back( { "popcount", []( const uint16_vec & v ) { return popcount( v ); }, true, "bits" } );
+    rv.push_back( { "popcount_parallel", []( const uint16_vec & v ) { return popcount_parallel( v.data(), v.size() ); }, true, "bits" } );
+
+    // the fused counts take the first and second halves of the input as
+    // the two bitmaps, so GB/s compares directly with a plain count.
+    // each op is also done the long way, through a third bitmap.
+    for ( const fused_kernel & k : fused_kernels() )
+    {
+        if ( ! k.supported )
+            continue;
+        const fused_counter_ptr func = k.func;
+        rv.push_back( { k.name, [func]( const uint16_vec & v )
+                        { return func( op_and, bytes_of( v ), bytes_of( v ) + v.size() / 2 * 2, v.size() / 2 * 2 ); },
+                        true, "and" } );
+    }
+    const bit_op ops[] = { op_and, op_or, op_xor, op_and_not };
+    const char * const op_names[] = { "and", "or", "xor", "and_not" };
+    for ( int o = 0; o < 4; ++o )
+    {
+        const bit_op op = ops[o];
+        const std::string name( op_names[o] );
+        rv.push_back( { "popcount_" + name, [op]( const uint16_vec & v )
+                        { return popcount_op( op, v.data(), v.data() + v.size() / 2, v.size() / 2 ); },
+                        true, name } );
+
+        const unfused_ptr unfused = unfused_ops[o];
+        std::shared_ptr< uint16_vec > scratch( std::make_shared< uint16_vec >() );
+        rv.push_back( { name + "_then_popcount", [unfused, scratch]( const uint16_vec & v )
+                        { return unfused( v, *scratch ); },
+                        true, name } );
+    }
+    rv.push_back( { "jaccard", []( const uint16_vec & v )
+                    { return static_cast< uint64_t >( jaccard( v.data(), v.data() + v.size() / 2, v.size() / 2 ) * 1e9 ); },
+                    true, "jaccard" } );
+
+    if ( ! only.empty() )
+        rv.erase( std::remove_if( rv.begin(), rv.end(), [&]( const candidate & c )
+                  { return std::find( only.begin(), only.end(), c.name ) == only.end(); } ),
+                  rv.end() );
+    return rv;
+}
+
+double
+run( const candidate & c, const uint16_vec & vec, const uint64_t reps, uint64_t & bits )
+{
+    const clock::time_point start = clock::now();
+    for ( uint64_t r = 0; r < reps; ++r )
+    {
+        bits = c.func( vec );
+        do_not_optimize( bits );
+    }
+    return std::chrono::duration< double >( clock::now() - start ).count();
+}
+
+result
+measure( const candidate & c, const uint16_vec & vec, const options & opts, perf_counters & perf )
+{
+    result rv;
+    rv.kernel = c.name;
+    rv.bytes = vec.size() * 2;
+    rv.level = level_of( rv.bytes );
+
+    // enough calls per trial that timer resolution and call overhead don't matter
+    rv.reps = 1;
+    while ( run( c, vec, rv.reps, rv.bits ) < opts.min_trial_secs )
+        rv.reps *= 2;
+
+    for ( int w = 0; w < opts.warmups; ++w )
+        run( c, vec, rv.reps, rv.bits );
+
+    std::vector< double > gbps;
+    perf_counters::values total = { 0, 0, 0 };
+    for ( int t = 0; t < opts.trials; ++t )
+    {
+        perf.start();
+        const double secs = run( c, vec, rv.reps, rv.bits );
+        const perf_counters::values v = perf.stop();
+        total.cycles += v.cycles;
+        total.instructions += v.instructions;
+        total.cache_misses += v.cache_misses;
+        gbps.push_back( rv.bytes * static_cast< double >( rv.reps ) / secs / 1e9 );
+    }
+    rv.gbps = summarize( gbps );
+
+    const double bytes = rv.bytes * static_cast< double >( rv.reps ) * opts.trials;
+    rv.cycles_per_byte = total.cycles / bytes;
+    rv.instructions_per_byte = total.instructions / bytes;
+    rv.misses_per_kib = total.cache_misses / bytes * 1024;
+    return rv;
+}
+
+std::string
+json_string( const std::string & str )
+{
+    std::string rv( "\"" );
+    for ( const char ch : str )
+    {
+        if ( ch == '"' || ch == '\\' )
+            rv += '\\';
+        if ( static_cast< unsigned char >( ch ) >= 0x20 )
+            rv += ch;
+    }
+    return rv + "\"";
+}
+
+void
+print( const std::vector< result > & results, const options & opts,
+       const std::string & cpu, const perf_counters & perf )
+{
+    std::ostream & os = std::cout;
+    const bool counters = perf.available();
+
+    if ( opts.format == "csv" )
+    {
+        os << "cpu,kernel,bytes,level,reps,trials,median_gbps,mad_gbps,min_gbps,max_gbps,"
+              "cycles_per_byte,instructions_per_byte,cache_misses_per_kib,bits\n";
+        for ( const result & r : results )
+        {
+            os << '"' << cpu << "\"," << r.kernel << ',' << r.bytes << ',' << r.level << ','
+               << r.reps << ',' << opts.trials << ',' << r.gbps.median << ',' << r.gbps.mad << ','
+               << r.gbps.min << ',' << r.gbps.max << ',';
+            if ( counters )
+                os << r.cycles_per_byte << ',' << r.instructions_per_byte << ',' << r.misses_per_kib;
+            else
+                os << ",,";
+            os << ',' << r.bits << '\n';
+        }
+        return;
+    }
+
+    if ( opts.format == "json" )
+    {
+        os << "{ \"cpu\": " << json_string( cpu )
+           << ", \"perf_counters\": " << ( counters ? "true" : "false" );
+        if ( ! counters )
+            os << ", \"perf_counters_reason\": " << json_string( perf.reason() );
+        os << ", \"warmups\": " << opts.warmups << ", \"trials\": " << opts.trials
+           << ", \"results\": [";
+        for ( std::size_t i = 0; i < results.size(); ++i )
+        {
+            const result & r = results[i];
+            os << ( i ? "," : "" ) << "\n  { \"kernel\": " << json_string( r.kernel )
+               << ", \"bytes\": " << r.bytes << ", \"level\": \"" << r.level << "\""
+               << ", \"reps\": " << r.reps
+               << ", \"median_gbps\": " << r.gbps.median << ", \"mad_gbps\": " << r.gbps.mad
+               << ", \"min_gbps\": " << r.gbps.min << ", \"max_gbps\": " << r.gbps.max;
+            if ( counters )
+                os << ", \"cycles_per_byte\": " << r.cycles_per_byte
+                   << ", \"instructions_per_byte\": " << r.instructions_per_byte
+                   << ", \"cache_misses_per_kib\": " << r.misses_per_kib;
+            os << ", \"bits\": " << r.bits << " }";
+        }
+        os << "\n] }" << std::endl;
+        return;
+    }
+
+    os << "cpu: " << cpu << "\n";
+    if ( ! counters )
+        os << "hardware counters unavailable (" << perf.reason() << ")\n";
+    os << std::left << std::setw( 24 ) << "kernel" << std::right
+       << std::setw( 12 ) << "bytes" << std::setw( 6 ) << "level"
+       << std::setw( 10 ) << "GB/s" << std::setw( 8 ) << "±MAD";
+    if ( counters )
+        os << std::setw( 10 ) << "cyc/B" << std::setw( 10 ) << "ins/B" << std::setw( 12 ) << "miss/KiB";
+    os << "\n";
+    for ( const result & r : results )
+    {
+        os << std::left << std::setw( 24 ) << r.kernel << std::right
+           << std::setw( 12 ) << r.bytes << std::setw( 6 ) << r.level
+           << std::fixed << std::setprecision( 2 )
+           << std::setw( 10 ) << r.gbps.median << std::setw( 8 ) << r.gbps.mad;
+        if ( counters )
+            os << std::setw( 10 ) << r.cycles_per_byte << std::setw( 10 ) << r.instructions_per_byte
+               << std::setw( 12 ) << r.misses_per_kib;
+        os << "\n";
+        os.unsetf( std::ios::floatfield );
+    }
+    os.flush();
+}
+
+void
+usage( const char * argv0 )
+{
+    std::cerr <<
+        "usage: " << argv0 << " [options]\n"
+        "  --sizes S,S,...     input sizes in bytes, with K/M/G suffixes\n"
+        "                      (default: half of L1, L2 and L3, then DRAM)\n"
+        "  --max-size S        cap on the default DRAM size (default: 1G)\n"
+        "  --kernels K,K,...   only these (default: every supported one)\n"
+        "  --warmups N         untimed runs first (default: 3)\n"
+        "  --trials N          timed runs to summarise (default: 11)\n"
+        "  --min-ms N          least time per trial (default: 20)\n"
+        "  --format F          text, csv or json (default: text)\n";
+}
+
+} // end namespace [anonymous]
+
+int main( int argc, char * argv [] )
+{
+    options opts;
+    std::size_t max_bytes = opts.max_bytes;
+
+    try
+    {
+        for ( int i = 1; i < argc; ++i )
+        {
+            const std::string arg( argv[i] );
+            const bool has_value = i + 1 < argc;
+            if ( arg == "--sizes" && has_value )
+                for ( const std::string & s : split( argv[++i] ) )
+                    opts.sizes.push_back( parse_size( s ) & ~std::size_t( 1 ) );
+            else if ( arg == "--max-size" && has_value )
+                max_bytes = parse_size( argv[++i] );
+            else if ( arg == "--kernels" && has_value )
+                opts.kernels = split( argv[++i] );
+            else if ( arg == "--warmups" && has_value )
+                opts.warmups = std::stoi( argv[++i] );
+            else if ( arg == "--trials" && has_value )
+                opts.trials = std::max( 1, std::stoi( argv[++i] ) );
+            else if ( arg == "--min-ms" && has_value )
+                opts.min_trial_secs = std::stod( argv[++i] ) / 1000;
+            else if ( arg == "--format" && has_value )
+                opts.format = argv[++i];
+            else
+            {
+                usage( argv[0] );
+                return 2;
+            }
+        }
+    }
+    catch ( const std::exception & e )
+    {
+        std::cerr << "bad argument: " << e.what() << std::endl;
+        usage( argv[0] );
+        return 2;
+    }
+
+    if ( opts.format != "text" && opts.format != "csv" && opts.format != "json" )
+    {
+        usage( argv[0] );
+        return 2;
+    }
+    if ( opts.sizes.empty() )
+        opts.sizes = default_sizes( max_bytes );
+
+    const std::vector< candidate > candidates = make_candidates( opts.kernels );
+    if ( candidates.empty() )
+    {
+        std::cerr << "no such kernels" << std::endl;
+        return 2;
+    }
+
+    perf_counters perf;
+    std::mt19937_64 rand_gen( 12345 );
+    std::vector< result > results;
+    int status = 0;
+
+    for ( const std::size_t bytes : opts.sizes )
+    {
+        uint16_vec vec( bytes / 2 );
+        for ( uint16_t & v : vec )
+            v = static_cast< uint16_t >( rand_gen() );
+
+        std::map< std::string, uint64_t > expected;
+        for ( const candidate & c : candidates )
+        {
+            std::cerr << c.name << " over " << bytes << " bytes..." << std::endl;
+            results.push_back( measure( c, vec, opts, perf ) );
+
+            // the int-returning kernels only count right below INT_MAX bits
+            if ( ! c.wide && bytes * 8 > static_cast< std::size_t >( INT_MAX ) )
+                continue;
+            const auto first = expected.insert( std::make_pair( c.counts, results.back().bits ) );
+            if ( results.back().bits != first.first->second )
+            {
+                std::cerr << c.name << ": " << results.back().bits << " != " << first.first->second
+                          << " over " << bytes << " bytes" << std::endl;
+                status = 1;
+            }
+        }
+    }
+
+    print( results, opts, cpu_model(), perf );
+    return status;
+}
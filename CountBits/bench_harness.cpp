@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "bench_harness.hpp"
+
+namespace
+{
+
+#ifdef __linux__
+
+int
+open_counter( const uint32_t type, const uint64_t config, const int group )
+{
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size = sizeof( attr );
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1;      // the leader starts them all
+    attr.exclude_kernel = 1;          // all that paranoid >= 2 allows
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall( __NR_perf_event_open, &attr, 0, -1, group, 0 );
+}
+
+#endif
+
+}
+
+perf_counters::perf_counters()
+{
+    m_fds[0] = m_fds[1] = m_fds[2] = -1;
+
+#ifdef __linux__
+    const uint64_t configs[3] = { PERF_COUNT_HW_CPU_CYCLES,
+                                  PERF_COUNT_HW_INSTRUCTIONS,
+                                  PERF_COUNT_HW_CACHE_MISSES };
+    for ( int i = 0; i < 3; ++i )
+    {
+        m_fds[i] = open_counter( PERF_TYPE_HARDWARE, configs[i], i == 0 ? -1 : m_fds[0] );
+        if ( m_fds[i] == -1 )
+        {
+            m_reason = std::string( "perf_event_open: " ) + strerror( errno );
+            for ( int j = 0; j < i; ++j )
+                close( m_fds[j] );
+            m_fds[0] = m_fds[1] = m_fds[2] = -1;
+            return;
+        }
+    }
+#else
+    m_reason = "perf counters need linux";
+#endif
+}
+
+perf_counters::~perf_counters()
+{
+    for ( int i = 0; i < 3; ++i )
+        if ( m_fds[i] != -1 )
+            close( m_fds[i] );
+}
+
+void
+perf_counters::start()
+{
+#ifdef __linux__
+    if ( ! available() )
+        return;
+    ioctl( m_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+    ioctl( m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+#endif
+}
+
+perf_counters::values
+perf_counters::stop()
+{
+    values rv = { 0, 0, 0 };
+#ifdef __linux__
+    if ( ! available() )
+        return rv;
+    ioctl( m_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+
+    uint64_t buf[4];   // nr, then one value per counter
+    if ( read( m_fds[0], buf, sizeof( buf ) ) == static_cast< ssize_t >( sizeof( buf ) ) && buf[0] == 3 )
+    {
+        rv.cycles = buf[1];
+        rv.instructions = buf[2];
+        rv.cache_misses = buf[3];
+    }
+#endif
+    return rv;
+}
+
+trial_summary
+summarize( std::vector< double > samples )
+{
+    trial_summary rv = { 0, 0, 0, 0 };
+    if ( samples.empty() )
+        return rv;
+
+    std::sort( samples.begin(), samples.end() );
+    const std::size_t n = samples.size();
+    rv.min = samples.front();
+    rv.max = samples.back();
+    rv.median = n % 2 ? samples[ n / 2 ] : ( samples[ n / 2 - 1 ] + samples[ n / 2 ] ) / 2;
+
+    for ( double & s : samples )
+        s = std::fabs( s - rv.median );
+    std::sort( samples.begin(), samples.end() );
+    rv.mad = n % 2 ? samples[ n / 2 ] : ( samples[ n / 2 - 1 ] + samples[ n / 2 ] ) / 2;
+
+    return rv;
+}
+
+std::string
+cpu_model()
+{
+    // x86 says "model name", powerpc just "cpu"
+    std::ifstream ifs( "/proc/cpuinfo" );
+    std::string line, fallback( "unknown" );
+    while ( std::getline( ifs, line ) )
+    {
+        const std::size_t colon = line.find( ':' );
+        if ( colon == std::string::npos || colon + 2 >= line.size() )
+            continue;
+        const std::string key = line.substr( 0, line.find_last_not_of( " \t", colon - 1 ) + 1 );
+        if ( key == "model name" )
+            return line.substr( colon + 2 );
+        if ( key == "cpu" && fallback == "unknown" )
+            fallback = line.substr( colon + 2 );
+    }
+    return fallback;
+}
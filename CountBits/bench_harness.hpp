@@ -0,0 +1,73 @@
+#ifndef COUNTBITS_BENCH_HARNESS_HPP
+#define COUNTBITS_BENCH_HARNESS_HPP 1
+
+// Pieces for timing kernels honestly: a barrier that keeps results
+// (and the work behind them) from being optimised away, hardware
+// counters where the kernel lets us have them, and robust summaries
+// of repeated trials.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// make the compiler believe val is used, so the computation that
+// produced it has to happen.
+template < typename T >
+inline
+void
+do_not_optimize( const T & val )
+{
+    __asm__ __volatile__ ( "" : : "g" ( val ) : "memory" );
+}
+
+// cycles, instructions and last-level cache misses for this thread,
+// from perf_event_open(2).  if any of them can't be opened (no
+// permission, no pmu in a vm, not linux), available() is false and
+// reason() says why; start() and stop() then do nothing.
+class perf_counters
+{
+
+public:
+
+    struct values
+    {
+        uint64_t cycles;
+        uint64_t instructions;
+        uint64_t cache_misses;
+    };
+
+    perf_counters();
+    ~perf_counters();
+
+    bool available() const { return m_fds[0] != -1; }
+    const std::string & reason() const { return m_reason; }
+
+    void start();
+
+    // counts since start()
+    values stop();
+
+private:
+
+    perf_counters( const perf_counters & );
+    perf_counters & operator=( const perf_counters & );
+
+    int m_fds[3];
+    std::string m_reason;
+
+};
+
+struct trial_summary
+{
+    double median;
+    double mad;        // median absolute deviation from the median
+    double min;
+    double max;
+};
+
+trial_summary summarize( std::vector< double > samples );
+
+// the cpu's model name, for telling results from different machines apart.
+std::string cpu_model();
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdexcept>
+
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#endif
+
+namespace
+{
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+struct cpu_features
+{
+    cpu_features();
+
+    bool popcnt;
+    bool avx2;
+    bool avx512_vpopcntdq;
+    bool avx512bw;
+};
+
+// which register state the os saves on a context switch
+uint64_t
+xgetbv0()
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__ ( "xgetbv" : "=a" ( lo ), "=d" ( hi ) : "c" ( 0 ) );
+    return ( static_cast< uint64_t >( hi ) << 32 ) | lo;
+}
+
+cpu_features::cpu_features()
+    : popcnt( false ),
+      avx2( false ),
+      avx512_vpopcntdq( false ),
+      avx512bw( false )
+{
+    unsigned a, b, c, d;
+    if ( ! __get_cpuid( 1, &a, &b, &c, &d ) )
+        return;
+
+    popcnt = c & bit_POPCNT;
+
+    // the cpu having avx isn't enough: the os has to be saving the
+    // ymm (and for avx-512, the opmask and zmm) registers too.
+    const uint64_t xcr0 = ( c & bit_OSXSAVE ) ? xgetbv0() : 0;
+    const bool ymm_saved = ( xcr0 & 0x06 ) == 0x06;
+    const bool zmm_saved = ( xcr0 & 0xe6 ) == 0xe6;
+
+    if ( __get_cpuid_max( 0, 0 ) < 7 )
+        return;
+    __cpuid_count( 7, 0, a, b, c, d );
+
+    avx2 = ymm_saved && ( b & bit_AVX2 );
+    avx512_vpopcntdq = zmm_saved && ( b & bit_AVX512F ) && ( c & bit_AVX512VPOPCNTDQ );
+    avx512bw = zmm_saved && ( b & bit_AVX512F ) && ( b & bit_AVX512BW );
+}
+
+#endif
+
+std::vector< bit_counter_kernel >
+make_kernels()
+{
+    std::vector< bit_counter_kernel > rv;
+    rv.push_back( { "eight_bit_lookup",     eight_bit_lookup,     0,                          true } );
+    rv.push_back( { "thirty_two_bit_slice", thirty_two_bit_slice, 0,                          true } );
+    rv.push_back( { "sixty_four_bit_slice", sixty_four_bit_slice, sixty_four_bit_slice_bytes, true } );
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+    const cpu_features cpu;
+    rv.push_back( { "popcnt_instruction",   popcnt_instruction,   popcnt_instruction_bytes,   cpu.popcnt } );
+    rv.push_back( { "avx2_nibble_lookup",   avx2_nibble_lookup,   avx2_nibble_lookup_bytes,   cpu.avx2 } );
+    rv.push_back( { "avx2_harley_seal",     avx2_harley_seal,     avx2_harley_seal_bytes,     cpu.avx2 } );
+    rv.push_back( { "avx512_vpopcntdq",     avx512_vpopcntdq,     avx512_vpopcntdq_bytes,     cpu.avx512_vpopcntdq } );
+#endif
+
+    return rv;
+}
+
+std::vector< positional_kernel >
+make_positional_kernels()
+{
+    // the vector kernels spill their byte counters into the 64 counts
+    // a handful of times per call, however short the run; below these
+    // lengths (where they overtook the kernel before them on an
+    // avx-512 box) that costs more than the wider registers save.
+    std::vector< positional_kernel > rv;
+    rv.push_back( { "positional_scalar",    positional_scalar_bytes,    true,         0 } );
+    rv.push_back( { "positional_bit_slice", positional_bit_slice_bytes, true,         0 } );
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+    const cpu_features cpu;
+    rv.push_back( { "positional_avx2",      positional_avx2_bytes,      cpu.avx2,     16 << 10 } );
+    rv.push_back( { "positional_avx512",    positional_avx512_bytes,    cpu.avx512bw, 128 << 10 } );
+#endif
+
+    return rv;
+}
+
+std::vector< fused_kernel >
+make_fused_kernels()
+{
+    std::vector< fused_kernel > rv;
+    rv.push_back( { "fused_scalar",           fused_scalar_bytes,           true } );
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+    const cpu_features cpu;
+    rv.push_back( { "fused_popcnt",           fused_popcnt_bytes,           cpu.popcnt } );
+    rv.push_back( { "fused_avx2_harley_seal", fused_avx2_harley_seal_bytes, cpu.avx2 } );
+    rv.push_back( { "fused_avx512",           fused_avx512_bytes,           cpu.avx512_vpopcntdq } );
+#endif
+
+    return rv;
+}
+
+} // end namespace [anonymous]
+
+const std::vector< bit_counter_kernel > &
+bit_counter_kernels()
+{
+    static const std::vector< bit_counter_kernel > kernels( make_kernels() );
+    return kernels;
+}
+
+const bit_counter_kernel &
+best_bit_counter()
+{
+    static const bit_counter_kernel & best = []() -> const bit_counter_kernel &
+    {
+        const std::vector< bit_counter_kernel > & kernels = bit_counter_kernels();
+        for ( std::size_t i = kernels.size(); i-- > 0; )
+            if ( kernels[i].supported && kernels[i].bytes )
+                return kernels[i];
+        throw std::logic_error( "no byte-range bit counter" );
+    }();
+    return best;
+}
+
+int
+count_bits( const uint16_vec & vals )
+{
+    return best_bit_counter().func( vals );
+}
+
+const std::vector< positional_kernel > &
+positional_kernels()
+{
+    static const std::vector< positional_kernel > kernels( make_positional_kernels() );
+    return kernels;
+}
+
+const positional_kernel &
+best_positional_kernel()
+{
+    static const positional_kernel & best = []() -> const positional_kernel &
+    {
+        const std::vector< positional_kernel > & kernels = positional_kernels();
+        for ( std::size_t i = kernels.size(); i-- > 0; )
+            if ( kernels[i].supported )
+                return kernels[i];
+        throw std::logic_error( "no positional bit counter" );
+    }();
+    return best;
+}
+
+const positional_kernel &
+positional_kernel_for( const std::size_t len )
+{
+    const std::vector< positional_kernel > & kernels = positional_kernels();
+    for ( std::size_t i = kernels.size(); i-- > 0; )
+        if ( kernels[i].supported && kernels[i].min_bytes <= len )
+            return kernels[i];
+    throw std::logic_error( "no positional bit counter" );
+}
+
+const std::vector< fused_kernel > &
+fused_kernels()
+{
+    static const std::vector< fused_kernel > kernels( make_fused_kernels() );
+    return kernels;
+}
+
+const fused_kernel &
+best_fused_kernel()
+{
+    static const fused_kernel & best = []() -> const fused_kernel &
+    {
+        const std::vector< fused_kernel > & kernels = fused_kernels();
+        for ( std::size_t i = kernels.size(); i-- > 0; )
+            if ( kernels[i].supported )
+                return kernels[i];
+        throw std::logic_error( "no fused bit counter" );
+    }();
+    return best;
+}
@@ -1,6 +1,8 @@
 #include <cstdint>
 #include <vector>
 
+#include "popcount.hpp"
+
 namespace
 {
 
@@ -29,7 +31,171 @@ count_bits_uint8( uint8_t n )
 
 typedef std::vector< uint16_t > uint16_vec;
 
+namespace
+{
+
+// the bytes of vals, which char-typed access may look at directly.
+inline
+const unsigned char *
+bytes_of( const uint16_vec & vals )
+{
+    return static_cast< const unsigned char * >( static_cast< const void * >( vals.data() ) );
+}
+
+}
+
 int eight_bit_lookup( const uint16_vec & vals );
 int sixty_four_bit_slice( const uint16_vec & vals );
 int thirty_two_bit_slice( const uint16_vec & vals );
 
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+// these need cpu support beyond the baseline; see bit_counter_kernels()
+// for which ones this cpu can run.
+int popcnt_instruction( const uint16_vec & vals );
+int avx2_nibble_lookup( const uint16_vec & vals );
+int avx2_harley_seal( const uint16_vec & vals );
+int avx512_vpopcntdq( const uint16_vec & vals );
+
+#endif
+
+// the same kernels over len bytes at data, of any alignment, with
+// 64-bit counts.  these are what popcount.hpp runs on.
+uint64_t sixty_four_bit_slice_bytes( const unsigned char * data, std::size_t len );
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+uint64_t popcnt_instruction_bytes( const unsigned char * data, std::size_t len );
+uint64_t avx2_nibble_lookup_bytes( const unsigned char * data, std::size_t len );
+uint64_t avx2_harley_seal_bytes( const unsigned char * data, std::size_t len );
+uint64_t avx512_vpopcntdq_bytes( const unsigned char * data, std::size_t len );
+
+#endif
+
+typedef int ( * bit_counter_ptr )( const uint16_vec & vals );
+typedef uint64_t ( * byte_counter_ptr )( const unsigned char * data, std::size_t len );
+
+struct bit_counter_kernel
+{
+    const char * name;
+    bit_counter_ptr func;
+    byte_counter_ptr bytes;    // null for the original uint16-only ones
+    bool supported;            // by the cpu we're running on
+};
+
+// every kernel built for this architecture, slowest first.
+const std::vector< bit_counter_kernel > & bit_counter_kernels();
+
+// the fastest supported kernel (with a byte version), picked from
+// cpuid on first use.
+const bit_counter_kernel & best_bit_counter();
+
+int count_bits( const uint16_vec & vals );
+
+// Positional counts: for each byte offset k (0..7) within a 64-bit
+// word and each bit b of a byte, how many bytes at that offset have
+// bit b set.  counts[8 * ( i % 8 ) + b] gets bit b of data[i] added
+// to it; on a little-endian cpu that's how many of the 64-bit words
+// in data have bit 8 * k + b set.  positional_popcount.hpp folds
+// them down to narrower elements.
+
+namespace
+{
+
+// adds weight times each bit of the len bytes at data (the start of
+// a word) to counts.
+inline
+void
+add_positional_counts( const unsigned char * data, std::size_t len,
+                       const uint64_t weight, uint64_t * counts )
+{
+    for ( std::size_t i = 0; i < len; ++i )
+        for ( int b = 0; b < 8; ++b )
+            counts[8 * ( i % 8 ) + b] += weight * ( ( data[i] >> b ) & 1 );
+}
+
+// adds weight times the len per-byte counts of bit b at lanes (the
+// start of a word) to counts.
+inline
+void
+add_lane_counts( const unsigned char * lanes, std::size_t len, const int b,
+                 const uint64_t weight, uint64_t * counts )
+{
+    for ( std::size_t i = 0; i < len; ++i )
+        counts[8 * ( i % 8 ) + b] += weight * lanes[i];
+}
+
+}
+
+void positional_scalar_bytes( const unsigned char * data, std::size_t len, uint64_t * counts );
+void positional_bit_slice_bytes( const unsigned char * data, std::size_t len, uint64_t * counts );
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+void positional_avx2_bytes( const unsigned char * data, std::size_t len, uint64_t * counts );
+void positional_avx512_bytes( const unsigned char * data, std::size_t len, uint64_t * counts );
+
+#endif
+
+typedef void ( * positional_counter_ptr )( const unsigned char * data, std::size_t len, uint64_t * counts );
+
+struct positional_kernel
+{
+    const char * name;
+    positional_counter_ptr func;
+    bool supported;            // by the cpu we're running on
+    std::size_t min_bytes;     // shorter runs go faster on an earlier kernel
+};
+
+// every positional kernel built for this architecture, slowest first.
+const std::vector< positional_kernel > & positional_kernels();
+
+// the fastest supported one on long runs, picked from cpuid on first use.
+const positional_kernel & best_positional_kernel();
+
+// the fastest supported one for a run of len bytes.
+const positional_kernel & positional_kernel_for( std::size_t len );
+
+// Fused counts: the set bits of a op b over len bytes at each, where
+// a op b is never stored, so each bitmap is read just once.
+
+namespace
+{
+
+// a op b, a word at a time
+template < bit_op Op, typename T >
+inline
+T
+combine( const T a, const T b )
+{
+    return static_cast< T >( Op == op_and ? a & b :
+                             Op == op_or  ? a | b :
+                             Op == op_xor ? a ^ b : a & ~b );
+}
+
+}
+
+uint64_t fused_scalar_bytes( bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len );
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+uint64_t fused_popcnt_bytes( bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len );
+uint64_t fused_avx2_harley_seal_bytes( bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len );
+uint64_t fused_avx512_bytes( bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len );
+
+#endif
+
+typedef uint64_t ( * fused_counter_ptr )( bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len );
+
+struct fused_kernel
+{
+    const char * name;
+    fused_counter_ptr func;
+    bool supported;            // by the cpu we're running on
+};
+
+// every fused kernel built for this architecture, slowest first.
+const std::vector< fused_kernel > & fused_kernels();
+
+// the fastest supported one, picked from cpuid on first use.
+const fused_kernel & best_fused_kernel();
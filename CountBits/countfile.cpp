@@ -0,0 +1,84 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "popcount_file.hpp"
+
+namespace // anonymous
+{
+
+// quick and dirty version of boost::lexical_cast
+template < typename T >
+T
+lexical_cast( const char * str )
+{
+    std::istringstream iss( str );
+    T rv;
+    iss >> rv;
+    if ( ! iss && ! iss.eof() )
+        throw std::invalid_argument( str );
+    return rv;
+}
+
+void
+usage( const char * argv0 )
+{
+    std::cerr <<
+        "usage: " << argv0 << " [-t THREADS] [--stream] FILE...\n"
+        "  count the set bits in each FILE ('-' for standard input)\n"
+        "  -t THREADS   count mapped files on this many threads (default: all)\n"
+        "  --stream     read through buffers even where the file could be mapped\n";
+}
+
+} // end namespace [anonymous]
+
+int main( int argc, char * argv [] )
+{
+    unsigned threads = 0;
+    bool stream = false;
+    int status = 0;
+    int files = 0;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( std::strcmp( argv[i], "-t" ) == 0 && i + 1 < argc )
+        {
+            threads = lexical_cast< unsigned >( argv[++i] );
+            continue;
+        }
+        if ( std::strcmp( argv[i], "--stream" ) == 0 )
+        {
+            stream = true;
+            continue;
+        }
+        if ( argv[i][0] == '-' && argv[i][1] != '\0' )
+        {
+            usage( argv[0] );
+            return 2;
+        }
+
+        ++files;
+        try
+        {
+            const popcount_file_result r = popcount_file( argv[i], threads, stream );
+            std::cout << argv[i] << ": " << r.bits << " set bits in " << r.bytes << " bytes, "
+                      << ( r.seconds > 0 ? r.bytes / r.seconds / 1e9 : 0 ) << " GB/s"
+                      << ( r.mapped ? " (mapped)" : " (streamed)" ) << std::endl;
+        }
+        catch ( const std::system_error & e )
+        {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            status = 1;
+        }
+    }
+
+    if ( files == 0 )
+    {
+        usage( argv[0] );
+        return 2;
+    }
+
+    return status;
+}
@@ -0,0 +1,103 @@
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include "avx2_popcount.hpp"
+
+namespace
+{
+
+// 32 bytes of a op b
+template < bit_op Op >
+__attribute__(( target( "avx2" ) ))
+inline
+__m256i
+load_op_avx2( const unsigned char * a, const unsigned char * b )
+{
+    const __m256i x = load_avx2( a );
+    const __m256i y = load_avx2( b );
+    switch ( Op )
+    {
+    case op_and:     return _mm256_and_si256( x, y );
+    case op_or:      return _mm256_or_si256( x, y );
+    case op_xor:     return _mm256_xor_si256( x, y );
+    case op_and_not: return _mm256_andnot_si256( y, x );
+    }
+    return x;
+}
+
+// avx2_harley_seal_bytes(), on a op b
+template < bit_op Op >
+__attribute__(( target( "avx2" ) ))
+uint64_t
+fused_avx2_harley_seal( const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    const std::size_t n_blocks = len / ( 16 * 32 );
+
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256();
+    __m256i twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    __m256i eights = _mm256_setzero_si256();
+    __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+    for ( std::size_t i = 0; i < n_blocks; ++i )
+    {
+        const unsigned char * p = a + i * 16 * 32;
+        const unsigned char * q = b + i * 16 * 32;
+
+        csa( twos_a, ones, ones, load_op_avx2< Op >( p +   0, q +   0 ), load_op_avx2< Op >( p +  32, q +  32 ) );
+        csa( twos_b, ones, ones, load_op_avx2< Op >( p +  64, q +  64 ), load_op_avx2< Op >( p +  96, q +  96 ) );
+        csa( fours_a, twos, twos, twos_a, twos_b );
+        csa( twos_a, ones, ones, load_op_avx2< Op >( p + 128, q + 128 ), load_op_avx2< Op >( p + 160, q + 160 ) );
+        csa( twos_b, ones, ones, load_op_avx2< Op >( p + 192, q + 192 ), load_op_avx2< Op >( p + 224, q + 224 ) );
+        csa( fours_b, twos, twos, twos_a, twos_b );
+        csa( eights_a, fours, fours, fours_a, fours_b );
+
+        csa( twos_a, ones, ones, load_op_avx2< Op >( p + 256, q + 256 ), load_op_avx2< Op >( p + 288, q + 288 ) );
+        csa( twos_b, ones, ones, load_op_avx2< Op >( p + 320, q + 320 ), load_op_avx2< Op >( p + 352, q + 352 ) );
+        csa( fours_a, twos, twos, twos_a, twos_b );
+        csa( twos_a, ones, ones, load_op_avx2< Op >( p + 384, q + 384 ), load_op_avx2< Op >( p + 416, q + 416 ) );
+        csa( twos_b, ones, ones, load_op_avx2< Op >( p + 448, q + 448 ), load_op_avx2< Op >( p + 480, q + 480 ) );
+        csa( fours_b, twos, twos, twos_a, twos_b );
+        csa( eights_b, fours, fours, fours_a, fours_b );
+
+        csa( sixteens, eights, eights, eights_a, eights_b );
+
+        total = _mm256_add_epi64( total, count_bits_avx2( sixteens ) );
+    }
+
+    total = _mm256_slli_epi64( total, 4 );
+    total = _mm256_add_epi64( total, _mm256_slli_epi64( count_bits_avx2( eights ), 3 ) );
+    total = _mm256_add_epi64( total, _mm256_slli_epi64( count_bits_avx2( fours ), 2 ) );
+    total = _mm256_add_epi64( total, _mm256_slli_epi64( count_bits_avx2( twos ), 1 ) );
+    total = _mm256_add_epi64( total, count_bits_avx2( ones ) );
+
+    // whole vectors left over, then any at the end
+    std::size_t i = n_blocks * 16 * 32;
+    for ( ; i + 32 <= len; i += 32 )
+        total = _mm256_add_epi64( total, count_bits_avx2( load_op_avx2< Op >( a + i, b + i ) ) );
+
+    uint64_t rv = sum_lanes_avx2( total );
+    for ( ; i < len; ++i )
+        rv += count_bits_uint8( combine< Op >( a[i], b[i] ) );
+
+    return rv;
+}
+
+}
+
+uint64_t
+fused_avx2_harley_seal_bytes( const bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    switch ( op )
+    {
+    case op_and:     return fused_avx2_harley_seal< op_and >( a, b, len );
+    case op_or:      return fused_avx2_harley_seal< op_or >( a, b, len );
+    case op_xor:     return fused_avx2_harley_seal< op_xor >( a, b, len );
+    case op_and_not: return fused_avx2_harley_seal< op_and_not >( a, b, len );
+    }
+    return 0;
+}
+
+#endif
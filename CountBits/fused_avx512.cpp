@@ -0,0 +1,77 @@
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include <immintrin.h>
+
+namespace
+{
+
+// 64 bytes of a op b
+template < bit_op Op >
+__attribute__(( target( "avx512f" ) ))
+inline
+__m512i
+load_op_avx512( const unsigned char * a, const unsigned char * b )
+{
+    const __m512i x = _mm512_loadu_si512( a );
+    const __m512i y = _mm512_loadu_si512( b );
+    switch ( Op )
+    {
+    case op_and:     return _mm512_and_si512( x, y );
+    case op_or:      return _mm512_or_si512( x, y );
+    case op_xor:     return _mm512_xor_si512( x, y );
+    case op_and_not: return _mm512_ternarylogic_epi64( x, y, y, 0x30 );     // x & ~y
+    }
+    return x;
+}
+
+// avx512_vpopcntdq_bytes(), on a op b
+template < bit_op Op >
+__attribute__(( target( "avx512f,avx512vpopcntdq" ) ))
+uint64_t
+fused_avx512( const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    const std::size_t n_vecs = len / 64;
+
+    // two accumulators to keep both vector ports busy
+    __m512i sum0 = _mm512_setzero_si512();
+    __m512i sum1 = _mm512_setzero_si512();
+    std::size_t v = 0;
+    for ( ; v + 2 <= n_vecs; v += 2 )
+    {
+        sum0 = _mm512_add_epi64( sum0, _mm512_popcnt_epi64( load_op_avx512< Op >( a + v * 64, b + v * 64 ) ) );
+        sum1 = _mm512_add_epi64( sum1, _mm512_popcnt_epi64( load_op_avx512< Op >( a + v * 64 + 64, b + v * 64 + 64 ) ) );
+    }
+    if ( v < n_vecs )
+        sum0 = _mm512_add_epi64( sum0, _mm512_popcnt_epi64( load_op_avx512< Op >( a + v * 64, b + v * 64 ) ) );
+
+    uint64_t lanes[8];
+    _mm512_storeu_si512( lanes, _mm512_add_epi64( sum0, sum1 ) );
+    uint64_t rv = 0;
+    for ( int l = 0; l < 8; ++l )
+        rv += lanes[l];
+
+    // and then any at the end
+    for ( std::size_t i = n_vecs * 64; i < len; ++i )
+        rv += count_bits_uint8( combine< Op >( a[i], b[i] ) );
+
+    return rv;
+}
+
+}
+
+uint64_t
+fused_avx512_bytes( const bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    switch ( op )
+    {
+    case op_and:     return fused_avx512< op_and >( a, b, len );
+    case op_or:      return fused_avx512< op_or >( a, b, len );
+    case op_xor:     return fused_avx512< op_xor >( a, b, len );
+    case op_and_not: return fused_avx512< op_and_not >( a, b, len );
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include <cstring>
+
+namespace
+{
+
+// popcnt_instruction_bytes(), on a op b
+template < bit_op Op >
+__attribute__(( target( "popcnt" ) ))
+uint64_t
+fused_popcnt( const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    // four independent sums, so the popcnts don't wait on one add chain
+    uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    std::size_t i = 0;
+    for ( ; i + 32 <= len; i += 32 )
+    {
+        uint64_t x[4], y[4];
+        std::memcpy( x, a + i, sizeof( x ) );
+        std::memcpy( y, b + i, sizeof( y ) );
+        sum0 += __builtin_popcountll( combine< Op >( x[0], y[0] ) );
+        sum1 += __builtin_popcountll( combine< Op >( x[1], y[1] ) );
+        sum2 += __builtin_popcountll( combine< Op >( x[2], y[2] ) );
+        sum3 += __builtin_popcountll( combine< Op >( x[3], y[3] ) );
+    }
+    for ( ; i + 8 <= len; i += 8 )
+    {
+        uint64_t x, y;
+        std::memcpy( &x, a + i, sizeof( x ) );
+        std::memcpy( &y, b + i, sizeof( y ) );
+        sum0 += __builtin_popcountll( combine< Op >( x, y ) );
+    }
+
+    // and then any at the end
+    for ( ; i < len; ++i )
+        sum0 += __builtin_popcount( combine< Op >( a[i], b[i] ) );
+
+    return sum0 + sum1 + sum2 + sum3;
+}
+
+}
+
+uint64_t
+fused_popcnt_bytes( const bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    switch ( op )
+    {
+    case op_and:     return fused_popcnt< op_and >( a, b, len );
+    case op_or:      return fused_popcnt< op_or >( a, b, len );
+    case op_xor:     return fused_popcnt< op_xor >( a, b, len );
+    case op_and_not: return fused_popcnt< op_and_not >( a, b, len );
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#include <cstring>
+
+#include "bit_counters.hpp"
+
+namespace
+{
+
+// sixty_four_bit_slice_bytes(), on a op b
+template < bit_op Op >
+uint64_t
+fused_scalar( const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    uint64_t rv = 0;
+    std::size_t i = 0;
+
+    for ( ; i + 8 <= len; i += 8 )
+    {
+        uint64_t x, y;
+        std::memcpy( &x, a + i, sizeof( x ) );
+        std::memcpy( &y, b + i, sizeof( y ) );
+        uint64_t n = combine< Op >( x, y );
+        n = ( ( n & 0xaaaaaaaaaaaaaaaa ) >>  1 ) + ( n & 0x5555555555555555 );
+        n = ( ( n & 0xcccccccccccccccc ) >>  2 ) + ( n & 0x3333333333333333 );
+        n = ( ( n & 0xf0f0f0f0f0f0f0f0 ) >>  4 ) + ( n & 0x0f0f0f0f0f0f0f0f );
+        rv += ( n * 0x0101010101010101 ) >> 56;
+    }
+
+    // and then any at the end
+    for ( ; i < len; ++i )
+        rv += count_bits_uint8( combine< Op >( a[i], b[i] ) );
+
+    return rv;
+}
+
+}
+
+uint64_t
+fused_scalar_bytes( const bit_op op, const unsigned char * a, const unsigned char * b, std::size_t len )
+{
+    switch ( op )
+    {
+    case op_and:     return fused_scalar< op_and >( a, b, len );
+    case op_or:      return fused_scalar< op_or >( a, b, len );
+    case op_xor:     return fused_scalar< op_xor >( a, b, len );
+    case op_and_not: return fused_scalar< op_and_not >( a, b, len );
+    }
+    return 0;
+}
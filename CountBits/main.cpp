@@ -1,13 +1,20 @@
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <numeric>
 #include <random>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
 // This is a new blank line!
 #include "bit_counters.hpp"
+#include "popcount.hpp"
+#include "positional_popcount.hpp"
 
 namespace // anonymous
 {
@@ -60,12 +67,308 @@ time_loops( bit_counter_func func,
     return count;
 }
 
+// check every supported kernel against the first (plain lookup) at
+// every size up to a few times the biggest kernel's block, so that all
+// the tail and remainder paths get exercised.  returns false on any
+// disagreement.
+bool
+cross_validate( std::mt19937 & rand_gen )
+{
+    const std::vector< bit_counter_kernel > & kernels = bit_counter_kernels();
+    std::uniform_int_distribution< uint16_t > rand_dist;
+
+    bool ok = true;
+    uint16_vec vec;
+    for ( std::size_t size = 0; size <= 1100; ++size )
+    {
+        const int expected = kernels[0].func( vec );
+        for ( const bit_counter_kernel & k : kernels )
+        {
+            if ( ! k.supported )
+                continue;
+            const int count = k.func( vec );
+            if ( count != expected )
+            {
+                std::clog << k.name << ": " << count << " != " << expected
+                          << " at " << size << " values" << std::endl;
+                ok = false;
+            }
+        }
+        vec.push_back( rand_dist( rand_gen ) );
+    }
+
+    // the library, at every width and every alignment, against a
+    // plain count of the bytes.
+    std::vector< unsigned char > buf( 1100 + 64 );
+    for ( unsigned char & b : buf )
+        b = rand_dist( rand_gen );
+    for ( std::size_t offset = 0; offset < 64; ++offset )
+    {
+        for ( std::size_t len = 0; len + offset <= buf.size(); len += 1 + len / 16 )
+        {
+            const unsigned char * p = buf.data() + offset;
+            uint64_t expected = 0;
+            for ( std::size_t i = 0; i < len; ++i )
+                expected += count_bits_uint8( p[i] );
+
+            std::vector< uint16_t > v16( len / 2 );
+            std::vector< uint32_t > v32( len / 4 );
+            std::vector< uint64_t > v64( len / 8 );
+            std::memcpy( v16.data(), p, v16.size() * 2 );
+            std::memcpy( v32.data(), p, v32.size() * 4 );
+            std::memcpy( v64.data(), p, v64.size() * 8 );
+            uint64_t expected16 = 0, expected32 = 0, expected64 = 0;
+            for ( std::size_t i = 0; i < len; ++i )
+            {
+                const unsigned bits = count_bits_uint8( p[i] );
+                expected16 += i < v16.size() * 2 ? bits : 0;
+                expected32 += i < v32.size() * 4 ? bits : 0;
+                expected64 += i < v64.size() * 8 ? bits : 0;
+            }
+
+            const uint64_t got[] = { popcount_bytes( p, len ), popcount( p, len ),
+                                     popcount( v16 ), popcount( v32 ), popcount( v64 ) };
+            const uint64_t want[] = { expected, expected, expected16, expected32, expected64 };
+            const char * const what[] = { "popcount_bytes", "popcount<uint8_t>",
+                                          "popcount<uint16_t>", "popcount<uint32_t>", "popcount<uint64_t>" };
+            for ( int w = 0; w < 5; ++w )
+            {
+                if ( got[w] != want[w] )
+                {
+                    std::clog << what[w] << ": " << got[w] << " != " << want[w]
+                              << " at offset " << offset << ", " << len << " bytes" << std::endl;
+                    ok = false;
+                }
+            }
+            for ( const bit_counter_kernel & k : kernels )
+            {
+                if ( ! k.supported || ! k.bytes )
+                    continue;
+                const uint64_t count = k.bytes( p, len );
+                if ( count != expected )
+                {
+                    std::clog << k.name << "_bytes: " << count << " != " << expected
+                              << " at offset " << offset << ", " << len << " bytes" << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+
+    return ok;
+}
+
+// the library's positional counts of len bytes at p, as elements of
+// type T, against counting a bit at a time.
+template < typename T >
+bool
+check_positional( const unsigned char * p, const std::size_t len, const char * what )
+{
+    std::vector< T > vals( len / sizeof( T ) );
+    std::memcpy( vals.data(), p, vals.size() * sizeof( T ) );
+
+    uint64_t want[8 * sizeof( T )] = { 0 };
+    for ( const T v : vals )
+        for ( std::size_t bit = 0; bit < 8 * sizeof( T ); ++bit )
+            want[bit] += ( v >> bit ) & 1;
+
+    uint64_t got[8 * sizeof( T )] = { 0 };
+    positional_popcount( vals, got );
+
+    if ( std::equal( got, got + 8 * sizeof( T ), want ) )
+        return true;
+    std::clog << what << ": wrong counts at " << len << " bytes" << std::endl;
+    return false;
+}
+
+// every supported positional kernel against the first (a bit at a
+// time) at every alignment and at sizes up to a couple of the biggest
+// kernel's blocks, and the library at every width; then over enough
+// bytes, all ones and random, that the kernels' byte counters fill
+// right up before they're emptied.
+bool
+cross_validate_positional( std::mt19937 & rand_gen )
+{
+    const std::vector< positional_kernel > & kernels = positional_kernels();
+    std::uniform_int_distribution< uint16_t > rand_dist;
+
+    bool ok = true;
+    auto check_kernels = [&]( const unsigned char * p, const std::size_t len )
+    {
+        uint64_t expected[64] = { 0 };
+        kernels[0].func( p, len, expected );
+        for ( const positional_kernel & k : kernels )
+        {
+            if ( ! k.supported )
+                continue;
+            uint64_t counts[64] = { 0 };
+            k.func( p, len, counts );
+            if ( ! std::equal( counts, counts + 64, expected ) )
+            {
+                std::clog << k.name << ": wrong counts at alignment "
+                          << reinterpret_cast< uintptr_t >( p ) % 64 << ", " << len << " bytes" << std::endl;
+                ok = false;
+            }
+        }
+    };
+
+    std::vector< unsigned char > buf( 2 * 16 * 64 + 200 + 64 );
+    for ( unsigned char & b : buf )
+        b = rand_dist( rand_gen );
+    for ( std::size_t offset = 0; offset < 64; ++offset )
+    {
+        for ( std::size_t len = 0; len + offset <= buf.size(); len += 1 + len / 16 )
+        {
+            const unsigned char * p = buf.data() + offset;
+            check_kernels( p, len );
+            ok = check_positional< uint8_t >( p, len, "positional_popcount<uint8_t>" ) && ok;
+            ok = check_positional< uint16_t >( p, len, "positional_popcount<uint16_t>" ) && ok;
+            ok = check_positional< uint32_t >( p, len, "positional_popcount<uint32_t>" ) && ok;
+            ok = check_positional< uint64_t >( p, len, "positional_popcount<uint64_t>" ) && ok;
+        }
+    }
+
+    std::vector< unsigned char > big( 300 * 16 * 64 + 100, 0xff );
+    check_kernels( big.data(), big.size() );
+    for ( unsigned char & b : big )
+        b = rand_dist( rand_gen );
+    check_kernels( big.data(), big.size() );
+    ok = check_positional< uint32_t >( big.data(), big.size(), "positional_popcount<uint32_t>" ) && ok;
+
+    return ok;
+}
+
+// every supported fused kernel and the library, for each op, against
+// combining and counting a byte at a time, with the two bitmaps at
+// different alignments and at sizes past the biggest kernel's block;
+// and jaccard() against its definition, over enough to take a few of
+// its pieces.
+bool
+cross_validate_fused( std::mt19937 & rand_gen )
+{
+    const std::vector< fused_kernel > & kernels = fused_kernels();
+    std::uniform_int_distribution< uint16_t > rand_dist;
+    const bit_op ops[] = { op_and, op_or, op_xor, op_and_not };
+    const char * const op_names[] = { "and", "or", "xor", "and_not" };
+
+    std::vector< unsigned char > a( 40000 ), b( a.size() );
+    for ( std::size_t i = 0; i < a.size(); ++i )
+    {
+        a[i] = rand_dist( rand_gen );
+        b[i] = rand_dist( rand_gen );
+    }
+
+    bool ok = true;
+    auto check = [&]( const unsigned char * p, const unsigned char * q, const std::size_t len )
+    {
+        uint64_t expected[4] = { 0 };
+        for ( int o = 0; o < 4; ++o )
+        {
+            for ( std::size_t i = 0; i < len; ++i )
+                expected[o] += count_bits_uint8( popcount_detail::combine( ops[o], p[i], q[i] ) );
+
+            for ( const fused_kernel & k : kernels )
+            {
+                if ( ! k.supported )
+                    continue;
+                const uint64_t count = k.func( ops[o], p, q, len );
+                if ( count != expected[o] )
+                {
+                    std::clog << k.name << " " << op_names[o] << ": " << count << " != " << expected[o]
+                              << " at " << len << " bytes" << std::endl;
+                    ok = false;
+                }
+            }
+            const uint64_t count = popcount_op( ops[o], p, q, len );
+            if ( count != expected[o] )
+            {
+                std::clog << "popcount_op " << op_names[o] << ": " << count << " != " << expected[o]
+                          << " at " << len << " bytes" << std::endl;
+                ok = false;
+            }
+        }
+
+        const double want = expected[1] ? static_cast< double >( expected[0] ) / expected[1] : 1.0;
+        const double got = jaccard( p, q, len );
+        if ( got != want )
+        {
+            std::clog << "jaccard: " << got << " != " << want << " at " << len << " bytes" << std::endl;
+            ok = false;
+        }
+    };
+
+    for ( std::size_t offset = 0; offset < 64; ++offset )
+        for ( std::size_t len = 0; len + 64 <= 1100; len += 1 + len / 16 )
+            check( a.data() + offset, b.data() + ( 7 * offset ) % 64, len );
+    check( a.data() + 1, b.data(), a.size() - 1 );
+
+    return ok;
+}
+
+// popcount_parallel() over a buffer of mb megabytes at 1, 2, 4, ...
+// threads, up to twice the hardware threads, in GB/s.  once the
+// buffer is well past the last-level cache, the point where adding
+// threads stops helping is where DRAM bandwidth runs out.  returns
+// false if any thread count disagrees with one thread.
+bool
+thread_sweep( std::mt19937 & rand_gen, const std::size_t mb, const int sec )
+{
+    std::vector< uint64_t > buf( mb * 1024 * 1024 / sizeof( uint64_t ) );
+    std::mt19937_64 rand_gen_64( rand_gen() );
+    for ( uint64_t & w : buf )
+        w = rand_gen_64();
+
+    std::cout << "thread sweep over " << mb << " MiB" << std::endl;
+
+    const unsigned hw = std::max( 1u, std::thread::hardware_concurrency() );
+    std::vector< unsigned > counts;
+    for ( unsigned t = 1; t < 2 * hw; t *= 2 )
+        counts.push_back( t );
+    if ( std::find( counts.begin(), counts.end(), hw ) == counts.end() )
+        counts.push_back( hw );
+    counts.push_back( 2 * hw );
+    std::sort( counts.begin(), counts.end() );
+
+    bool ok = true;
+    uint64_t expected = 0;
+    for ( const unsigned threads : counts )
+    {
+        int reps = 0;
+        uint64_t count = 0;
+        instant start( clock::now() );
+        duration elapsed;
+        do
+        {
+            count = popcount_parallel( buf.data(), buf.size(), threads );
+            ++reps;
+            elapsed = clock::now() - start;
+        }
+        while ( elapsed < std::chrono::seconds( sec ) );
+
+        const double secs = std::chrono::duration< double >( elapsed ).count();
+        std::cout << "  threads=" << threads << ": "
+                  << buf.size() * sizeof( uint64_t ) * static_cast< double >( reps ) / secs / 1e9
+                  << " GB/s" << std::endl;
+
+        if ( threads == counts.front() )
+            expected = count;
+        else if ( count != expected )
+        {
+            std::clog << "popcount_parallel at " << threads << " threads: "
+                      << count << " != " << expected << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
 } // end namespace [anonymous]
 
 int main( int argc, char * argv [] )
 {
     size_t num_vals = 10000;
     int sec = 1;
+    size_t sweep_mb = 256;
 
     if ( argc > 1 )
         num_vals = lexical_cast< size_t >( argv[1] );
@@ -73,6 +376,9 @@ int main( int argc, char * argv [] )
     if ( argc > 2 )
         sec = lexical_cast< int >( argv[2] );
 
+    if ( argc > 3 )
+        sweep_mb = lexical_cast< size_t >( argv[3] );
+
     std::cout << "timing loops over " << num_vals << " values for " << sec << " seconds" << std::endl;
 
     // generate random values
@@ -85,19 +391,80 @@ int main( int argc, char * argv [] )
     for ( size_t i = 0; i < num_vals; ++i )
         vec.push_back( rand_dist( rand_gen ) );
 
-    const int eight_bit_lookup_count     = time_loops( eight_bit_lookup,     "eight_bit_lookup:     ", vec, sec );
-    const int thirty_two_bit_slice_count = time_loops( thirty_two_bit_slice, "thirty_two_bit_slice: ", vec, sec );
-    const int sixty_four_bit_slice_count = time_loops( sixty_four_bit_slice, "sixty_four_bit_slice: ", vec, sec );
+    if ( ! cross_validate( rand_gen ) || ! cross_validate_positional( rand_gen ) ||
+         ! cross_validate_fused( rand_gen ) )
+        return 1;
+
+    const std::vector< bit_counter_kernel > & kernels = bit_counter_kernels();
+    int status = 0;
+    int expected = 0;
+    for ( const bit_counter_kernel & k : kernels )
+    {
+        std::string label( k.name );
+        label += ": ";
+        label.resize( 23, ' ' );
+        if ( ! k.supported )
+        {
+            std::cout << label << "(not supported on this cpu)" << std::endl;
+            continue;
+        }
+
+        const int count = time_loops( k.func, label.c_str(), vec, sec );
+        if ( &k == &kernels[0] )
+            expected = count;
+        else if ( count != expected )
+        {
+            std::clog << k.name << "=" << count << " != " << kernels[0].name << "=" << expected << std::endl;
+            status = 1;
+        }
+    }
+
+    // the library entry point, dispatch and all
+    time_loops( []( const uint16_vec & v ) { return static_cast< int >( popcount( v ) ); },
+                "popcount<uint16_t>:    ", vec, sec );
+
+    std::cout << "best on this cpu: " << best_bit_counter().name << std::endl;
+
+    // positional counts, each kernel and then the library; they add up
+    // to the plain count, which they're checked against.
+    for ( const positional_kernel & k : positional_kernels() )
+    {
+        std::string label( k.name );
+        label += ": ";
+        label.resize( 23, ' ' );
+        if ( ! k.supported )
+        {
+            std::cout << label << "(not supported on this cpu)" << std::endl;
+            continue;
+        }
+
+        const positional_counter_ptr func = k.func;
+        const int count = time_loops( [func]( const uint16_vec & v )
+                                      {
+                                          uint64_t counts[64] = { 0 };
+                                          func( bytes_of( v ), v.size() * 2, counts );
+                                          return static_cast< int >( std::accumulate( counts, counts + 64, uint64_t( 0 ) ) );
+                                      },
+                                      label.c_str(), vec, sec );
+        if ( count != expected )
+        {
+            std::clog << k.name << "=" << count << " != " << kernels[0].name << "=" << expected << std::endl;
+            status = 1;
+        }
+    }
+    time_loops( []( const uint16_vec & v )
+                {
+                    uint64_t counts[16] = { 0 };
+                    positional_popcount( v, counts );
+                    return static_cast< int >( std::accumulate( counts, counts + 16, uint64_t( 0 ) ) );
+                },
+                "positional<uint16_t>:  ", vec, sec );
 
-    if ( eight_bit_lookup_count != sixty_four_bit_slice_count )
-        std::clog <<
-          "8blc=" << eight_bit_lookup_count << " != "
-          "64bsc=" << sixty_four_bit_slice_count << std::endl;
+    std::cout << "best positional on this cpu: " << best_positional_kernel().name
+              << " (" << positional_kernel_for( vec.size() * 2 ).name << " at " << vec.size() * 2 << " bytes)" << std::endl;
 
-    if ( eight_bit_lookup_count != thirty_two_bit_slice_count )
-        std::clog <<
-          "8blc=" << eight_bit_lookup_count << " != "
-          "32bsc=" << thirty_two_bit_slice_count << std::endl;
+    if ( sweep_mb > 0 && ! thread_sweep( rand_gen, sweep_mb, sec ) )
+        status = 1;
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,43 @@
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include <cstring>
+
+__attribute__(( target( "popcnt" ) ))
+uint64_t
+popcnt_instruction_bytes( const unsigned char * data, std::size_t len )
+{
+    // four independent sums, so the popcnts don't wait on one add chain
+    uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    std::size_t i = 0;
+    for ( ; i + 32 <= len; i += 32 )
+    {
+        uint64_t n[4];
+        std::memcpy( n, data + i, sizeof( n ) );
+        sum0 += __builtin_popcountll( n[0] );
+        sum1 += __builtin_popcountll( n[1] );
+        sum2 += __builtin_popcountll( n[2] );
+        sum3 += __builtin_popcountll( n[3] );
+    }
+    for ( ; i + 8 <= len; i += 8 )
+    {
+        uint64_t n;
+        std::memcpy( &n, data + i, sizeof( n ) );
+        sum0 += __builtin_popcountll( n );
+    }
+
+    // and then any at the end
+    for ( ; i < len; ++i )
+        sum0 += __builtin_popcount( data[i] );
+
+    return sum0 + sum1 + sum2 + sum3;
+}
+
+int
+popcnt_instruction( const uint16_vec & vals )
+{
+    return popcnt_instruction_bytes( bytes_of( vals ), vals.size() * 2 );
+}
+
+#endif
@@ -0,0 +1,40 @@
+#include <algorithm>
+
+#include "bit_counters.hpp"
+#include "popcount.hpp"
+
+uint64_t
+popcount_bytes( const void * data, std::size_t len )
+{
+    static const byte_counter_ptr kernel = best_bit_counter().bytes;
+    return kernel( static_cast< const unsigned char * >( data ), len );
+}
+
+uint64_t
+popcount_op_bytes( const bit_op op, const void * a, const void * b, std::size_t len )
+{
+    static const fused_counter_ptr kernel = best_fused_kernel().func;
+    return kernel( op, static_cast< const unsigned char * >( a ), static_cast< const unsigned char * >( b ), len );
+}
+
+double
+jaccard_bytes( const void * a, const void * b, std::size_t len )
+{
+    static const fused_counter_ptr kernel = best_fused_kernel().func;
+    const unsigned char * p = static_cast< const unsigned char * >( a );
+    const unsigned char * q = static_cast< const unsigned char * >( b );
+
+    // both counts a piece at a time; the second pass over a piece reads
+    // it from L1, so the bitmaps still only come from memory once.
+    const std::size_t piece = 8 * 1024;
+    uint64_t both = 0;
+    uint64_t either = 0;
+    for ( std::size_t i = 0; i < len; i += piece )
+    {
+        const std::size_t n = std::min( piece, len - i );
+        both += kernel( op_and, p + i, q + i, n );
+        either += kernel( op_or, p + i, q + i, n );
+    }
+
+    return either ? static_cast< double >( both ) / either : 1.0;
+}
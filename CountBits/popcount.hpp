@@ -0,0 +1,222 @@
+#ifndef COUNTBITS_POPCOUNT_HPP
+#define COUNTBITS_POPCOUNT_HPP 1
+
+// Bit counting over any contiguous run of unsigned 8, 16, 32 or 64
+// bit integers, or of raw bytes, at any alignment, with 64-bit
+// totals.  Runs of more than a few words go to the fastest kernel
+// this cpu supports (see bit_counters.hpp); short ones are counted
+// inline, a word at a time at the element's own width.
+//
+// The fused counts take two equal runs, a and b, and count the set
+// bits of a & b, a | b, a ^ b or a & ~b without storing that anywhere,
+// so each is read once: as fast as counting the two of them.
+//
+// Link with libcountbits.a.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// set bits in the len bytes at data.
+uint64_t popcount_bytes( const void * data, std::size_t len );
+
+// the same, split over up to threads threads (0: one per hardware
+// thread) from a pool kept for the purpose.  each thread gets one
+// contiguous, page-aligned range, so it streams its own pages (local
+// ones, if the same split first touched them), and at least 1 MiB of
+// it; anything smaller is counted on the calling thread alone.
+uint64_t popcount_parallel( const void * data, std::size_t len, unsigned threads = 0 );
+
+// which combination of two bitmaps a fused count counts.
+enum bit_op
+{
+    op_and,         // a & b: the intersection
+    op_or,          // a | b: the union
+    op_xor,         // a ^ b: the symmetric difference; the Hamming distance
+    op_and_not      // a & ~b: what's in a but not in b
+};
+
+// set bits in a op b, over the len bytes at each of a and b.
+uint64_t popcount_op_bytes( bit_op op, const void * a, const void * b, std::size_t len );
+
+// |a & b| / |a | b| over the len bytes at each of a and b: the Jaccard
+// index of the two as sets, which for bit vectors is the Tanimoto
+// coefficient too.  1 if neither has any bits set.
+double jaccard_bytes( const void * a, const void * b, std::size_t len );
+
+namespace popcount_detail
+{
+
+// one element's set bits; specialised on the element's width.
+template < std::size_t Width >
+struct word;
+
+template <>
+struct word< 1 >
+{
+    static unsigned count( uint8_t n ) { return __builtin_popcount( n ); }
+};
+
+template <>
+struct word< 2 >
+{
+    static unsigned count( uint16_t n ) { return __builtin_popcount( n ); }
+};
+
+template <>
+struct word< 4 >
+{
+    static unsigned count( uint32_t n ) { return __builtin_popcount( n ); }
+};
+
+template <>
+struct word< 8 >
+{
+    static unsigned count( uint64_t n ) { return __builtin_popcountll( n ); }
+};
+
+// below this many bytes, going through the kernel costs more than it saves.
+const std::size_t inline_bytes = 64;
+
+template < typename T >
+T
+combine( const bit_op op, const T a, const T b )
+{
+    switch ( op )
+    {
+    case op_and:     return a & b;
+    case op_or:      return a | b;
+    case op_xor:     return a ^ b;
+    case op_and_not: return a & static_cast< T >( ~b );
+    }
+    return a;
+}
+
+// two containers' common size, for the functions that take a pair.
+template < typename Container >
+std::size_t
+same_size( const Container & a, const Container & b, const char * func )
+{
+    if ( a.size() != b.size() )
+        throw std::invalid_argument( std::string( func ) + ": bitmaps differ in size" );
+    return a.size();
+}
+
+}
+
+// set bits in the n elements at data.
+template < typename T >
+uint64_t
+popcount( const T * data, std::size_t n )
+{
+    static_assert( std::is_integral< T >::value && std::is_unsigned< T >::value,
+                   "popcount() counts unsigned integers" );
+    static_assert( sizeof( T ) == 1 || sizeof( T ) == 2 || sizeof( T ) == 4 || sizeof( T ) == 8,
+                   "popcount() handles 8, 16, 32 and 64 bit elements" );
+
+    if ( n * sizeof( T ) < popcount_detail::inline_bytes )
+    {
+        uint64_t rv = 0;
+        for ( std::size_t i = 0; i < n; ++i )
+            rv += popcount_detail::word< sizeof( T ) >::count( data[i] );
+        return rv;
+    }
+
+    return popcount_bytes( data, n * sizeof( T ) );
+}
+
+// set bits in any contiguous container: std::vector, std::array, ...
+template < typename Container >
+uint64_t
+popcount( const Container & c )
+{
+    return popcount( c.data(), c.size() );
+}
+
+// set bits in a op b over the n elements at each of a and b.
+template < typename T >
+uint64_t
+popcount_op( const bit_op op, const T * a, const T * b, std::size_t n )
+{
+    static_assert( std::is_integral< T >::value && std::is_unsigned< T >::value,
+                   "popcount_op() counts unsigned integers" );
+    static_assert( sizeof( T ) == 1 || sizeof( T ) == 2 || sizeof( T ) == 4 || sizeof( T ) == 8,
+                   "popcount_op() handles 8, 16, 32 and 64 bit elements" );
+
+    if ( n * sizeof( T ) < popcount_detail::inline_bytes )
+    {
+        uint64_t rv = 0;
+        for ( std::size_t i = 0; i < n; ++i )
+            rv += popcount_detail::word< sizeof( T ) >::count( popcount_detail::combine( op, a[i], b[i] ) );
+        return rv;
+    }
+
+    return popcount_op_bytes( op, a, b, n * sizeof( T ) );
+}
+
+// the same over two contiguous containers, which must be the same size.
+template < typename Container >
+uint64_t
+popcount_op( const bit_op op, const Container & a, const Container & b )
+{
+    return popcount_op( op, a.data(), b.data(), popcount_detail::same_size( a, b, "popcount_op()" ) );
+}
+
+template < typename T >
+uint64_t
+popcount_and( const T * a, const T * b, std::size_t n )
+{
+    return popcount_op( op_and, a, b, n );
+}
+
+template < typename T >
+uint64_t
+popcount_or( const T * a, const T * b, std::size_t n )
+{
+    return popcount_op( op_or, a, b, n );
+}
+
+template < typename T >
+uint64_t
+popcount_xor( const T * a, const T * b, std::size_t n )
+{
+    return popcount_op( op_xor, a, b, n );
+}
+
+template < typename T >
+uint64_t
+popcount_and_not( const T * a, const T * b, std::size_t n )
+{
+    return popcount_op( op_and_not, a, b, n );
+}
+
+template < typename T >
+double
+jaccard( const T * a, const T * b, std::size_t n )
+{
+    static_assert( std::is_integral< T >::value && std::is_unsigned< T >::value,
+                   "jaccard() compares unsigned integers" );
+
+    return jaccard_bytes( a, b, n * sizeof( T ) );
+}
+
+template < typename Container >
+double
+jaccard( const Container & a, const Container & b )
+{
+    return jaccard( a.data(), b.data(), popcount_detail::same_size( a, b, "jaccard()" ) );
+}
+
+template < typename T >
+uint64_t
+popcount_parallel( const T * data, std::size_t n, unsigned threads = 0 )
+{
+    static_assert( std::is_integral< T >::value && std::is_unsigned< T >::value,
+                   "popcount_parallel() counts unsigned integers" );
+
+    return popcount_parallel( static_cast< const void * >( data ), n * sizeof( T ), threads );
+}
+
+#endif
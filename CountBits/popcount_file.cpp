@@ -0,0 +1,244 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "popcount.hpp"
+#include "popcount_file.hpp"
+
+namespace
+{
+
+typedef std::chrono::steady_clock clock;
+
+// mapped files are counted, read ahead and dropped this much at a time.
+const uint64_t window_bytes = 256 << 20;
+
+// unmappable input goes through this many buffers of this size.
+const unsigned stream_buffers = 4;
+const std::size_t stream_buffer_bytes = 1 << 20;
+const std::size_t buffer_alignment = 4096;
+
+std::system_error
+os_error( const std::string & what )
+{
+    return std::system_error( errno, std::generic_category(), what );
+}
+
+// count size bytes of fd from offset by mapping them; false if
+// they can't be mapped, leaving bits alone.
+bool
+count_mapped( const int fd, const uint64_t offset, const uint64_t size,
+              const unsigned threads, uint64_t & bits )
+{
+    // mappings start on a page; count from there, then take off
+    // whatever came before the offset.
+    const uint64_t page = sysconf( _SC_PAGESIZE );
+    const uint64_t start = offset / page * page;
+    const uint64_t skip = offset - start;
+    const uint64_t map_bytes = size + skip;
+
+    // on a 32-bit build a big file is more than a size_t can hold,
+    // let alone the address space; read it instead.
+    if ( map_bytes > SIZE_MAX )
+        return false;
+
+    void * const map = mmap( 0, map_bytes, PROT_READ, MAP_PRIVATE, fd, start );
+    if ( map == MAP_FAILED )
+        return false;
+
+    unsigned char * const base = static_cast< unsigned char * >( map );
+    madvise( base, map_bytes, MADV_SEQUENTIAL );
+#ifdef MADV_HUGEPAGE
+    madvise( base, map_bytes, MADV_HUGEPAGE );   // only some filesystems take this
+#endif
+
+    uint64_t rv = 0;
+    for ( uint64_t at = 0; at < map_bytes; at += window_bytes )
+    {
+        const uint64_t len = std::min( window_bytes, map_bytes - at );
+        if ( at + len < map_bytes )
+            madvise( base + at + len, std::min( window_bytes, map_bytes - at - len ), MADV_WILLNEED );
+
+        const uint64_t from = at == 0 ? skip : 0;
+        rv += popcount_parallel( base + at + from, len - from, threads );
+
+        // done with these; keep them out of our resident set.
+        madvise( base + at, len, MADV_DONTNEED );
+    }
+
+    munmap( map, map_bytes );
+    bits = rv;
+    return true;
+}
+
+struct free_deleter
+{
+    void operator()( void * p ) const { free( p ); }
+};
+
+typedef std::unique_ptr< unsigned char, free_deleter > buffer_ptr;
+
+// count everything read from fd until end of file, reading on one
+// thread and counting on this one.
+uint64_t
+count_streamed( const int fd, uint64_t & bytes )
+{
+    std::vector< buffer_ptr > buffers;
+    for ( unsigned i = 0; i < stream_buffers; ++i )
+    {
+        void * p = 0;
+        if ( posix_memalign( &p, buffer_alignment, stream_buffer_bytes ) != 0 )
+            throw std::bad_alloc();
+        buffers.push_back( buffer_ptr( static_cast< unsigned char * >( p ) ) );
+    }
+    std::vector< std::size_t > lengths( stream_buffers );
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque< unsigned > empty, full;
+    for ( unsigned i = 0; i < stream_buffers; ++i )
+        empty.push_back( i );
+    bool done = false;      // the reader has queued its last buffer
+    int read_errno = 0;
+
+    // fills empty buffers, whole unless the input ends, and queues
+    // them for counting.
+    std::thread reader( [&]
+    {
+        while ( true )
+        {
+            unsigned b;
+            {
+                std::unique_lock< std::mutex > lock( mutex );
+                changed.wait( lock, [&] { return ! empty.empty(); } );
+                b = empty.front();
+                empty.pop_front();
+            }
+
+            std::size_t len = 0;
+            int err = 0;
+            while ( len < stream_buffer_bytes )
+            {
+                const ssize_t n = ::read( fd, buffers[b].get() + len, stream_buffer_bytes - len );
+                if ( n < 0 && errno == EINTR )
+                    continue;
+                if ( n < 0 )
+                    err = errno;
+                if ( n <= 0 )
+                    break;
+                len += n;
+            }
+
+            std::lock_guard< std::mutex > lock( mutex );
+            lengths[b] = len;
+            full.push_back( b );
+            read_errno = err;
+            done = len < stream_buffer_bytes;
+            changed.notify_all();
+            if ( done )
+                return;
+        }
+    } );
+
+    uint64_t bits = 0;
+    bytes = 0;
+    while ( true )
+    {
+        unsigned b;
+        {
+            std::unique_lock< std::mutex > lock( mutex );
+            changed.wait( lock, [&] { return done || ! full.empty(); } );
+            if ( full.empty() )
+                break;
+            b = full.front();
+            full.pop_front();
+        }
+
+        bits += popcount_bytes( buffers[b].get(), lengths[b] );
+        bytes += lengths[b];
+
+        std::lock_guard< std::mutex > lock( mutex );
+        empty.push_back( b );
+        changed.notify_all();
+    }
+    reader.join();
+
+    if ( read_errno != 0 )
+    {
+        errno = read_errno;
+        throw os_error( "read" );
+    }
+    return bits;
+}
+
+}
+
+popcount_file_result
+popcount_fd( const int fd, const unsigned threads, const bool stream )
+{
+    const clock::time_point start = clock::now();
+
+    popcount_file_result rv;
+    rv.bits = 0;
+    rv.bytes = 0;
+    rv.mapped = false;
+
+    // regular files that say how big they are get mapped; /proc
+    // files (size 0) and everything else get read.
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 )
+        throw os_error( "stat" );
+    if ( ! stream && S_ISREG( st.st_mode ) && st.st_size > 0 )
+    {
+        const off_t offset = lseek( fd, 0, SEEK_CUR );
+        if ( offset >= 0 && offset < st.st_size &&
+             count_mapped( fd, offset, st.st_size - offset, threads, rv.bits ) )
+        {
+            rv.bytes = st.st_size - offset;
+            rv.mapped = true;
+            lseek( fd, 0, SEEK_END );
+        }
+    }
+
+    if ( ! rv.mapped )
+        rv.bits = count_streamed( fd, rv.bytes );
+
+    rv.seconds = std::chrono::duration< double >( clock::now() - start ).count();
+    return rv;
+}
+
+popcount_file_result
+popcount_file( const std::string & path, const unsigned threads, const bool stream )
+{
+    if ( path == "-" )
+        return popcount_fd( 0, threads, stream );
+
+    const int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+        throw os_error( "open " + path );
+
+    try
+    {
+        const popcount_file_result rv = popcount_fd( fd, threads, stream );
+        close( fd );
+        return rv;
+    }
+    catch ( const std::system_error & e )
+    {
+        close( fd );
+        throw std::system_error( e.code(), path );
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef COUNTBITS_POPCOUNT_FILE_HPP
+#define COUNTBITS_POPCOUNT_FILE_HPP 1
+
+// Bit counting straight from files, pipes and sockets, without first
+// loading them into memory.
+//
+// Regular files are mapped and counted with popcount_parallel() a
+// 256 MiB window at a time: the whole mapping is marked sequential
+// (and huge pages requested, where the filesystem can use them), the
+// next window is asked for ahead of time, and each finished one is
+// dropped again, so the process never holds more than about two
+// windows however big the file is.  Anything that can't be mapped is
+// read through four 1 MiB page-aligned buffers, one thread reading
+// while the caller counts.
+//
+// Link with libcountbits.a.
+
+#include <cstdint>
+#include <string>
+
+struct popcount_file_result
+{
+    uint64_t bits;
+    uint64_t bytes;
+    double seconds;
+    bool mapped;        // false if it was streamed through buffers
+};
+
+// count the set bits in path ("-" for standard input), on up to
+// threads threads (see popcount_parallel()).  stream skips mapping.
+// throws std::system_error if the file can't be opened or read.
+popcount_file_result popcount_file( const std::string & path, unsigned threads = 0, bool stream = false );
+
+// the same, from the current position of an open descriptor to its end.
+popcount_file_result popcount_fd( int fd, unsigned threads = 0, bool stream = false );
+
+#endif
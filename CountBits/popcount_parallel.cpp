@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "popcount.hpp"
+
+namespace
+{
+
+// below this much per thread, waking one costs more than it saves.
+const std::size_t grain_bytes = 1 << 20;
+
+// thread ranges start on page boundaries.
+const std::uintptr_t page_bytes = 4096;
+
+// partial counts sit this far apart, a cache line each.
+const std::size_t partial_stride = 64 / sizeof( uint64_t );
+
+// workers that live for the whole program, so a count doesn't pay
+// for starting threads.  one run() at a time.
+class pool
+{
+
+public:
+
+    static pool & instance();
+
+    // task( 0 ) .. task( n - 1 ), task( 0 ) on the calling thread; returns once all are done.
+    void run( unsigned n, const std::function< void ( unsigned ) > & task );
+
+private:
+
+    pool();
+    ~pool();
+
+    pool( const pool & );
+    pool & operator=( const pool & );
+
+    void worker( unsigned index, uint64_t generation );
+
+    std::mutex m_run_mutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::vector< std::thread > m_threads;
+    const std::function< void ( unsigned ) > * m_task;
+    unsigned m_tasks;
+    unsigned m_pending;
+    uint64_t m_generation;
+    bool m_stop;
+
+};
+
+pool &
+pool::instance()
+{
+    static pool p;
+    return p;
+}
+
+pool::pool()
+    : m_task( 0 ),
+      m_tasks( 0 ),
+      m_pending( 0 ),
+      m_generation( 0 ),
+      m_stop( false )
+{
+}
+
+pool::~pool()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for ( std::thread & t : m_threads )
+        t.join();
+}
+
+void
+pool::run( const unsigned n, const std::function< void ( unsigned ) > & task )
+{
+    std::lock_guard< std::mutex > serial( m_run_mutex );
+
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        // new workers start at the current generation, so they wait
+        // for the one about to begin.
+        while ( m_threads.size() + 1 < n )
+            m_threads.push_back( std::thread( &pool::worker, this,
+                                             static_cast< unsigned >( m_threads.size() ), m_generation ) );
+
+        m_task = &task;
+        m_tasks = n;
+        m_pending = n - 1;
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    task( 0 );
+
+    std::unique_lock< std::mutex > lock( m_mutex );
+    m_done.wait( lock, [this] { return m_pending == 0; } );
+}
+
+void
+pool::worker( const unsigned index, uint64_t generation )
+{
+    std::unique_lock< std::mutex > lock( m_mutex );
+    while ( true )
+    {
+        m_wake.wait( lock, [&] { return m_stop || m_generation != generation; } );
+        if ( m_stop )
+            return;
+        generation = m_generation;
+
+        const unsigned t = index + 1;
+        if ( t >= m_tasks )
+            continue;
+
+        const std::function< void ( unsigned ) > & task = *m_task;
+        lock.unlock();
+        task( t );
+        lock.lock();
+
+        if ( --m_pending == 0 )
+            m_done.notify_one();
+    }
+}
+
+}
+
+uint64_t
+popcount_parallel( const void * data, const std::size_t len, unsigned threads )
+{
+    // too small to split: don't pay for the thread count, let alone the pool.
+    if ( len < 2 * grain_bytes )
+        return popcount_bytes( data, len );
+
+    // a syscall (or a /proc read) on some libcs, so ask just the once.
+    static const unsigned hardware_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    if ( threads == 0 )
+        threads = hardware_threads;
+    threads = static_cast< unsigned >( std::min< std::size_t >( threads, std::max< std::size_t >( 1, len / grain_bytes ) ) );
+
+    if ( threads == 1 )
+        return popcount_bytes( data, len );
+
+    // split points, rounded up to the next page
+    const unsigned char * const base = static_cast< const unsigned char * >( data );
+    const std::uintptr_t addr = reinterpret_cast< std::uintptr_t >( base );
+    std::vector< std::size_t > split( threads + 1 );
+    split[0] = 0;
+    split[threads] = len;
+    for ( unsigned t = 1; t < threads; ++t )
+    {
+        const std::uintptr_t at = ( addr + len / threads * t + page_bytes - 1 ) & ~( page_bytes - 1 );
+        split[t] = std::min< std::size_t >( at - addr, len );
+    }
+
+    std::vector< uint64_t > partial( threads * partial_stride );
+    pool::instance().run( threads, [&]( const unsigned t )
+    {
+        partial[ t * partial_stride ] = popcount_bytes( base + split[t], split[t + 1] - split[t] );
+    } );
+
+    uint64_t rv = 0;
+    for ( unsigned t = 0; t < threads; ++t )
+        rv += partial[ t * partial_stride ];
+    return rv;
+}
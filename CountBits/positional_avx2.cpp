@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include "avx2_popcount.hpp"
+
+namespace
+{
+
+// per-byte counts of each bit of v, added to acc[0..7]
+__attribute__(( target( "avx2" ) ))
+inline
+void
+add_bits( __m256i * acc, const __m256i v )
+{
+    const __m256i low_bits = _mm256_set1_epi8( 1 );
+    for ( int b = 0; b < 8; ++b )
+        acc[b] = _mm256_add_epi8( acc[b], _mm256_and_si256( _mm256_srli_epi16( v, b ), low_bits ) );
+}
+
+// adds weight times the byte counters in acc to counts, and clears them
+__attribute__(( target( "avx2" ) ))
+void
+flush( __m256i * acc, const uint64_t weight, uint64_t * counts )
+{
+    for ( int b = 0; b < 8; ++b )
+    {
+        unsigned char lanes[32];
+        _mm256_storeu_si256( static_cast< __m256i * >( static_cast< void * >( lanes ) ), acc[b] );
+        add_lane_counts( lanes, sizeof( lanes ), b, weight, counts );
+        acc[b] = _mm256_setzero_si256();
+    }
+}
+
+}
+
+// the same carry-save tree as positional_bit_slice_bytes(), 32 bytes
+// at a time.
+__attribute__(( target( "avx2" ) ))
+void
+positional_avx2_bytes( const unsigned char * data, std::size_t len, uint64_t * counts )
+{
+    const std::size_t n_blocks = len / ( 16 * 32 );
+
+    __m256i acc[8];
+    for ( int b = 0; b < 8; ++b )
+        acc[b] = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256();
+    __m256i twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    __m256i eights = _mm256_setzero_si256();
+    __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+    for ( std::size_t b = 0; b < n_blocks; )
+    {
+        for ( const std::size_t end = std::min( n_blocks, b + 255 ); b < end; ++b )
+        {
+            const unsigned char * p = data + b * 16 * 32;
+
+            csa( twos_a, ones, ones, load_avx2( p +   0 ), load_avx2( p +  32 ) );
+            csa( twos_b, ones, ones, load_avx2( p +  64 ), load_avx2( p +  96 ) );
+            csa( fours_a, twos, twos, twos_a, twos_b );
+            csa( twos_a, ones, ones, load_avx2( p + 128 ), load_avx2( p + 160 ) );
+            csa( twos_b, ones, ones, load_avx2( p + 192 ), load_avx2( p + 224 ) );
+            csa( fours_b, twos, twos, twos_a, twos_b );
+            csa( eights_a, fours, fours, fours_a, fours_b );
+
+            csa( twos_a, ones, ones, load_avx2( p + 256 ), load_avx2( p + 288 ) );
+            csa( twos_b, ones, ones, load_avx2( p + 320 ), load_avx2( p + 352 ) );
+            csa( fours_a, twos, twos, twos_a, twos_b );
+            csa( twos_a, ones, ones, load_avx2( p + 384 ), load_avx2( p + 416 ) );
+            csa( twos_b, ones, ones, load_avx2( p + 448 ), load_avx2( p + 480 ) );
+            csa( fours_b, twos, twos, twos_a, twos_b );
+            csa( eights_b, fours, fours, fours_a, fours_b );
+
+            csa( sixteens, eights, eights, eights_a, eights_b );
+
+            add_bits( acc, sixteens );
+        }
+        flush( acc, 16, counts );
+    }
+
+    add_bits( acc, eights );
+    flush( acc, 8, counts );
+    add_bits( acc, fours );
+    flush( acc, 4, counts );
+    add_bits( acc, twos );
+    flush( acc, 2, counts );
+    add_bits( acc, ones );
+
+    // whole vectors left over, then any at the end
+    std::size_t i = n_blocks * 16 * 32;
+    for ( ; i + 32 <= len; i += 32 )
+        add_bits( acc, load_avx2( data + i ) );
+    flush( acc, 1, counts );
+
+    add_positional_counts( data + i, len - i, 1, counts );
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include <algorithm>
+
+#include "bit_counters.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+#include <immintrin.h>
+
+namespace
+{
+
+// carry-save adder: h:l = a + b + c, bitwise; one ternary-logic
+// instruction each for the majority and the parity.
+__attribute__(( target( "avx512f" ) ))
+inline
+void
+csa( __m512i & h, __m512i & l, const __m512i a, const __m512i b, const __m512i c )
+{
+    h = _mm512_ternarylogic_epi64( a, b, c, 0xe8 );
+    l = _mm512_ternarylogic_epi64( a, b, c, 0x96 );
+}
+
+__attribute__(( target( "avx512f" ) ))
+inline
+__m512i
+load_avx512( const unsigned char * p )
+{
+    return _mm512_loadu_si512( p );
+}
+
+// per-byte counts of each bit of v, added to acc[0..7]
+__attribute__(( target( "avx512f,avx512bw" ) ))
+inline
+void
+add_bits( __m512i * acc, const __m512i v )
+{
+    const __m512i low_bits = _mm512_set1_epi8( 1 );
+    for ( int b = 0; b < 8; ++b )
+        acc[b] = _mm512_add_epi8( acc[b], _mm512_and_si512( _mm512_srli_epi16( v, b ), low_bits ) );
+}
+
+// adds weight times the byte counters in acc to counts, and clears them
+__attribute__(( target( "avx512f" ) ))
+void
+flush( __m512i * acc, const uint64_t weight, uint64_t * counts )
+{
+    for ( int b = 0; b < 8; ++b )
+    {
+        unsigned char lanes[64];
+        _mm512_storeu_si512( lanes, acc[b] );
+        add_lane_counts( lanes, sizeof( lanes ), b, weight, counts );
+        acc[b] = _mm512_setzero_si512();
+    }
+}
+
+}
+
+// the same carry-save tree as positional_bit_slice_bytes(), 64 bytes
+// at a time.
+__attribute__(( target( "avx512f,avx512bw" ) ))
+void
+positional_avx512_bytes( const unsigned char * data, std::size_t len, uint64_t * counts )
+{
+    const std::size_t n_blocks = len / ( 16 * 64 );
+
+    __m512i acc[8];
+    for ( int b = 0; b < 8; ++b )
+        acc[b] = _mm512_setzero_si512();
+    __m512i ones = _mm512_setzero_si512();
+    __m512i twos = _mm512_setzero_si512();
+    __m512i fours = _mm512_setzero_si512();
+    __m512i eights = _mm512_setzero_si512();
+    __m512i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+    for ( std::size_t b = 0; b < n_blocks; )
+    {
+        for ( const std::size_t end = std::min( n_blocks, b + 255 ); b < end; ++b )
+        {
+            const unsigned char * p = data + b * 16 * 64;
+
+            csa( twos_a, ones, ones, load_avx512( p +   0 ), load_avx512( p +  64 ) );
+            csa( twos_b, ones, ones, load_avx512( p + 128 ), load_avx512( p + 192 ) );
+            csa( fours_a, twos, twos, twos_a, twos_b );
+            csa( twos_a, ones, ones, load_avx512( p + 256 ), load_avx512( p + 320 ) );
+            csa( twos_b, ones, ones, load_avx512( p + 384 ), load_avx512( p + 448 ) );
+            csa( fours_b, twos, twos, twos_a, twos_b );
+            csa( eights_a, fours, fours, fours_a, fours_b );
+
+            csa( twos_a, ones, ones, load_avx512( p + 512 ), load_avx512( p + 576 ) );
+            csa( twos_b, ones, ones, load_avx512( p + 640 ), load_avx512( p + 704 ) );
+            csa( fours_a, twos, twos, twos_a, twos_b );
+            csa( twos_a, ones, ones, load_avx512( p + 768 ), load_avx512( p + 832 ) );
+            csa( twos_b, ones, ones, load_avx512( p + 896 ), load_avx512( p + 960 ) );
+            csa( fours_b, twos, twos, twos_a, twos_b );
+            csa( eights_b, fours, fours, fours_a, fours_b );
+
+            csa( sixteens, eights, eights, eights_a, eights_b );
+
+            add_bits( acc, sixteens );
+        }
+        flush( acc, 16, counts );
+    }
+
+    add_bits( acc, eights );
+    flush( acc, 8, counts );
+    add_bits( acc, fours );
+    flush( acc, 4, counts );
+    add_bits( acc, twos );
+    flush( acc, 2, counts );
+    add_bits( acc, ones );
+
+    // whole vectors left over, then any at the end
+    std::size_t i = n_blocks * 16 * 64;
+    for ( ; i + 64 <= len; i += 64 )
+        add_bits( acc, load_avx512( data + i ) );
+    flush( acc, 1, counts );
+
+    add_positional_counts( data + i, len - i, 1, counts );
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cstring>
+
+#include "bit_counters.hpp"
+
+namespace
+{
+
+inline
+uint64_t
+load_word( const unsigned char * p )
+{
+    uint64_t n;
+    std::memcpy( &n, p, sizeof( n ) );
+    return n;
+}
+
+// carry-save adder: h:l = a + b + c, bitwise
+inline
+void
+csa( uint64_t & h, uint64_t & l, const uint64_t a, const uint64_t b, const uint64_t c )
+{
+    const uint64_t u = a ^ b;
+    h = ( a & b ) | ( u & c );
+    l = u ^ c;
+}
+
+const uint64_t low_bits = 0x0101010101010101;
+
+// per-byte counts of each bit of n, added to acc[0..7]
+inline
+void
+add_bits( uint64_t * acc, const uint64_t n )
+{
+    for ( int b = 0; b < 8; ++b )
+        acc[b] += ( n >> b ) & low_bits;
+}
+
+// adds weight times the byte counters in acc to counts, and clears them
+void
+flush( uint64_t * acc, const uint64_t weight, uint64_t * counts )
+{
+    for ( int b = 0; b < 8; ++b )
+    {
+        unsigned char lanes[8];
+        std::memcpy( lanes, &acc[b], sizeof( lanes ) );
+        add_lane_counts( lanes, sizeof( lanes ), b, weight, counts );
+        acc[b] = 0;
+    }
+}
+
+}
+
+// Harley-Seal again, but since every bit of the ones, twos, ...
+// words stands for one bit position, the sixteens word is split into
+// a byte counter per bit of the byte instead of counted.  those
+// counters can take 255 blocks before they have to be emptied.
+void
+positional_bit_slice_bytes( const unsigned char * data, std::size_t len, uint64_t * counts )
+{
+    const std::size_t n_blocks = len / ( 16 * 8 );
+
+    uint64_t acc[8] = { 0 };
+    uint64_t ones = 0, twos = 0, fours = 0, eights = 0;
+    uint64_t sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+    for ( std::size_t b = 0; b < n_blocks; )
+    {
+        for ( const std::size_t end = std::min( n_blocks, b + 255 ); b < end; ++b )
+        {
+            const unsigned char * p = data + b * 16 * 8;
+
+            csa( twos_a, ones, ones, load_word( p +   0 ), load_word( p +   8 ) );
+            csa( twos_b, ones, ones, load_word( p +  16 ), load_word( p +  24 ) );
+            csa( fours_a, twos, twos, twos_a, twos_b );
+            csa( twos_a, ones, ones, load_word( p +  32 ), load_word( p +  40 ) );
+            csa( twos_b, ones, ones, load_word( p +  48 ), load_word( p +  56 ) );
+            csa( fours_b, twos, twos, twos_a, twos_b );
+            csa( eights_a, fours, fours, fours_a, fours_b );
+
+            csa( twos_a, ones, ones, load_word( p +  64 ), load_word( p +  72 ) );
+            csa( twos_b, ones, ones, load_word( p +  80 ), load_word( p +  88 ) );
+            csa( fours_a, twos, twos, twos_a, twos_b );
+            csa( twos_a, ones, ones, load_word( p +  96 ), load_word( p + 104 ) );
+            csa( twos_b, ones, ones, load_word( p + 112 ), load_word( p + 120 ) );
+            csa( fours_b, twos, twos, twos_a, twos_b );
+            csa( eights_b, fours, fours, fours_a, fours_b );
+
+            csa( sixteens, eights, eights, eights_a, eights_b );
+
+            add_bits( acc, sixteens );
+        }
+        flush( acc, 16, counts );
+    }
+
+    add_bits( acc, eights );
+    flush( acc, 8, counts );
+    add_bits( acc, fours );
+    flush( acc, 4, counts );
+    add_bits( acc, twos );
+    flush( acc, 2, counts );
+    add_bits( acc, ones );
+
+    // whole words left over, then any at the end
+    std::size_t i = n_blocks * 16 * 8;
+    for ( ; i + 8 <= len; i += 8 )
+        add_bits( acc, load_word( data + i ) );
+    flush( acc, 1, counts );
+
+    add_positional_counts( data + i, len - i, 1, counts );
+}
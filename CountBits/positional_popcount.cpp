@@ -0,0 +1,19 @@
+#include "bit_counters.hpp"
+#include "positional_popcount.hpp"
+
+void
+positional_popcount_bytes( const void * data, std::size_t len, const unsigned width, uint64_t * counts )
+{
+    uint64_t word_counts[64] = { 0 };
+    positional_kernel_for( len ).func( static_cast< const unsigned char * >( data ), len - len % width, word_counts );
+
+    // byte k of each word is byte k % width of an element, which holds
+    // its low bits first or last depending on the cpu.
+    const bool little_endian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+    for ( unsigned k = 0; k < 8; ++k )
+    {
+        const unsigned byte = little_endian ? k % width : width - 1 - k % width;
+        for ( unsigned b = 0; b < 8; ++b )
+            counts[8 * byte + b] += word_counts[8 * k + b];
+    }
+}
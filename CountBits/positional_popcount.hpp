@@ -0,0 +1,62 @@
+#ifndef COUNTBITS_POSITIONAL_POPCOUNT_HPP
+#define COUNTBITS_POSITIONAL_POPCOUNT_HPP 1
+
+// Positional popcount: for each bit position of an unsigned 8, 16,
+// 32 or 64 bit element, how many elements in a contiguous run have
+// that bit set.  Counts are added to what's already there, so a
+// column can be fed through in pieces.  Runs go to whichever
+// positional kernel this cpu supports is fastest at their length (see
+// bit_counters.hpp): they all work through 64-bit words with
+// carry-save adders, the widest only paying off on long runs.  Very
+// short ones are counted inline.
+//
+// Link with libcountbits.a.
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// adds to counts[p], for each bit position p (0 for the least
+// significant) of a width-byte element, how many of the len / width
+// elements at data have bit p set.  width is 1, 2, 4 or 8, and
+// counts has 8 * width entries.
+void positional_popcount_bytes( const void * data, std::size_t len, unsigned width, uint64_t * counts );
+
+namespace positional_detail
+{
+
+// below this many bytes, going through the kernel costs more than it saves.
+const std::size_t inline_bytes = 64;
+
+}
+
+template < typename T >
+void
+positional_popcount( const T * data, std::size_t n, uint64_t ( & counts )[8 * sizeof( T )] )
+{
+    static_assert( std::is_integral< T >::value && std::is_unsigned< T >::value,
+                   "positional_popcount() counts unsigned integers" );
+    static_assert( sizeof( T ) == 1 || sizeof( T ) == 2 || sizeof( T ) == 4 || sizeof( T ) == 8,
+                   "positional_popcount() handles 8, 16, 32 and 64 bit elements" );
+
+    if ( n * sizeof( T ) < positional_detail::inline_bytes )
+    {
+        for ( std::size_t i = 0; i < n; ++i )
+            for ( std::size_t p = 0; p < 8 * sizeof( T ); ++p )
+                counts[p] += ( data[i] >> p ) & 1;
+        return;
+    }
+
+    positional_popcount_bytes( data, n * sizeof( T ), sizeof( T ), counts );
+}
+
+// the same over any contiguous container: std::vector, std::array, ...
+template < typename Container >
+void
+positional_popcount( const Container & c,
+                     uint64_t ( & counts )[8 * sizeof( typename Container::value_type )] )
+{
+    positional_popcount( c.data(), c.size(), counts );
+}
+
+#endif
@@ -0,0 +1,8 @@
+#include "bit_counters.hpp"
+
+// a bit at a time; the reference the others are checked against.
+void
+positional_scalar_bytes( const unsigned char * data, std::size_t len, uint64_t * counts )
+{
+    add_positional_counts( data, len, 1, counts );
+}
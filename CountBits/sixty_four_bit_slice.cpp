@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "bit_counters.hpp"
 
 int
@@ -32,3 +34,28 @@ sixty_four_bit_slice( const uint16_vec & vals )
 
     return rv;
 }
+
+uint64_t
+sixty_four_bit_slice_bytes( const unsigned char * data, std::size_t len )
+{
+    uint64_t rv = 0;
+    std::size_t i = 0;
+
+    // whole 64-bit words, copied out rather than cast, so any
+    // alignment (and any type underneath) is fine.
+    for ( ; i + 8 <= len; i += 8 )
+    {
+        uint64_t n;
+        std::memcpy( &n, data + i, sizeof( n ) );
+        n = ( ( n & 0xaaaaaaaaaaaaaaaa ) >>  1 ) + ( n & 0x5555555555555555 );
+        n = ( ( n & 0xcccccccccccccccc ) >>  2 ) + ( n & 0x3333333333333333 );
+        n = ( ( n & 0xf0f0f0f0f0f0f0f0 ) >>  4 ) + ( n & 0x0f0f0f0f0f0f0f0f );
+        rv += ( n * 0x0101010101010101 ) >> 56;
+    }
+
+    // and then any at the end
+    for ( ; i < len; ++i )
+        rv += count_bits_uint8( data[i] );
+
+    return rv;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file AsyncSender.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <algorithm>
+#include <chrono>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "AsyncSender.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+typedef std::chrono::steady_clock Clock;
+
+// the wait is only a backstop against a missed wakeup; normally the
+// other side notifies us long before it expires.
+const std::chrono::milliseconds WAIT_SLICE( 10 );
+
+size_t
+roundUpPow2( size_t n )
+{
+    size_t rv( 1 );
+    while ( rv < n )
+        rv <<= 1;
+    return rv;
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+AsyncSender::AsyncSender( Zip64Streamer::Sender & inner, const size_t depth )
+    : m_inner( inner ),
+      m_ring( roundUpPow2( std::max< size_t >( depth, 2 ) ) ),
+      m_mask( m_ring.size() - 1 ),
+      m_head( 0 ),
+      m_tail( 0 ),
+      m_bProducerWaiting( false ),
+      m_bConsumerWaiting( false ),
+      m_bStop( false ),
+      m_bFailed( false ),
+      m_flushesDone( 0 ),
+      m_flushesRequested( 0 ),
+      m_emptyWaits( 0 )
+{
+    zeroStruct( m_stats );
+    m_thread = std::thread( &AsyncSender::ioLoop, this );
+    DEBUG( "as: ctor: depth=" << m_ring.size() );
+}
+
+AsyncSender::~AsyncSender()
+{
+    m_bStop = true;
+    {
+        std::lock_guard< std::mutex > lock( m_waitMutex );
+        m_waitCond.notify_all();
+    }
+    m_thread.join();
+
+    const Stats s( stats() );
+    DEBUG( "as: dtor: sends=" << s.sends <<
+           ", avg depth=" << s.averageDepth() <<
+           ", max depth=" << s.maxDepth <<
+           ", full stalls=" << s.fullStalls <<
+           ", empty waits=" << s.emptyWaits );
+
+    if ( m_error )
+    {
+        try
+        {
+            std::rethrow_exception( m_error );
+        }
+        catch ( const std::exception & e )
+        {
+            ERROR( "as: dtor: unreported send error: " << e.what() );
+        }
+        catch ( ... )
+        {
+            ERROR( "as: dtor: unreported send error" );
+        }
+    }
+}
+
+/* virtual */ void
+AsyncSender::send( CharBuffer & b )
+{
+    push( SLOT_BUFFER, &b, 0 );
+}
+
+/* virtual */ void
+AsyncSender::send( string & s )
+{
+    push( SLOT_STRING, 0, &s );
+}
+
+/* virtual */ void
+AsyncSender::flush()
+{
+    push( SLOT_FLUSH, 0, 0 );
+    const uint64_t want( ++m_flushesRequested );
+
+    while ( m_flushesDone.load() < want )
+    {
+        std::unique_lock< std::mutex > lock( m_waitMutex );
+        m_bProducerWaiting = true;
+        if ( m_flushesDone.load() < want )
+            m_waitCond.wait_for( lock, WAIT_SLICE );
+        m_bProducerWaiting = false;
+    }
+
+    checkError();
+}
+
+AsyncSender::Stats
+AsyncSender::stats() const
+{
+    Stats rv( m_stats );
+    rv.emptyWaits = m_emptyWaits.load();
+    return rv;
+}
+
+void
+AsyncSender::push( const SlotKind kind, CharBuffer * b, string * s )
+{
+    checkError();
+
+    const uint64_t tail( m_tail.load( std::memory_order_relaxed ) );
+    uint64_t head( m_head.load( std::memory_order_acquire ) );
+
+    if ( tail - head == m_ring.size() )
+    {
+        // backpressure: the I/O side is behind by a full ring.
+        ++m_stats.fullStalls;
+        const Clock::time_point start( Clock::now() );
+
+        while ( tail - head == m_ring.size() )
+        {
+            checkError();
+
+            std::unique_lock< std::mutex > lock( m_waitMutex );
+            m_bProducerWaiting = true;
+            head = m_head.load();
+            if ( tail - head == m_ring.size() )
+                m_waitCond.wait_for( lock, WAIT_SLICE );
+            m_bProducerWaiting = false;
+            head = m_head.load();
+        }
+
+        m_stats.stallNanos += std::chrono::duration_cast< std::chrono::nanoseconds >(
+            Clock::now() - start ).count();
+    }
+
+    const uint64_t depth( tail - head );
+    ++m_stats.sends;
+    m_stats.depthTotal += depth;
+    if ( depth > m_stats.maxDepth )
+        m_stats.maxDepth = depth;
+
+    // swapping hands the caller the slot's previous (emptied) buffer,
+    // so its capacity gets reused.
+    Slot & slot( m_ring[ tail & m_mask ] );
+    slot.kind = kind;
+    if ( b )
+        slot.buf.swap( *b );
+    if ( s )
+        slot.str.swap( *s );
+
+    m_tail.store( tail + 1 );
+    wake( m_bConsumerWaiting );
+}
+
+void
+AsyncSender::ioLoop()
+{
+    while ( true )
+    {
+        const uint64_t head( m_head.load( std::memory_order_relaxed ) );
+
+        if ( head == m_tail.load() )
+        {
+            if ( m_bStop )
+                break;
+
+            ++m_emptyWaits;
+
+            std::unique_lock< std::mutex > lock( m_waitMutex );
+            m_bConsumerWaiting = true;
+            if ( head == m_tail.load() && ! m_bStop )
+                m_waitCond.wait_for( lock, WAIT_SLICE );
+            m_bConsumerWaiting = false;
+            continue;
+        }
+
+        Slot & slot( m_ring[ head & m_mask ] );
+
+        if ( ! m_bFailed )
+        {
+            try
+            {
+                switch ( slot.kind )
+                {
+                case SLOT_BUFFER: m_inner.send( slot.buf ); break;
+                case SLOT_STRING: m_inner.send( slot.str ); break;
+                case SLOT_FLUSH:  m_inner.flush();          break;
+                }
+            }
+            catch ( ... )
+            {
+                m_error = std::current_exception();
+                m_bFailed = true;
+            }
+        }
+
+        slot.buf.clear();
+        slot.str.clear();
+
+        if ( slot.kind == SLOT_FLUSH )
+            ++m_flushesDone;
+
+        m_head.store( head + 1 );
+        wake( m_bProducerWaiting );
+    }
+}
+
+void
+AsyncSender::wake( std::atomic< bool > & waiting )
+{
+    if ( waiting.load() )
+    {
+        std::lock_guard< std::mutex > lock( m_waitMutex );
+        m_waitCond.notify_all();
+    }
+}
+
+void
+AsyncSender::checkError()
+{
+    if ( m_bFailed.load() )
+        std::rethrow_exception( m_error );
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
@@ -0,0 +1,133 @@
+#ifndef COM_FOIANI_Z64S_ASYNCSENDER_HPP
+#define COM_FOIANI_Z64S_ASYNCSENDER_HPP 1
+
+/**
+ * @file AsyncSender.hpp
+ *
+ * A Zip64Streamer::Sender that decouples compression from I/O.
+ * send() swaps the buffer into a bounded single-producer /
+ * single-consumer ring and returns; a dedicated I/O thread drains the
+ * ring into the wrapped sender.  The streamer only waits when the
+ * ring is full.
+ *
+ * The wrapped sender is only ever called from the I/O thread.  If it
+ * throws, the error is handed back to the streamer from its next
+ * send() or flush(), and anything still queued is dropped.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Run another sender on its own thread behind a bounded queue. */
+class AsyncSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    struct Stats
+    {
+        uint64_t sends;          // buffers queued
+        uint64_t depthTotal;     // sum of queue depth seen at each send
+        uint64_t maxDepth;       // deepest the queue has been
+        uint64_t fullStalls;     // sends that had to wait for space
+        uint64_t stallNanos;     // time the producer spent waiting
+        uint64_t emptyWaits;     // times the I/O thread ran dry
+
+        double averageDepth() const
+        {
+            return sends ? static_cast< double >( depthTotal ) / sends : 0.0;
+        }
+    };
+
+    /**
+     * Forward to @a inner, queueing up to @a depth buffers (rounded
+     * up to a power of two).  @a inner must outlive this object.
+     */
+    explicit AsyncSender( Zip64Streamer::Sender & inner, size_t depth = 64 );
+
+    /** Drains the queue and stops the I/O thread. */
+    virtual ~AsyncSender();
+
+    virtual void send( CharBuffer & b );
+    virtual void send( string & s );
+
+    /** Wait until everything queued has been sent and @a inner flushed. */
+    virtual void flush();
+
+    /** Snapshot of the queue statistics; I/O-side fields may lag slightly. */
+    Stats stats() const;
+
+private:
+
+    AsyncSender( const AsyncSender & );
+    AsyncSender & operator=( const AsyncSender & );
+
+    enum SlotKind { SLOT_BUFFER, SLOT_STRING, SLOT_FLUSH };
+
+    struct Slot
+    {
+        SlotKind kind;
+        CharBuffer buf;
+        string str;
+    };
+
+    Zip64Streamer::Sender & m_inner;
+
+    std::vector< Slot > m_ring;
+    const size_t m_mask;
+
+    // head is owned by the I/O thread, tail by the producer; each
+    // only reads the other's.
+    std::atomic< uint64_t > m_head;
+    std::atomic< uint64_t > m_tail;
+
+    // sleeping is the slow path; these are only used when one side
+    // has to wait for the other.
+    std::mutex m_waitMutex;
+    std::condition_variable m_waitCond;
+    std::atomic< bool > m_bProducerWaiting;
+    std::atomic< bool > m_bConsumerWaiting;
+
+    std::atomic< bool > m_bStop;
+    std::atomic< bool > m_bFailed;
+    std::exception_ptr m_error;
+
+    std::atomic< uint64_t > m_flushesDone;
+    uint64_t m_flushesRequested;
+
+    Stats m_stats;
+    std::atomic< uint64_t > m_emptyWaits;
+
+    std::thread m_thread;
+
+    void push( SlotKind kind, CharBuffer * b, string * s );
+    void ioLoop();
+    void wake( std::atomic< bool > & waiting );
+    void checkError();
+
+}; // end class AsyncSender
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ASYNCSENDER_HPP
@@ -0,0 +1,279 @@
+/**
+ * @file FanoutSender.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <algorithm>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "FanoutSender.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+FanoutSender::FanoutSender()
+    : m_bStarted( false )
+{
+}
+
+FanoutSender::~FanoutSender()
+{
+    for ( const std::unique_ptr< Branch > & br : m_branches )
+    {
+        {
+            std::lock_guard< std::mutex > lock( br->mutex );
+            br->stop = true;
+        }
+        br->cond.notify_all();
+    }
+
+    for ( const std::unique_ptr< Branch > & br : m_branches )
+    {
+        br->thread.join();
+        DEBUG( "fo: dtor: " << QS( br->status.label ) << ": "
+               "sent=" << br->status.bytesSent << ", "
+               "max queued=" << br->status.maxQueuedBytes << ", "
+               "stalls=" << br->status.stalls <<
+               ( br->status.attached ? "" : ", detached: " + br->status.error ) );
+    }
+}
+
+size_t
+FanoutSender::addBranch( Zip64Streamer::Sender & sender,
+                         const string & label,
+                         const size_t maxQueuedBytes,
+                         const Overflow overflow )
+{
+    if ( m_bStarted )
+        throw std::logic_error( "fan-out: branch " + label + " added after data was sent" );
+
+    std::unique_ptr< Branch > br( new Branch );
+    br->sender = &sender;
+    br->overflow = overflow;
+    br->maxQueuedBytes = maxQueuedBytes;
+    br->queuedBytes = 0;
+    br->flushesRequested = 0;
+    br->flushesDone = 0;
+    br->stop = false;
+    br->status.label = label;
+    br->status.attached = true;
+    br->status.bytesSent = 0;
+    br->status.maxQueuedBytes = 0;
+    br->status.stalls = 0;
+
+    Branch & ref( *br );
+    m_branches.push_back( std::move( br ) );
+    ref.thread = std::thread( &FanoutSender::branchLoop, this, std::ref( ref ) );
+
+    DEBUG( "fo: added branch " << m_branches.size() - 1 << ": " << QS( label ) <<
+           ", limit=" << maxQueuedBytes <<
+           ", overflow=" << ( overflow == BLOCK ? "block" : "detach" ) );
+
+    return m_branches.size() - 1;
+}
+
+/* virtual */ void
+FanoutSender::send( CharBuffer & b )
+{
+    m_bStarted = true;
+    requireAttached();
+
+    if ( b.empty() )
+        return;
+
+    SharedBuffer shared( std::make_shared< Shared >() );
+    shared->data.swap( b );
+    shared->holders.store( 1 );
+
+    for ( const std::unique_ptr< Branch > & br : m_branches )
+        enqueue( *br, shared );
+
+    release( shared );
+}
+
+/* virtual */ void
+FanoutSender::send( string & s )
+{
+    CharBuffer b( s.begin(), s.end() );
+    s.clear();
+    send( b );
+}
+
+/* virtual */ void
+FanoutSender::flush()
+{
+    m_bStarted = true;
+
+    for ( const std::unique_ptr< Branch > & br : m_branches )
+        enqueue( *br, SharedBuffer() );
+
+    for ( const std::unique_ptr< Branch > & br : m_branches )
+    {
+        std::unique_lock< std::mutex > lock( br->mutex );
+        br->cond.wait( lock, [&]{ return ! br->status.attached ||
+                                         br->flushesDone >= br->flushesRequested; } );
+    }
+
+    requireAttached();
+}
+
+FanoutSender::BranchStatus
+FanoutSender::status( const size_t i ) const
+{
+    const Branch & br( *m_branches.at( i ) );
+    std::lock_guard< std::mutex > lock( br.mutex );
+    return br.status;
+}
+
+void
+FanoutSender::enqueue( Branch & br, const SharedBuffer & buf )
+{
+    const size_t bytes( buf ? buf->data.size() : 0 );
+
+    std::unique_lock< std::mutex > lock( br.mutex );
+    if ( ! br.status.attached )
+        return;
+
+    // an empty queue always takes one buffer, however big
+    if ( bytes && ! br.queue.empty() && br.queuedBytes + bytes > br.maxQueuedBytes )
+    {
+        if ( br.overflow == DETACH )
+        {
+            detach( br, "queue limit of " + std::to_string( br.maxQueuedBytes ) +
+                        " bytes exceeded" );
+            return;
+        }
+
+        ++br.status.stalls;
+        br.cond.wait( lock, [&]{ return ! br.status.attached ||
+                                        br.queue.empty() ||
+                                        br.queuedBytes + bytes <= br.maxQueuedBytes; } );
+        if ( ! br.status.attached )
+            return;
+    }
+
+    // the branch can't see it before the mutex is released
+    if ( buf )
+        buf->holders.fetch_add( 1, std::memory_order_relaxed );
+    br.queue.push_back( buf );
+    br.queuedBytes += bytes;
+    br.status.maxQueuedBytes = std::max< uint64_t >( br.status.maxQueuedBytes, br.queuedBytes );
+    if ( ! buf )
+        ++br.flushesRequested;
+
+    lock.unlock();
+    br.cond.notify_all();
+}
+
+/* static */ void
+FanoutSender::release( const SharedBuffer & buf )
+{
+    // release, so a branch that sees itself last also sees our copy done
+    buf->holders.fetch_sub( 1, std::memory_order_acq_rel );
+}
+
+void
+FanoutSender::detach( Branch & br, const string & why )
+{
+    // caller holds br.mutex
+    WARN( "fo: detaching " << QS( br.status.label ) << ": " << why );
+
+    br.status.attached = false;
+    br.status.error = why;
+
+    // buffers dropped here keep their holds (the branch thread may be
+    // in the middle of the first one), so the other branches copy them.
+    br.queue.clear();
+    br.queuedBytes = 0;
+    br.cond.notify_all();
+}
+
+void
+FanoutSender::branchLoop( Branch & br )
+{
+    CharBuffer local;
+
+    while ( true )
+    {
+        SharedBuffer buf;
+        bool isFlush( false );
+        {
+            std::unique_lock< std::mutex > lock( br.mutex );
+            br.cond.wait( lock, [&]{ return br.stop || ! br.queue.empty(); } );
+            if ( br.queue.empty() )
+                return;
+            buf = br.queue.front();
+            isFlush = ! buf;
+        }
+
+        const size_t bytes( buf ? buf->data.size() : 0 );
+        try
+        {
+            if ( isFlush )
+                br.sender->flush();
+            else
+            {
+                // the last branch to get here can have the buffer
+                // itself; everyone else gets a copy.
+                if ( buf->holders.load( std::memory_order_acquire ) == 1 )
+                    local.swap( buf->data );
+                else
+                {
+                    local.assign( buf->data.begin(), buf->data.end() );
+                    release( buf );
+                }
+                br.sender->send( local );
+                local.clear();
+            }
+        }
+        catch ( const std::exception & e )
+        {
+            std::lock_guard< std::mutex > lock( br.mutex );
+            detach( br, e.what() );
+            continue;
+        }
+        catch ( ... )
+        {
+            std::lock_guard< std::mutex > lock( br.mutex );
+            detach( br, "unknown error" );
+            continue;
+        }
+
+        {
+            std::lock_guard< std::mutex > lock( br.mutex );
+            if ( ! br.status.attached )
+                continue; // detached while we were sending; queue is gone
+            br.queue.pop_front();
+            br.queuedBytes -= bytes;
+            br.status.bytesSent += bytes;
+            if ( isFlush )
+                ++br.flushesDone;
+        }
+        br.cond.notify_all();
+    }
+}
+
+void
+FanoutSender::requireAttached() const
+{
+    for ( const std::unique_ptr< Branch > & br : m_branches )
+    {
+        std::lock_guard< std::mutex > lock( br->mutex );
+        if ( br->status.attached )
+            return;
+    }
+
+    throw std::runtime_error( "fan-out: no destinations left" );
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
@@ -0,0 +1,144 @@
+#ifndef COM_FOIANI_Z64S_FANOUTSENDER_HPP
+#define COM_FOIANI_Z64S_FANOUTSENDER_HPP 1
+
+/**
+ * @file FanoutSender.hpp
+ *
+ * A Zip64Streamer::Sender that delivers one archive to several
+ * destinations (a local cache copy, an upload, a live client), so
+ * each file is read, checksummed and deflated once no matter how
+ * many copies are produced.
+ *
+ * Every destination ("branch") gets its own queue and thread.  A slow
+ * branch only holds up the streamer once its queue reaches its byte
+ * limit; depending on its policy it then either blocks the streamer
+ * until it catches up, or is detached and receives nothing further.
+ * A branch whose sender throws is detached too.  Buffers are shared
+ * between branch queues; each is copied only when handed to a
+ * destination, and the last branch to consume it takes it as-is.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Send one archive to several destinations, each behind its own bounded queue. */
+class FanoutSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    /** What to do when a branch's queue is full. */
+    enum Overflow
+    {
+        /** Wait for the branch to catch up (and so hold up everyone). */
+        BLOCK,
+
+        /** Give up on the branch; the others carry on. */
+        DETACH
+    };
+
+    struct BranchStatus
+    {
+        string label;
+        bool attached;
+        uint64_t bytesSent;
+        uint64_t maxQueuedBytes;  // high-water mark
+        uint64_t stalls;          // sends that waited on this branch
+        string error;             // why it was detached, if it was
+    };
+
+    FanoutSender();
+
+    /** Drains every attached branch and stops the threads. */
+    virtual ~FanoutSender();
+
+    /**
+     * Add a destination; must be called before the first send().
+     * @a sender must outlive this object.  Returns the branch index.
+     */
+    size_t addBranch( Zip64Streamer::Sender & sender,
+                      const string & label,
+                      size_t maxQueuedBytes = 64 * 1024 * 1024,
+                      Overflow overflow = BLOCK );
+
+    virtual void send( CharBuffer & b );
+    virtual void send( string & s );
+
+    /** Wait for every attached branch to drain and flush its destination. */
+    virtual void flush();
+
+    size_t branches() const { return m_branches.size(); }
+    BranchStatus status( size_t i ) const;
+
+private:
+
+    FanoutSender( const FanoutSender & );
+    FanoutSender & operator=( const FanoutSender & );
+
+    /** A buffer queued to several branches at once. */
+    struct Shared
+    {
+        CharBuffer data;
+
+        // branches yet to send it, plus send() until it's queued it
+        // everywhere.  branches copy the data and then let go; the one
+        // that finds itself the only holder can take it uncopied.
+        std::atomic< unsigned > holders;
+    };
+
+    typedef std::shared_ptr< Shared > SharedBuffer;
+
+    struct Branch
+    {
+        Zip64Streamer::Sender * sender;
+        Overflow overflow;
+        size_t maxQueuedBytes;
+
+        mutable std::mutex mutex;
+        std::condition_variable cond;
+        std::deque< SharedBuffer > queue; // null entries are flush requests
+        size_t queuedBytes;
+        uint64_t flushesRequested;
+        uint64_t flushesDone;
+        bool stop;
+
+        BranchStatus status;
+        std::thread thread;
+    };
+
+    std::vector< std::unique_ptr< Branch > > m_branches;
+    bool m_bStarted;
+
+    void enqueue( Branch & br, const SharedBuffer & buf );
+    static void release( const SharedBuffer & buf );
+    void detach( Branch & br, const string & why );
+    void branchLoop( Branch & br );
+    void requireAttached() const;
+
+}; // end class FanoutSender
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_FANOUTSENDER_HPP
@@ -0,0 +1,470 @@
+/**
+ * @file FastDeflate.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// standard C++ headers
+#include <algorithm>
+#include <cstring>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "FastDeflate.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+const size_t WINDOW_BYTES = 32 * 1024;
+const size_t BLOCK_BYTES = 64 * 1024;
+
+// slack after the block, so match extension can over-read safely.
+const size_t PAD_BYTES = 16;
+
+const unsigned HASH_BITS = 15;
+
+const size_t MIN_MATCH = 4;   // what the hash covers; deflate allows 3
+const size_t MAX_MATCH = 258;
+const size_t MAX_STORED = 65535;
+
+// after this many misses in a row, start stepping over input faster.
+const unsigned SKIP_SHIFT = 6;
+
+/** A Huffman code (bit-reversed, ready to send) plus any extra bits. */
+struct Code
+{
+    uint32_t bits;
+    uint32_t len;
+};
+
+/** The fixed Huffman code (RFC 1951, 3.2.6), precomputed per length and distance. */
+struct FixedTables
+{
+    Code literal[ 256 ];
+    Code endOfBlock;
+    Code length[ MAX_MATCH + 1 ];   // code and extra bits together
+
+    // distances go through zlib's trick: direct for 1..256, else by (d-1)>>7
+    uint8_t distCode[ 512 ];
+    uint16_t distBase[ 30 ];
+    uint8_t distExtra[ 30 ];
+    uint8_t distBits[ 30 ];   // the 5-bit code, reversed
+
+    FixedTables();
+};
+
+uint32_t
+reverseBits( uint32_t code, const unsigned len )
+{
+    uint32_t rv( 0 );
+    for ( unsigned i = 0; i < len; ++i, code >>= 1 )
+        rv = ( rv << 1 ) | ( code & 1 );
+    return rv;
+}
+
+/** The fixed literal/length code for @a sym. */
+Code
+fixedCode( const unsigned sym )
+{
+    Code c;
+    if ( sym < 144 )
+    {
+        c.len = 8;
+        c.bits = reverseBits( 0x30 + sym, 8 );
+    }
+    else if ( sym < 256 )
+    {
+        c.len = 9;
+        c.bits = reverseBits( 0x190 + sym - 144, 9 );
+    }
+    else if ( sym < 280 )
+    {
+        c.len = 7;
+        c.bits = reverseBits( sym - 256, 7 );
+    }
+    else
+    {
+        c.len = 8;
+        c.bits = reverseBits( 0xc0 + sym - 280, 8 );
+    }
+    return c;
+}
+
+FixedTables::FixedTables()
+{
+    for ( unsigned i = 0; i < 256; ++i )
+        literal[i] = fixedCode( i );
+    endOfBlock = fixedCode( 256 );
+
+    static const uint16_t LENGTH_BASE[ 29 ] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t LENGTH_EXTRA[ 29 ] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+    zeroStruct( length );
+    for ( unsigned i = 0; i < 29; ++i )
+    {
+        const unsigned last( i == 28 ? MAX_MATCH
+                                     : LENGTH_BASE[i] + ( 1u << LENGTH_EXTRA[i] ) - 1 );
+        for ( unsigned n = LENGTH_BASE[i]; n <= last; ++n )
+        {
+            // 284's range runs to 258, but 258 has a code of its own
+            if ( n == MAX_MATCH && i != 28 )
+                continue;
+            const Code c( fixedCode( 257 + i ) );
+            length[n].bits = c.bits | ( ( n - LENGTH_BASE[i] ) << c.len );
+            length[n].len = c.len + LENGTH_EXTRA[i];
+        }
+    }
+
+    static const uint16_t DIST_BASE[ 30 ] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577 };
+
+    for ( unsigned i = 0; i < 30; ++i )
+    {
+        distBase[i] = DIST_BASE[i];
+        distExtra[i] = static_cast< uint8_t >( i < 2 ? 0 : i / 2 - 1 );
+        distBits[i] = static_cast< uint8_t >( reverseBits( i, 5 ) );
+    }
+
+    for ( unsigned code = 0; code < 30; ++code )
+    {
+        const unsigned first( distBase[code] - 1 );
+        const unsigned last( first + ( 1u << distExtra[code] ) - 1 );
+        for ( unsigned d = first; d <= last; ++d )
+        {
+            if ( d < 256 )
+                distCode[d] = static_cast< uint8_t >( code );
+            else
+                distCode[ 256 + ( d >> 7 ) ] = static_cast< uint8_t >( code );
+        }
+    }
+}
+
+const FixedTables &
+fixedTables()
+{
+    static const FixedTables tables;
+    return tables;
+}
+
+inline uint32_t
+load32( const char * p )
+{
+    uint32_t v;
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+inline uint32_t
+hash4( const uint32_t v )
+{
+    return ( v * 2654435761u ) >> ( 32 - HASH_BITS );
+}
+
+/** How many bytes (up to @a max) @a a and @a b have in common. */
+inline size_t
+matchLength( const char * a, const char * b, const size_t max )
+{
+    size_t n( 0 );
+
+#ifdef __SSE2__
+    while ( n + 16 <= max )
+    {
+        const __m128i x( _mm_loadu_si128( reinterpret_cast< const __m128i * >( a + n ) ) );
+        const __m128i y( _mm_loadu_si128( reinterpret_cast< const __m128i * >( b + n ) ) );
+        const unsigned diff( static_cast< unsigned >( _mm_movemask_epi8( _mm_cmpeq_epi8( x, y ) ) ) ^ 0xffff );
+        if ( diff )
+            return n + static_cast< size_t >( __builtin_ctz( diff ) );
+        n += 16;
+    }
+#endif
+
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while ( n + 8 <= max )
+    {
+        uint64_t x, y;
+        memcpy( &x, a + n, sizeof( x ) );
+        memcpy( &y, b + n, sizeof( y ) );
+        if ( x != y )
+            return n + static_cast< size_t >( __builtin_ctzll( x ^ y ) ) / 8;
+        n += 8;
+    }
+#endif
+
+    while ( n < max && a[n] == b[n] )
+        ++n;
+    return n;
+}
+
+/**
+ * Appends bits, lowest first, straight into preallocated output.
+ * Works on copies of the pending bits (the output writes would
+ * otherwise force them back to memory every time); save() them when
+ * done.
+ */
+class BitWriter
+{
+
+public:
+
+    BitWriter( const uint64_t buf, const unsigned count, char * out )
+        : m_buf( buf ), m_count( count ), m_out( out ) {}
+
+    void save( uint64_t & buf, unsigned & count ) const
+    {
+        buf = m_buf;
+        count = m_count;
+    }
+
+    /** Add @a len (at most 32) bits from @a bits. */
+    void put( const uint32_t bits, const unsigned len )
+    {
+        m_buf |= static_cast< uint64_t >( bits ) << m_count;
+        m_count += len;
+        if ( m_count >= 32 )
+        {
+            m_out[0] = static_cast< char >( m_buf );
+            m_out[1] = static_cast< char >( m_buf >> 8 );
+            m_out[2] = static_cast< char >( m_buf >> 16 );
+            m_out[3] = static_cast< char >( m_buf >> 24 );
+            m_out += 4;
+            m_buf >>= 32;
+            m_count -= 32;
+        }
+    }
+
+    /** Pad with zero bits to a byte boundary and write out everything. */
+    void align()
+    {
+        while ( m_count > 0 )
+        {
+            *m_out++ = static_cast< char >( m_buf );
+            m_buf >>= 8;
+            m_count = m_count > 8 ? m_count - 8 : 0;
+        }
+        m_buf = 0;
+    }
+
+    void putBytes( const char * p, const size_t n )
+    {
+        memcpy( m_out, p, n );
+        m_out += n;
+    }
+
+    char * out() const { return m_out; }
+
+private:
+
+    uint64_t m_buf;
+    unsigned m_count;
+    char * m_out;
+
+};
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+FastDeflater::FastDeflater()
+    : m_window( WINDOW_BYTES + BLOCK_BYTES + PAD_BYTES ),
+      m_hashTable( 1u << HASH_BITS, 0 )
+{
+    // build the tables now rather than on the first block
+    fixedTables();
+    reset();
+}
+
+void
+FastDeflater::reset()
+{
+    // the hash table keeps whatever it had: every candidate it offers
+    // is checked against the window before use, so stale entries only
+    // cost a comparison.
+    m_historyBytes = 0;
+    m_pendingBytes = 0;
+    m_windowStart = 0;
+    m_bitBuf = 0;
+    m_bitCount = 0;
+    m_totalIn = 0;
+    m_totalOut = 0;
+    m_bFinished = false;
+}
+
+void
+FastDeflater::compress( const char * data, size_t len, const bool final, CharBuffer & out )
+{
+    if ( m_bFinished )
+        throw std::logic_error( "fast deflate: stream already finished" );
+
+    const size_t before( out.size() );
+    m_totalIn += len;
+
+    while ( len > 0 )
+    {
+        const size_t n( std::min( len, BLOCK_BYTES - m_pendingBytes ) );
+        memcpy( &m_window[ m_historyBytes + m_pendingBytes ], data, n );
+        m_pendingBytes += n;
+        data += n;
+        len -= n;
+
+        if ( m_pendingBytes == BLOCK_BYTES )
+        {
+            encodeBlock( false, out );
+            slideWindow();
+        }
+    }
+
+    if ( final )
+    {
+        encodeBlock( true, out );
+        m_bFinished = true;
+    }
+
+    m_totalOut += out.size() - before;
+}
+
+void
+FastDeflater::encodeBlock( const bool final, CharBuffer & out )
+{
+    const FixedTables & t( fixedTables() );
+
+    // in case this block has to go out stored after all
+    const size_t outStart( out.size() );
+    const uint64_t savedBuf( m_bitBuf );
+    const unsigned savedCount( m_bitCount );
+
+    // fixed codes never take more than 9 bits a byte
+    out.resize( outStart + m_pendingBytes * 9 / 8 + 32 );
+    BitWriter bw( m_bitBuf, m_bitCount, &out[ outStart ] );
+
+    bw.put( ( final ? 1 : 0 ) | ( 1 << 1 ) /* BTYPE 01, fixed codes */, 3 );
+
+    const char * const w( m_window.data() );
+    const size_t end( m_historyBytes + m_pendingBytes );
+    size_t p( m_historyBytes );
+    unsigned misses( 0 );
+
+    while ( p + MIN_MATCH <= end )
+    {
+        const uint32_t here( load32( w + p ) );
+        uint32_t & slot( m_hashTable[ hash4( here ) ] );
+        const uint32_t pos( static_cast< uint32_t >( m_windowStart + p ) );
+        const uint32_t dist( pos - slot );
+        slot = pos;
+
+        if ( dist - 1 < WINDOW_BYTES && dist <= p && load32( w + p - dist ) == here )
+        {
+            const size_t len( MIN_MATCH +
+                              matchLength( w + p + MIN_MATCH, w + p - dist + MIN_MATCH,
+                                           std::min( MAX_MATCH, end - p ) - MIN_MATCH ) );
+
+            const Code & lc( t.length[ len ] );
+            bw.put( lc.bits, lc.len );
+
+            const unsigned dc( t.distCode[ dist <= 256 ? dist - 1 : 256 + ( ( dist - 1 ) >> 7 ) ] );
+            bw.put( t.distBits[ dc ] | ( ( dist - t.distBase[ dc ] ) << 5 ),
+                    5 + t.distExtra[ dc ] );
+
+            p += len;
+            misses = 0;
+
+            // the end of a match is a likely start for the next one
+            if ( p + MIN_MATCH <= end )
+                m_hashTable[ hash4( load32( w + p - 2 ) ) ] =
+                    static_cast< uint32_t >( m_windowStart + p - 2 );
+            continue;
+        }
+
+        // nothing here; the longer that goes on, the less closely we look.
+        const size_t step( std::min< size_t >( 1 + ( misses++ >> SKIP_SHIFT ), end - p ) );
+        for ( size_t i = 0; i < step; ++i )
+        {
+            const Code & c( t.literal[ static_cast< unsigned char >( w[ p + i ] ) ] );
+            bw.put( c.bits, c.len );
+        }
+        p += step;
+    }
+
+    for ( ; p < end; ++p )
+    {
+        const Code & c( t.literal[ static_cast< unsigned char >( w[p] ) ] );
+        bw.put( c.bits, c.len );
+    }
+
+    bw.put( t.endOfBlock.bits, t.endOfBlock.len );
+    if ( final )
+        bw.align();
+    bw.save( m_bitBuf, m_bitCount );
+
+    const size_t encoded( static_cast< size_t >( bw.out() - &out[ outStart ] ) + ( m_bitCount + 7 ) / 8 );
+    const size_t pieces( std::max< size_t >( 1, ( m_pendingBytes + MAX_STORED - 1 ) / MAX_STORED ) );
+    if ( encoded > m_pendingBytes + 5 * pieces + 1 )
+    {
+        out.resize( outStart );
+        m_bitBuf = savedBuf;
+        m_bitCount = savedCount;
+        storeBlock( final, out );
+        return;
+    }
+
+    out.resize( static_cast< size_t >( bw.out() - out.data() ) );
+}
+
+void
+FastDeflater::storeBlock( const bool final, CharBuffer & out )
+{
+    const size_t outStart( out.size() );
+    out.resize( outStart + m_pendingBytes + 5 * ( m_pendingBytes / MAX_STORED + 1 ) + 16 );
+    BitWriter bw( m_bitBuf, m_bitCount, &out[ outStart ] );
+
+    const char * p( &m_window[ m_historyBytes ] );
+    size_t left( m_pendingBytes );
+    do
+    {
+        const size_t n( std::min( left, MAX_STORED ) );
+        left -= n;
+
+        bw.put( ( final && left == 0 ) ? 1 : 0 /* BTYPE 00, stored */, 3 );
+        bw.align();
+        bw.put( static_cast< uint32_t >( n ) | ( static_cast< uint32_t >( ~n & 0xffff ) << 16 ), 32 );
+        bw.putBytes( p, n );
+        p += n;
+    }
+    while ( left > 0 );
+    bw.save( m_bitBuf, m_bitCount );
+
+    out.resize( static_cast< size_t >( bw.out() - out.data() ) );
+}
+
+void
+FastDeflater::slideWindow()
+{
+    const size_t total( m_historyBytes + m_pendingBytes );
+    const size_t keep( std::min( total, WINDOW_BYTES ) );
+    memmove( &m_window[0], &m_window[ total - keep ], keep );
+    m_windowStart += total - keep;
+    m_historyBytes = keep;
+    m_pendingBytes = 0;
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
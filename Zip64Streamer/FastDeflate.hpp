@@ -0,0 +1,98 @@
+#ifndef COM_FOIANI_Z64S_FASTDEFLATE_HPP
+#define COM_FOIANI_Z64S_FASTDEFLATE_HPP 1
+
+/**
+ * @file FastDeflate.hpp
+ *
+ * A raw deflate encoder that gives up ratio for speed, in the spirit
+ * of igzip's lowest levels.  For bulk exports zlib, even at level 1,
+ * is the bottleneck long before the disk or the network is.
+ *
+ * Matching is greedy from a single-entry hash table of 4-byte
+ * sequences (no chains, no lazy evaluation), extended 16 bytes at a
+ * time with SSE2 where available.  Runs with no matches are skipped
+ * through progressively faster, so incompressible data costs little.
+ * Blocks use the fixed Huffman codes; any block that would come out
+ * bigger than its input is sent stored instead.
+ *
+ * The output is an ordinary raw deflate stream (RFC 1951) that any
+ * inflater reads.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdint>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Streaming raw deflate encoder tuned for speed over ratio. */
+class FastDeflater
+{
+
+public:
+
+    FastDeflater();
+
+    /** Start a new stream. */
+    void reset();
+
+    /**
+     * Compress @a len bytes at @a data, appending whatever output is
+     * ready to @a out.  Input is encoded in blocks of up to 64 KiB, so
+     * a short call may produce nothing yet.  With @a final, the rest
+     * is flushed and the stream ended; reset() before reusing.
+     */
+    void compress( const char * data, size_t len, bool final, CharBuffer & out );
+
+    uint64_t totalIn() const { return m_totalIn; }
+    uint64_t totalOut() const { return m_totalOut; }
+
+private:
+
+    FastDeflater( const FastDeflater & );
+    FastDeflater & operator=( const FastDeflater & );
+
+    // window: up to 32 KiB of history, then the pending block
+    CharBuffer m_window;
+    size_t m_historyBytes;
+    size_t m_pendingBytes;
+
+    // stream position of m_window[0]
+    uint64_t m_windowStart;
+
+    // most recent stream position (mod 2^32) of each 4-byte hash
+    std::vector< uint32_t > m_hashTable;
+
+    // bits not yet written out, lowest first
+    uint64_t m_bitBuf;
+    unsigned m_bitCount;
+
+    uint64_t m_totalIn;
+    uint64_t m_totalOut;
+    bool m_bFinished;
+
+    /** Encode the pending block into @a out, ending the stream if @a final. */
+    void encodeBlock( bool final, CharBuffer & out );
+
+    /** Send the pending block as stored block(s) instead. */
+    void storeBlock( bool final, CharBuffer & out );
+
+    /** Keep the last 32 KiB as history and empty the block. */
+    void slideWindow();
+
+}; // end class FastDeflater
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_FASTDEFLATE_HPP
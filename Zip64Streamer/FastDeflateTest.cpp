@@ -0,0 +1,301 @@
+/**
+ * @file FastDeflateTest.cpp
+ *
+ * Round-trip FastDeflater output through zlib's inflate, over
+ * synthetic inputs chosen to hit the awkward cases (empty input,
+ * overlapping matches, incompressible blocks, matches across block
+ * boundaries, input fed in odd-sized pieces) and over any files named
+ * on the command line.  Also reports speed and ratio next to zlib at
+ * levels 1 and 6.  Exits non-zero on any mismatch.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <zlib.h>
+
+// standard C++ headers
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+
+// local headers
+#include "Compat.hpp"
+
+// header under test
+#include "FastDeflate.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+typedef std::chrono::steady_clock Clock;
+
+struct SplitMix64
+{
+    explicit SplitMix64( const uint64_t seed ) : state( seed ) {}
+
+    uint64_t operator()()
+    {
+        uint64_t z = ( state += 0x9e3779b97f4a7c15ULL );
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+        return z ^ ( z >> 31 );
+    }
+
+    uint64_t state;
+};
+
+/** Inflate raw deflate @a in, expecting @a expectBytes out; throws if it won't. */
+CharBuffer
+inflateRaw( const CharBuffer & in, const size_t expectBytes )
+{
+    z_stream zs;
+    zeroStruct( zs );
+    if ( inflateInit2( &zs, -15 ) != Z_OK )
+        throw std::runtime_error( "inflateInit2" );
+
+    CharBuffer out( expectBytes + 1 );
+    zs.next_in = reinterpret_cast< Bytef * >( const_cast< char * >( in.data() ) );
+    zs.avail_in = static_cast< uInt >( in.size() );
+    zs.next_out = reinterpret_cast< Bytef * >( out.data() );
+    zs.avail_out = static_cast< uInt >( out.size() );
+    const int rc( inflate( &zs, Z_FINISH ) );
+    const bool consumedAll( zs.avail_in == 0 );
+    out.resize( zs.total_out );
+    inflateEnd( &zs );
+
+    if ( rc != Z_STREAM_END )
+        throw std::runtime_error( "inflate rc=" + std::to_string( rc ) +
+                                  ( zs.msg ? string( ": " ) + zs.msg : string() ) );
+    if ( ! consumedAll )
+        throw std::runtime_error( "trailing bytes after end of stream" );
+    return out;
+}
+
+/** FastDeflater over @a in, fed in pieces of at most @a piece bytes (0: random sizes). */
+CharBuffer
+fastCompress( FastDeflater & fd, const CharBuffer & in, const size_t piece, SplitMix64 & rng )
+{
+    CharBuffer out;
+    fd.reset();
+    size_t done( 0 );
+    do
+    {
+        size_t n( piece ? piece : 1 + rng() % 100000 );
+        n = std::min( n, in.size() - done );
+        fd.compress( in.data() + done, n, done + n == in.size(), out );
+        done += n;
+    }
+    while ( done < in.size() );
+    return out;
+}
+
+CharBuffer
+zlibCompress( const CharBuffer & in, const int level )
+{
+    z_stream zs;
+    zeroStruct( zs );
+    if ( deflateInit2( &zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+        throw std::runtime_error( "deflateInit2" );
+
+    CharBuffer out( deflateBound( &zs, in.size() ) );
+    zs.next_in = reinterpret_cast< Bytef * >( const_cast< char * >( in.data() ) );
+    zs.avail_in = static_cast< uInt >( in.size() );
+    zs.next_out = reinterpret_cast< Bytef * >( out.data() );
+    zs.avail_out = static_cast< uInt >( out.size() );
+    deflate( &zs, Z_FINISH );
+    out.resize( zs.total_out );
+    deflateEnd( &zs );
+    return out;
+}
+
+CharBuffer
+textInput( const size_t bytes, const uint64_t seed )
+{
+    static const char * const WORDS[] = {
+        "GET", "POST", "/api/v1/items", "/index.html", "200", "304", "404",
+        "INFO", "WARN", "cache", "hit", "miss", "upstream", "latency_ms="
+    };
+    SplitMix64 rng( seed );
+    string s;
+    while ( s.size() < bytes )
+    {
+        const uint64_t r( rng() );
+        s += WORDS[ r % ( sizeof( WORDS ) / sizeof( WORDS[0] ) ) ];
+        s += ' ';
+        s += std::to_string( ( r >> 20 ) % 100000 );
+        s += ( r & 0x10000 ) ? '\n' : ' ';
+    }
+    return CharBuffer( s.begin(), s.begin() + bytes );
+}
+
+CharBuffer
+randomInput( const size_t bytes, const uint64_t seed )
+{
+    SplitMix64 rng( seed );
+    CharBuffer b( bytes );
+    for ( char & c : b )
+        c = static_cast< char >( rng() );
+    return b;
+}
+
+/** Runs of a few repeated bytes, then random, then text: matches of every length and distance. */
+CharBuffer
+mixedInput( const size_t bytes, const uint64_t seed )
+{
+    SplitMix64 rng( seed );
+    CharBuffer b;
+    while ( b.size() < bytes )
+    {
+        const uint64_t r( rng() );
+        const size_t n( 1 + r % 2000 );
+        switch ( r >> 60 & 3 )
+        {
+        case 0:
+            b.insert( b.end(), n, static_cast< char >( r >> 32 ) );
+            break;
+        case 1:
+        {
+            const CharBuffer rnd( randomInput( n, r ) );
+            b.insert( b.end(), rnd.begin(), rnd.end() );
+            break;
+        }
+        case 2:
+        {
+            // copy something from up to 40 KiB back, sometimes out of window reach
+            if ( b.empty() )
+                break;
+            const size_t back( std::min< size_t >( b.size(), 1 + ( r >> 8 ) % ( 40 * 1024 ) ) );
+            const size_t from( b.size() - back );
+            for ( size_t i = 0; i < n; ++i )
+                b.push_back( b[ from + i % back ] );
+            break;
+        }
+        default:
+        {
+            const CharBuffer txt( textInput( n, r ) );
+            b.insert( b.end(), txt.begin(), txt.end() );
+            break;
+        }
+        }
+    }
+    b.resize( bytes );
+    return b;
+}
+
+double
+secondsSince( const Clock::time_point start )
+{
+    return std::chrono::duration< double >( Clock::now() - start ).count();
+}
+
+/** Round-trip @a in every which way; returns false (and says why) on a mismatch. */
+bool
+check( const string & label, const CharBuffer & in, FastDeflater & fd, SplitMix64 & rng )
+{
+    static const size_t PIECES[] = { 0, 1, 7, 4096, 65536, 1 << 30 };
+
+    for ( const size_t piece : PIECES )
+    {
+        if ( piece == 1 && in.size() > 300000 )
+            continue; // correct, but slow
+        try
+        {
+            const CharBuffer packed( fastCompress( fd, in, piece, rng ) );
+            if ( fd.totalIn() != in.size() || fd.totalOut() != packed.size() )
+                throw std::runtime_error( "totals don't match" );
+            if ( inflateRaw( packed, in.size() ) != in )
+                throw std::runtime_error( "content differs" );
+        }
+        catch ( const std::exception & e )
+        {
+            ERROR( label << " (pieces of " << piece << "): " << e.what() );
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Speed and ratio of FastDeflater against zlib for @a in. */
+void
+compare( const string & label, const CharBuffer & in, FastDeflater & fd, SplitMix64 & rng )
+{
+    const int reps( static_cast< int >( std::max< size_t >( 1, ( 64 << 20 ) / ( in.size() + 1 ) ) ) );
+
+    std::cout << std::left << std::setw( 14 ) << label << std::right
+              << std::setw( 11 ) << in.size();
+
+    Clock::time_point start( Clock::now() );
+    size_t fastBytes( 0 );
+    for ( int i = 0; i < reps; ++i )
+        fastBytes = fastCompress( fd, in, 1 << 30, rng ).size();
+    const double fastSecs( secondsSince( start ) / reps );
+
+    std::cout << std::fixed << std::setprecision( 3 )
+              << "  fast " << std::setw( 6 ) << static_cast< double >( fastBytes ) / ( in.size() + 1 )
+              << " " << std::setw( 8 ) << std::setprecision( 1 ) << in.size() / 1e6 / fastSecs << " MB/s";
+
+    static const int LEVELS[] = { 1, 6 };
+    for ( const int level : LEVELS )
+    {
+        start = Clock::now();
+        size_t zBytes( 0 );
+        for ( int i = 0; i < reps; ++i )
+            zBytes = zlibCompress( in, level ).size();
+        const double zSecs( secondsSince( start ) / reps );
+        std::cout << std::setprecision( 3 )
+                  << "  zlib-" << level << " " << std::setw( 6 ) << static_cast< double >( zBytes ) / ( in.size() + 1 )
+                  << " " << std::setw( 8 ) << std::setprecision( 1 ) << in.size() / 1e6 / zSecs << " MB/s";
+    }
+    std::cout << std::endl;
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    FastDeflater fd;
+    SplitMix64 rng( 42 );
+    bool ok( true );
+
+    std::vector< std::pair< string, CharBuffer > > inputs;
+    inputs.push_back( std::make_pair( "empty", CharBuffer() ) );
+    inputs.push_back( std::make_pair( "one-byte", CharBuffer( 1, 'x' ) ) );
+    inputs.push_back( std::make_pair( "zeros", CharBuffer( 1 << 20, 0 ) ) );
+    inputs.push_back( std::make_pair( "text-small", textInput( 1000, 1 ) ) );
+    inputs.push_back( std::make_pair( "text", textInput( 4 << 20, 2 ) ) );
+    inputs.push_back( std::make_pair( "random", randomInput( 1 << 20, 3 ) ) );
+    inputs.push_back( std::make_pair( "mixed", mixedInput( 4 << 20, 4 ) ) );
+    for ( uint64_t seed = 5; seed < 25; ++seed )
+        inputs.push_back( std::make_pair( "mixed-" + std::to_string( seed ),
+                                          mixedInput( 1 + rng() % 300000, seed ) ) );
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::ifstream ifs( argv[i], std::ios::binary );
+        if ( ! ifs )
+        {
+            ERROR( "can't open " << QS( argv[i] ) );
+            return 1;
+        }
+        inputs.push_back( std::make_pair( string( argv[i] ),
+                                          CharBuffer( std::istreambuf_iterator< char >( ifs ),
+                                                      std::istreambuf_iterator< char >() ) ) );
+    }
+
+    for ( const std::pair< string, CharBuffer > & in : inputs )
+        ok = check( in.first, in.second, fd, rng ) && ok;
+
+    std::cout << ( ok ? "all round trips ok" : "ROUND TRIP FAILURES" )
+              << " (" << inputs.size() << " inputs)\n"
+              << "input               bytes        ratio     speed\n";
+    for ( const std::pair< string, CharBuffer > & in : inputs )
+        if ( in.second.size() >= ( 1 << 20 ) )
+            compare( in.first, in.second, fd, rng );
+
+    return ok ? 0 : 1;
+}
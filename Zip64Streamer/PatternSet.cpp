@@ -0,0 +1,452 @@
+/**
+ * @file PatternSet.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// standard C++ headers
+#include <algorithm>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "PatternSet.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+/** Set the bits in @a set for character class @a name ("alpha" etc.); false if unknown. */
+bool
+addCharClass( const string & name, std::bitset< 256 > & set )
+{
+    static const struct { const char * name; int ( *test )( int ); } CLASSES[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+        { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+        { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+        { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+    };
+
+    for ( const auto & cls : CLASSES )
+    {
+        if ( name != cls.name )
+            continue;
+        for ( int c = 0; c < 256; ++c )
+            if ( cls.test( c ) )
+                set.set( c );
+        return true;
+    }
+    return false;
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+// ---------------------------------------------------------------------
+// Trie
+
+PatternSet::Trie::Trie()
+    : nodes( 1 )
+{
+}
+
+void
+PatternSet::Trie::add( const string & key, const uint32_t component )
+{
+    uint32_t n( 0 );
+    for ( const char c : key )
+    {
+        uint32_t next( 0 );
+        for ( const std::pair< char, uint32_t > & e : nodes[n].next )
+            if ( e.first == c )
+                next = e.second;
+        if ( next == 0 )
+        {
+            next = static_cast< uint32_t >( nodes.size() );
+            nodes[n].next.push_back( std::make_pair( c, next ) );
+            nodes.push_back( TrieNode() );
+        }
+        n = next;
+    }
+    nodes[n].components.push_back( component );
+}
+
+void
+PatternSet::Trie::collect( const string & name, const bool reversed,
+                           std::vector< uint32_t > & out ) const
+{
+    uint32_t n( 0 );
+    const size_t len( name.size() );
+    for ( size_t i = 0; i < len; ++i )
+    {
+        const char c( reversed ? name[ len - 1 - i ] : name[i] );
+        uint32_t next( 0 );
+        for ( const std::pair< char, uint32_t > & e : nodes[n].next )
+            if ( e.first == c )
+            {
+                next = e.second;
+                break;
+            }
+        if ( next == 0 )
+            return;
+        n = next;
+        out.insert( out.end(), nodes[n].components.begin(), nodes[n].components.end() );
+    }
+}
+
+// ---------------------------------------------------------------------
+// PatternSet
+
+PatternSet::PatternSet( const StringList & patterns )
+    : m_nodes( 1 ),
+      m_patternCount( patterns.size() )
+{
+    for ( uint32_t k = 0; k < patterns.size(); ++k )
+    {
+        const string & pattern( patterns[k] );
+
+        // glob() would only match directories with this; we never return those.
+        if ( pattern.empty() || pattern[ pattern.size() - 1 ] == '/' )
+            continue;
+
+        StringList parts;
+        size_t start( 0 );
+        while ( start <= pattern.size() )
+        {
+            size_t slash( pattern.find( '/', start ) );
+            if ( slash == string::npos )
+                slash = pattern.size();
+            const string part( pattern, start, slash - start );
+            if ( ! part.empty() )
+                parts.push_back( part );
+            start = slash + 1;
+        }
+        if ( parts.empty() )
+            continue;
+
+        size_t n( 0 );
+        for ( size_t i = 0; i < parts.size(); ++i )
+        {
+            const uint32_t ci( addComponent( n, parts[i] ) );
+            if ( i + 1 == parts.size() )
+            {
+                m_nodes[n].components[ci].finals.push_back( k );
+                break;
+            }
+            if ( m_nodes[n].components[ci].child < 0 )
+            {
+                m_nodes[n].components[ci].child = static_cast< int >( m_nodes.size() );
+                m_nodes.push_back( Node() );
+            }
+            n = static_cast< size_t >( m_nodes[n].components[ci].child );
+        }
+    }
+
+    DEBUG( "ps: " << patterns.size() << " patterns, " << m_nodes.size() << " levels" );
+}
+
+uint32_t
+PatternSet::addComponent( const size_t n, const string & text )
+{
+    {
+        const auto it( m_nodes[n].bySource.find( text ) );
+        if ( it != m_nodes[n].bySource.end() )
+            return it->second;
+    }
+
+    Component c;
+    c.child = -1;
+
+    // compile: runs of '*' become one STAR; a '[' with no closing
+    // ']' is just a character, as in glob().
+    for ( size_t i = 0; i < text.size(); ++i )
+    {
+        Op op;
+        op.kind = Op::CHAR;
+        op.c = text[i];
+
+        if ( text[i] == '\\' && i + 1 < text.size() )
+            op.c = text[ ++i ];
+        else if ( text[i] == '*' )
+        {
+            if ( ! c.ops.empty() && c.ops.back().kind == Op::STAR )
+                continue;
+            op.kind = Op::STAR;
+        }
+        else if ( text[i] == '?' )
+            op.kind = Op::ANY;
+        else if ( text[i] == '[' )
+        {
+            size_t j( i + 1 );
+            const bool negate( j < text.size() && ( text[j] == '!' || text[j] == '^' ) );
+            if ( negate )
+                ++j;
+
+            std::bitset< 256 > set;
+            bool closed( false );
+            for ( bool first = true; j < text.size(); first = false )
+            {
+                unsigned char lo( static_cast< unsigned char >( text[j] ) );
+                if ( lo == ']' && ! first )
+                {
+                    closed = true;
+                    break;
+                }
+                if ( lo == '[' && j + 1 < text.size() && text[ j + 1 ] == ':' )
+                {
+                    const size_t end( text.find( ":]", j + 2 ) );
+                    if ( end != string::npos &&
+                         addCharClass( text.substr( j + 2, end - j - 2 ), set ) )
+                    {
+                        j = end + 2;
+                        continue;
+                    }
+                }
+                if ( lo == '\\' && j + 1 < text.size() )
+                    lo = static_cast< unsigned char >( text[ ++j ] );
+                ++j;
+
+                unsigned char hi( lo );
+                if ( j + 1 < text.size() && text[j] == '-' && text[ j + 1 ] != ']' )
+                {
+                    j += 1;
+                    if ( text[j] == '\\' && j + 1 < text.size() )
+                        ++j;
+                    hi = static_cast< unsigned char >( text[j] );
+                    ++j;
+                }
+                for ( unsigned v = lo; v <= hi; ++v )
+                    set.set( v );
+            }
+
+            if ( closed )
+            {
+                if ( negate )
+                    set.flip();
+                set.reset( '/' );
+                op.kind = Op::SET;
+                op.set = set;
+                i = j;
+            }
+        }
+
+        c.ops.push_back( op );
+    }
+
+    c.bLeadingDot = ! c.ops.empty() && c.ops[0].kind == Op::CHAR && c.ops[0].c == '.';
+
+    // index it by whatever literal text it's guaranteed to have.
+    string prefix;
+    size_t p( 0 );
+    for ( ; p < c.ops.size() && c.ops[p].kind == Op::CHAR; ++p )
+        prefix += c.ops[p].c;
+
+    string suffix;
+    for ( size_t s = c.ops.size(); s > p && c.ops[ s - 1 ].kind == Op::CHAR; --s )
+        suffix.insert( suffix.begin(), c.ops[ s - 1 ].c );
+
+    Node & node( m_nodes[n] );
+    const uint32_t ci( static_cast< uint32_t >( node.components.size() ) );
+    if ( p == c.ops.size() )
+        node.literals[ prefix ] = ci;
+    else if ( ! prefix.empty() )
+        node.prefixes.add( prefix, ci );
+    else if ( ! suffix.empty() )
+        node.suffixes.add( string( suffix.rbegin(), suffix.rend() ), ci );
+    else
+        node.others.push_back( ci );
+
+    node.components.push_back( c );
+    node.bySource[ text ] = ci;
+    return ci;
+}
+
+bool
+PatternSet::matches( const Component & c, const string & name )
+{
+    // wildcards don't match a leading '.'
+    if ( ! name.empty() && name[0] == '.' && ! c.bLeadingDot )
+        return false;
+
+    const std::vector< Op > & ops( c.ops );
+    size_t p( 0 );
+    size_t i( 0 );
+    size_t starOp( string::npos );
+    size_t starName( 0 );
+
+    while ( i < name.size() )
+    {
+        if ( p < ops.size() )
+        {
+            const Op & op( ops[p] );
+            const unsigned char ch( static_cast< unsigned char >( name[i] ) );
+            if ( op.kind == Op::STAR )
+            {
+                starOp = p++;
+                starName = i;
+                continue;
+            }
+            if ( op.kind == Op::ANY ||
+                 ( op.kind == Op::CHAR && op.c == name[i] ) ||
+                 ( op.kind == Op::SET && op.set.test( ch ) ) )
+            {
+                ++p;
+                ++i;
+                continue;
+            }
+        }
+
+        // mismatch: let the last star eat one more character
+        if ( starOp == string::npos )
+            return false;
+        p = starOp + 1;
+        i = ++starName;
+    }
+
+    while ( p < ops.size() && ops[p].kind == Op::STAR )
+        ++p;
+    return p == ops.size();
+}
+
+/** What a match() collects as it goes. */
+struct PatternSet::Walk
+{
+    std::unordered_map< string, uint32_t > best;   // path -> first pattern
+    std::vector< uint32_t > candidates;
+    uint64_t entriesRead;
+};
+
+void
+PatternSet::walk( const size_t n, const string & dir, const string & prefix, Walk & w ) const
+{
+    const Node & node( m_nodes[n] );
+
+    std::vector< std::pair< int, string > > subdirs;
+
+    // what to do with @a name, matching component @a c, given its type
+    auto take = [&]( const string & name, const Component & c, const bool isDir )
+    {
+        if ( isDir )
+        {
+            if ( c.child >= 0 )
+                subdirs.push_back( std::make_pair( c.child, name ) );
+            return;
+        }
+        for ( const uint32_t k : c.finals )
+        {
+            const auto rv( w.best.insert( std::make_pair( prefix + name, k ) ) );
+            if ( ! rv.second && k < rv.first->second )
+                rv.first->second = k;
+        }
+    };
+
+    auto isDirectory = [&]( const string & name ) -> bool
+    {
+        struct stat st;
+        return stat( ( dir + "/" + name ).c_str(), &st ) == 0 && S_ISDIR( st.st_mode );
+    };
+
+    if ( node.literals.size() == node.components.size() )
+    {
+        // nothing to match against; just look for each name.
+        for ( const auto & lit : node.literals )
+        {
+            struct stat st;
+            if ( stat( ( dir + "/" + lit.first ).c_str(), &st ) != 0 &&
+                 lstat( ( dir + "/" + lit.first ).c_str(), &st ) != 0 )
+                continue;
+            take( lit.first, node.components[ lit.second ], S_ISDIR( st.st_mode ) );
+        }
+    }
+    else
+    {
+        DIR * const d( opendir( dir.c_str() ) );
+        if ( ! d )
+        {
+            // as glob() does without GLOB_ERR: an unreadable directory just has no matches
+            FINE( "ps: can't read " << QS( dir ) );
+            return;
+        }
+
+        string name;
+        while ( const struct dirent * de = readdir( d ) )
+        {
+            ++w.entriesRead;
+            name = de->d_name;
+
+            // a literal that's found needs no further checking
+            w.candidates.clear();
+            const auto lit( node.literals.find( name ) );
+            const uint32_t exact( lit != node.literals.end() ? lit->second : ~0U );
+            if ( exact != ~0U )
+                w.candidates.push_back( exact );
+            node.prefixes.collect( name, false, w.candidates );
+            node.suffixes.collect( name, true, w.candidates );
+            w.candidates.insert( w.candidates.end(), node.others.begin(), node.others.end() );
+
+            int type( -1 ); // unknown until something matches: 0 file, 1 directory
+            for ( const uint32_t ci : w.candidates )
+            {
+                const Component & c( node.components[ci] );
+                if ( ci != exact && ! matches( c, name ) )
+                    continue;
+                if ( type < 0 )
+                {
+                    if ( de->d_type == DT_DIR )
+                        type = 1;
+                    else if ( de->d_type == DT_REG )
+                        type = 0;
+                    else
+                        type = isDirectory( name ) ? 1 : 0;
+                }
+                take( name, c, type == 1 );
+            }
+        }
+        closedir( d );
+    }
+
+    for ( const std::pair< int, string > & sub : subdirs )
+        walk( static_cast< size_t >( sub.first ), dir + "/" + sub.second,
+              prefix + sub.second + "/", w );
+}
+
+StringList
+PatternSet::match( const string & dir ) const
+{
+    Walk w;
+    w.entriesRead = 0;
+    walk( 0, dir, "", w );
+
+    std::vector< std::pair< uint32_t, string > > found;
+    found.reserve( w.best.size() );
+    for ( auto & b : w.best )
+        found.push_back( std::make_pair( b.second, b.first ) );
+    std::sort( found.begin(), found.end() );
+
+    StringList rv;
+    rv.reserve( found.size() );
+    for ( std::pair< uint32_t, string > & f : found )
+        rv.push_back( std::move( f.second ) );
+
+    DEBUG( "ps: " << QS( dir ) << ": " << w.entriesRead << " entries read, " <<
+           rv.size() << " matched" );
+
+    return rv;
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
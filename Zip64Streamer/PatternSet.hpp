@@ -0,0 +1,131 @@
+#ifndef COM_FOIANI_Z64S_PATTERNSET_HPP
+#define COM_FOIANI_Z64S_PATTERNSET_HPP 1
+
+/**
+ * @file PatternSet.hpp
+ *
+ * Many glob patterns matched against a directory tree in one walk,
+ * rather than one glob() (and one full directory read) per pattern.
+ *
+ * Patterns are split on '/' into components and merged into a tree,
+ * so patterns sharing leading components share the directory reads
+ * too.  At each level, a name is only run through the wildcard
+ * programs that could match it: literal components are a hash lookup,
+ * and the rest are indexed by their literal prefix (in a character
+ * trie), failing that by their literal suffix (in a trie of reversed
+ * suffixes); only components with neither, such as "*" or "?x*", are
+ * tried against every name.
+ *
+ * Matching follows glob(3) as globFiles() uses it: '*', '?', bracket
+ * expressions (ranges, '!' or '^' to negate, [:class:]) and backslash
+ * escapes; wildcards never match '/' or a leading '.'; directories
+ * are not returned, but symlinks to files are.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <bitset>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** A compiled set of glob patterns. */
+class PatternSet
+{
+
+public:
+
+    explicit PatternSet( const StringList & patterns );
+
+    /**
+     * Paths under @a dir (relative to it) matching any of the
+     * patterns, each once: grouped by the first pattern each matches,
+     * in pattern order, and by byte order within a pattern.  That's
+     * what calling globFiles() for each pattern in turn gives (in
+     * the C locale), less the repeats.
+     */
+    StringList match( const string & dir ) const;
+
+    size_t size() const { return m_patternCount; }
+
+private:
+
+    /** One step of a compiled component. */
+    struct Op
+    {
+        enum Kind { CHAR, ANY, STAR, SET } kind;
+        char c;
+        std::bitset< 256 > set;
+    };
+
+    /** A distinct component at some level of the tree. */
+    struct Component
+    {
+        std::vector< Op > ops;
+        bool bLeadingDot;                // starts with a literal '.'
+        std::vector< uint32_t > finals;  // patterns that end here
+        int child;                       // node for what follows, or -1
+    };
+
+    /** Character trie over literal prefixes (or reversed suffixes). */
+    struct Trie
+    {
+        struct TrieNode
+        {
+            std::vector< std::pair< char, uint32_t > > next;
+            std::vector< uint32_t > components;
+        };
+
+        Trie();
+        void add( const string & key, uint32_t component );
+
+        /** Append components whose key starts @a name (or ends it, if @a reversed). */
+        void collect( const string & name, bool reversed, std::vector< uint32_t > & out ) const;
+
+        std::vector< TrieNode > nodes;
+    };
+
+    /** One directory level. */
+    struct Node
+    {
+        std::vector< Component > components;
+        std::unordered_map< string, uint32_t > bySource;   // component text -> index
+
+        // how names find their candidate components
+        std::unordered_map< string, uint32_t > literals;
+        Trie prefixes;
+        Trie suffixes;
+        std::vector< uint32_t > others;
+    };
+
+    std::vector< Node > m_nodes;
+    size_t m_patternCount;
+
+    PatternSet( const PatternSet & );
+    PatternSet & operator=( const PatternSet & );
+
+    /** Index of the component for @a text at node @a n, adding it if need be. */
+    uint32_t addComponent( size_t n, const string & text );
+
+    static bool matches( const Component & c, const string & name );
+
+    struct Walk;
+    void walk( size_t n, const string & dir, const string & prefix, Walk & w ) const;
+
+}; // end class PatternSet
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_PATTERNSET_HPP
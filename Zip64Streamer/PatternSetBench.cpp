@@ -0,0 +1,249 @@
+/**
+ * @file PatternSetBench.cpp
+ *
+ * Matching many patterns over a huge directory: one globFiles() per
+ * pattern (removing repeats afterwards), as a loop over
+ * addFileByPattern() does, against a single PatternSet walk.  Builds
+ * a directory of empty files (once; it's reused), times both, checks
+ * they found the same files in the same order, and prints one JSON
+ * object.
+ *
+ * The default is 500 patterns over 1M entries: literal names, literal
+ * prefixes, literal suffixes, bracket expressions, a few with no
+ * literal part at all, and some reaching into subdirectories.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <unordered_set>
+
+// local headers
+#include "Compat.hpp"
+
+// header under test
+#include "PatternSet.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+typedef std::chrono::steady_clock Clock;
+
+// entries are spread over this many groups, and this many subdirectories
+const unsigned GROUPS = 1000;
+const unsigned SUBDIRS = 50;
+
+const char * const EXTENSIONS[] = { "log", "txt", "dat", "csv" };
+
+string
+format( const char * fmt, const unsigned a, const unsigned b = 0 )
+{
+    char buf[ 128 ];
+    snprintf( buf, sizeof( buf ), fmt, a, b );
+    return buf;
+}
+
+/** Name of entry @a i: "app-GGG-NNNNNNN.EXT", one in a hundred in a subdirectory. */
+string
+entryName( const unsigned i )
+{
+    const string base( format( "app-%03u-%07u.", i % GROUPS, i ) + EXTENSIONS[ i % 4 ] );
+    if ( i % 100 == 99 )
+        return format( "sub%02u/", ( i / 100 ) % SUBDIRS ) + base;
+    return base;
+}
+
+void
+makeDir( const string & dir )
+{
+    if ( mkdir( dir.c_str(), 0777 ) != 0 && errno != EEXIST )
+        throw OSError( "mkdir " + dir );
+}
+
+/** Create @a dir with @a entries empty files, unless a previous run already did. */
+void
+buildTree( const string & dir, const unsigned entries )
+{
+    const string marker( dir + "/.built-" + std::to_string( entries ) );
+    struct stat st;
+    if ( stat( marker.c_str(), &st ) == 0 )
+        return;
+
+    std::cerr << "creating " << entries << " files in " << dir << "..." << std::endl;
+    makeDir( dir );
+    for ( unsigned s = 0; s < SUBDIRS; ++s )
+        makeDir( dir + format( "/sub%02u", s ) );
+
+    for ( unsigned i = 0; i < entries; ++i )
+    {
+        const string path( dir + "/" + entryName( i ) );
+        const int fd( open( path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666 ) );
+        if ( fd < 0 )
+            throw OSError( "create " + path );
+        close( fd );
+    }
+
+    const int fd( open( marker.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666 ) );
+    if ( fd < 0 )
+        throw OSError( "create " + marker );
+    close( fd );
+}
+
+/** @a count patterns of every kind PatternSet indexes differently. */
+StringList
+makePatterns( const unsigned count, const unsigned entries )
+{
+    StringList rv;
+    for ( unsigned k = 0; rv.size() < count; ++k )
+    {
+        const unsigned g( ( k * 7919 ) % GROUPS );
+        const unsigned i( ( k * 104729 ) % std::max( 1U, entries ) );
+        switch ( k % 10 )
+        {
+        case 0: case 1: case 2: case 3:
+            rv.push_back( format( "app-%03u-*", g ) );                  // literal prefix
+            break;
+        case 4: case 5:
+            rv.push_back( format( "*%04u.", i % 10000 ) + EXTENSIONS[ k % 4 ] ); // literal suffix
+            break;
+        case 6: case 7:
+            rv.push_back( entryName( i ) );                             // exact name
+            break;
+        case 8:
+            rv.push_back( format( "app-%u[0-4]?-*[13579].txt", g % 10 ) ); // brackets
+            break;
+        default:
+            if ( k % 20 == 9 )
+                rv.push_back( format( "?pp-%03u-*", g ) );              // no literal prefix or suffix
+            else
+                rv.push_back( format( "sub%02u/app-%u*", k % SUBDIRS, g % 10 ) ); // subdirectory
+            break;
+        }
+    }
+    return rv;
+}
+
+double
+secondsSince( const Clock::time_point start )
+{
+    return std::chrono::duration< double >( Clock::now() - start ).count();
+}
+
+void
+usage( const char * argv0 )
+{
+    std::cerr <<
+        "usage: " << argv0 << " [options]\n"
+        "  --dir DIR         where to build the tree (default: z64s-patterns)\n"
+        "  --entries N       files in it (default: 1000000)\n"
+        "  --patterns N      patterns to match (default: 500)\n"
+        "  --no-baseline     skip the one-glob-per-pattern run\n";
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    string dir( "z64s-patterns" );
+    unsigned entries( 1000000 );
+    unsigned patternCount( 500 );
+    bool baseline( true );
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        const bool hasValue( i + 1 < argc );
+        if ( arg == "--dir" && hasValue )
+            dir = argv[++i];
+        else if ( arg == "--entries" && hasValue )
+            entries = static_cast< unsigned >( std::atol( argv[++i] ) );
+        else if ( arg == "--patterns" && hasValue )
+            patternCount = static_cast< unsigned >( std::atol( argv[++i] ) );
+        else if ( arg == "--no-baseline" )
+            baseline = false;
+        else
+        {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+
+    try
+    {
+        buildTree( dir, entries );
+        const StringList patterns( makePatterns( patternCount, entries ) );
+
+        // per-match logging would swamp the timings
+        std::streambuf * const clogBuf( std::clog.rdbuf( 0 ) );
+
+        Clock::time_point start( Clock::now() );
+        const PatternSet ps( patterns );
+        const double compileSecs( secondsSince( start ) );
+        start = Clock::now();
+        const StringList matched( ps.match( dir ) );
+        const double matchSecs( secondsSince( start ) );
+
+        double globSecs( 0 );
+        size_t globRaw( 0 );
+        bool same( true );
+        if ( baseline )
+        {
+            start = Clock::now();
+            StringList files;
+            std::unordered_set< string > seen;
+            for ( const string & p : patterns )
+            {
+                const StringList found( globFiles( dir, p ) );
+                globRaw += found.size();
+                for ( const string & f : found )
+                    if ( seen.insert( f ).second )
+                        files.push_back( f );
+            }
+            globSecs = secondsSince( start );
+            same = ( files == matched );
+        }
+
+        std::clog.rdbuf( clogBuf );
+
+        std::cout << std::fixed << std::setprecision( 3 )
+                  << "{ \"entries\": " << entries
+                  << ", \"patterns\": " << patterns.size()
+                  << ", \"matched\": " << matched.size()
+                  << ", \"compile_s\": " << compileSecs
+                  << ", \"pattern_set_s\": " << matchSecs;
+        if ( baseline )
+            std::cout << ", \"glob_per_pattern_s\": " << globSecs
+                      << ", \"glob_matches_with_repeats\": " << globRaw
+                      << ", \"speedup\": " << std::setprecision( 1 )
+                      << globSecs / ( compileSecs + matchSecs )
+                      << ", \"same_result\": " << ( same ? "true" : "false" );
+        std::cout << " }" << std::endl;
+
+        if ( ! same )
+        {
+            ERROR( "PatternSet and globFiles() disagree" );
+            return 1;
+        }
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( e.what() );
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,470 @@
+/**
+ * @file SocketSender.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/errqueue.h> // needs struct timespec first
+
+// standard C++ headers
+#include <algorithm>
+#include <chrono>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "SocketSender.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+// iovecs per writev(); well under IOV_MAX everywhere we care about.
+const int MAX_IOV = 256;
+
+// keep this many spare buffers, and none bigger than this.
+const size_t MAX_FREE_BUFFERS = 32;
+const size_t MAX_RECYCLED_CAPACITY = 4 * 1024 * 1024;
+
+// how long the destructor waits for outstanding zero-copy completions;
+// a stalled peer or a dead socket may never deliver them.
+const int ZEROCOPY_DRAIN_SECONDS = 10;
+
+/** True if @a a comes at or before @a b in wrapping sequence space. */
+bool
+seqAtOrBefore( const uint32_t a, const uint32_t b )
+{
+    return static_cast< int32_t >( a - b ) <= 0;
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+SocketSender::Options::Options()
+    : batchBytes( 256 * 1024 ),
+      cork( true ),
+      zeroCopy( false ),
+      zeroCopyMinBytes( 64 * 1024 ),
+      zeroCopyMaxInFlight( 32 * 1024 * 1024 )
+{
+}
+
+SocketSender::SocketSender( const int fd, const Options & opts )
+    : m_fd( fd ),
+      m_opts( opts ),
+      m_bCorked( false ),
+      m_pendingBytes( 0 ),
+      m_nextSeq( 0 ),
+      m_inFlightBytes( 0 )
+{
+    zeroStruct( m_stats );
+
+    if ( m_opts.cork )
+    {
+        int val( 0 );
+        socklen_t len( sizeof( val ) );
+        if ( getsockopt( m_fd, IPPROTO_TCP, TCP_CORK, &val, &len ) != 0 )
+        {
+            FINE( "ss: ctor: not a tcp socket, corking disabled" );
+            m_opts.cork = false;
+        }
+    }
+
+    if ( m_opts.zeroCopy )
+    {
+#ifdef SO_ZEROCOPY
+        const int one( 1 );
+        if ( setsockopt( m_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof( one ) ) != 0 )
+        {
+            WARN( "ss: ctor: SO_ZEROCOPY unavailable, errno=" << errno );
+            m_opts.zeroCopy = false;
+        }
+#else
+        WARN( "ss: ctor: built without SO_ZEROCOPY" );
+        m_opts.zeroCopy = false;
+#endif
+    }
+
+    DEBUG( "ss: ctor: fd=" << m_fd << ", cork=" << m_opts.cork <<
+           ", zerocopy=" << m_opts.zeroCopy );
+}
+
+SocketSender::~SocketSender()
+{
+    try
+    {
+        flush();
+
+        const std::chrono::steady_clock::time_point deadline(
+            std::chrono::steady_clock::now() + std::chrono::seconds( ZEROCOPY_DRAIN_SECONDS ) );
+        while ( ! m_inFlight.empty() && std::chrono::steady_clock::now() < deadline )
+            reapCompletions( true );
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( "ss: dtor: " << e.what() );
+    }
+
+    // the kernel holds its own references to pages still being sent,
+    // so the buffers can go even if their completions never came.
+    if ( ! m_inFlight.empty() )
+    {
+        ERROR( "ss: dtor: giving up on " << m_inFlight.size() << " zero-copy sends (" <<
+               m_inFlightBytes << " bytes) never reported complete" );
+        m_inFlight.clear();
+        m_inFlightBytes = 0;
+    }
+
+    DEBUG( "ss: dtor: bytes=" << m_stats.bytes <<
+           ", writev=" << m_stats.writevCalls <<
+           ", sendfile=" << m_stats.sendFileCalls <<
+           ", zerocopy=" << m_stats.zeroCopySends <<
+           " (copied " << m_stats.zeroCopyCopied << ")" );
+}
+
+/* virtual */ void
+SocketSender::send( CharBuffer & b )
+{
+    if ( b.empty() )
+        return;
+
+    if ( m_opts.zeroCopy && b.size() >= m_opts.zeroCopyMinBytes )
+    {
+        // keep ordering: anything batched has to go first.
+        flushPending();
+        sendZeroCopy( b );
+    }
+    else
+    {
+        queue( b );
+        if ( m_pendingBytes >= m_opts.batchBytes )
+            flushPending();
+    }
+
+    handBack( b );
+}
+
+/* virtual */ void
+SocketSender::send( string & s )
+{
+    if ( s.empty() )
+        return;
+
+    CharBuffer b;
+    handBack( b );
+    b.assign( s.begin(), s.end() );
+    s.clear();
+    send( b );
+}
+
+/* virtual */ void
+SocketSender::flush()
+{
+    flushPending();
+    if ( m_bCorked )
+        setCork( false );
+    reapCompletions( false );
+}
+
+/* virtual */ uint64_t
+SocketSender::sendFile( const int fd, const uint64_t offset, const uint64_t length )
+{
+    // keep ordering: anything batched has to go first.  the cork
+    // stays on, so the file's first bytes can share a segment with
+    // the header before them.
+    flushPending();
+
+    off_t pos( static_cast< off_t >( offset ) );
+    uint64_t sent( 0 );
+    while ( sent < length )
+    {
+        const ssize_t w( ::sendfile( m_fd, fd, &pos, length - sent ) );
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                waitWritable();
+                continue;
+            }
+            // not a file sendfile() can read from; the caller copies.
+            if ( sent == 0 && ( errno == EINVAL || errno == ENOSYS ) )
+                return 0;
+            throw OSError( "sendfile" );
+        }
+        if ( w == 0 )
+            break;   // the file is shorter than it was
+
+        ++m_stats.sendFileCalls;
+        m_stats.bytes += w;
+        sent += w;
+    }
+    return sent;
+}
+
+void
+SocketSender::queue( CharBuffer & b )
+{
+    if ( m_pending.size() >= static_cast< size_t >( MAX_IOV ) )
+        flushPending();
+
+    m_pendingBytes += b.size();
+    m_pending.push_back( CharBuffer() );
+    m_pending.back().swap( b );
+}
+
+void
+SocketSender::flushPending()
+{
+    if ( m_pending.empty() )
+        return;
+
+    if ( m_opts.cork && ! m_bCorked )
+        setCork( true );
+
+    size_t skip( 0 ); // bytes of the front buffer already written
+    while ( ! m_pending.empty() )
+    {
+        struct iovec iov[ MAX_IOV ];
+        int n( 0 );
+        size_t off( skip );
+        for ( std::deque< CharBuffer >::iterator it( m_pending.begin() );
+              it != m_pending.end() && n < MAX_IOV;
+              ++it, ++n )
+        {
+            iov[n].iov_base = &(*it)[ off ];
+            iov[n].iov_len = it->size() - off;
+            off = 0;
+        }
+
+        const ssize_t w( writev( m_fd, iov, n ) );
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                waitWritable();
+                continue;
+            }
+            throw OSError( "writev" );
+        }
+
+        ++m_stats.writevCalls;
+        m_stats.bytes += w;
+        m_pendingBytes -= w;
+
+        size_t left( skip + w );
+        while ( ! m_pending.empty() && left >= m_pending.front().size() )
+        {
+            left -= m_pending.front().size();
+            recycle( m_pending.front() );
+            m_pending.pop_front();
+        }
+        skip = left;
+    }
+}
+
+void
+SocketSender::sendZeroCopy( CharBuffer & b )
+{
+#ifdef MSG_ZEROCOPY
+    while ( m_inFlightBytes >= m_opts.zeroCopyMaxInFlight )
+        reapCompletions( true );
+
+    size_t off( 0 );
+    uint32_t lastSeq( m_nextSeq );
+    bool any( false );
+    while ( off < b.size() )
+    {
+        struct iovec iov;
+        iov.iov_base = &b[ off ];
+        iov.iov_len = b.size() - off;
+
+        struct msghdr msg;
+        zeroStruct( msg );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        const ssize_t w( sendmsg( m_fd, &msg, MSG_ZEROCOPY ) );
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                waitWritable();
+                continue;
+            }
+            if ( errno == ENOBUFS )
+            {
+                // out of pinned-page budget; let some complete, or
+                // give up and copy this one.
+                if ( ! m_inFlight.empty() )
+                {
+                    reapCompletions( true );
+                    continue;
+                }
+                break;
+            }
+            throw OSError( "sendmsg" );
+        }
+
+        // every successful zero-copy call consumes one sequence number
+        lastSeq = m_nextSeq++;
+        any = true;
+        off += w;
+        m_stats.bytes += w;
+    }
+
+    if ( off < b.size() )
+    {
+        // whatever the kernel wouldn't pin goes out the ordinary way
+        CharBuffer rest( b.begin() + off, b.end() );
+        queue( rest );
+        flushPending();
+    }
+
+    if ( any )
+    {
+        ++m_stats.zeroCopySends;
+        m_inFlightBytes += b.size();
+        m_inFlight.push_back( InFlight() );
+        m_inFlight.back().lastSeq = lastSeq;
+        m_inFlight.back().buf.swap( b );
+    }
+
+    reapCompletions( false );
+#else
+    queue( b );
+    flushPending();
+#endif
+}
+
+void
+SocketSender::reapCompletions( const bool wait )
+{
+    if ( m_inFlight.empty() )
+        return;
+
+    if ( wait )
+    {
+        // completions are reported as POLLERR, which poll() always watches
+        struct pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = 0;
+        pfd.revents = 0;
+        if ( poll( &pfd, 1, 1000 ) < 0 && errno != EINTR )
+            throw OSError( "poll" );
+    }
+
+    while ( ! m_inFlight.empty() )
+    {
+        char control[ 128 ];
+        struct msghdr msg;
+        zeroStruct( msg );
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+
+        if ( recvmsg( m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+                return;
+            throw OSError( "recvmsg errqueue" );
+        }
+
+        for ( struct cmsghdr * cm = CMSG_FIRSTHDR( &msg ); cm; cm = CMSG_NXTHDR( &msg, cm ) )
+        {
+            const bool isErr( ( cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR ) ||
+                              ( cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR ) );
+            if ( ! isErr )
+                continue;
+
+            const struct sock_extended_err * serr(
+                reinterpret_cast< const struct sock_extended_err * >( CMSG_DATA( cm ) ) );
+            if ( serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY )
+                continue;
+
+            // [ee_info, ee_data] is the range of completed sends
+            const uint32_t lo( serr->ee_info );
+            const uint32_t hi( serr->ee_data );
+            m_stats.zeroCopyCompleted += hi - lo + 1;
+            if ( serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED )
+                m_stats.zeroCopyCopied += hi - lo + 1;
+
+            while ( ! m_inFlight.empty() && seqAtOrBefore( m_inFlight.front().lastSeq, hi ) )
+            {
+                m_inFlightBytes -= m_inFlight.front().buf.size();
+                recycle( m_inFlight.front().buf );
+                m_inFlight.pop_front();
+            }
+        }
+    }
+}
+
+void
+SocketSender::setCork( const bool on )
+{
+    const int val( on ? 1 : 0 );
+    if ( setsockopt( m_fd, IPPROTO_TCP, TCP_CORK, &val, sizeof( val ) ) != 0 )
+        throw OSError( "setsockopt TCP_CORK" );
+    m_bCorked = on;
+}
+
+void
+SocketSender::waitWritable()
+{
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if ( poll( &pfd, 1, -1 ) < 0 && errno != EINTR )
+        throw OSError( "poll" );
+}
+
+void
+SocketSender::recycle( CharBuffer & b )
+{
+    if ( m_free.size() < MAX_FREE_BUFFERS && b.capacity() <= MAX_RECYCLED_CAPACITY )
+    {
+        b.clear();
+        m_free.push_back( CharBuffer() );
+        m_free.back().swap( b );
+    }
+}
+
+void
+SocketSender::handBack( CharBuffer & b )
+{
+    // give the caller an empty buffer with capacity, so that its next
+    // resize() doesn't have to allocate.
+    if ( b.empty() && ! m_free.empty() )
+    {
+        b.swap( m_free.back() );
+        m_free.pop_back();
+        ++m_stats.recycled;
+    }
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
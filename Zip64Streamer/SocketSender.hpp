@@ -0,0 +1,131 @@
+#ifndef COM_FOIANI_Z64S_SOCKETSENDER_HPP
+#define COM_FOIANI_Z64S_SOCKETSENDER_HPP 1
+
+/**
+ * @file SocketSender.hpp
+ *
+ * A Zip64Streamer::Sender that writes to a connected socket (or any
+ * other file descriptor) without copying each buffer in user space.
+ *
+ * Small buffers (headers, descriptors, short entries) are held and
+ * handed to the kernel in one writev() per batch, with TCP_CORK set
+ * while a burst is in progress so that they leave as full segments.
+ * Optionally, large buffers go out with MSG_ZEROCOPY; they are kept
+ * alive until the kernel's completion notification arrives and are
+ * then recycled back to the caller on later send() calls.  File
+ * content handed to sendFile() goes out with sendfile(2).
+ *
+ * The descriptor is expected to be blocking; if it isn't, the sender
+ * waits for it to become writable.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Send archive data to a socket with batching, corking and optional zero-copy. */
+class SocketSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    struct Options
+    {
+        Options();
+
+        /** Hand pending small buffers to the kernel once this many bytes are queued. */
+        size_t batchBytes;
+
+        /** Set TCP_CORK while batching; ignored on non-TCP descriptors. */
+        bool cork;
+
+        /** Send large buffers with MSG_ZEROCOPY if the kernel supports it. */
+        bool zeroCopy;
+
+        /** Buffers at least this large qualify for zero-copy. */
+        size_t zeroCopyMinBytes;
+
+        /** Wait for completions once this many zero-copy bytes are outstanding. */
+        size_t zeroCopyMaxInFlight;
+    };
+
+    struct Stats
+    {
+        uint64_t bytes;
+        uint64_t writevCalls;
+        uint64_t zeroCopySends;
+        uint64_t zeroCopyCompleted;
+        uint64_t zeroCopyCopied;   // the kernel fell back to copying
+        uint64_t recycled;
+        uint64_t sendFileCalls;
+    };
+
+    /** Send to @a fd, which the caller keeps ownership of. */
+    explicit SocketSender( int fd, const Options & opts = Options() );
+
+    /** Flushes and waits for outstanding zero-copy sends. */
+    virtual ~SocketSender();
+
+    virtual void send( CharBuffer & b );
+    virtual void send( string & s );
+    virtual void flush();
+    virtual uint64_t sendFile( int fd, uint64_t offset, uint64_t length );
+
+    const Stats & stats() const { return m_stats; }
+
+private:
+
+    SocketSender( const SocketSender & );
+    SocketSender & operator=( const SocketSender & );
+
+    struct InFlight
+    {
+        uint32_t lastSeq;
+        CharBuffer buf;
+    };
+
+    const int m_fd;
+    Options m_opts;
+    bool m_bCorked;
+
+    std::deque< CharBuffer > m_pending;
+    size_t m_pendingBytes;
+
+    uint32_t m_nextSeq;
+    std::deque< InFlight > m_inFlight;
+    size_t m_inFlightBytes;
+
+    std::vector< CharBuffer > m_free;
+
+    Stats m_stats;
+
+    void queue( CharBuffer & b );
+    void flushPending();
+    void sendZeroCopy( CharBuffer & b );
+    void reapCompletions( bool wait );
+    void setCork( bool on );
+    void waitWritable();
+    void recycle( CharBuffer & b );
+    void handBack( CharBuffer & b );
+
+}; // end class SocketSender
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_SOCKETSENDER_HPP
@@ -0,0 +1,275 @@
+/**
+ * @file SocketSenderBench.cpp
+ *
+ * Loopback benchmark for SocketSender.  Streams an archive-shaped
+ * sequence of buffers (small headers, data chunks, descriptors) over
+ * a TCP connection to a draining reader thread, and reports the
+ * sending thread's CPU time per GB for each sending strategy.
+ *
+ * Note that loopback never really does zero-copy; the kernel copies
+ * and says so in the completion, which shows up as "zc_copied".  Run
+ * against a real NIC to see the zero-copy savings.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <thread>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+// header under test
+#include "SocketSender.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+/** What most integrators write: one write() per buffer. */
+class NaiveSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    explicit NaiveSender( const int fd ) : m_fd( fd ) {}
+
+    virtual void send( CharBuffer & b ) { writeAll( b.data(), b.size() ); }
+    virtual void send( string & s )     { writeAll( s.data(), s.size() ); }
+
+private:
+
+    void writeAll( const char * p, size_t n );
+
+    const int m_fd;
+
+};
+
+void
+NaiveSender::writeAll( const char * p, size_t n )
+{
+    while ( n > 0 )
+    {
+        const ssize_t w( write( m_fd, p, n ) );
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            throw OSError( "write" );
+        }
+        p += w;
+        n -= w;
+    }
+}
+
+double
+threadCpuSeconds()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Connected loopback TCP pair; first is the sending side. */
+std::pair< int, int >
+loopbackPair()
+{
+    const int listener( socket( AF_INET, SOCK_STREAM, 0 ) );
+    if ( listener < 0 )
+        throw OSError( "socket" );
+
+    struct sockaddr_in addr;
+    zeroStruct( addr );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port = 0;
+
+    socklen_t len( sizeof( addr ) );
+    if ( bind( listener, reinterpret_cast< struct sockaddr * >( &addr ), len ) != 0 ||
+         listen( listener, 1 ) != 0 ||
+         getsockname( listener, reinterpret_cast< struct sockaddr * >( &addr ), &len ) != 0 )
+        throw OSError( "listen" );
+
+    const int client( socket( AF_INET, SOCK_STREAM, 0 ) );
+    if ( client < 0 ||
+         connect( client, reinterpret_cast< struct sockaddr * >( &addr ), len ) != 0 )
+        throw OSError( "connect" );
+
+    const int server( accept( listener, 0, 0 ) );
+    if ( server < 0 )
+        throw OSError( "accept" );
+
+    close( listener );
+    return std::make_pair( client, server );
+}
+
+/**
+ * Feed @a sender an archive-like stream of @a totalBytes: a header
+ * per entry, @a chunk-sized data buffers, then a descriptor.
+ */
+void
+feed( Zip64Streamer::Sender & sender,
+      const uint64_t totalBytes,
+      const size_t entryBytes,
+      const size_t chunk )
+{
+    CharBuffer buf;
+    uint64_t sent( 0 );
+    while ( sent < totalBytes )
+    {
+        buf.assign( 102, 'h' );
+        sent += buf.size();
+        sender.send( buf );
+
+        for ( size_t done = 0; done < entryBytes; done += chunk )
+        {
+            // like the streamer: resize whatever we were handed back
+            buf.resize( std::min( chunk, entryBytes - done ) );
+            buf[0] = 'd';
+            sent += buf.size();
+            sender.send( buf );
+        }
+
+        buf.assign( 24, 'x' );
+        sent += buf.size();
+        sender.send( buf );
+    }
+    sender.flush();
+}
+
+void
+runOne( const string & mode,
+        const uint64_t totalBytes,
+        const size_t entryBytes,
+        const size_t chunk,
+        bool & first )
+{
+    const std::pair< int, int > fds( loopbackPair() );
+
+    uint64_t received( 0 );
+    std::thread reader( [&]()
+    {
+        CharBuffer buf( 1024 * 1024 );
+        while ( true )
+        {
+            const ssize_t n( read( fds.second, &buf[0], buf.size() ) );
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n <= 0 )
+                break;
+            received += n;
+        }
+    } );
+
+    SocketSender::Stats stats;
+    zeroStruct( stats );
+
+    const std::chrono::steady_clock::time_point start( std::chrono::steady_clock::now() );
+    const double cpu0( threadCpuSeconds() );
+
+    if ( mode == "write" )
+    {
+        NaiveSender sender( fds.first );
+        feed( sender, totalBytes, entryBytes, chunk );
+    }
+    else
+    {
+        SocketSender::Options opts;
+        opts.cork = ( mode != "writev" );
+        opts.zeroCopy = ( mode == "zerocopy" );
+        SocketSender sender( fds.first, opts );
+        feed( sender, totalBytes, entryBytes, chunk );
+        sender.flush();
+        stats = sender.stats();
+    }
+
+    const double cpu( threadCpuSeconds() - cpu0 );
+    shutdown( fds.first, SHUT_WR );
+    reader.join();
+    const double secs( std::chrono::duration< double >(
+                           std::chrono::steady_clock::now() - start ).count() );
+    close( fds.first );
+    close( fds.second );
+
+    const double gb( received / 1e9 );
+    std::cout << ( first ? "[\n" : ",\n" ) << std::fixed << std::setprecision( 3 )
+              << "  { \"mode\": \"" << mode << "\""
+              << ", \"entry_bytes\": " << entryBytes
+              << ", \"chunk_bytes\": " << chunk
+              << ", \"bytes\": " << received
+              << ", \"seconds\": " << secs
+              << ", \"gb_per_s\": " << gb / secs
+              << ", \"cpu_s_per_gb\": " << cpu / gb
+              << ", \"writev_calls\": " << stats.writevCalls
+              << ", \"zc_sends\": " << stats.zeroCopySends
+              << ", \"zc_copied\": " << stats.zeroCopyCopied
+              << ", \"recycled\": " << stats.recycled
+              << " }" << std::flush;
+    first = false;
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    double gb( 2.0 );
+    StringList modes;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        if ( arg == "--gb" && i + 1 < argc )
+            gb = std::atof( argv[++i] );
+        else if ( arg == "--mode" && i + 1 < argc )
+            modes.push_back( argv[++i] );
+        else
+        {
+            ERROR( "usage: " << argv[0] << " [--gb N] [--mode write|writev|cork|zerocopy]..." );
+            return 1;
+        }
+    }
+
+    if ( modes.empty() )
+        modes = StringList{ "write", "writev", "cork", "zerocopy" };
+
+    // (entry size, chunk size): small entries, streamer-sized chunks, big chunks
+    const std::pair< size_t, size_t > shapes[] = {
+        std::make_pair(          2 * 1024,        2 * 1024 ),
+        std::make_pair( 4 * 1024 * 1024,         32 * 1024 ),
+        std::make_pair( 4 * 1024 * 1024,  1024 * 1024 )
+    };
+
+    std::clog.rdbuf( 0 );
+
+    try
+    {
+        bool first( true );
+        for ( const std::pair< size_t, size_t > & shape : shapes )
+            for ( const string & mode : modes )
+                runOne( mode, static_cast< uint64_t >( gb * 1e9 ),
+                        shape.first, shape.second, first );
+        std::cout << "\n]" << std::endl;
+    }
+    catch ( const std::exception & e )
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,509 @@
+/**
+ * @file TarStreamer.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <algorithm>
+
+// local headers
+#include "Compat.hpp"
+#include "PatternSet.hpp"
+#include "Zip64Format.hpp"
+
+// interface
+#include "TarStreamer.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+const size_t BLOCK_BYTES = 512;
+
+// tar(1) writes whole records of 20 blocks; some readers expect that.
+const size_t RECORD_BYTES = 20 * BLOCK_BYTES;
+
+// output is sent, and files read, in pieces of this size.
+const size_t OUTPUT_BYTES = 256 * 1024;
+const size_t READ_BYTES = 256 * 1024;
+
+// below this, a sendfile() costs more than the copy it saves.
+const uint64_t SENDFILE_MIN_BYTES = 64 * 1024;
+
+// the biggest size that fits the ustar field's 11 octal digits.
+const uint64_t MAX_USTAR_SIZE = 077777777777ULL;
+
+const char ZEROS[ BLOCK_BYTES ] = { 0 };
+
+struct UstarHeader
+{
+    char name[ 100 ];
+    char mode[ 8 ];
+    char uid[ 8 ];
+    char gid[ 8 ];
+    char size[ 12 ];
+    char mtime[ 12 ];
+    char chksum[ 8 ];
+    char typeflag;
+    char linkname[ 100 ];
+    char magic[ 6 ];
+    char version[ 2 ];
+    char uname[ 32 ];
+    char gname[ 32 ];
+    char devmajor[ 8 ];
+    char devminor[ 8 ];
+    char prefix[ 155 ];
+    char pad[ 12 ];
+};
+
+static_assert( sizeof( UstarHeader ) == BLOCK_BYTES, "ustar header must be one block" );
+
+/** Zero-padded octal @a val, filling all but the last byte of @a field. */
+void
+putOctal( char * field, const size_t width, const uint64_t val )
+{
+    snprintf( field, width, "%0*llo", static_cast< int >( width - 1 ),
+              static_cast< unsigned long long >( val ) );
+}
+
+/**
+ * Split @a name into ustar @a prefix and @a base, at a '/', so that
+ * each fits its field.  Returns false if there's no such '/'.
+ */
+bool
+splitName( const string & name, string & prefix, string & base )
+{
+    if ( name.size() <= sizeof( UstarHeader().name ) )
+    {
+        prefix.clear();
+        base = name;
+        return true;
+    }
+
+    // the base can't be longer than the name field, so the split
+    // can't come before this.
+    const size_t earliest( name.size() - sizeof( UstarHeader().name ) - 1 );
+    const size_t slash( name.find( '/', earliest ) );
+    if ( slash == string::npos || slash == 0 || slash + 1 == name.size() ||
+         slash > sizeof( UstarHeader().prefix ) )
+        return false;
+
+    prefix.assign( name, 0, slash );
+    base.assign( name, slash + 1, string::npos );
+    return true;
+}
+
+/** One pax record: "LENGTH KEY=VALUE\n", where LENGTH counts itself too. */
+string
+paxRecord( const string & key, const string & value )
+{
+    const size_t rest( key.size() + value.size() + 3 );  // ' ', '=', '\n'
+    size_t len( rest + std::to_string( rest ).size() );
+    if ( std::to_string( len ).size() != std::to_string( rest ).size() )
+        ++len;
+    return std::to_string( len ) + " " + key + "=" + value + "\n";
+}
+
+void
+fillHeader( UstarHeader & h,
+            const string & name,
+            const string & prefix,
+            const uint64_t size,
+            const uint32_t mtime,
+            const uint32_t mode,
+            const char typeflag )
+{
+    zeroStruct( h );
+
+    memcpy( h.name, name.data(), std::min( name.size(), sizeof( h.name ) ) );
+    memcpy( h.prefix, prefix.data(), std::min( prefix.size(), sizeof( h.prefix ) ) );
+    putOctal( h.mode, sizeof( h.mode ), mode & 07777 );
+    putOctal( h.uid, sizeof( h.uid ), 0 );
+    putOctal( h.gid, sizeof( h.gid ), 0 );
+    putOctal( h.size, sizeof( h.size ), size <= MAX_USTAR_SIZE ? size : 0 );
+    putOctal( h.mtime, sizeof( h.mtime ), mtime );
+    h.typeflag = typeflag;
+    memcpy( h.magic, "ustar", 6 );
+    memcpy( h.version, "00", 2 );
+
+    // checksum of the header with the checksum field as spaces
+    memset( h.chksum, ' ', sizeof( h.chksum ) );
+    const unsigned char * p( reinterpret_cast< const unsigned char * >( &h ) );
+    unsigned sum( 0 );
+    for ( size_t i = 0; i < sizeof( h ); ++i )
+        sum += p[i];
+    snprintf( h.chksum, sizeof( h.chksum ), "%06o", sum );
+    h.chksum[7] = ' ';
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+TarStreamer::TarStreamer( const string & dir, Sender & sender )
+    : m_sDir( dir ),
+      m_sender( sender ),
+      m_offset( 0 ),
+      m_entries( 0 ),
+      m_bFinished( false ),
+      m_bGzip( false ),
+      m_bZStreamInit( false )
+{
+    zeroStruct( m_zs );
+    m_pending.reserve( OUTPUT_BYTES );
+
+    DEBUG( "ts: ctor: dir=" << QS( m_sDir ) );
+}
+
+TarStreamer::~TarStreamer()
+{
+    try
+    {
+        finish();
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( "ts: dtor: " << e.what() );
+    }
+
+    if ( m_bZStreamInit )
+        deflateEnd( &m_zs );
+
+    DEBUG( "ts: dtor: done" );
+}
+
+void
+TarStreamer::finish()
+{
+    if ( m_bFinished )
+        return;
+    m_bFinished = true;
+
+    DEBUG( "ts: fin: " << m_entries << " entries, " << m_offset << " bytes" );
+
+    // end of archive is two zero blocks, then whatever fills the record.
+    emitZeros( 2 * BLOCK_BYTES );
+    if ( m_offset % RECORD_BYTES != 0 )
+        emitZeros( RECORD_BYTES - m_offset % RECORD_BYTES );
+
+    if ( m_bGzip )
+        deflateOutput( Z_FINISH );
+
+    flushPending();
+    m_sender.flush();
+}
+
+void
+TarStreamer::addFile( const string & file )
+{
+    DEBUG( "ts: af: adding file " << QS( file ) );
+    requireOpen();
+
+    const string path( m_sDir + "/" + file );
+    const int fd( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "open " + path );
+
+    try
+    {
+        struct stat st;
+        if ( fstat( fd, &st ) != 0 )
+            throw OSError( "stat " + path );
+
+        Zip64EntryInfo ei;
+        zip64::fillDateTime( ei, st );
+
+        const uint64_t size( static_cast< uint64_t >( st.st_size ) );
+        emitHeader( file, size, ei.stat_mtime, zip64::DEFAULT_FILE_MODE );
+        emitFileData( fd, size, file );
+    }
+    catch ( ... )
+    {
+        close( fd );
+        throw;
+    }
+
+    close( fd );
+    ++m_entries;
+}
+
+size_t
+TarStreamer::addFileByPattern( const string & pattern )
+{
+    DEBUG( "ts: afbp: adding pattern " << QS( pattern ) );
+    requireOpen();
+
+    const StringList files( globFiles( m_sDir, pattern ) );
+    for ( const string & file : files )
+        addFile( file );
+    return files.size();
+}
+
+size_t
+TarStreamer::addFilesByPatterns( const StringList & patterns )
+{
+    DEBUG( "ts: afbps: adding " << patterns.size() << " patterns" );
+    requireOpen();
+
+    const PatternSet ps( patterns );
+    const StringList files( ps.match( m_sDir ) );
+    for ( const string & file : files )
+        addFile( file );
+    return files.size();
+}
+
+void
+TarStreamer::addEntry( const string & name,
+                       Source & source,
+                       const EntryAttributes & attrs )
+{
+    DEBUG( "ts: ae: adding entry " << QS( name ) );
+    requireOpen();
+
+    Zip64EntryInfo ei;
+    zip64::fillDateTime( ei, attrs.mtime, attrs.atime );
+
+    const char * data( 0 );
+    size_t n( 0 );
+    const int64_t hint( source.sizeHint() );
+    if ( hint < 0 )
+    {
+        CharBuffer content;
+        while ( ( n = source.read( data ) ) > 0 )
+            content.insert( content.end(), data, data + n );
+
+        emitHeader( name, content.size(), ei.stat_mtime, attrs.mode );
+        emit( content.data(), content.size() );
+    }
+    else
+    {
+        const uint64_t size( static_cast< uint64_t >( hint ) );
+        emitHeader( name, size, ei.stat_mtime, attrs.mode );
+
+        uint64_t done( 0 );
+        while ( ( n = source.read( data ) ) > 0 )
+        {
+            if ( n > size - done )
+                throw std::runtime_error( "ts: " + name + ": source is longer than its size hint" );
+            emit( data, n );
+            done += n;
+        }
+        if ( done < size )
+        {
+            WARN( "ts: " << QS( name ) << ": source ended at " << done <<
+                  " of " << size << " bytes; padding with zeros" );
+            emitZeros( size - done );
+        }
+    }
+
+    emitPadding();
+    ++m_entries;
+}
+
+void
+TarStreamer::setGzip( const bool on, const int level )
+{
+    requireOpen();
+    if ( m_offset != 0 )
+        throw std::logic_error( "ts: compression must be set before adding anything" );
+
+    if ( m_bZStreamInit )
+    {
+        deflateEnd( &m_zs );
+        m_bZStreamInit = false;
+    }
+
+    m_bGzip = on;
+    if ( ! on )
+        return;
+
+    // window bits + 16 asks zlib for a gzip wrapper; its header has
+    // no name or time, so the output depends only on the tar.
+    zeroStruct( m_zs );
+    if ( deflateInit2( &m_zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+        throw std::runtime_error( "ts: deflateInit2 failed" );
+    m_bZStreamInit = true;
+}
+
+void
+TarStreamer::requireOpen() const
+{
+    if ( m_bFinished )
+        throw std::logic_error( "tar streamer already finished" );
+}
+
+void
+TarStreamer::flushPending()
+{
+    if ( m_pending.empty() )
+        return;
+
+    m_sender.send( m_pending );
+    m_pending.clear();
+}
+
+void
+TarStreamer::emit( const char * data, const size_t len )
+{
+    m_offset += len;
+
+    if ( m_bGzip )
+    {
+        m_zs.next_in = reinterpret_cast< Bytef * >( const_cast< char * >( data ) );
+        m_zs.avail_in = static_cast< uInt >( len );
+        deflateOutput( Z_NO_FLUSH );
+        return;
+    }
+
+    m_pending.insert( m_pending.end(), data, data + len );
+    if ( m_pending.size() >= OUTPUT_BYTES )
+        flushPending();
+}
+
+void
+TarStreamer::emitZeros( uint64_t n )
+{
+    while ( n > 0 )
+    {
+        const size_t len( static_cast< size_t >( std::min< uint64_t >( n, sizeof( ZEROS ) ) ) );
+        emit( ZEROS, len );
+        n -= len;
+    }
+}
+
+void
+TarStreamer::emitPadding()
+{
+    if ( m_offset % BLOCK_BYTES != 0 )
+        emitZeros( BLOCK_BYTES - m_offset % BLOCK_BYTES );
+}
+
+void
+TarStreamer::deflateOutput( const int flush )
+{
+    while ( true )
+    {
+        if ( m_pending.size() >= OUTPUT_BYTES )
+            flushPending();
+
+        const size_t have( m_pending.size() );
+        m_pending.resize( OUTPUT_BYTES );
+        m_zs.next_out = reinterpret_cast< Bytef * >( &m_pending[ have ] );
+        m_zs.avail_out = static_cast< uInt >( OUTPUT_BYTES - have );
+
+        const int rc( deflate( &m_zs, flush ) );
+        m_pending.resize( OUTPUT_BYTES - m_zs.avail_out );
+        if ( rc == Z_STREAM_ERROR )
+            throw std::runtime_error( "ts: deflate failed" );
+
+        if ( flush == Z_FINISH )
+        {
+            if ( rc == Z_STREAM_END )
+                break;
+        }
+        else if ( m_zs.avail_in == 0 && m_zs.avail_out != 0 )
+            break;
+    }
+}
+
+void
+TarStreamer::emitHeader( const string & name,
+                         const uint64_t size,
+                         const uint32_t mtime,
+                         const uint32_t mode )
+{
+    string prefix, base;
+    const bool nameFits( splitName( name, prefix, base ) );
+    const bool sizeFits( size <= MAX_USTAR_SIZE );
+
+    UstarHeader h;
+    if ( ! nameFits || ! sizeFits )
+    {
+        FINE( "ts: eh: pax header for " << QS( name ) );
+
+        string records;
+        if ( ! nameFits )
+            records += paxRecord( "path", name );
+        if ( ! sizeFits )
+            records += paxRecord( "size", std::to_string( size ) );
+
+        // the pax header's own name only matters to readers that
+        // don't understand it, which extract it as a file.
+        const size_t slash( name.rfind( '/' ) );
+        const string paxName( "PaxHeaders/" +
+                              ( slash == string::npos ? name : name.substr( slash + 1 ) ) );
+        fillHeader( h, paxName, "", records.size(), mtime, 0644, 'x' );
+        emit( reinterpret_cast< const char * >( &h ), sizeof( h ) );
+        emit( records.data(), records.size() );
+        emitPadding();
+
+        // the ustar fields get whatever fits.
+        if ( ! nameFits )
+        {
+            prefix.clear();
+            base = name;
+        }
+    }
+
+    fillHeader( h, base, prefix, size, mtime, mode, '0' );
+    emit( reinterpret_cast< const char * >( &h ), sizeof( h ) );
+}
+
+void
+TarStreamer::emitFileData( const int fd, const uint64_t size, const string & name )
+{
+    uint64_t done( 0 );
+
+    if ( ! m_bGzip && size >= SENDFILE_MIN_BYTES )
+    {
+        // ordering: everything before this in the stream goes first.
+        flushPending();
+        done = m_sender.sendFile( fd, 0, size );
+        m_offset += done;
+        FINE( "ts: efd: " << QS( name ) << ": " << done << " of " << size <<
+              " bytes by sendFile()" );
+    }
+
+    if ( done < size && m_readBuf.empty() )
+        m_readBuf.resize( READ_BYTES );
+
+    while ( done < size )
+    {
+        const size_t want( static_cast< size_t >( std::min< uint64_t >( size - done, m_readBuf.size() ) ) );
+        const ssize_t n( pread( fd, m_readBuf.data(), want, static_cast< off_t >( done ) ) );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            throw OSError( "read " + name );
+        if ( n == 0 )
+        {
+            // the header already promised the full size.
+            WARN( "ts: " << QS( name ) << " shrank to " << done << " of " << size <<
+                  " bytes as it was read; padding with zeros" );
+            emitZeros( size - done );
+            break;
+        }
+        emit( m_readBuf.data(), static_cast< size_t >( n ) );
+        done += static_cast< uint64_t >( n );
+    }
+
+    emitPadding();
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
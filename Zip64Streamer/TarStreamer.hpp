@@ -0,0 +1,151 @@
+#ifndef COM_FOIANI_Z64S_TARSTREAMER_HPP
+#define COM_FOIANI_Z64S_TARSTREAMER_HPP 1
+
+/**
+ * @file TarStreamer.hpp
+ *
+ * Stream files as a POSIX (pax) tar archive instead of a ZIP, through
+ * the same Sender, and taking files, patterns and Sources the same
+ * way as Zip64Streamer.
+ *
+ * Each entry is a ustar header followed by the content, padded to a
+ * 512-byte block.  Names too long to fit the ustar name and prefix
+ * fields, and sizes of 8 GiB or more, go in a pax extended header
+ * ('x') just before it.  The mtime is the one Zip64Streamer records
+ * (see zip64::fillDateTime()), and files get the same mode as in a
+ * ZIP; owners are 0, so the archive depends only on what is added.
+ *
+ * Since tar has no central directory, nothing is kept per entry and
+ * memory use stays the same however many files are added.  When the
+ * output isn't compressed, file content is handed to the sender's
+ * sendFile() and need never be copied into user space.  The whole
+ * stream can instead be gzip'ed (a .tar.gz); then everything is read
+ * and compressed here.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix / library headers
+#include <zlib.h>
+
+// standard C++ headers
+#include <cstdint>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Stream zero or more files as a pax tar archive. */
+class TarStreamer
+{
+
+public:
+
+    typedef Zip64Streamer::Sender Sender;
+    typedef Zip64Streamer::Source Source;
+    typedef Zip64Streamer::EntryAttributes EntryAttributes;
+
+    /** Start the streamer in directory @a dir.  */
+    TarStreamer( const string & dir, Sender & sender );
+
+    /** Standard destructor; calls finish() if the caller didn't. */
+    ~TarStreamer();
+
+    /**
+     * Write the end-of-archive blocks, finish compressing, and flush
+     * the sender.  Nothing can be added afterwards.
+     */
+    void finish();
+
+    /** Add a single @a file (relative to dir given in constructor). */
+    void addFile( const string & file );
+
+    /**
+     * Add all files that match @a pattern (relative to dir given in
+     * constructor).  Returns how many were added.
+     */
+    size_t addFileByPattern( const string & pattern );
+
+    /**
+     * Add all files that match any of @a patterns, each once, in one
+     * walk of the directory tree; see Zip64Streamer::addFilesByPatterns().
+     * Returns how many were added.
+     */
+    size_t addFilesByPatterns( const StringList & patterns );
+
+    /**
+     * Add an entry called @a name whose content is pulled from
+     * @a source until it runs dry.  A tar header needs the size
+     * first, so a source without a sizeHint() is read into memory
+     * before anything is sent; one that runs past its hint throws.
+     */
+    void addEntry( const string & name,
+                   Source & source,
+                   const EntryAttributes & attrs = EntryAttributes() );
+
+    /**
+     * Gzip the whole stream at @a level (or not, if @a on is false).
+     * That rules out sendFile().  Must be set before anything is
+     * added.
+     */
+    void setGzip( bool on, int level = Z_DEFAULT_COMPRESSION );
+
+    /** Entries added so far. */
+    uint64_t entries() const { return m_entries; }
+
+    /** Tar bytes produced so far (before any gzip'ing). */
+    uint64_t offset() const { return m_offset; }
+
+private:
+
+    const string m_sDir;
+    Sender & m_sender;
+
+    uint64_t m_offset;
+    uint64_t m_entries;
+
+    bool m_bFinished;
+    void requireOpen() const;
+
+    // uncompressed output is batched here up to OUTPUT_BYTES per send.
+    CharBuffer m_pending;
+    void flushPending();
+
+    /** Append @a len bytes of tar stream, compressing them if need be. */
+    void emit( const char * data, size_t len );
+
+    void emitZeros( uint64_t n );
+
+    /** Append zeros to the end of the current 512-byte block. */
+    void emitPadding();
+
+    bool m_bGzip;
+    struct z_stream_s m_zs;
+    bool m_bZStreamInit;
+    void deflateOutput( int flush );
+
+    // file content is read through here when it can't be sent directly.
+    CharBuffer m_readBuf;
+
+    /** Header block(s) for @a name, with a pax header first if need be. */
+    void emitHeader( const string & name, uint64_t size, uint32_t mtime, uint32_t mode );
+
+    /** Send @a size bytes of @a fd, from the start, then the padding. */
+    void emitFileData( int fd, uint64_t size, const string & name );
+
+    TarStreamer( const TarStreamer & );
+    TarStreamer & operator=( const TarStreamer & );
+
+}; // end class TarStreamer
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_TARSTREAMER_HPP
@@ -0,0 +1,192 @@
+/**
+ * @file TarStreamerTest.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Sources.hpp"
+
+// header under test
+#include "TarStreamer.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+/** Writes to a file, taking file content by sendfile(2). */
+class FileSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+    FileSender( const string & filename, bool useSendFile );
+    ~FileSender();
+
+    virtual void send( CharBuffer & b );
+    virtual void send( string & s );
+    virtual uint64_t sendFile( int fd, uint64_t offset, uint64_t length );
+
+    uint64_t sentByFile() const { return m_sentByFile; }
+
+private:
+
+    FileSender( const FileSender & );
+    FileSender & operator=( const FileSender & );
+
+    const string m_filename;
+    const bool m_bUseSendFile;
+    int m_fd;
+    uint64_t m_sentByFile;
+
+    void write( const char * data, size_t len );
+
+};
+
+FileSender::FileSender( const string & filename, const bool useSendFile )
+    : m_filename( filename ),
+      m_bUseSendFile( useSendFile ),
+      m_fd( open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 ) ),
+      m_sentByFile( 0 )
+{
+    if ( m_fd < 0 )
+        throw OSError( "open " + m_filename );
+    DEBUG( "fs: ctor: done" );
+}
+
+FileSender::~FileSender()
+{
+    close( m_fd );
+    DEBUG( "fs: dtor: done" );
+}
+
+void
+FileSender::write( const char * data, size_t len )
+{
+    while ( len > 0 )
+    {
+        const ssize_t n( ::write( m_fd, data, len ) );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            throw OSError( "write " + m_filename );
+        data += n;
+        len -= static_cast< size_t >( n );
+    }
+}
+
+/* virtual */ void
+FileSender::send( CharBuffer & b )
+{
+    write( b.data(), b.size() );
+}
+
+/* virtual */ void
+FileSender::send( string & s )
+{
+    write( s.data(), s.size() );
+}
+
+/* virtual */ uint64_t
+FileSender::sendFile( const int fd, const uint64_t offset, const uint64_t length )
+{
+    if ( ! m_bUseSendFile )
+        return 0;
+
+    off_t pos( static_cast< off_t >( offset ) );
+    uint64_t sent( 0 );
+    while ( sent < length )
+    {
+        const ssize_t n( ::sendfile( m_fd, fd, &pos, length - sent ) );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            throw OSError( "sendfile to " + m_filename );
+        if ( n == 0 )
+            break;
+        sent += static_cast< uint64_t >( n );
+    }
+    m_sentByFile += sent;
+    return sent;
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    if ( argc < 3 )
+    {
+        ERROR( "usage: " << argv[0] << " TARFILE "
+               "[--gzip] [--no-sendfile] [FILE/PATTERN | --stdin NAME]..." );
+        return 1;
+    }
+
+    const string tarFile( argv[1] );
+
+    bool useSendFile( true );
+    for ( int i = 2; i < argc; ++i )
+        if ( string( argv[i] ) == "--no-sendfile" )
+            useSendFile = false;
+
+    try
+    {
+        DEBUG( "creating file sender for " << QS( tarFile ) );
+        FileSender sender( tarFile, useSendFile );
+
+        const string dir( "." );
+        DEBUG( "creating tar streamer in dir " << QS( dir ) );
+        TarStreamer ts( dir, sender );
+
+        // consecutive patterns are matched together, in one pass.
+        StringList patterns;
+
+        for ( int i = 2; i < argc; ++i )
+        {
+            const string pat( argv[i] );
+            if ( pat.compare( 0, 2, "--" ) == 0 && ! patterns.empty() )
+            {
+                ts.addFilesByPatterns( patterns );
+                patterns.clear();
+            }
+            if ( pat == "--gzip" )
+            {
+                ts.setGzip( true );
+                continue;
+            }
+            if ( pat == "--no-sendfile" )
+                continue;
+            if ( pat == "--stdin" && i + 1 < argc )
+            {
+                const string name( argv[++i] );
+                FINE( "adding stdin as " << QS( name ) );
+                FdSource source( 0 );
+                ts.addEntry( name, source );
+                continue;
+            }
+            FINE( "adding pattern " << QS( pat ) );
+            patterns.push_back( pat );
+        }
+        if ( ! patterns.empty() )
+            ts.addFilesByPatterns( patterns );
+
+        ts.finish();
+        std::cout << ts.entries() << " entries, " << ts.offset() << " tar bytes, "
+                  << sender.sentByFile() << " by sendfile" << std::endl;
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( e.what() );
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+/**
+ * @file Zip64Checkpoint.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <sstream>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Manifest.hpp"
+
+// interface
+#include "Zip64Checkpoint.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+const char * const JOURNAL_HEADER = "z64s journal v1";
+
+/** Write all of @a data to @a fd; throws on error. */
+void
+writeAll( const int fd, const char * data, size_t len, const string & what )
+{
+    while ( len > 0 )
+    {
+        const ssize_t n( ::write( fd, data, len ) );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            throw OSError( "write " + what );
+        data += n;
+        len -= static_cast< size_t >( n );
+    }
+}
+
+void
+syncFd( const int fd, const string & what )
+{
+    if ( fdatasync( fd ) != 0 )
+        throw OSError( "sync " + what );
+}
+
+/** Parse an "E" record (after the tag) into @a ei; false if it's torn or garbled. */
+bool
+parseEntry( const string & rec, Zip64EntryInfo & ei )
+{
+    std::istringstream iss( rec );
+    iss >> std::hex >> ei.offset >> ei.uncompressed >> ei.compressed >> ei.crc32
+        >> ei.flags >> ei.method >> ei.msdos_time >> ei.msdos_date
+        >> ei.stat_atime >> ei.stat_mtime >> ei.mode;
+    if ( ! iss || iss.get() != ' ' )
+        return false;
+
+    string rest;
+    std::getline( iss, rest );
+    ei.name = Zip64Manifest::unescapeName( rest );
+    return ! ei.name.empty();
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+Zip64CheckpointFile::Zip64CheckpointFile( const string & path )
+    : m_path( path ),
+      m_journalPath( path + ".journal" ),
+      m_fd( -1 ),
+      m_journalFd( -1 ),
+      m_length( 0 ),
+      m_entries( 0 ),
+      m_bResuming( false )
+{
+    m_state.length = 0;
+    m_state.outputCrc = 0;
+    m_state.outputAdler = 0;
+
+    const uint64_t journalBytes( loadJournal() );
+
+    if ( journalBytes == 0 )
+    {
+        DEBUG( "cp: ctor: new archive " << QS( m_path ) );
+
+        m_fd = open( m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+        if ( m_fd < 0 )
+            throw OSError( "open " + m_path );
+
+        m_journalFd = open( m_journalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+        if ( m_journalFd < 0 )
+            throw OSError( "open " + m_journalPath );
+
+        const string header( string( JOURNAL_HEADER ) + "\n" );
+        writeAll( m_journalFd, header.data(), header.size(), m_journalPath );
+        syncFd( m_journalFd, m_journalPath );
+        return;
+    }
+
+    m_bResuming = true;
+    m_length = m_state.length;
+    m_entries = m_state.entries.size();
+
+    DEBUG( "cp: ctor: resuming " << QS( m_path ) << " at " << m_length <<
+           " bytes, " << m_entries << " entries" );
+
+    m_fd = open( m_path.c_str(), O_WRONLY | O_CLOEXEC );
+    if ( m_fd < 0 )
+        throw OSError( "open " + m_path );
+
+    struct stat st;
+    if ( fstat( m_fd, &st ) != 0 )
+        throw OSError( "stat " + m_path );
+    if ( static_cast< uint64_t >( st.st_size ) < m_length )
+        throw std::runtime_error( "cp: " + m_path + " is shorter than its journal says" );
+
+    // drop whatever was written after the last commit, in both.
+    if ( ftruncate( m_fd, static_cast< off_t >( m_length ) ) != 0 )
+        throw OSError( "truncate " + m_path );
+    if ( lseek( m_fd, 0, SEEK_END ) < 0 )
+        throw OSError( "seek " + m_path );
+
+    m_journalFd = open( m_journalPath.c_str(), O_WRONLY | O_CLOEXEC );
+    if ( m_journalFd < 0 )
+        throw OSError( "open " + m_journalPath );
+    if ( ftruncate( m_journalFd, static_cast< off_t >( journalBytes ) ) != 0 )
+        throw OSError( "truncate " + m_journalPath );
+    if ( lseek( m_journalFd, 0, SEEK_END ) < 0 )
+        throw OSError( "seek " + m_journalPath );
+}
+
+/* virtual */
+Zip64CheckpointFile::~Zip64CheckpointFile()
+{
+    if ( m_fd != -1 )
+        close( m_fd );
+    if ( m_journalFd != -1 )
+        close( m_journalFd );
+
+    DEBUG( "cp: dtor: " << m_length << " bytes, " << m_entries << " entries" );
+}
+
+uint64_t
+Zip64CheckpointFile::loadJournal()
+{
+    const int fd( open( m_journalPath.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+    {
+        if ( errno == ENOENT )
+            return 0;
+        throw OSError( "open " + m_journalPath );
+    }
+
+    string text;
+    char buf[ 64 * 1024 ];
+    while ( true )
+    {
+        const ssize_t n( read( fd, buf, sizeof( buf ) ) );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+        {
+            const int savedErrno( errno );
+            close( fd );
+            errno = savedErrno;
+            throw OSError( "read " + m_journalPath );
+        }
+        if ( n == 0 )
+            break;
+        text.append( buf, static_cast< size_t >( n ) );
+    }
+    close( fd );
+
+    // only whole lines count; stop at the first one that doesn't parse.
+    std::vector< Zip64EntryInfo > uncommitted;
+    uint64_t committedBytes( 0 );
+    size_t pos( 0 );
+    bool first( true );
+    while ( true )
+    {
+        const size_t eol( text.find( '\n', pos ) );
+        if ( eol == string::npos )
+            break;
+        const string line( text, pos, eol - pos );
+        pos = eol + 1;
+
+        if ( first )
+        {
+            if ( line != JOURNAL_HEADER )
+                throw std::runtime_error( "cp: " + m_journalPath + " isn't a journal" );
+            first = false;
+            continue;
+        }
+
+        if ( line.compare( 0, 2, "E " ) == 0 )
+        {
+            Zip64EntryInfo ei;
+            if ( ! parseEntry( line.substr( 2 ), ei ) )
+                break;
+            uncommitted.push_back( ei );
+        }
+        else if ( line.compare( 0, 2, "C " ) == 0 )
+        {
+            std::istringstream iss( line.substr( 2 ) );
+            uint64_t length, entries;
+            uint32_t crc, adler;
+            iss >> std::hex >> length >> entries >> crc >> adler;
+            if ( ! iss || entries != m_state.entries.size() + uncommitted.size() )
+                break;
+
+            m_state.entries.insert( m_state.entries.end(), uncommitted.begin(), uncommitted.end() );
+            uncommitted.clear();
+            m_state.length = length;
+            m_state.outputCrc = crc;
+            m_state.outputAdler = adler;
+            committedBytes = pos;
+        }
+        else
+            break;
+    }
+
+    if ( first )
+        return 0;   // not even a header: the run died as it started
+
+    if ( committedBytes == 0 )
+        committedBytes = strlen( JOURNAL_HEADER ) + 1;
+
+    if ( ! uncommitted.empty() )
+        DEBUG( "cp: dropping " << uncommitted.size() << " uncommitted entries" );
+
+    return committedBytes;
+}
+
+void
+Zip64CheckpointFile::write( const char * data, const size_t len )
+{
+    writeAll( m_fd, data, len, m_path );
+    m_length += len;
+}
+
+/* virtual */ void
+Zip64CheckpointFile::send( CharBuffer & b )
+{
+    write( b.data(), b.size() );
+}
+
+/* virtual */ void
+Zip64CheckpointFile::send( string & s )
+{
+    write( s.data(), s.size() );
+}
+
+void
+Zip64CheckpointFile::addEntry( const Zip64EntryInfo & ei )
+{
+    std::ostringstream oss;
+    oss << std::hex
+        << "E " << ei.offset << " " << ei.uncompressed << " " << ei.compressed
+        << " " << ei.crc32 << " " << ei.flags << " " << ei.method
+        << " " << ei.msdos_time << " " << ei.msdos_date
+        << " " << ei.stat_atime << " " << ei.stat_mtime << " " << ei.mode
+        << " " << Zip64Manifest::escapeName( ei.name ) << "\n";
+    m_journalBuf += oss.str();
+    ++m_entries;
+}
+
+void
+Zip64CheckpointFile::commit( const uint64_t length,
+                             const uint32_t outputCrc,
+                             const uint32_t outputAdler )
+{
+    if ( length != m_length )
+        throw std::logic_error( "cp: commit at " + std::to_string( length ) +
+                                " but " + std::to_string( m_length ) + " bytes written" );
+
+    // the archive has to be on disk before the journal says it is.
+    syncFd( m_fd, m_path );
+
+    std::ostringstream oss;
+    oss << std::hex
+        << "C " << length << " " << m_entries << " " << outputCrc << " " << outputAdler << "\n";
+    m_journalBuf += oss.str();
+
+    writeAll( m_journalFd, m_journalBuf.data(), m_journalBuf.size(), m_journalPath );
+    syncFd( m_journalFd, m_journalPath );
+    m_journalBuf.clear();
+
+    FINE( "cp: committed " << length << " bytes, " << m_entries << " entries" );
+}
+
+void
+Zip64CheckpointFile::complete()
+{
+    if ( m_journalFd == -1 )
+        return;
+
+    syncFd( m_fd, m_path );
+
+    close( m_journalFd );
+    m_journalFd = -1;
+    if ( unlink( m_journalPath.c_str() ) != 0 && errno != ENOENT )
+        throw OSError( "remove " + m_journalPath );
+
+    DEBUG( "cp: complete: " << m_length << " bytes, " << m_entries << " entries" );
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
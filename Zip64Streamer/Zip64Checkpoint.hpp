@@ -0,0 +1,135 @@
+#ifndef COM_FOIANI_Z64S_ZIP64CHECKPOINT_HPP
+#define COM_FOIANI_Z64S_ZIP64CHECKPOINT_HPP 1
+
+/**
+ * @file Zip64Checkpoint.hpp
+ *
+ * An archive file with a sidecar journal, so that a long archive job
+ * that dies part way through (OOM kill, node drain) can pick up where
+ * it left off rather than start again.
+ *
+ * The streamer (see Zip64Streamer::setCheckpoint()) records each
+ * finished entry's central directory details in the journal, and every
+ * so often commits: the archive is synced to disk, then a commit
+ * record with the archive's length is appended to the journal and that
+ * is synced too.  Entries after the last commit don't count.
+ *
+ * Opening an archive whose journal is still there (the job never got
+ * as far as finishing it) truncates the archive to the last commit;
+ * the streamer then carries on after the entries already written.
+ * Once the archive is finished the journal is removed.
+ *
+ * The journal is text, one record per line:
+ *
+ *   z64s journal v1
+ *   E OFFSET UNCOMPRESSED COMPRESSED CRC32 FLAGS METHOD DOSTIME DOSDATE ATIME MTIME MODE NAME
+ *   C LENGTH ENTRIES OUTPUT_CRC32 OUTPUT_ADLER32
+ *
+ * with numbers in hex and the name escaped as in Zip64Manifest.  A
+ * torn last line, and anything after the last commit, are ignored.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdint>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Format.hpp"
+#include "Zip64Streamer.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Archive file sender that journals its progress, for resuming. */
+class Zip64CheckpointFile
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    /** What the journal had committed when the file was opened. */
+    struct State
+    {
+        uint64_t length;         // archive bytes
+        uint32_t outputCrc;      // CRC-32 and Adler-32 of those bytes,
+        uint32_t outputAdler;    // if the streamer was keeping them
+        std::vector< Zip64EntryInfo > entries;
+    };
+
+    /**
+     * Open archive @a path, with its journal at @a path + ".journal".
+     * If the journal is there, resume from its last commit; otherwise
+     * start a new, empty archive.  Throws if the archive is shorter
+     * than the journal says.
+     */
+    explicit Zip64CheckpointFile( const string & path );
+
+    /** Closes the files; the journal stays unless complete() was called. */
+    virtual ~Zip64CheckpointFile();
+
+    virtual void send( CharBuffer & b );
+    virtual void send( string & s );
+
+    /** Whether there was an earlier run to resume. */
+    bool resuming() const { return m_bResuming; }
+
+    /** The earlier run's committed state (empty if not resuming). */
+    const State & state() const { return m_state; }
+
+    /** Archive bytes written so far, including any resumed. */
+    uint64_t length() const { return m_length; }
+
+    /** Note @a ei as written; it's in the journal from the next commit() on. */
+    void addEntry( const Zip64EntryInfo & ei );
+
+    /**
+     * Sync the archive, which must be @a length bytes long by now,
+     * then commit everything noted so far to the journal, along with
+     * @a outputCrc and @a outputAdler.
+     */
+    void commit( uint64_t length, uint32_t outputCrc, uint32_t outputAdler );
+
+    /** The archive is finished: sync it and remove the journal. */
+    void complete();
+
+private:
+
+    Zip64CheckpointFile( const Zip64CheckpointFile & );
+    Zip64CheckpointFile & operator=( const Zip64CheckpointFile & );
+
+    const string m_path;
+    const string m_journalPath;
+
+    int m_fd;
+    int m_journalFd;
+
+    uint64_t m_length;
+    uint64_t m_entries;     // entries in the journal, committed or not
+
+    bool m_bResuming;
+    State m_state;
+
+    // journal records not yet written out
+    string m_journalBuf;
+
+    /**
+     * Read the journal into m_state; returns the length of its
+     * committed part, or 0 if it has none.
+     */
+    uint64_t loadJournal();
+
+    void write( const char * data, size_t len );
+
+}; // end class Zip64CheckpointFile
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64CHECKPOINT_HPP
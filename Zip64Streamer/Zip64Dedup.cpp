@@ -0,0 +1,359 @@
+/**
+ * @file Zip64Dedup.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <algorithm>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "Zip64Dedup.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+const uint64_t HASH_MUL_1 = 0x9e3779b97f4a7c15ULL;
+const uint64_t HASH_MUL_2 = 0xbf58476d1ce4e5b9ULL;
+const uint64_t HASH_MUL_3 = 0x94d049bb133111ebULL;
+
+// bytes handed to replay's callback at a time
+const size_t REPLAY_CHUNK_BYTES = 256 * 1024;
+
+inline uint64_t
+rotl64( const uint64_t x, const int n )
+{
+    return ( x << n ) | ( x >> ( 64 - n ) );
+}
+
+inline uint64_t
+load64le( const char * p )
+{
+    const unsigned char * u( reinterpret_cast< const unsigned char * >( p ) );
+    uint64_t w( 0 );
+    for ( int i = 7; i >= 0; --i )
+        w = ( w << 8 ) | u[i];
+    return w;
+}
+
+} // end namespace [anonymous]
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+// ---------------------------------------------------------------------
+// Hasher
+
+Zip64DedupCache::Hasher::Hasher()
+    : m_state( HASH_MUL_1 ),
+      m_length( 0 ),
+      m_tailBytes( 0 )
+{
+}
+
+void
+Zip64DedupCache::Hasher::mix( const uint64_t word )
+{
+    m_state = rotl64( m_state ^ ( word * HASH_MUL_1 ), 31 ) * HASH_MUL_2;
+}
+
+void
+Zip64DedupCache::Hasher::update( const char * data, size_t len )
+{
+    m_length += len;
+
+    if ( m_tailBytes )
+    {
+        const size_t n( std::min( len, sizeof( m_tail ) - m_tailBytes ) );
+        memcpy( m_tail + m_tailBytes, data, n );
+        m_tailBytes += n;
+        data += n;
+        len -= n;
+        if ( m_tailBytes < sizeof( m_tail ) )
+            return;
+        mix( load64le( m_tail ) );
+        m_tailBytes = 0;
+    }
+
+    for ( ; len >= 8; data += 8, len -= 8 )
+        mix( load64le( data ) );
+
+    memcpy( m_tail, data, len );
+    m_tailBytes = len;
+}
+
+uint64_t
+Zip64DedupCache::Hasher::digest() const
+{
+    uint64_t h( m_state );
+    if ( m_tailBytes )
+    {
+        char last[ 8 ] = { 0 };
+        memcpy( last, m_tail, m_tailBytes );
+        h = rotl64( h ^ ( load64le( last ) * HASH_MUL_1 ), 31 ) * HASH_MUL_2;
+    }
+
+    // splitmix64's finalizer, with the length folded in
+    h ^= m_length;
+    h = ( h ^ ( h >> 30 ) ) * HASH_MUL_2;
+    h = ( h ^ ( h >> 27 ) ) * HASH_MUL_3;
+    return h ^ ( h >> 31 );
+}
+
+// ---------------------------------------------------------------------
+// Zip64DedupCache
+
+Zip64DedupCache::Zip64DedupCache( const size_t memoryBytes, const uint64_t spillBytes )
+    : m_memoryLimit( memoryBytes ),
+      m_spillLimit( spillBytes ),
+      m_spillFd( -1 ),
+      m_spillEnd( 0 ),
+      m_bCaptureSpilled( false ),
+      m_captureBytes( 0 ),
+      m_bCaptureFailed( false )
+{
+    zeroStruct( m_stats );
+}
+
+Zip64DedupCache::~Zip64DedupCache()
+{
+    if ( m_spillFd != -1 )
+        close( m_spillFd );
+
+    DEBUG( "dd: dtor: " <<
+           m_stats.hardLinks << " hard links, " <<
+           m_stats.sameContent << " same content, " <<
+           m_stats.bytesDeduped << " bytes deduplicated, " <<
+           m_stats.cpuSecondsSaved << "s cpu saved; " <<
+           m_stats.cachedEntries << " cached (" <<
+           m_stats.memoryBytes << " in memory, " <<
+           m_stats.spilledBytes << " spilled)" );
+}
+
+const Zip64DedupCache::Entry *
+Zip64DedupCache::findLink( const uint64_t device, const uint64_t inode ) const
+{
+    const std::map< Key, size_t >::const_iterator it( m_byLink.find( Key( device, inode ) ) );
+    return it == m_byLink.end() ? 0 : &m_entries[ it->second ];
+}
+
+bool
+Zip64DedupCache::hasCandidates( const uint64_t size, const uint64_t firstHash ) const
+{
+    return m_byContent.find( Key( size, firstHash ) ) != m_byContent.end();
+}
+
+const Zip64DedupCache::Entry *
+Zip64DedupCache::find( const uint64_t size, const uint64_t firstHash,
+                       const uint64_t fullHash, const uint32_t crc32 ) const
+{
+    const std::map< Key, std::vector< size_t > >::const_iterator it(
+        m_byContent.find( Key( size, firstHash ) ) );
+    if ( it == m_byContent.end() )
+        return 0;
+
+    for ( const size_t i : it->second )
+    {
+        const Entry & e( m_entries[i] );
+        if ( e.fullHash == fullHash && e.crc32 == crc32 )
+            return &e;
+    }
+
+    return 0;
+}
+
+void
+Zip64DedupCache::beginCapture()
+{
+    m_captureBuf.clear();
+    m_bCaptureSpilled = false;
+    m_captureBytes = 0;
+    m_bCaptureFailed = false;
+}
+
+bool
+Zip64DedupCache::spillWrite( const char * data, size_t len, uint64_t offset )
+{
+    if ( m_spillFd == -1 )
+    {
+        const char * const dir( getenv( "TMPDIR" ) );
+        string path( string( dir && *dir ? dir : "/tmp" ) + "/z64s-dedup-XXXXXX" );
+        m_spillFd = mkstemp( &path[0] );
+        if ( m_spillFd == -1 )
+        {
+            WARN( "dd: can't create spill file in " << QS( path ) << ": " << strerror( errno ) );
+            return false;
+        }
+        unlink( path.c_str() );
+        DEBUG( "dd: spilling to " << QS( path ) );
+    }
+
+    while ( len > 0 )
+    {
+        const ssize_t n( pwrite( m_spillFd, data, len, static_cast< off_t >( offset ) ) );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+        {
+            WARN( "dd: spill write failed: " << strerror( errno ) );
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+void
+Zip64DedupCache::capture( const char * data, const size_t len )
+{
+    if ( m_bCaptureFailed || len == 0 )
+        return;
+
+    const uint64_t total( m_captureBytes + len );
+
+    if ( ! m_bCaptureSpilled )
+    {
+        if ( m_stats.memoryBytes + total <= m_memoryLimit )
+        {
+            m_captureBuf.insert( m_captureBuf.end(), data, data + len );
+            m_captureBytes = total;
+            return;
+        }
+
+        // out of memory budget: move what we have to the spill file
+        if ( m_spillEnd + total > m_spillLimit ||
+             ! spillWrite( m_captureBuf.data(), m_captureBuf.size(), m_spillEnd ) )
+        {
+            abandonCapture();
+            m_bCaptureFailed = true;
+            return;
+        }
+        CharBuffer().swap( m_captureBuf );
+        m_bCaptureSpilled = true;
+    }
+
+    if ( m_spillEnd + total > m_spillLimit ||
+         ! spillWrite( data, len, m_spillEnd + m_captureBytes ) )
+    {
+        abandonCapture();
+        m_bCaptureFailed = true;
+        return;
+    }
+    m_captureBytes = total;
+}
+
+bool
+Zip64DedupCache::commitCapture( const Entry & meta, const uint64_t device, const uint64_t inode )
+{
+    if ( m_bCaptureFailed || meta.compressed != m_captureBytes )
+    {
+        FINE( "dd: not caching " << meta.size << " bytes: " <<
+              ( m_bCaptureFailed ? "out of room" : "capture incomplete" ) );
+        abandonCapture();
+        return false;
+    }
+
+    const size_t index( m_entries.size() );
+    m_entries.push_back( meta );
+    Entry & e( m_entries.back() );
+
+    e.bSpilled = m_bCaptureSpilled;
+    if ( m_bCaptureSpilled )
+    {
+        e.data.clear();
+        e.spillOffset = m_spillEnd;
+        m_spillEnd += m_captureBytes;
+        m_stats.spilledBytes += m_captureBytes;
+    }
+    else
+    {
+        // copy rather than swap, so capacity slack doesn't count against us unseen
+        e.data.assign( m_captureBuf.begin(), m_captureBuf.end() );
+        e.spillOffset = 0;
+        m_stats.memoryBytes += m_captureBytes;
+    }
+
+    m_byContent[ Key( e.size, e.firstHash ) ].push_back( index );
+    if ( inode != 0 )
+        m_byLink[ Key( device, inode ) ] = index;
+    ++m_stats.cachedEntries;
+
+    beginCapture();
+    return true;
+}
+
+void
+Zip64DedupCache::abandonCapture()
+{
+    // anything spilled is simply overwritten by the next capture
+    m_captureBuf.clear();
+    m_bCaptureSpilled = false;
+    m_captureBytes = 0;
+}
+
+void
+Zip64DedupCache::replay( const Entry & e, const std::function< void ( CharBuffer & ) > & send ) const
+{
+    CharBuffer buf;
+    uint64_t done( 0 );
+    while ( done < e.compressed )
+    {
+        const size_t n( static_cast< size_t >( std::min< uint64_t >( REPLAY_CHUNK_BYTES, e.compressed - done ) ) );
+        if ( ! e.bSpilled )
+        {
+            buf.assign( e.data.begin() + done, e.data.begin() + done + n );
+        }
+        else
+        {
+            buf.resize( n );
+            size_t got( 0 );
+            while ( got < n )
+            {
+                const ssize_t r( pread( m_spillFd, buf.data() + got, n - got,
+                                        static_cast< off_t >( e.spillOffset + done + got ) ) );
+                if ( r < 0 && errno == EINTR )
+                    continue;
+                if ( r < 0 )
+                    throw OSError( "dd: reading spill file" );
+                if ( r == 0 )
+                    throw std::runtime_error( "dd: spill file truncated" );
+                got += r;
+            }
+        }
+        send( buf );
+        done += n;
+    }
+}
+
+void
+Zip64DedupCache::noteDuplicate( const Entry & e, const bool hardLink, const double cpuSeconds )
+{
+    if ( hardLink )
+        ++m_stats.hardLinks;
+    else
+        ++m_stats.sameContent;
+    m_stats.bytesDeduped += e.size;
+    m_stats.bytesReplayed += e.compressed;
+    m_stats.cpuSecondsSaved += std::max( 0.0, e.cpuSeconds - cpuSeconds );
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
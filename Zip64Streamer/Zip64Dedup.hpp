@@ -0,0 +1,171 @@
+#ifndef COM_FOIANI_Z64S_ZIP64DEDUP_HPP
+#define COM_FOIANI_Z64S_ZIP64DEDUP_HPP 1
+
+/**
+ * @file Zip64Dedup.hpp
+ *
+ * Compressed output of entries already in an archive, kept so that a
+ * later entry with the same content can reuse it rather than read and
+ * deflate it all over again.
+ *
+ * Entries are found two ways: by (device, inode), for hard links, and
+ * by size plus a hash of the first 4 KiB, confirmed by the CRC-32 and
+ * a 64-bit hash over the whole content.  The hashes are quick, not
+ * cryptographic; identical-looking content crafted to collide would
+ * fool them.
+ *
+ * Compressed bytes are captured while the entry is produced, into
+ * memory up to one limit and then into an unlinked temporary file up
+ * to another.  Once both are used up nothing more is cached; what's
+ * there stays.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Cache of compressed entry data, keyed by content and by inode. */
+class Zip64DedupCache
+{
+
+public:
+
+    /** Bytes covered by Entry::firstHash. */
+    static const size_t FIRST_BLOCK_BYTES = 4096;
+
+    /** 64-bit content hash, fed a piece at a time. */
+    class Hasher
+    {
+
+    public:
+
+        Hasher();
+
+        void update( const char * data, size_t len );
+        uint64_t digest() const;
+
+    private:
+
+        uint64_t m_state;
+        uint64_t m_length;
+        char m_tail[ 8 ];
+        size_t m_tailBytes;
+
+        void mix( uint64_t word );
+
+    };
+
+    struct Entry
+    {
+        uint64_t size;          // uncompressed bytes
+        uint64_t firstHash;     // Hasher over the first FIRST_BLOCK_BYTES
+        uint64_t fullHash;      // Hasher over everything
+        uint32_t crc32;
+        uint16_t method;
+        uint64_t compressed;
+        double cpuSeconds;      // what producing it cost the streamer's thread
+
+        // where the compressed bytes are
+        CharBuffer data;
+        bool bSpilled;
+        uint64_t spillOffset;
+    };
+
+    struct Stats
+    {
+        uint64_t hardLinks;        // duplicates found by inode
+        uint64_t sameContent;      // duplicates found by content
+        uint64_t bytesDeduped;     // uncompressed bytes not read and deflated again
+        uint64_t bytesReplayed;    // compressed bytes sent from the cache
+        double cpuSecondsSaved;    // original cost, less the cost of replaying
+        uint64_t cachedEntries;
+        uint64_t memoryBytes;
+        uint64_t spilledBytes;
+    };
+
+    Zip64DedupCache( size_t memoryBytes, uint64_t spillBytes );
+    ~Zip64DedupCache();
+
+    /** Cached entry for @a device / @a inode, or null. */
+    const Entry * findLink( uint64_t device, uint64_t inode ) const;
+
+    /** Whether anything cached has this @a size and @a firstHash. */
+    bool hasCandidates( uint64_t size, uint64_t firstHash ) const;
+
+    /** Cached entry with exactly this content, or null. */
+    const Entry * find( uint64_t size, uint64_t firstHash,
+                        uint64_t fullHash, uint32_t crc32 ) const;
+
+    /** Start collecting an entry's compressed bytes. */
+    void beginCapture();
+
+    /** Add @a len bytes of the entry being captured. */
+    void capture( const char * data, size_t len );
+
+    /**
+     * Keep what was captured, described by @a meta, and reachable
+     * through @a device / @a inode too if @a inode is non-zero.
+     * Returns false if it didn't fit.
+     */
+    bool commitCapture( const Entry & meta, uint64_t device, uint64_t inode );
+
+    /** Forget what was captured. */
+    void abandonCapture();
+
+    /** Hand @a e's compressed bytes to @a send, a piece at a time. */
+    void replay( const Entry & e, const std::function< void ( CharBuffer & ) > & send ) const;
+
+    /** Count a duplicate of @a e, found by inode if @a hardLink, that took @a cpuSeconds. */
+    void noteDuplicate( const Entry & e, bool hardLink, double cpuSeconds );
+
+    const Stats & stats() const { return m_stats; }
+
+private:
+
+    Zip64DedupCache( const Zip64DedupCache & );
+    Zip64DedupCache & operator=( const Zip64DedupCache & );
+
+    typedef std::pair< uint64_t, uint64_t > Key;
+
+    const size_t m_memoryLimit;
+    const uint64_t m_spillLimit;
+
+    std::deque< Entry > m_entries;
+    std::map< Key, std::vector< size_t > > m_byContent;   // (size, firstHash)
+    std::map< Key, size_t > m_byLink;                     // (device, inode)
+
+    int m_spillFd;
+    uint64_t m_spillEnd;
+
+    // the capture in progress
+    CharBuffer m_captureBuf;
+    bool m_bCaptureSpilled;
+    uint64_t m_captureBytes;
+    bool m_bCaptureFailed;
+
+    Stats m_stats;
+
+    bool spillWrite( const char * data, size_t len, uint64_t offset );
+
+}; // end class Zip64DedupCache
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64DEDUP_HPP
@@ -0,0 +1,222 @@
+/**
+ * @file Zip64Executor.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <unistd.h>
+
+// standard C++ headers
+#include <algorithm>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "Zip64Executor.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+Zip64Executor::Zip64Executor( unsigned threads, const size_t maxInFlightBytes )
+    : m_maxInFlightBytes( maxInFlightBytes ),
+      m_nextTenant( 1 ),
+      m_virtualTime( 0 ),
+      m_queued( 0 ),
+      m_inFlightBytes( 0 ),
+      m_bStopping( false )
+{
+    zeroStruct( m_stats );
+
+    if ( threads == 0 )
+        threads = static_cast< unsigned >( std::max( 1L, sysconf( _SC_NPROCESSORS_ONLN ) ) );
+
+    DEBUG( "zx: ctor: " << threads << " workers, " << maxInFlightBytes << " bytes in flight" );
+
+    for ( unsigned i = 0; i < threads; ++i )
+        m_workers.push_back( std::thread( &Zip64Executor::workerLoop, this ) );
+}
+
+Zip64Executor::~Zip64Executor()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_bStopping = true;
+    }
+    m_workCond.notify_all();
+
+    for ( std::thread & t : m_workers )
+        t.join();
+
+    DEBUG( "zx: dtor: tasks=" << m_stats.tasks << ", "
+           "max queued=" << m_stats.maxQueued << ", "
+           "max in flight=" << m_stats.maxInFlightBytes << ", "
+           "memory stalls=" << m_stats.memoryStalls );
+}
+
+Zip64Executor::TenantId
+Zip64Executor::addTenant( const double weight, const Priority priority )
+{
+    if ( ! ( weight > 0 ) )
+        throw std::invalid_argument( "tenant weight must be positive" );
+
+    std::lock_guard< std::mutex > lock( m_mutex );
+
+    const TenantId id( m_nextTenant++ );
+    Tenant & t( m_tenants[ id ] );
+    t.weight = weight;
+    t.priority = priority;
+    t.lastTag = m_virtualTime;
+
+    FINE( "zx: tenant " << id << ": weight=" << weight <<
+          ( priority == INTERACTIVE ? ", interactive" : ", bulk" ) );
+
+    return id;
+}
+
+void
+Zip64Executor::removeTenant( const TenantId tenant )
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+
+    const std::map< TenantId, Tenant >::iterator it( m_tenants.find( tenant ) );
+    if ( it == m_tenants.end() )
+        return;
+    if ( ! it->second.queue.empty() )
+        throw std::logic_error( "executor: removing tenant with queued tasks" );
+    m_tenants.erase( it );
+}
+
+std::future< void >
+Zip64Executor::submit( const TenantId tenant, const size_t cost, Task task )
+{
+    std::packaged_task< void () > pt( std::move( task ) );
+    std::future< void > rv( pt.get_future() );
+
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        const std::map< TenantId, Tenant >::iterator it( m_tenants.find( tenant ) );
+        if ( it == m_tenants.end() )
+            throw std::logic_error( "executor: unknown tenant " + std::to_string( tenant ) );
+        if ( m_bStopping )
+            throw std::logic_error( "executor: submit while stopping" );
+
+        // an idle tenant starts from the present, not from where it
+        // left off, so it can't bank credit while it was away.
+        Tenant & t( it->second );
+        const double start( std::max( m_virtualTime, t.lastTag ) );
+        t.lastTag = start + std::max< size_t >( cost, 1 ) / t.weight;
+
+        Queued q;
+        q.tag = t.lastTag;
+        q.task = std::move( pt );
+        t.queue.push_back( std::move( q ) );
+
+        ++m_queued;
+        m_stats.maxQueued = std::max( m_stats.maxQueued, m_queued );
+    }
+    m_workCond.notify_one();
+
+    return rv;
+}
+
+void
+Zip64Executor::acquire( const size_t bytes )
+{
+    std::unique_lock< std::mutex > lock( m_mutex );
+
+    if ( m_inFlightBytes > 0 && m_inFlightBytes + bytes > m_maxInFlightBytes )
+    {
+        ++m_stats.memoryStalls;
+        m_memoryCond.wait( lock, [&]{ return m_inFlightBytes == 0 ||
+                                             m_inFlightBytes + bytes <= m_maxInFlightBytes; } );
+    }
+
+    m_inFlightBytes += bytes;
+    m_stats.maxInFlightBytes = std::max< uint64_t >( m_stats.maxInFlightBytes, m_inFlightBytes );
+}
+
+bool
+Zip64Executor::tryAcquire( const size_t bytes )
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+
+    if ( m_inFlightBytes > 0 && m_inFlightBytes + bytes > m_maxInFlightBytes )
+        return false;
+
+    m_inFlightBytes += bytes;
+    m_stats.maxInFlightBytes = std::max< uint64_t >( m_stats.maxInFlightBytes, m_inFlightBytes );
+    return true;
+}
+
+void
+Zip64Executor::release( const size_t bytes )
+{
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_inFlightBytes -= std::min( bytes, m_inFlightBytes );
+    }
+    m_memoryCond.notify_all();
+}
+
+Zip64Executor::Stats
+Zip64Executor::stats() const
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    return m_stats;
+}
+
+Zip64Executor::Tenant *
+Zip64Executor::pickNext()
+{
+    // a linear scan; there are dozens of archives, not thousands.
+    Tenant * best( 0 );
+    for ( std::map< TenantId, Tenant >::value_type & entry : m_tenants )
+    {
+        Tenant & t( entry.second );
+        if ( t.queue.empty() )
+            continue;
+        if ( ! best ||
+             t.priority < best->priority ||
+             ( t.priority == best->priority && t.queue.front().tag < best->queue.front().tag ) )
+            best = &t;
+    }
+    return best;
+}
+
+void
+Zip64Executor::workerLoop()
+{
+    while ( true )
+    {
+        std::packaged_task< void () > task;
+        {
+            std::unique_lock< std::mutex > lock( m_mutex );
+            Tenant * t( 0 );
+            m_workCond.wait( lock, [&]{ return ( t = pickNext() ) || m_bStopping; } );
+            if ( ! t )
+                return;
+
+            Queued & q( t->queue.front() );
+            m_virtualTime = std::max( m_virtualTime, q.tag );
+            task = std::move( q.task );
+            t->queue.pop_front();
+            --m_queued;
+        }
+
+        // exceptions end up in the future
+        task();
+
+        std::lock_guard< std::mutex > lock( m_mutex );
+        ++m_stats.tasks;
+    }
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
@@ -0,0 +1,161 @@
+#ifndef COM_FOIANI_Z64S_ZIP64EXECUTOR_HPP
+#define COM_FOIANI_Z64S_ZIP64EXECUTOR_HPP 1
+
+/**
+ * @file Zip64Executor.hpp
+ *
+ * A compression worker pool shared by many concurrent archives.  Each
+ * Zip64Streamer given an executor registers as a "tenant" and hands
+ * it chunk-sized pieces of deflate work instead of compressing on its
+ * own thread, so one fixed set of threads does all the compressing
+ * however many archives are running.
+ *
+ * Tenants are served by weighted fair queueing: every task is tagged
+ * with a virtual finish time (its tenant's previous tag, or the
+ * current virtual time if that's later, plus its cost over the
+ * tenant's weight), and workers always take the lowest tag.  A tenant
+ * pushing 50 GB through therefore gets its share of the pool and no
+ * more, and an archive that arrives later starts level with it rather
+ * than behind its backlog.  Interactive tenants are served strictly
+ * before bulk ones.
+ *
+ * Memory in flight (chunk input plus room for its output) is capped
+ * separately: acquire() blocks a producer until enough is released,
+ * except that a lone request is always admitted so the cap can't
+ * deadlock anything.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Worker pool with per-archive weighted fair queueing and a memory cap. */
+class Zip64Executor
+{
+
+public:
+
+    enum Priority
+    {
+        /** Someone is waiting on this archive; served before any bulk work. */
+        INTERACTIVE,
+
+        /** Exports and other background work. */
+        BULK
+    };
+
+    typedef uint64_t TenantId;
+    typedef std::function< void () > Task;
+
+    struct Stats
+    {
+        uint64_t tasks;            // tasks run to completion
+        uint64_t maxQueued;        // most tasks waiting at once
+        uint64_t maxInFlightBytes; // high-water mark of acquired bytes
+        uint64_t memoryStalls;     // acquire() calls that had to wait
+    };
+
+    /**
+     * Start @a threads workers (0 means one per online CPU), allowing
+     * at most @a maxInFlightBytes to be acquired at once.
+     */
+    explicit Zip64Executor( unsigned threads = 0,
+                            size_t maxInFlightBytes = 256 * 1024 * 1024 );
+
+    /** Runs whatever is still queued, then stops the workers. */
+    ~Zip64Executor();
+
+    /** Register an archive with a share of @a weight (> 0). */
+    TenantId addTenant( double weight = 1.0, Priority priority = BULK );
+
+    /** Forget @a tenant; it must have nothing queued. */
+    void removeTenant( TenantId tenant );
+
+    /**
+     * Queue @a task for @a tenant.  @a cost (normally input bytes) is
+     * what fair queueing charges the tenant for it.  The future
+     * becomes ready when the task has run, and rethrows whatever the
+     * task threw.
+     */
+    std::future< void > submit( TenantId tenant, size_t cost, Task task );
+
+    /** Reserve @a bytes of the memory cap, waiting for others to release if needed. */
+    void acquire( size_t bytes );
+
+    /** Reserve @a bytes if that fits right now; never waits. */
+    bool tryAcquire( size_t bytes );
+
+    /** Give back @a bytes from acquire() or tryAcquire(). */
+    void release( size_t bytes );
+
+    unsigned threads() const { return static_cast< unsigned >( m_workers.size() ); }
+    size_t maxInFlightBytes() const { return m_maxInFlightBytes; }
+
+    Stats stats() const;
+
+private:
+
+    Zip64Executor( const Zip64Executor & );
+    Zip64Executor & operator=( const Zip64Executor & );
+
+    struct Queued
+    {
+        double tag;
+        std::packaged_task< void () > task;
+    };
+
+    struct Tenant
+    {
+        double weight;
+        Priority priority;
+        double lastTag;
+        std::deque< Queued > queue;
+    };
+
+    const size_t m_maxInFlightBytes;
+
+    // everything below is guarded by m_mutex
+    mutable std::mutex m_mutex;
+    std::condition_variable m_workCond;
+    std::condition_variable m_memoryCond;
+
+    std::map< TenantId, Tenant > m_tenants;
+    TenantId m_nextTenant;
+    double m_virtualTime;
+    uint64_t m_queued;
+    size_t m_inFlightBytes;
+    bool m_bStopping;
+    Stats m_stats;
+
+    std::vector< std::thread > m_workers;
+
+    /** Tenant whose head task should run next, or null; caller holds m_mutex. */
+    Tenant * pickNext();
+
+    void workerLoop();
+
+}; // end class Zip64Executor
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64EXECUTOR_HPP
@@ -0,0 +1,333 @@
+/**
+ * @file Zip64ExecutorBench.cpp
+ *
+ * Load generator for Zip64Executor.  A few large "export" archives
+ * stream continuously while small "download" archives arrive at a
+ * fixed rate, each on its own thread as in production.  Reports how
+ * long the small archives took from arrival to completion (p50, p99,
+ * max) and the exports' output rate, one JSON object per scheduling
+ * mode:
+ *
+ *   own-thread   no executor; every archive compresses on its own thread
+ *   shared-fair  one executor, every archive a bulk tenant of equal weight
+ *   shared       one executor, downloads interactive, exports bulk
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// standard C++ headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <thread>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+// header under test
+#include "Zip64Executor.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+typedef std::chrono::steady_clock Clock;
+
+/** Throw everything away, adding up the bytes in @a total. */
+class NullSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    explicit NullSender( std::atomic< uint64_t > & total ) : m_total( total ) {}
+
+    virtual void send( CharBuffer & b ) { m_total += b.size(); }
+    virtual void send( string & s )     { m_total += s.size(); }
+
+private:
+
+    std::atomic< uint64_t > & m_total;
+
+};
+
+/** Write @a bytes of compressible, log-like text to @a path (unless it's already there). */
+void
+writeTextFile( const string & path, const uint64_t bytes, uint64_t seed )
+{
+    struct stat st;
+    if ( stat( path.c_str(), &st ) == 0 && static_cast< uint64_t >( st.st_size ) == bytes )
+        return;
+
+    std::ofstream ofs( path );
+    if ( ! ofs )
+        throw OSError( "creating " + path );
+
+    static const char * const WORDS[] = {
+        "GET", "POST", "/api/v1/items", "/index.html", "200", "304", "404",
+        "INFO", "WARN", "cache", "hit", "miss", "upstream", "latency_ms="
+    };
+
+    string buf;
+    uint64_t written( 0 );
+    while ( written < bytes )
+    {
+        buf.clear();
+        while ( buf.size() < 64 * 1024 )
+        {
+            // splitmix64
+            uint64_t z( seed += 0x9e3779b97f4a7c15ULL );
+            z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+            z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+            z ^= z >> 31;
+
+            buf += WORDS[ z % ( sizeof( WORDS ) / sizeof( WORDS[0] ) ) ];
+            buf += ' ';
+            buf += std::to_string( ( z >> 20 ) % 100000 );
+            buf += ( z & 0x10000 ) ? '\n' : ' ';
+        }
+        const size_t n( std::min< uint64_t >( buf.size(), bytes - written ) );
+        ofs.write( buf.data(), n );
+        written += n;
+    }
+}
+
+void
+makeDir( const string & dir )
+{
+    if ( mkdir( dir.c_str(), 0777 ) != 0 && errno != EEXIST )
+        throw OSError( "mkdir " + dir );
+}
+
+struct Options
+{
+    string dir;
+    unsigned threads;
+    unsigned exports;
+    uint64_t exportBytes;
+    unsigned downloads;
+    unsigned downloadFiles;
+    uint64_t downloadFileBytes;
+    double rate;
+};
+
+/** The @a p'th percentile (0..1) of sorted @a v, in milliseconds. */
+double
+percentileMs( const std::vector< double > & v, const double p )
+{
+    if ( v.empty() )
+        return 0;
+    const size_t i( std::min( v.size() - 1, static_cast< size_t >( p * v.size() ) ) );
+    return v[i] * 1000;
+}
+
+void
+runMode( const string & mode, const Options & opt, bool & first )
+{
+    std::unique_ptr< Zip64Executor > executor;
+    if ( mode != "own-thread" )
+        executor.reset( new Zip64Executor( opt.threads ) );
+    const bool interactive( mode == "shared" );
+
+    std::atomic< bool > stop( false );
+    std::atomic< uint64_t > exportBytes( 0 );
+    std::atomic< uint64_t > downloadBytes( 0 );
+
+    // exports run back to back until the downloads are done
+    std::vector< std::thread > exporters;
+    for ( unsigned i = 0; i < opt.exports; ++i )
+        exporters.push_back( std::thread( [&]
+        {
+            while ( ! stop )
+            {
+                NullSender sender( exportBytes );
+                Zip64Streamer z64s( opt.dir, sender );
+                z64s.setExecutor( executor.get() );
+                z64s.addFile( "export.log" );
+                z64s.finish();
+            }
+        } ) );
+
+    // let the exports get going first
+    std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+
+    const Clock::time_point start( Clock::now() );
+    const uint64_t exportBytesAtStart( exportBytes );
+    const Clock::duration interval( std::chrono::duration_cast< Clock::duration >(
+                                        std::chrono::duration< double >( 1 / opt.rate ) ) );
+
+    std::vector< double > latencies( opt.downloads );
+    std::vector< std::thread > downloaders;
+    for ( unsigned i = 0; i < opt.downloads; ++i )
+    {
+        const Clock::time_point arrival( start + i * interval );
+        std::this_thread::sleep_until( arrival );
+
+        downloaders.push_back( std::thread( [&, i, arrival]
+        {
+            NullSender sender( downloadBytes );
+            {
+                Zip64Streamer z64s( opt.dir, sender );
+                if ( executor )
+                    z64s.setExecutor( executor.get(), 1.0,
+                                      interactive ? Zip64Executor::INTERACTIVE
+                                                  : Zip64Executor::BULK );
+                z64s.addFileByPattern( "small-*.log" );
+                z64s.finish();
+            }
+            latencies[i] = std::chrono::duration< double >( Clock::now() - arrival ).count();
+        } ) );
+    }
+
+    for ( std::thread & t : downloaders )
+        t.join();
+    const double secs( std::chrono::duration< double >( Clock::now() - start ).count() );
+
+    stop = true;
+    const uint64_t exportedDuringLoad( exportBytes - exportBytesAtStart );
+    for ( std::thread & t : exporters )
+        t.join();
+
+    std::sort( latencies.begin(), latencies.end() );
+
+    std::cout << ( first ? "[\n" : ",\n" ) << std::fixed << std::setprecision( 3 )
+              << "  { \"mode\": \"" << mode << "\""
+              << ", \"threads\": " << ( executor ? executor->threads() : 0 )
+              << ", \"exports\": " << opt.exports
+              << ", \"downloads\": " << opt.downloads
+              << ", \"download_bytes\": " << opt.downloadFiles * opt.downloadFileBytes
+              << ", \"arrivals_per_s\": " << opt.rate
+              << ", \"p50_ms\": " << percentileMs( latencies, 0.50 )
+              << ", \"p99_ms\": " << percentileMs( latencies, 0.99 )
+              << ", \"max_ms\": " << percentileMs( latencies, 1.0 )
+              << ", \"seconds\": " << secs
+              << ", \"download_mb_out_per_s\": " << downloadBytes / 1e6 / secs
+              << ", \"export_mb_out_per_s\": " << exportedDuringLoad / 1e6 / secs;
+    if ( executor )
+    {
+        const Zip64Executor::Stats st( executor->stats() );
+        std::cout << ", \"tasks\": " << st.tasks
+                  << ", \"max_queued\": " << st.maxQueued
+                  << ", \"max_in_flight_bytes\": " << st.maxInFlightBytes
+                  << ", \"memory_stalls\": " << st.memoryStalls;
+    }
+    std::cout << " }" << std::flush;
+    first = false;
+}
+
+void
+usage( const char * argv0 )
+{
+    std::cerr <<
+        "usage: " << argv0 << " [options]\n"
+        "  --dir DIR           where to put the input files (default: z64s-load)\n"
+        "  --threads N         executor workers (default: one per CPU)\n"
+        "  --exports N         concurrent large archives (default: 2)\n"
+        "  --export-mb MB      size of each large archive (default: 32)\n"
+        "  --downloads N       small archives to time (default: 40)\n"
+        "  --files N           files per small archive (default: 4)\n"
+        "  --file-kb KB        size of each of those files (default: 128)\n"
+        "  --rate R            small archive arrivals per second (default: 5)\n"
+        "  --mode M            own-thread, shared-fair or shared (repeatable;\n"
+        "                      default: all three)\n";
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    Options opt;
+    opt.dir = "z64s-load";
+    opt.threads = 0;
+    opt.exports = 2;
+    opt.exportBytes = 32ULL << 20;
+    opt.downloads = 40;
+    opt.downloadFiles = 4;
+    opt.downloadFileBytes = 128 << 10;
+    opt.rate = 5;
+    StringList modes;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        const bool hasValue( i + 1 < argc );
+        if ( arg == "--dir" && hasValue )
+            opt.dir = argv[++i];
+        else if ( arg == "--threads" && hasValue )
+            opt.threads = static_cast< unsigned >( std::atoi( argv[++i] ) );
+        else if ( arg == "--exports" && hasValue )
+            opt.exports = static_cast< unsigned >( std::atoi( argv[++i] ) );
+        else if ( arg == "--export-mb" && hasValue )
+            opt.exportBytes = static_cast< uint64_t >( std::atof( argv[++i] ) * ( 1 << 20 ) );
+        else if ( arg == "--downloads" && hasValue )
+            opt.downloads = static_cast< unsigned >( std::atoi( argv[++i] ) );
+        else if ( arg == "--files" && hasValue )
+            opt.downloadFiles = static_cast< unsigned >( std::atoi( argv[++i] ) );
+        else if ( arg == "--file-kb" && hasValue )
+            opt.downloadFileBytes = static_cast< uint64_t >( std::atof( argv[++i] ) * 1024 );
+        else if ( arg == "--rate" && hasValue )
+            opt.rate = std::atof( argv[++i] );
+        else if ( arg == "--mode" && hasValue )
+            modes.push_back( argv[++i] );
+        else
+        {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+
+    if ( opt.rate <= 0 || opt.downloads == 0 || opt.downloadFiles == 0 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    if ( modes.empty() )
+        modes = StringList{ "own-thread", "shared-fair", "shared" };
+
+    try
+    {
+        makeDir( opt.dir );
+        writeTextFile( opt.dir + "/export.log", opt.exportBytes, 1 );
+        for ( unsigned i = 0; i < opt.downloadFiles; ++i )
+            writeTextFile( opt.dir + "/small-" + std::to_string( i ) + ".log",
+                           opt.downloadFileBytes, 100 + i );
+
+        // per-chunk logging from dozens of threads would dominate the numbers
+        std::streambuf * const clogBuf( std::clog.rdbuf( 0 ) );
+
+        bool first( true );
+        for ( const string & mode : modes )
+        {
+            if ( mode != "own-thread" && mode != "shared-fair" && mode != "shared" )
+            {
+                std::clog.rdbuf( clogBuf );
+                ERROR( "unknown mode " << QS( mode ) );
+                return 1;
+            }
+            runMode( mode, opt, first );
+        }
+
+        std::clog.rdbuf( clogBuf );
+        std::cout << ( first ? "[]\n" : "\n]\n" );
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( e.what() );
+        return 1;
+    }
+
+    return 0;
+}
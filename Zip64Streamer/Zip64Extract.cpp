@@ -0,0 +1,110 @@
+/**
+ * @file Zip64Extract.cpp
+ *
+ * List, verify or extract a ZIP64 archive with Zip64Reader.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdlib>
+#include <iomanip>
+
+// local headers
+#include "Compat.hpp"
+
+// header under test
+#include "Zip64Reader.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+void
+usage( const char * argv0 )
+{
+    std::cerr <<
+        "usage: " << argv0 << " [-l | -t | -d DIR] [-j THREADS] ZIPFILE\n"
+        "  -l          list entries\n"
+        "  -t          verify every entry (the default)\n"
+        "  -d DIR      extract into DIR\n"
+        "  -j THREADS  worker threads (default: one per CPU)\n";
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    enum { LIST, VERIFY, EXTRACT } mode( VERIFY );
+    string destDir;
+    unsigned threads( 0 );
+    string zipFile;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        const bool hasValue( i + 1 < argc );
+        if ( arg == "-l" )
+            mode = LIST;
+        else if ( arg == "-t" )
+            mode = VERIFY;
+        else if ( arg == "-d" && hasValue )
+        {
+            mode = EXTRACT;
+            destDir = argv[++i];
+        }
+        else if ( arg == "-j" && hasValue )
+            threads = static_cast< unsigned >( std::atoi( argv[++i] ) );
+        else if ( zipFile.empty() && ! arg.empty() && arg[0] != '-' )
+            zipFile = arg;
+        else
+        {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+
+    if ( zipFile.empty() )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    try
+    {
+        const Zip64Reader reader( zipFile );
+
+        if ( mode == LIST )
+        {
+            for ( const Zip64EntryInfo & ei : reader.entries() )
+                std::cout << std::oct << std::setw( 7 ) << std::setfill( '0' ) << ei.mode
+                          << std::dec << std::setfill( ' ' )
+                          << " " << std::setw( 14 ) << ei.uncompressed
+                          << " " << std::setw( 14 ) << ei.compressed
+                          << " " << ei.stat_mtime
+                          << " " << ei.name << "\n";
+            return 0;
+        }
+
+        const Zip64Reader::Result r( mode == EXTRACT ? reader.extract( destDir, threads )
+                                                     : reader.verify( threads ) );
+
+        for ( const string & e : r.errors )
+            ERROR( e );
+
+        std::cout << ( mode == EXTRACT ? "extracted " : "verified " )
+                  << r.entries << " entries, " << r.bytes << " bytes in "
+                  << std::fixed << std::setprecision( 3 ) << r.seconds << "s ("
+                  << ( r.seconds > 0 ? r.bytes / 1e6 / r.seconds : 0.0 ) << " MB/s)"
+                  << ", " << r.failures << " failed" << std::endl;
+
+        return r.failures ? 1 : 0;
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( e.what() );
+        return 1;
+    }
+}
@@ -0,0 +1,423 @@
+/**
+ * @file Zip64Format.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <time.h>
+
+// standard C++ headers
+#include <iomanip>
+#include <sstream>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "Zip64Format.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+using namespace com::foiani::zip64;
+
+// need version 4.5 for zip64 support
+const uint16_t VERSION_NEEDED_TO_EXTRACT_4_5 = 45;
+const uint16_t VERSION_CREATED_BY_4_5_UNIX   =
+  ( 3 << 8 |  // unix
+    VERSION_NEEDED_TO_EXTRACT_4_5 );
+
+const uint32_t DEFER_CRC32 = 0;
+const uint32_t DEFER_COMPRESSED_SIZE = 0;
+const uint32_t DEFER_UNCOMPRESSED_SIZE = 0;
+
+const uint32_t FORCE_Z64_COMPRESSED_SIZE = 0xffffffff;
+const uint32_t FORCE_Z64_UNCOMPRESSED_SIZE = 0xffffffff;
+const uint32_t FORCE_Z64_OFFSET = 0xffffffff;
+const uint16_t FORCE_Z64_LOCAL_ENTRIES = 0xffff;
+const uint16_t FORCE_Z64_TOTAL_ENTRIES = 0xffff;
+const uint32_t FORCE_Z64_CDIR_SIZE = 0xffffffff;
+const uint32_t FORCE_Z64_CDIR_OFFSET = 0xffffffff;
+
+const uint16_t LENGTH_PLACEHOLDER = 0;
+
+const uint16_t UNIX_ZIP_UID = 0;
+const uint16_t UNIX_ZIP_GID = 0;
+
+// tag + length + two sizes, and tag + length + times + ids
+const size_t LOCAL_Z64_EXTRA_SIZE = 4 + 16;
+const size_t LOCAL_UNIX_EXTRA_SIZE = 4 + 12;
+const size_t LOCAL_EXTRA_FIELDS_SIZE = LOCAL_Z64_EXTRA_SIZE + LOCAL_UNIX_EXTRA_SIZE;
+const size_t LOCAL_FILE_HEADER_FIXED_SIZE = 30;
+
+const uint16_t DISK_START_ZERO = 0;
+const uint16_t DISK_NUMBER_ZERO = 0;
+const uint16_t DISK_TOTAL_ONE = 1;
+
+const uint16_t ZERO_COMMENT_LENGTH = 0;
+const uint16_t ZERO_INTERNAL_FILE_ATTR = 0;
+const uint32_t UNIX_EXTERNAL_FILE_ATTR_FLAGS = (
+    ( 1 << 13 ) | // GMT timestamps
+    ( 1 << 12 )   // uid/gid present
+);
+
+#if EXTRA_DEBUGGING
+
+void
+dumpBytes( const string & label,
+           const CharBuffer & buf,
+           const size_t begin,
+           const size_t end )
+{
+    std::ostringstream oss;
+    for ( size_t i = begin; i < end; ++i )
+        oss << " " << std::hex << std::setw( 2 ) << std::setfill( '0' ) << +buf.at(i);
+    FINE( label << "[" << begin << "-" << end << "]:" << oss.str() );
+}
+
+#else
+
+void
+dumpBytes( const string &,
+           const CharBuffer &,
+           const size_t,
+           const size_t )
+{
+}
+
+#endif
+
+/** Patch the 2-byte length of the extra field that starts at @a start. */
+void
+fixupExtraFieldLength( CharBuffer & cb, const size_t start )
+{
+    if ( cb.size() >= start + 4 )
+    {
+        const uint64_t size( cb.size() - start - 4 );
+        dumpBytes( "fefl: before", cb, start, start + 4 );
+        cb[ start + 2 ] = static_cast< char >( size      );
+        cb[ start + 3 ] = static_cast< char >( size >> 8 );
+        dumpBytes( "fefl:  after", cb, start, start + 4 );
+    }
+}
+
+/** Patch the 8-byte length of the record that starts at @a start. */
+void
+fixupRecordLength64( CharBuffer & cb, const size_t start )
+{
+    if ( cb.size() >= start + 12 )
+    {
+        dumpBytes( "frl64: before", cb, start, start + 12 );
+        const uint64_t size( cb.size() - start - 12 );
+        for ( size_t i = 0; i < 8; ++i )
+            cb[ start + 4 + i ] = static_cast< char >( size >> ( 8 * i ) );
+        dumpBytes( "frl64:  after", cb, start, start + 12 );
+    }
+}
+
+void
+appendUnixExtra( CharBuffer & cb, const Zip64EntryInfo & ei )
+{
+    const size_t start( cb.size() );
+    write2( cb, UNIX_EXTRA_FIELD_TAG );
+    write2( cb, LENGTH_PLACEHOLDER );
+    write4( cb, ei.stat_atime );
+    write4( cb, ei.stat_mtime );
+    write2( cb, UNIX_ZIP_UID );
+    write2( cb, UNIX_ZIP_GID );
+    fixupExtraFieldLength( cb, start );
+}
+
+void
+appendName( CharBuffer & cb, const Zip64EntryInfo & ei )
+{
+    cb.insert( cb.end(), ei.name.begin(), ei.name.end() );
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+namespace /* com::foiani:: */ zip64
+{
+
+void
+write2( CharBuffer & cb, const uint16_t val )
+{
+    cb.push_back( static_cast< char >( val      ) );
+    cb.push_back( static_cast< char >( val >> 8 ) );
+}
+
+void
+write4( CharBuffer & cb, const uint32_t val )
+{
+    cb.push_back( static_cast< char >( val       ) );
+    cb.push_back( static_cast< char >( val >>  8 ) );
+    cb.push_back( static_cast< char >( val >> 16 ) );
+    cb.push_back( static_cast< char >( val >> 24 ) );
+}
+
+uint16_t
+read2( const char * p )
+{
+    const unsigned char * u( reinterpret_cast< const unsigned char * >( p ) );
+    return static_cast< uint16_t >( u[0] | u[1] << 8 );
+}
+
+uint32_t
+read4( const char * p )
+{
+    return static_cast< uint32_t >( read2( p ) ) |
+           static_cast< uint32_t >( read2( p + 2 ) ) << 16;
+}
+
+uint64_t
+read8( const char * p )
+{
+    return static_cast< uint64_t >( read4( p ) ) |
+           static_cast< uint64_t >( read4( p + 4 ) ) << 32;
+}
+
+void
+write8( CharBuffer & cb, const uint64_t val )
+{
+    cb.push_back( static_cast< char >( val       ) );
+    cb.push_back( static_cast< char >( val >>  8 ) );
+    cb.push_back( static_cast< char >( val >> 16 ) );
+    cb.push_back( static_cast< char >( val >> 24 ) );
+    cb.push_back( static_cast< char >( val >> 32 ) );
+    cb.push_back( static_cast< char >( val >> 40 ) );
+    cb.push_back( static_cast< char >( val >> 48 ) );
+    cb.push_back( static_cast< char >( val >> 56 ) );
+}
+
+void
+fillDateTime( Zip64EntryInfo & ei, const struct stat & st )
+{
+    fillDateTime( ei, st.st_mtime, st.st_atime );
+}
+
+void
+fillDateTime( Zip64EntryInfo & ei, const time_t mtime, const time_t atime )
+{
+    ei.stat_atime = static_cast< uint32_t >( atime );
+    ei.stat_mtime = static_cast< uint32_t >( mtime );
+
+    // yes, this is a little insane.  these are the bits:
+    //   date = YYYYYYYM MMMDDDDD   time = HHHHHMMM MMMSSSSS
+    // notes:
+    //   year starts at 1980, month is 1-12, day is 1-31
+    //   hour is 0-23, minute is 0-59, seconds is 0-29 (times 2)
+
+    struct tm mtm;
+    gmtime_r( &mtime, &mtm );
+
+    ei.msdos_date = static_cast< uint16_t >(
+        ( mtm.tm_year - 80 ) << 9 |
+        ( mtm.tm_mon  +  1 ) << 5 |
+        ( mtm.tm_mday      )
+    );
+    ei.msdos_time = static_cast< uint16_t >(
+        mtm.tm_hour << 11 |
+        mtm.tm_min  <<  5 |
+        mtm.tm_sec  >>  1
+    );
+
+    FINE( "fdt: unix=["
+          "y=" << mtm.tm_year << ", "
+          "m=" << mtm.tm_mon << ", "
+          "d=" << mtm.tm_mday << "; "
+          "h=" << mtm.tm_hour << ", "
+          "m=" << mtm.tm_min << ", "
+          "s=" << mtm.tm_sec << "]" );
+    FINE( "fdt: msdos=["
+          "y=" << ( ( ei.msdos_date >>  9 ) & 0x007f ) << ", "
+          "m=" << ( ( ei.msdos_date >>  5 ) & 0x000f ) << ", "
+          "d=" << ( ( ei.msdos_date       ) & 0x001f ) << "; "
+          "h=" << ( ( ei.msdos_time >> 11 ) & 0x001f ) << ", "
+          "m=" << ( ( ei.msdos_time >>  5 ) & 0x003f ) << ", "
+          "s=" << ( ( ei.msdos_time <<  1 ) & 0x003e ) << "]" );
+}
+
+void
+appendLocalHeader( CharBuffer & cb, const Zip64EntryInfo & ei )
+{
+    const bool deferred( ( ei.flags & GPB_DATA_DESC_FOLLOWS_DATA ) != 0 );
+
+    write4( cb, LOCAL_FILE_HEADER_SIG );
+    write2( cb, VERSION_NEEDED_TO_EXTRACT_4_5 );
+    write2( cb, ei.flags );
+    write2( cb, ei.method );
+    write2( cb, ei.msdos_time );
+    write2( cb, ei.msdos_date );
+    write4( cb, deferred ? DEFER_CRC32 : ei.crc32 );
+    write4( cb, FORCE_Z64_COMPRESSED_SIZE );
+    write4( cb, FORCE_Z64_UNCOMPRESSED_SIZE );
+    write2( cb, static_cast< uint16_t >( ei.name.size() ) );
+    write2( cb, static_cast< uint16_t >( LOCAL_EXTRA_FIELDS_SIZE ) );
+
+    appendName( cb, ei );
+
+    const size_t z64( cb.size() );
+    write2( cb, Z64_EXTRA_FIELD_TAG );
+    write2( cb, LENGTH_PLACEHOLDER );
+    write8( cb, deferred ? DEFER_UNCOMPRESSED_SIZE : ei.uncompressed );
+    write8( cb, deferred ? DEFER_COMPRESSED_SIZE : ei.compressed );
+    fixupExtraFieldLength( cb, z64 );
+
+    appendUnixExtra( cb, ei );
+}
+
+size_t
+localHeaderSize( const Zip64EntryInfo & ei )
+{
+    return LOCAL_FILE_HEADER_FIXED_SIZE + ei.name.size() + LOCAL_EXTRA_FIELDS_SIZE;
+}
+
+bool
+needsZip64Sizes( const Zip64EntryInfo & ei )
+{
+    return ei.uncompressed >= FORCE_Z64_UNCOMPRESSED_SIZE ||
+           ei.compressed >= FORCE_Z64_COMPRESSED_SIZE;
+}
+
+void
+appendCompactLocalHeader( CharBuffer & cb, const Zip64EntryInfo & ei )
+{
+    const bool z64( needsZip64Sizes( ei ) );
+
+    write4( cb, LOCAL_FILE_HEADER_SIG );
+    write2( cb, VERSION_NEEDED_TO_EXTRACT_4_5 );
+    write2( cb, ei.flags );
+    write2( cb, ei.method );
+    write2( cb, ei.msdos_time );
+    write2( cb, ei.msdos_date );
+    write4( cb, ei.crc32 );
+    write4( cb, z64 ? FORCE_Z64_COMPRESSED_SIZE   : static_cast< uint32_t >( ei.compressed ) );
+    write4( cb, z64 ? FORCE_Z64_UNCOMPRESSED_SIZE : static_cast< uint32_t >( ei.uncompressed ) );
+    write2( cb, static_cast< uint16_t >( ei.name.size() ) );
+    write2( cb, static_cast< uint16_t >( ( z64 ? LOCAL_Z64_EXTRA_SIZE : 0 ) +
+                                         LOCAL_UNIX_EXTRA_SIZE ) );
+
+    appendName( cb, ei );
+
+    if ( z64 )
+    {
+        const size_t start( cb.size() );
+        write2( cb, Z64_EXTRA_FIELD_TAG );
+        write2( cb, LENGTH_PLACEHOLDER );
+        write8( cb, ei.uncompressed );
+        write8( cb, ei.compressed );
+        fixupExtraFieldLength( cb, start );
+    }
+
+    appendUnixExtra( cb, ei );
+}
+
+size_t
+compactLocalHeaderSize( const Zip64EntryInfo & ei )
+{
+    return LOCAL_FILE_HEADER_FIXED_SIZE + ei.name.size() +
+        ( needsZip64Sizes( ei ) ? LOCAL_Z64_EXTRA_SIZE : 0 ) + LOCAL_UNIX_EXTRA_SIZE;
+}
+
+void
+appendDataDescriptor( CharBuffer & cb, const Zip64EntryInfo & ei )
+{
+    write4( cb, DATA_DESC_SIG );
+    write4( cb, ei.crc32 );
+    write8( cb, ei.compressed );
+    write8( cb, ei.uncompressed );
+}
+
+void
+appendCentralDirRecord( CharBuffer & cb, const Zip64EntryInfo & ei )
+{
+    CharBuffer extra;
+
+    write2( extra, Z64_EXTRA_FIELD_TAG );
+    write2( extra, LENGTH_PLACEHOLDER );
+    write8( extra, ei.uncompressed );
+    write8( extra, ei.compressed );
+    write8( extra, ei.offset );
+    fixupExtraFieldLength( extra, 0 );
+
+    appendUnixExtra( extra, ei );
+
+    write4( cb, CDIR_FILE_HEADER_SIG );
+    write2( cb, VERSION_CREATED_BY_4_5_UNIX );
+    write2( cb, VERSION_NEEDED_TO_EXTRACT_4_5 );
+    write2( cb, ei.flags );
+    write2( cb, ei.method );
+    write2( cb, ei.msdos_time );
+    write2( cb, ei.msdos_date );
+    write4( cb, ei.crc32 );
+    write4( cb, FORCE_Z64_COMPRESSED_SIZE );
+    write4( cb, FORCE_Z64_UNCOMPRESSED_SIZE );
+    write2( cb, static_cast< uint16_t >( ei.name.size() ) );
+    write2( cb, static_cast< uint16_t >( extra.size() ) );
+    write2( cb, ZERO_COMMENT_LENGTH );
+    write2( cb, DISK_START_ZERO );
+    write2( cb, ZERO_INTERNAL_FILE_ATTR );
+    write4( cb, ( ei.mode << 16 ) | UNIX_EXTERNAL_FILE_ATTR_FLAGS );
+    write4( cb, FORCE_Z64_OFFSET );
+
+    appendName( cb, ei );
+    cb.insert( cb.end(), extra.begin(), extra.end() );
+}
+
+void
+appendEndRecords( CharBuffer & cb,
+                  const uint64_t entries,
+                  const uint64_t centralDirOffset,
+                  const uint64_t centralDirBytes,
+                  const uint64_t endOffset )
+{
+    FINE( "aer: central dir: "
+          "bytes=" << centralDirBytes << ", "
+          "offset=" << centralDirOffset );
+
+    DEBUG( "aer: adding z64 end of central directory record @ " << endOffset );
+    const size_t z64( cb.size() );
+    write4( cb, Z64_END_OF_CENTRAL_DIR_REC_SIG );
+    write8( cb, LENGTH_PLACEHOLDER );
+    write2( cb, VERSION_CREATED_BY_4_5_UNIX );
+    write2( cb, VERSION_NEEDED_TO_EXTRACT_4_5 );
+    write4( cb, DISK_NUMBER_ZERO );
+    write4( cb, DISK_START_ZERO );
+    write8( cb, entries ); // # dir entries on this disk
+    write8( cb, entries ); // # dir entries total
+    write8( cb, centralDirBytes );
+    write8( cb, centralDirOffset );
+    fixupRecordLength64( cb, z64 );
+
+    DEBUG( "aer: adding z64 end of central directory locator @ " <<
+           endOffset + ( cb.size() - z64 ) );
+    write4( cb, Z64_END_OF_CENTRAL_DIR_LOC_SIG );
+    write4( cb, DISK_NUMBER_ZERO );
+    write8( cb, endOffset );
+    write4( cb, DISK_TOTAL_ONE );
+
+    DEBUG( "aer: adding end of central directory record @ " <<
+           endOffset + ( cb.size() - z64 ) );
+    write4( cb, END_OF_CENTRAL_DIR_SIG );
+    write2( cb, DISK_NUMBER_ZERO );
+    write2( cb, DISK_START_ZERO );
+    write2( cb, FORCE_Z64_LOCAL_ENTRIES );
+    write2( cb, FORCE_Z64_TOTAL_ENTRIES );
+    write4( cb, FORCE_Z64_CDIR_SIZE );
+    write4( cb, FORCE_Z64_CDIR_OFFSET );
+    write2( cb, ZERO_COMMENT_LENGTH );
+}
+
+} // end namespace com::foiani::zip64
+
+} // end namespace com::foiani
+
+} // end namespace com
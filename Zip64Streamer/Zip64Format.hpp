@@ -0,0 +1,135 @@
+#ifndef COM_FOIANI_Z64S_ZIP64FORMAT_HPP
+#define COM_FOIANI_Z64S_ZIP64FORMAT_HPP 1
+
+/**
+ * @file Zip64Format.hpp
+ *
+ * Record builders shared by everything that writes ZIP64 archives.
+ * Each function appends one complete record (including its name and
+ * extra fields) to a buffer, little-endian, ready to send.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <sys/stat.h>
+
+// standard C++ headers
+#include <cstdint>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Everything needed to describe one entry in the central directory. */
+struct Zip64EntryInfo
+{
+    string name;
+    uint64_t offset;
+    uint64_t uncompressed;
+    uint64_t compressed;
+    uint32_t crc32;
+    uint16_t flags;
+    uint16_t method;
+    uint16_t msdos_time;
+    uint16_t msdos_date;
+    uint32_t stat_atime;
+    uint32_t stat_mtime;
+    uint32_t mode;        // unix type and permission bits
+};
+
+namespace /* com::foiani:: */ zip64
+{
+
+// record signatures and extra field tags
+const uint32_t LOCAL_FILE_HEADER_SIG = 0x04034b50;
+const uint32_t DATA_DESC_SIG = 0x08074b50;
+const uint32_t CDIR_FILE_HEADER_SIG = 0x02014b50;
+const uint32_t Z64_END_OF_CENTRAL_DIR_REC_SIG = 0x06064b50;
+const uint32_t Z64_END_OF_CENTRAL_DIR_LOC_SIG = 0x07064b50;
+const uint32_t END_OF_CENTRAL_DIR_SIG = 0x06054b50;
+
+const uint16_t Z64_EXTRA_FIELD_TAG = 0x0001;
+const uint16_t UNIX_EXTRA_FIELD_TAG = 0x000d;
+
+// GPB == "general purpose bits"
+const uint16_t GPB_NO_FLAGS = 0;
+const uint16_t GPB_DATA_DESC_FOLLOWS_DATA = 1 << 3;
+
+const uint16_t COMPRESSION_METHOD_STORE   = 0;
+const uint16_t COMPRESSION_METHOD_DEFLATE = 8;
+
+/** Unix mode recorded for regular files: rw by all. */
+const uint32_t DEFAULT_FILE_MODE = 0100666;
+
+/** Size of the data descriptor that follows deferred entries. */
+const size_t DATA_DESC_SIZE = 24;
+
+void write2( CharBuffer & cb, uint16_t val );
+void write4( CharBuffer & cb, uint32_t val );
+void write8( CharBuffer & cb, uint64_t val );
+
+/** Little-endian loads from unaligned memory, for readers. */
+uint16_t read2( const char * p );
+uint32_t read4( const char * p );
+uint64_t read8( const char * p );
+
+/** Fill in the time fields of @a ei from @a st. */
+void fillDateTime( Zip64EntryInfo & ei, const struct stat & st );
+
+/** Fill in the time fields of @a ei from explicit unix times. */
+void fillDateTime( Zip64EntryInfo & ei, time_t mtime, time_t atime );
+
+/**
+ * Local file header for @a ei.  If @a ei.flags has
+ * GPB_DATA_DESC_FOLLOWS_DATA, the crc and sizes are deferred to a
+ * data descriptor; otherwise they are written here.
+ */
+void appendLocalHeader( CharBuffer & cb, const Zip64EntryInfo & ei );
+
+/** Length that appendLocalHeader() will produce for @a ei. */
+size_t localHeaderSize( const Zip64EntryInfo & ei );
+
+/** True if either size in @a ei is too big for the classic 32-bit fields. */
+bool needsZip64Sizes( const Zip64EntryInfo & ei );
+
+/**
+ * Local file header for an entry whose crc and sizes are already
+ * known (no data descriptor).  The ZIP64 extra field is only
+ * included if needsZip64Sizes(); the central directory still gets
+ * the full ZIP64 treatment.
+ */
+void appendCompactLocalHeader( CharBuffer & cb, const Zip64EntryInfo & ei );
+
+/** Length that appendCompactLocalHeader() will produce for @a ei. */
+size_t compactLocalHeaderSize( const Zip64EntryInfo & ei );
+
+/** Data descriptor (ZIP64 form) for @a ei. */
+void appendDataDescriptor( CharBuffer & cb, const Zip64EntryInfo & ei );
+
+/** Central directory file header for @a ei. */
+void appendCentralDirRecord( CharBuffer & cb, const Zip64EntryInfo & ei );
+
+/**
+ * ZIP64 end of central directory record and locator, followed by
+ * the classic end of central directory record.  @a endOffset is the
+ * archive offset at which these records begin.
+ */
+void appendEndRecords( CharBuffer & cb,
+                       uint64_t entries,
+                       uint64_t centralDirOffset,
+                       uint64_t centralDirBytes,
+                       uint64_t endOffset );
+
+} // end namespace com::foiani::zip64
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64FORMAT_HPP
@@ -0,0 +1,143 @@
+/**
+ * @file Zip64Manifest.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "Zip64Manifest.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+const char * const MANIFEST_HEADER = "# z64s manifest v1: crc32 size mtime name";
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+string
+Zip64Manifest::escapeName( const string & name )
+{
+    string rv;
+    rv.reserve( name.size() );
+    for ( const char c : name )
+    {
+        if ( c == '\\' )
+            rv += "\\\\";
+        else if ( c == '\n' )
+            rv += "\\n";
+        else
+            rv += c;
+    }
+    return rv;
+}
+
+string
+Zip64Manifest::unescapeName( const string & s )
+{
+    string rv;
+    rv.reserve( s.size() );
+    for ( size_t i = 0; i < s.size(); ++i )
+    {
+        if ( s[i] == '\\' && i + 1 < s.size() )
+        {
+            ++i;
+            rv += ( s[i] == 'n' ? '\n' : s[i] );
+        }
+        else
+            rv += s[i];
+    }
+    return rv;
+}
+
+void
+Zip64Manifest::add( const Entry & e )
+{
+    const auto it( m_index.find( e.name ) );
+    if ( it != m_index.end() )
+    {
+        m_entries[ it->second ] = e;
+        return;
+    }
+
+    m_index[ e.name ] = m_entries.size();
+    m_entries.push_back( e );
+}
+
+const Zip64Manifest::Entry *
+Zip64Manifest::find( const string & name ) const
+{
+    const auto it( m_index.find( name ) );
+    return it == m_index.end() ? 0 : &m_entries[ it->second ];
+}
+
+void
+Zip64Manifest::load( std::istream & is )
+{
+    m_entries.clear();
+    m_index.clear();
+
+    string line;
+    size_t lineNo( 0 );
+    while ( std::getline( is, line ) )
+    {
+        ++lineNo;
+        if ( line.empty() || line[0] == '#' )
+            continue;
+
+        std::istringstream iss( line );
+        string crc;
+        Entry e;
+        iss >> crc >> e.size >> e.mtime;
+        if ( ! iss || iss.get() != ' ' )
+            throw std::runtime_error( "manifest: bad line " + std::to_string( lineNo ) );
+
+        e.bCrcKnown = ( crc != "-" );
+        e.crc32 = e.bCrcKnown ? static_cast< uint32_t >( std::stoul( crc, 0, 16 ) ) : 0;
+
+        string rest;
+        std::getline( iss, rest );
+        e.name = unescapeName( rest );
+
+        add( e );
+    }
+
+    DEBUG( "zm: loaded " << m_entries.size() << " entries" );
+}
+
+void
+Zip64Manifest::save( std::ostream & os ) const
+{
+    os << MANIFEST_HEADER << "\n";
+    for ( const Entry & e : m_entries )
+    {
+        if ( e.bCrcKnown )
+            os << std::hex << std::setw( 8 ) << std::setfill( '0' ) << e.crc32 << std::dec;
+        else
+            os << "-";
+        os << " " << e.size << " " << e.mtime << " " << escapeName( e.name ) << "\n";
+    }
+
+    if ( ! os )
+        throw std::runtime_error( "manifest: write failed" );
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
@@ -0,0 +1,88 @@
+#ifndef COM_FOIANI_Z64S_ZIP64MANIFEST_HPP
+#define COM_FOIANI_Z64S_ZIP64MANIFEST_HPP 1
+
+/**
+ * @file Zip64Manifest.hpp
+ *
+ * Compact record of what an archive run saw: name, size, mtime and
+ * CRC-32 of every file.  Handing the previous run's manifest to a
+ * Zip64Streamer lets it skip unchanged files on the strength of a
+ * stat() alone, producing a delta archive.
+ *
+ * The text form is one line per entry:
+ *
+ *   CRC32 SIZE MTIME NAME
+ *
+ * with the crc in hex ("-" if it was never computed), size and mtime
+ * in decimal, and backslash and newline in the name escaped as "\\"
+ * and "\n".  Lines starting with '#' are comments.  Files that have
+ * disappeared since the previous run simply aren't listed; diff two
+ * manifests to find deletions.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdint>
+#include <iosfwd>
+#include <unordered_map>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Name, size, mtime and crc of each file in an archive run. */
+class Zip64Manifest
+{
+
+public:
+
+    struct Entry
+    {
+        string name;
+        uint64_t size;
+        uint64_t mtime;
+        uint32_t crc32;
+        bool bCrcKnown;
+    };
+
+    typedef std::vector< Entry > EntryVec;
+
+    /** Add @a e, replacing any earlier entry of the same name. */
+    void add( const Entry & e );
+
+    /** The entry called @a name, or null. */
+    const Entry * find( const string & name ) const;
+
+    const EntryVec & entries() const { return m_entries; }
+    size_t size() const { return m_entries.size(); }
+
+    /** Replace the contents with the manifest read from @a is. */
+    void load( std::istream & is );
+
+    void save( std::ostream & os ) const;
+
+    /** @a name with backslash and newline escaped, as in the text form. */
+    static string escapeName( const string & name );
+
+    /** Undo escapeName(). */
+    static string unescapeName( const string & s );
+
+private:
+
+    EntryVec m_entries;
+    std::unordered_map< string, size_t > m_index;
+
+}; // end class Zip64Manifest
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64MANIFEST_HPP
@@ -0,0 +1,542 @@
+/**
+ * @file Zip64ParallelWriter.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// standard C++ headers
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Format.hpp"
+
+// interface
+#include "Zip64ParallelWriter.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+using namespace com::foiani::zip64;
+
+const size_t IO_CHUNK_BYTES = 1024 * 1024;
+
+// grow the preallocated region by at least this much at a time, so
+// that reservations rarely have to call into the filesystem.
+const uint64_t MIN_PREALLOC_BYTES = 64 * 1024 * 1024;
+
+/** Closes a file descriptor on scope exit. */
+struct FdCloser
+{
+    explicit FdCloser( const int fd ) : fd( fd ) {}
+    ~FdCloser() { if ( fd >= 0 ) close( fd ); }
+    const int fd;
+};
+
+/** Read up to @a len bytes, retrying on EINTR; returns bytes read. */
+size_t
+readSome( const int fd, char * buf, const size_t len, const string & path )
+{
+    while ( true )
+    {
+        const ssize_t n( read( fd, buf, len ) );
+        if ( n >= 0 )
+            return static_cast< size_t >( n );
+        if ( errno != EINTR )
+            throw OSError( "reading " + path );
+    }
+}
+
+/** Owns a raw deflate stream for one worker. */
+class Deflater
+{
+
+public:
+
+    Deflater()
+    {
+        zeroStruct( m_zs );
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+        const int rc = deflateInit2(
+            &m_zs,
+            Z_DEFAULT_COMPRESSION,
+            Z_DEFLATED,
+            -15 /* ZLIB_WINDOW_BITS, negative = raw deflate data */,
+            8   /* ZLIB_MEMORY_LEVEL */,
+            Z_DEFAULT_STRATEGY
+        );
+
+#pragma GCC diagnostic pop
+
+        if ( rc != Z_OK )
+            throw std::runtime_error( "initializing compression, rc=" + std::to_string( rc ) );
+    }
+
+    ~Deflater() { deflateEnd( &m_zs ); }
+
+    z_stream & zs() { return m_zs; }
+
+private:
+
+    Deflater( const Deflater & );
+    Deflater & operator=( const Deflater & );
+
+    z_stream m_zs;
+
+};
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+Zip64ParallelWriter::Zip64ParallelWriter( const string & dir,
+                                          const string & zipFile,
+                                          const Method method,
+                                          unsigned threads )
+    : m_sDir( dir ),
+      m_sZipFile( zipFile ),
+      m_method( method ),
+      m_fd( -1 ),
+      m_maxBufferedBytes( 256 * 1024 * 1024 ),
+      m_bClosed( false ),
+      m_nextOffset( 0 ),
+      m_allocated( 0 ),
+      m_bFinished( false ),
+      m_size( 0 )
+{
+    m_fd = open( zipFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+    if ( m_fd < 0 )
+        throw OSError( "opening " + zipFile );
+
+    if ( threads == 0 )
+        threads = static_cast< unsigned >( std::max( 1L, sysconf( _SC_NPROCESSORS_ONLN ) ) );
+
+    DEBUG( "ctor: " << QS( zipFile ) << ": starting " << threads << " workers" );
+
+    for ( unsigned i = 0; i < threads; ++i )
+        m_workers.push_back( std::thread( &Zip64ParallelWriter::workerLoop, this ) );
+}
+
+Zip64ParallelWriter::~Zip64ParallelWriter()
+{
+    try
+    {
+        finish();
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( "dtor: " << e.what() );
+    }
+
+    if ( m_fd >= 0 )
+        close( m_fd );
+}
+
+void
+Zip64ParallelWriter::setMaxBufferedBytes( const size_t bytes )
+{
+    m_maxBufferedBytes = bytes;
+}
+
+bool
+Zip64ParallelWriter::addFile( const string & file )
+{
+    DEBUG( "af: queueing file " << QS( file ) );
+
+    Job job;
+    job.path = m_sDir + "/" + file;
+    job.name = file;
+
+    struct stat st;
+    if ( stat( job.path.c_str(), &st ) != 0 )
+        throw OSError( "stat" );
+    job.size = static_cast< uint64_t >( st.st_size );
+
+    Zip64EntryInfo & ei( job.ei );
+    ei.name = file;
+    ei.offset = 0;
+    ei.uncompressed = job.size;
+    ei.compressed = 0;
+    ei.crc32 = 0;
+    ei.flags = GPB_NO_FLAGS;
+    ei.method = ( m_method == STORE ? COMPRESSION_METHOD_STORE
+                                    : COMPRESSION_METHOD_DEFLATE );
+    ei.mode = DEFAULT_FILE_MODE;
+    fillDateTime( ei, st );
+
+    {
+        std::lock_guard< std::mutex > lock( m_jobMutex );
+        if ( m_bClosed )
+            throw std::logic_error( "addFile after finish" );
+        m_jobs.push_back( job );
+    }
+    m_jobCond.notify_one();
+
+    return true;
+}
+
+size_t
+Zip64ParallelWriter::addFileByPattern( const string & pattern )
+{
+    DEBUG( "afbp: adding pattern " << QS( pattern ) );
+
+    const StringList files( globFiles( m_sDir, pattern ) );
+    for ( const string & file : files )
+        addFile( file );
+    return files.size();
+}
+
+uint64_t
+Zip64ParallelWriter::finish()
+{
+    if ( m_bFinished )
+        return m_size;
+    m_bFinished = true;
+
+    DEBUG( "fin: waiting for workers" );
+    {
+        std::lock_guard< std::mutex > lock( m_jobMutex );
+        m_bClosed = true;
+    }
+    m_jobCond.notify_all();
+    for ( std::thread & t : m_workers )
+        t.join();
+    m_workers.clear();
+
+    if ( m_error )
+    {
+        discard();
+        std::rethrow_exception( m_error );
+    }
+
+    uint64_t offset( 0 );
+    try
+    {
+        // entries landed in completion order; list them in file order so
+        // the central directory reads front to back.
+        std::sort( m_entries.begin(), m_entries.end(),
+                   []( const Zip64EntryInfo & a, const Zip64EntryInfo & b )
+                   { return a.offset < b.offset; } );
+
+        const uint64_t centralDirOffset( m_nextOffset );
+        offset = centralDirOffset;
+
+        CharBuffer cd;
+        for ( const Zip64EntryInfo & ei : m_entries )
+        {
+            appendCentralDirRecord( cd, ei );
+            if ( cd.size() >= IO_CHUNK_BYTES )
+            {
+                pwriteAll( cd.data(), cd.size(), offset );
+                offset += cd.size();
+                cd.clear();
+            }
+        }
+
+        appendEndRecords( cd, m_entries.size(), centralDirOffset,
+                          offset + cd.size() - centralDirOffset,
+                          offset + cd.size() );
+        pwriteAll( cd.data(), cd.size(), offset );
+        offset += cd.size();
+
+        // drop whatever preallocation we didn't use
+        if ( ftruncate( m_fd, static_cast< off_t >( offset ) ) != 0 )
+            throw OSError( "ftruncate" );
+
+        if ( close( m_fd ) != 0 )
+        {
+            m_fd = -1;
+            throw OSError( "close" );
+        }
+        m_fd = -1;
+    }
+    catch ( ... )
+    {
+        discard();
+        throw;
+    }
+
+    m_size = offset;
+    DEBUG( "fin: " << m_entries.size() << " entries, " << m_size << " bytes" );
+    return m_size;
+}
+
+void
+Zip64ParallelWriter::discard()
+{
+    ERROR( "fin: removing partial archive " << QS( m_sZipFile ) );
+    if ( m_fd >= 0 )
+    {
+        if ( ftruncate( m_fd, 0 ) != 0 )
+            WARN( "fin: truncating " << QS( m_sZipFile ) << ", errno=" << errno );
+        close( m_fd );
+        m_fd = -1;
+    }
+    if ( unlink( m_sZipFile.c_str() ) != 0 && errno != ENOENT )
+        WARN( "fin: removing " << QS( m_sZipFile ) << ", errno=" << errno );
+}
+
+void
+Zip64ParallelWriter::workerLoop()
+{
+    while ( true )
+    {
+        Job job;
+        {
+            std::unique_lock< std::mutex > lock( m_jobMutex );
+            m_jobCond.wait( lock, [this]{ return m_bClosed || ! m_jobs.empty(); } );
+            if ( m_jobs.empty() )
+                return;
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        try
+        {
+            if ( m_method == STORE )
+                writeStored( job );
+            else
+                writeDeflated( job );
+        }
+        catch ( ... )
+        {
+            std::lock_guard< std::mutex > lock( m_outMutex );
+            if ( ! m_error )
+                m_error = std::current_exception();
+        }
+    }
+}
+
+void
+Zip64ParallelWriter::writeStored( Job & job )
+{
+    FINE( "ws: " << QS( job.name ) << ": " << job.size << " bytes" );
+
+    const int fd( open( job.path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "opening " + job.path );
+    FdCloser closer( fd );
+
+    // the size is known up front, so claim the whole range now and
+    // stream the data straight into place; the header goes in last,
+    // once the crc is known.
+    Zip64EntryInfo & ei( job.ei );
+    const uint64_t headerBytes( localHeaderSize( ei ) );
+    ei.offset = reserve( headerBytes + job.size );
+    ei.compressed = job.size;
+
+    thread_local CharBuffer buf( IO_CHUNK_BYTES );
+
+    uLong crc = crc32( 0, Z_NULL, 0 );
+    uint64_t done( 0 );
+    while ( done < job.size )
+    {
+        const size_t want( std::min< uint64_t >( buf.size(), job.size - done ) );
+        const size_t n( readSome( fd, &buf[0], want, job.path ) );
+        if ( n == 0 )
+            throw std::runtime_error( job.path + ": file shrank while archiving" );
+        crc = crc32( crc, reinterpret_cast< const Bytef * >( &buf[0] ),
+                     static_cast< uInt >( n ) );
+        pwriteAll( &buf[0], n, ei.offset + headerBytes + done );
+        done += n;
+    }
+
+    // the range was sized from stat; anything past it would be lost
+    char extra;
+    if ( readSome( fd, &extra, 1, job.path ) != 0 )
+        throw std::runtime_error( job.path + ": file grew while archiving" );
+    ei.crc32 = static_cast< uint32_t >( crc );
+
+    CharBuffer lh;
+    appendLocalHeader( lh, ei );
+    pwriteAll( lh.data(), lh.size(), ei.offset );
+
+    commit( ei );
+}
+
+void
+Zip64ParallelWriter::writeDeflated( Job & job )
+{
+    FINE( "wd: " << QS( job.name ) << ": " << job.size << " bytes" );
+
+    thread_local std::unique_ptr< Deflater > t_deflater;
+    if ( ! t_deflater )
+        t_deflater.reset( new Deflater );
+    else
+        deflateReset( &t_deflater->zs() );
+    z_stream & zs( t_deflater->zs() );
+
+    const int fd( open( job.path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "opening " + job.path );
+    FdCloser closer( fd );
+
+    // compress into memory, spilling to an unlinked temporary file if
+    // the output gets large; only then is the final size known.
+    CharBuffer output;
+    std::unique_ptr< FILE, int (*)( FILE * ) > spill( 0, fclose );
+    uint64_t spilled( 0 );
+
+    // per-worker scratch, so small files don't pay for allocations
+    thread_local CharBuffer input( IO_CHUNK_BYTES );
+    thread_local CharBuffer chunk( IO_CHUNK_BYTES );
+
+    uLong crc = crc32( 0, Z_NULL, 0 );
+    while ( true )
+    {
+        const size_t nRead( readSome( fd, &input[0], input.size(), job.path ) );
+        zs.next_in = reinterpret_cast< Bytef * >( &input[0] );
+        zs.avail_in = static_cast< uInt >( nRead );
+        crc = crc32( crc, zs.next_in, zs.avail_in );
+
+        const int flag( nRead > 0 ? Z_NO_FLUSH : Z_FINISH );
+        int rc;
+        do
+        {
+            zs.next_out = reinterpret_cast< Bytef * >( &chunk[0] );
+            zs.avail_out = static_cast< uInt >( chunk.size() );
+            rc = deflate( &zs, flag );
+            if ( rc == Z_STREAM_ERROR )
+                throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
+
+            const size_t used( chunk.size() - zs.avail_out );
+            output.insert( output.end(), chunk.begin(), chunk.begin() + used );
+
+            if ( output.size() > m_maxBufferedBytes )
+            {
+                if ( ! spill )
+                {
+                    spill.reset( tmpfile() );
+                    if ( ! spill )
+                        throw OSError( "creating spill file" );
+                }
+                if ( fwrite( output.data(), 1, output.size(), spill.get() ) != output.size() )
+                    throw OSError( "writing spill file" );
+                spilled += output.size();
+                output.clear();
+            }
+        }
+        while ( zs.avail_out == 0 );
+
+        if ( flag == Z_FINISH )
+        {
+            if ( rc != Z_STREAM_END )
+                throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
+            break;
+        }
+    }
+
+    Zip64EntryInfo & ei( job.ei );
+    ei.crc32 = static_cast< uint32_t >( crc );
+    ei.uncompressed = zs.total_in;
+    ei.compressed = zs.total_out;
+
+    const uint64_t headerBytes( localHeaderSize( ei ) );
+    ei.offset = reserve( headerBytes + ei.compressed );
+
+    CharBuffer lh;
+    appendLocalHeader( lh, ei );
+    pwriteAll( lh.data(), lh.size(), ei.offset );
+
+    uint64_t at( ei.offset + headerBytes );
+    if ( spill )
+    {
+        if ( fflush( spill.get() ) != 0 )
+            throw OSError( "flushing spill file" );
+        const int spillFd( fileno( spill.get() ) );
+        uint64_t copied( 0 );
+        while ( copied < spilled )
+        {
+            const size_t want( std::min< uint64_t >( input.size(), spilled - copied ) );
+            const ssize_t n( pread( spillFd, &input[0], want, static_cast< off_t >( copied ) ) );
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n <= 0 )
+                throw OSError( "reading spill file" );
+            pwriteAll( &input[0], static_cast< size_t >( n ), at );
+            at += n;
+            copied += n;
+        }
+    }
+    pwriteAll( output.data(), output.size(), at );
+
+    commit( ei );
+}
+
+uint64_t
+Zip64ParallelWriter::reserve( const uint64_t bytes )
+{
+    uint64_t rv( 0 );
+    uint64_t growFrom( 0 );
+    uint64_t grow( 0 );
+    {
+        std::lock_guard< std::mutex > lock( m_outMutex );
+
+        rv = m_nextOffset;
+        m_nextOffset += bytes;
+
+        if ( m_nextOffset > m_allocated )
+        {
+            growFrom = m_allocated;
+            grow = std::max( std::max( m_nextOffset - m_allocated, MIN_PREALLOC_BYTES ),
+                             m_allocated / 8 );
+            m_allocated += grow;
+        }
+    }
+
+    // purely an optimization; if the filesystem can't do it, the
+    // writes will simply allocate as they go.  it's done unlocked,
+    // since it can take a while and the range is already ours.
+    if ( grow > 0 &&
+         fallocate( m_fd, 0, static_cast< off_t >( growFrom ), static_cast< off_t >( grow ) ) != 0 )
+        FINE( "res: fallocate failed, errno=" << errno );
+
+    return rv;
+}
+
+void
+Zip64ParallelWriter::pwriteAll( const char * data, size_t len, uint64_t offset )
+{
+    while ( len > 0 )
+    {
+        const ssize_t n( pwrite( m_fd, data, len, static_cast< off_t >( offset ) ) );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            throw OSError( "pwrite" );
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+void
+Zip64ParallelWriter::commit( const Zip64EntryInfo & ei )
+{
+    std::lock_guard< std::mutex > lock( m_outMutex );
+    m_entries.push_back( ei );
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
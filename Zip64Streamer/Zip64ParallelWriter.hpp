@@ -0,0 +1,139 @@
+#ifndef COM_FOIANI_Z64S_ZIP64PARALLELWRITER_HPP
+#define COM_FOIANI_Z64S_ZIP64PARALLELWRITER_HPP 1
+
+/**
+ * @file Zip64ParallelWriter.hpp
+ *
+ * Build a ZIP64 archive in a local file with several workers writing
+ * entries concurrently.  Unlike Zip64Streamer, nothing is serialized
+ * through a Sender: each worker reserves a byte range in the output
+ * and fills it with pwrite(), so entries land in whatever order the
+ * workers finish them.  The central directory and ZIP64 trailer are
+ * written last, by finish().
+ *
+ * Since every entry's sizes are known before its header is written,
+ * entries carry their crc and sizes in the local header and have no
+ * data descriptor.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Format.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Write a ZIP64 archive to a local file using concurrent positional writes. */
+class Zip64ParallelWriter
+{
+
+public:
+
+    enum Method
+    {
+        /** Store entries; the range is reserved before reading. */
+        STORE,
+
+        /** Deflate entries; the range is reserved once compressed. */
+        DEFLATE
+    };
+
+    /**
+     * Create @a zipFile (truncating it) for files found in @a dir.
+     * @a threads of zero means one per online CPU.
+     */
+    Zip64ParallelWriter( const string & dir,
+                         const string & zipFile,
+                         Method method = DEFLATE,
+                         unsigned threads = 0 );
+
+    /** Standard destructor; calls finish() if the caller didn't. */
+    ~Zip64ParallelWriter();
+
+    /** Queue a single @a file (relative to dir given in constructor). */
+    bool addFile( const string & file );
+
+    /** Queue all files that match @a pattern (relative to dir given in constructor). */
+    size_t addFileByPattern( const string & pattern );
+
+    /**
+     * Wait for all queued entries, then write the central directory
+     * and trailer.  Returns the archive size.  Rethrows the first
+     * error any worker hit, after removing the partial archive.
+     */
+    uint64_t finish();
+
+    /**
+     * Deflated entries whose compressed form grows past this many
+     * bytes spill to a temporary file instead of memory.
+     */
+    void setMaxBufferedBytes( size_t bytes );
+
+private:
+
+    Zip64ParallelWriter( const Zip64ParallelWriter & );
+    Zip64ParallelWriter & operator=( const Zip64ParallelWriter & );
+
+    struct Job
+    {
+        string path;
+        string name;
+        uint64_t size;
+        Zip64EntryInfo ei;
+    };
+
+    const string m_sDir;
+    const string m_sZipFile;
+    const Method m_method;
+    int m_fd;
+    size_t m_maxBufferedBytes;
+
+    // job queue; guarded by m_jobMutex
+    std::mutex m_jobMutex;
+    std::condition_variable m_jobCond;
+    std::deque< Job > m_jobs;
+    bool m_bClosed;
+    std::vector< std::thread > m_workers;
+
+    // output space and results; guarded by m_outMutex
+    std::mutex m_outMutex;
+    uint64_t m_nextOffset;
+    uint64_t m_allocated;
+    std::vector< Zip64EntryInfo > m_entries;
+    std::exception_ptr m_error;
+
+    bool m_bFinished;
+    uint64_t m_size;
+
+    void workerLoop();
+    void writeStored( Job & job );
+    void writeDeflated( Job & job );
+
+    /** Remove the partial archive after a failure. */
+    void discard();
+
+    uint64_t reserve( uint64_t bytes );
+    void pwriteAll( const char * data, size_t len, uint64_t offset );
+    void commit( const Zip64EntryInfo & ei );
+
+}; // end class Zip64ParallelWriter
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64PARALLELWRITER_HPP
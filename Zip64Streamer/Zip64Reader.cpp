@@ -0,0 +1,745 @@
+/**
+ * @file Zip64Reader.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// standard C++ headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Format.hpp"
+
+// interface
+#include "Zip64Reader.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+using namespace com::foiani::zip64;
+
+const uint64_t END_OF_CENTRAL_DIR_SIZE = 22;
+const uint64_t MAX_ARCHIVE_COMMENT = 0xffff;
+const uint64_t Z64_END_OF_CENTRAL_DIR_LOC_SIZE = 20;
+const uint64_t Z64_END_OF_CENTRAL_DIR_REC_MIN_SIZE = 56;
+const uint64_t CDIR_FILE_HEADER_FIXED_SIZE = 46;
+const uint64_t LOCAL_FILE_HEADER_FIXED_SIZE = 30;
+
+const uint32_t Z64_MARKER_32 = 0xffffffff;
+
+const uint16_t EXTENDED_TIMESTAMP_EXTRA_FIELD_TAG = 0x5455;
+
+const uint16_t HOST_UNIX = 3;
+const uint32_t DEFAULT_DIR_MODE = 040755;
+
+// crc32() and inflate() count in 32-bit units; feed them slices.
+const uint64_t SLICE_BYTES = 1024 * 1024 * 1024;
+const size_t OUTPUT_CHUNK_BYTES = 256 * 1024;
+
+/** Owns a raw inflate stream for one worker. */
+class Inflater
+{
+
+public:
+
+    Inflater()
+    {
+        zeroStruct( m_zs );
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+        const int rc = inflateInit2( &m_zs, -15 /* raw deflate data */ );
+
+#pragma GCC diagnostic pop
+
+        if ( rc != Z_OK )
+            throw std::runtime_error( "initializing decompression, rc=" + std::to_string( rc ) );
+    }
+
+    ~Inflater() { inflateEnd( &m_zs ); }
+
+    z_stream & zs() { return m_zs; }
+
+private:
+
+    Inflater( const Inflater & );
+    Inflater & operator=( const Inflater & );
+
+    z_stream m_zs;
+
+};
+
+/** Convert an MS-DOS date and time (local to nobody; we treat it as UTC). */
+time_t
+fromMsdos( const uint16_t date, const uint16_t time )
+{
+    struct tm tm;
+    zeroStruct( tm );
+    tm.tm_year = ( ( date >> 9 ) & 0x7f ) + 80;
+    tm.tm_mon  = ( ( date >> 5 ) & 0x0f ) - 1;
+    tm.tm_mday = ( date & 0x1f );
+    tm.tm_hour = ( time >> 11 ) & 0x1f;
+    tm.tm_min  = ( time >>  5 ) & 0x3f;
+    tm.tm_sec  = ( time & 0x1f ) * 2;
+    return timegm( &tm );
+}
+
+/** Refuse names that would land outside the destination directory. */
+void
+checkSafeName( const string & name )
+{
+    if ( name.empty() )
+        throw std::runtime_error( "empty name" );
+    if ( name[0] == '/' )
+        throw std::runtime_error( "absolute path" );
+    if ( name.find( '\0' ) != string::npos )
+        throw std::runtime_error( "NUL in name" );
+
+    size_t start( 0 );
+    while ( start <= name.size() )
+    {
+        size_t end( name.find( '/', start ) );
+        if ( end == string::npos )
+            end = name.size();
+        if ( name.compare( start, end - start, ".." ) == 0 )
+            throw std::runtime_error( "\"..\" in path" );
+        start = end + 1;
+    }
+}
+
+/** @a name without empty or "." components: the path it ends up at. */
+string
+normalName( const string & name )
+{
+    string rv;
+    size_t start( 0 );
+    while ( start < name.size() )
+    {
+        size_t end( name.find( '/', start ) );
+        if ( end == string::npos )
+            end = name.size();
+        if ( end > start && name.compare( start, end - start, "." ) != 0 )
+        {
+            if ( ! rv.empty() )
+                rv += '/';
+            rv.append( name, start, end - start );
+        }
+        start = end + 1;
+    }
+    return rv;
+}
+
+/** mkdir -p; directories that already exist are fine. */
+void
+makeDirs( const string & path )
+{
+    for ( size_t slash = path.find( '/', 1 ); ; slash = path.find( '/', slash + 1 ) )
+    {
+        const string prefix( path.substr( 0, slash ) );
+        if ( mkdir( prefix.c_str(), 0777 ) != 0 && errno != EEXIST )
+            throw OSError( "mkdir " + prefix );
+        if ( slash == string::npos )
+            break;
+    }
+}
+
+void
+writeAll( const int fd, const char * p, size_t n )
+{
+    while ( n > 0 )
+    {
+        const ssize_t w( write( fd, p, n ) );
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            throw OSError( "write" );
+        }
+        p += w;
+        n -= static_cast< size_t >( w );
+    }
+}
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+Zip64Reader::Zip64Reader( const string & zipFile )
+    : m_sPath( zipFile ),
+      m_fd( -1 ),
+      m_base( 0 ),
+      m_size( 0 )
+{
+    m_fd = open( zipFile.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( m_fd < 0 )
+        throw OSError( "opening " + zipFile );
+
+    struct stat st;
+    if ( fstat( m_fd, &st ) != 0 )
+    {
+        close( m_fd );
+        throw OSError( "stat " + zipFile );
+    }
+    m_size = static_cast< uint64_t >( st.st_size );
+
+    if ( m_size < END_OF_CENTRAL_DIR_SIZE )
+    {
+        close( m_fd );
+        throw std::runtime_error( zipFile + ": too short to be a zip file" );
+    }
+
+    void * const map( mmap( 0, m_size, PROT_READ, MAP_SHARED, m_fd, 0 ) );
+    if ( map == MAP_FAILED )
+    {
+        close( m_fd );
+        throw OSError( "mmap " + zipFile );
+    }
+    m_base = static_cast< const char * >( map );
+
+    try
+    {
+        readCentralDirectory();
+    }
+    catch ( ... )
+    {
+        munmap( const_cast< char * >( m_base ), m_size );
+        close( m_fd );
+        throw;
+    }
+
+    DEBUG( "zr: ctor: " << QS( zipFile ) << ": " << m_entries.size() << " entries" );
+}
+
+Zip64Reader::~Zip64Reader()
+{
+    munmap( const_cast< char * >( m_base ), m_size );
+    close( m_fd );
+}
+
+const char *
+Zip64Reader::at( const uint64_t offset, const uint64_t len ) const
+{
+    if ( offset > m_size || len > m_size - offset )
+        throw std::runtime_error( m_sPath + ": truncated (wanted " + std::to_string( len ) +
+                                  " bytes at " + std::to_string( offset ) + ")" );
+    return m_base + offset;
+}
+
+void
+Zip64Reader::readCentralDirectory()
+{
+    // the end record is last, followed only by a comment of up to 64 KiB.
+    uint64_t eocd( m_size - END_OF_CENTRAL_DIR_SIZE );
+    const uint64_t lowest( eocd > MAX_ARCHIVE_COMMENT ? eocd - MAX_ARCHIVE_COMMENT : 0 );
+    while ( read4( at( eocd, 4 ) ) != END_OF_CENTRAL_DIR_SIG )
+    {
+        if ( eocd == lowest )
+            throw std::runtime_error( m_sPath + ": no end of central directory record" );
+        --eocd;
+    }
+
+    const char * e( at( eocd, END_OF_CENTRAL_DIR_SIZE ) );
+    uint64_t entries( read2( e + 10 ) );
+    uint64_t cdBytes( read4( e + 12 ) );
+    uint64_t cdOffset( read4( e + 16 ) );
+
+    // a ZIP64 locator right before it means the real numbers are in
+    // the ZIP64 end record.
+    if ( eocd >= Z64_END_OF_CENTRAL_DIR_LOC_SIZE )
+    {
+        const char * loc( at( eocd - Z64_END_OF_CENTRAL_DIR_LOC_SIZE,
+                              Z64_END_OF_CENTRAL_DIR_LOC_SIZE ) );
+        if ( read4( loc ) == Z64_END_OF_CENTRAL_DIR_LOC_SIG )
+        {
+            const char * z( at( read8( loc + 8 ), Z64_END_OF_CENTRAL_DIR_REC_MIN_SIZE ) );
+            if ( read4( z ) != Z64_END_OF_CENTRAL_DIR_REC_SIG )
+                throw std::runtime_error( m_sPath + ": bad ZIP64 end of central directory record" );
+            entries = read8( z + 32 );
+            cdBytes = read8( z + 40 );
+            cdOffset = read8( z + 48 );
+        }
+    }
+
+    DEBUG( "zr: rcd: " << entries << " entries, " << cdBytes << " bytes at " << cdOffset );
+
+    const char * p( at( cdOffset, cdBytes ) );
+    const char * const end( p + cdBytes );
+
+    // we're about to walk all of it.
+    const uintptr_t page( static_cast< uintptr_t >( sysconf( _SC_PAGESIZE ) ) );
+    const uintptr_t aligned( reinterpret_cast< uintptr_t >( p ) & ~( page - 1 ) );
+    madvise( reinterpret_cast< void * >( aligned ),
+             reinterpret_cast< uintptr_t >( end ) - aligned, MADV_WILLNEED );
+
+    m_entries.reserve( std::min< uint64_t >( entries, cdBytes / CDIR_FILE_HEADER_FIXED_SIZE ) );
+
+    for ( uint64_t i = 0; i < entries; ++i )
+    {
+        if ( static_cast< uint64_t >( end - p ) < CDIR_FILE_HEADER_FIXED_SIZE ||
+             read4( p ) != CDIR_FILE_HEADER_SIG )
+            throw std::runtime_error( m_sPath + ": bad central directory record " +
+                                      std::to_string( i ) );
+
+        const uint16_t madeBy( read2( p + 4 ) );
+        const uint16_t nameLen( read2( p + 28 ) );
+        const uint16_t extraLen( read2( p + 30 ) );
+        const uint16_t commentLen( read2( p + 32 ) );
+        const uint32_t externalAttr( read4( p + 38 ) );
+
+        const uint64_t recordBytes( CDIR_FILE_HEADER_FIXED_SIZE + nameLen + extraLen + commentLen );
+        if ( static_cast< uint64_t >( end - p ) < recordBytes )
+            throw std::runtime_error( m_sPath + ": central directory record " +
+                                      std::to_string( i ) + " runs past the end" );
+
+        Zip64EntryInfo ei;
+        ei.flags = read2( p + 8 );
+        ei.method = read2( p + 10 );
+        ei.msdos_time = read2( p + 12 );
+        ei.msdos_date = read2( p + 14 );
+        ei.crc32 = read4( p + 16 );
+        ei.compressed = read4( p + 20 );
+        ei.uncompressed = read4( p + 24 );
+        ei.offset = read4( p + 42 );
+        ei.name.assign( p + CDIR_FILE_HEADER_FIXED_SIZE, nameLen );
+
+        const bool isDir( ! ei.name.empty() && ei.name.back() == '/' );
+        if ( ( madeBy >> 8 ) == HOST_UNIX && ( externalAttr >> 16 ) != 0 )
+            ei.mode = externalAttr >> 16;
+        else
+            ei.mode = isDir ? DEFAULT_DIR_MODE : DEFAULT_FILE_MODE;
+
+        bool haveTimes( false );
+        const char * x( p + CDIR_FILE_HEADER_FIXED_SIZE + nameLen );
+        const char * const xEnd( x + extraLen );
+        while ( xEnd - x >= 4 )
+        {
+            const uint16_t tag( read2( x ) );
+            const uint16_t len( read2( x + 2 ) );
+            const char * data( x + 4 );
+            if ( xEnd - data < len )
+                throw std::runtime_error( m_sPath + ": bad extra field in " + QS( ei.name ) );
+
+            if ( tag == Z64_EXTRA_FIELD_TAG )
+            {
+                // only the fields that overflowed are present, in this order.
+                const char * q( data );
+                const char * const qEnd( data + len );
+                if ( ei.uncompressed == Z64_MARKER_32 && qEnd - q >= 8 )
+                {
+                    ei.uncompressed = read8( q );
+                    q += 8;
+                }
+                if ( ei.compressed == Z64_MARKER_32 && qEnd - q >= 8 )
+                {
+                    ei.compressed = read8( q );
+                    q += 8;
+                }
+                if ( ei.offset == Z64_MARKER_32 && qEnd - q >= 8 )
+                {
+                    ei.offset = read8( q );
+                    q += 8;
+                }
+            }
+            else if ( tag == UNIX_EXTRA_FIELD_TAG && len >= 8 )
+            {
+                ei.stat_atime = read4( data );
+                ei.stat_mtime = read4( data + 4 );
+                haveTimes = true;
+            }
+            else if ( tag == EXTENDED_TIMESTAMP_EXTRA_FIELD_TAG && len >= 5 && ( data[0] & 1 ) )
+            {
+                ei.stat_mtime = read4( data + 1 );
+                ei.stat_atime = ( ( data[0] & 2 ) && len >= 9 ) ? read4( data + 5 ) : ei.stat_mtime;
+                haveTimes = true;
+            }
+
+            x = data + len;
+        }
+
+        if ( ! haveTimes )
+        {
+            ei.stat_mtime = static_cast< uint32_t >( fromMsdos( ei.msdos_date, ei.msdos_time ) );
+            ei.stat_atime = ei.stat_mtime;
+        }
+
+        m_entries.push_back( ei );
+        p += recordBytes;
+    }
+}
+
+void
+Zip64Reader::read( const Zip64EntryInfo & ei, const Sink & sink ) const
+{
+    const char * lh( at( ei.offset, LOCAL_FILE_HEADER_FIXED_SIZE ) );
+    if ( read4( lh ) != LOCAL_FILE_HEADER_SIG )
+        throw std::runtime_error( "no local header at " + std::to_string( ei.offset ) );
+    if ( read2( lh + 8 ) != ei.method )
+        throw std::runtime_error( "local header and central directory disagree on method" );
+
+    const uint64_t dataStart( ei.offset + LOCAL_FILE_HEADER_FIXED_SIZE +
+                              read2( lh + 26 ) + read2( lh + 28 ) );
+    const char * const data( at( dataStart, ei.compressed ) );
+
+    uLong crc( crc32( 0, Z_NULL, 0 ) );
+    uint64_t produced( 0 );
+
+    if ( ei.method == COMPRESSION_METHOD_STORE )
+    {
+        if ( ei.compressed != ei.uncompressed )
+            throw std::runtime_error( "stored entry with differing sizes" );
+
+        for ( uint64_t done = 0; done < ei.compressed; )
+        {
+            const uint64_t n( std::min( ei.compressed - done, SLICE_BYTES ) );
+            crc = crc32( crc, reinterpret_cast< const Bytef * >( data + done ),
+                         static_cast< uInt >( n ) );
+            sink( data + done, n );
+            done += n;
+        }
+        produced = ei.compressed;
+    }
+    else if ( ei.method == COMPRESSION_METHOD_DEFLATE )
+    {
+        thread_local std::unique_ptr< Inflater > t_inflater;
+        if ( ! t_inflater )
+            t_inflater.reset( new Inflater );
+        else
+            inflateReset( &t_inflater->zs() );
+        z_stream & zs( t_inflater->zs() );
+
+        thread_local CharBuffer t_output( OUTPUT_CHUNK_BYTES );
+
+        uint64_t fed( 0 );
+        zs.avail_in = 0;
+        while ( true )
+        {
+            if ( zs.avail_in == 0 && fed < ei.compressed )
+            {
+                const uint64_t n( std::min( ei.compressed - fed, SLICE_BYTES ) );
+                zs.next_in = reinterpret_cast< Bytef * >( const_cast< char * >( data + fed ) );
+                zs.avail_in = static_cast< uInt >( n );
+                fed += n;
+            }
+
+            zs.next_out = reinterpret_cast< Bytef * >( &t_output[0] );
+            zs.avail_out = static_cast< uInt >( t_output.size() );
+
+            const int rc( inflate( &zs, Z_NO_FLUSH ) );
+            if ( rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR )
+                throw std::runtime_error( string( "inflate: " ) +
+                                          ( zs.msg ? zs.msg : std::to_string( rc ).c_str() ) );
+
+            const size_t used( t_output.size() - zs.avail_out );
+            if ( used )
+            {
+                crc = crc32( crc, reinterpret_cast< const Bytef * >( &t_output[0] ),
+                             static_cast< uInt >( used ) );
+                sink( &t_output[0], used );
+                produced += used;
+            }
+
+            if ( rc == Z_STREAM_END )
+                break;
+            if ( rc == Z_BUF_ERROR && zs.avail_in == 0 && fed == ei.compressed )
+                throw std::runtime_error( "compressed data ends early" );
+        }
+
+        if ( fed - zs.avail_in != ei.compressed )
+            throw std::runtime_error( "compressed size mismatch" );
+    }
+    else
+    {
+        throw std::runtime_error( "unsupported compression method " + std::to_string( ei.method ) );
+    }
+
+    if ( produced != ei.uncompressed )
+        throw std::runtime_error( "size mismatch: expected " + std::to_string( ei.uncompressed ) +
+                                  ", got " + std::to_string( produced ) );
+    if ( crc != ei.crc32 )
+        throw std::runtime_error( "crc mismatch" );
+
+    if ( ei.flags & GPB_DATA_DESC_FOLLOWS_DATA )
+        checkDataDescriptor( ei, dataStart + ei.compressed );
+}
+
+void
+Zip64Reader::checkDataDescriptor( const Zip64EntryInfo & ei, uint64_t pos ) const
+{
+    // the signature is optional.
+    if ( read4( at( pos, 4 ) ) == DATA_DESC_SIG )
+        pos += 4;
+
+    const uint32_t crc( read4( at( pos, 4 ) ) );
+
+    // ZIP64 descriptors have 8-byte sizes; classic ones, 4-byte.
+    bool sizesMatch( false );
+    if ( m_size - pos >= 20 )
+    {
+        const char * d( at( pos, 20 ) );
+        sizesMatch = ( read8( d + 4 ) == ei.compressed && read8( d + 12 ) == ei.uncompressed );
+    }
+    if ( ! sizesMatch )
+    {
+        const char * d( at( pos, 12 ) );
+        sizesMatch = ( read4( d + 4 ) == ei.compressed && read4( d + 8 ) == ei.uncompressed );
+    }
+
+    if ( crc != ei.crc32 || ! sizesMatch )
+        throw std::runtime_error( "data descriptor disagrees with central directory" );
+}
+
+Zip64Reader::Result
+Zip64Reader::verify( const unsigned threads ) const
+{
+    std::vector< size_t > all( m_entries.size() );
+    for ( size_t i = 0; i < all.size(); ++i )
+        all[i] = i;
+
+    const Sink discard( []( const char *, size_t ) {} );
+    return forEachEntry( threads, all, [&]( const Zip64EntryInfo & ei ) { read( ei, discard ); } );
+}
+
+/**
+ * Makes directories under one extract()'s destination.  Every part of
+ * an entry's path must be a real directory: one that's a symlink
+ * (already in the tree, say) is refused rather than followed, as it
+ * could lead anywhere.  Many entries share a directory, so the ones
+ * made or checked are remembered and a repeat skips the syscalls.
+ * Its workers share one of these; it lasts only as long as that
+ * extract().
+ */
+class Zip64Reader::MadeDirs
+{
+
+public:
+
+    /** Make @a dest itself; it's the caller's, so it may be a symlink. */
+    explicit MadeDirs( const string & dest )
+        : m_dest( dest )
+    {
+        makeDirs( dest );
+    }
+
+    /** Make @a rel, a normalName() under the destination, and its parents. */
+    void make( const string & rel )
+    {
+        for ( size_t slash = rel.find( '/' ); ! rel.empty(); slash = rel.find( '/', slash + 1 ) )
+        {
+            const string prefix( rel.substr( 0, slash ) );
+            if ( ! isMade( prefix ) )
+            {
+                // two workers may both get here; mkdir takes care of that.
+                const string path( m_dest + "/" + prefix );
+                if ( mkdir( path.c_str(), 0777 ) != 0 )
+                {
+                    if ( errno != EEXIST )
+                        throw OSError( "mkdir " + path );
+                    struct stat st;
+                    if ( lstat( path.c_str(), &st ) != 0 )
+                        throw OSError( "lstat " + path );
+                    if ( ! S_ISDIR( st.st_mode ) )
+                        throw std::runtime_error( path + ": not a directory" );
+                }
+
+                std::lock_guard< std::mutex > lock( m_mutex );
+                m_made.insert( prefix );
+            }
+            if ( slash == string::npos )
+                break;
+        }
+    }
+
+private:
+
+    MadeDirs( const MadeDirs & );
+    MadeDirs & operator=( const MadeDirs & );
+
+    bool isMade( const string & prefix )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        return m_made.count( prefix ) != 0;
+    }
+
+    const string m_dest;
+    std::mutex m_mutex;
+    std::unordered_set< string > m_made;
+
+};
+
+Zip64Reader::Result
+Zip64Reader::extract( const string & destDir, const unsigned threads ) const
+{
+    const string dest( destDir.empty() ? "." : destDir );
+
+    // modes are masked as open() would, but with the mask read just
+    // the once; setting it is process-wide, so not from the workers.
+    const mode_t mask( umask( 0 ) );
+    umask( mask );
+
+    // files that land on the same path (an archive appended to, say)
+    // would truncate and unlink each other's output; only the last of
+    // them is written, as if each overwrote the one before.
+    std::unordered_map< string, size_t > last;
+    for ( size_t i = 0; i < m_entries.size(); ++i )
+        if ( m_entries[i].name.empty() || m_entries[i].name.back() != '/' )
+            last[ normalName( m_entries[i].name ) ] = i;
+
+    std::vector< size_t > todo;
+    for ( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        const string & name( m_entries[i].name );
+        if ( ( ! name.empty() && name.back() == '/' ) || last[ normalName( name ) ] == i )
+            todo.push_back( i );
+    }
+
+    MadeDirs made( dest );
+    return forEachEntry( threads, todo, [&]( const Zip64EntryInfo & ei ) { extractOne( dest, ei, mask, made ); } );
+}
+
+void
+Zip64Reader::extractOne( const string & destDir, const Zip64EntryInfo & ei,
+                         const mode_t mask, MadeDirs & made ) const
+{
+    checkSafeName( ei.name );
+
+    const string name( normalName( ei.name ) );
+    if ( ei.name.back() == '/' )
+    {
+        made.make( name );
+        return;
+    }
+    const size_t slash( name.rfind( '/' ) );
+    made.make( slash == string::npos ? string() : name.substr( 0, slash ) );
+
+    // the directories are known to be real ones; O_NOFOLLOW covers the file.
+    const string path( destDir + "/" + name );
+
+    const int fd( open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600 ) );
+    if ( fd < 0 )
+        throw OSError( "creating " + path );
+
+    try
+    {
+        read( ei, [fd]( const char * p, size_t n ) { writeAll( fd, p, n ); } );
+
+        if ( fchmod( fd, ei.mode & 0777 & ~mask ) != 0 )
+            throw OSError( "chmod " + path );
+
+        struct timespec times[2];
+        times[0].tv_sec = ei.stat_atime;
+        times[0].tv_nsec = 0;
+        times[1].tv_sec = ei.stat_mtime;
+        times[1].tv_nsec = 0;
+        if ( futimens( fd, times ) != 0 )
+            throw OSError( "setting times on " + path );
+    }
+    catch ( ... )
+    {
+        close( fd );
+        unlink( path.c_str() );
+        throw;
+    }
+
+    if ( close( fd ) != 0 )
+        throw OSError( "closing " + path );
+}
+
+Zip64Reader::Result
+Zip64Reader::forEachEntry( unsigned threads,
+                           std::vector< size_t > order,
+                           const std::function< void ( const Zip64EntryInfo & ) > & fn ) const
+{
+    const std::chrono::steady_clock::time_point start( std::chrono::steady_clock::now() );
+
+    if ( threads == 0 )
+        threads = static_cast< unsigned >( std::max( 1L, sysconf( _SC_NPROCESSORS_ONLN ) ) );
+    threads = static_cast< unsigned >(
+        std::max< size_t >( 1, std::min< size_t >( threads, order.size() ) ) );
+
+    // biggest first, so one huge entry doesn't start last and run alone.
+    std::stable_sort( order.begin(), order.end(),
+                      [this]( const size_t a, const size_t b )
+                      { return m_entries[a].compressed > m_entries[b].compressed; } );
+
+    Result rv;
+    rv.entries = 0;
+    rv.bytes = 0;
+    rv.failures = 0;
+
+    std::atomic< size_t > next( 0 );
+    std::mutex mutex;
+
+    const auto worker = [&]()
+    {
+        uint64_t entries( 0 );
+        uint64_t bytes( 0 );
+        for ( size_t i = next++; i < order.size(); i = next++ )
+        {
+            const Zip64EntryInfo & ei( m_entries[ order[i] ] );
+            string error;
+            try
+            {
+                fn( ei );
+                ++entries;
+                bytes += ei.uncompressed;
+                continue;
+            }
+            catch ( const std::exception & e )
+            {
+                error = e.what();
+            }
+            catch ( ... )
+            {
+                error = "unknown error";
+            }
+
+            std::lock_guard< std::mutex > lock( mutex );
+            ++rv.failures;
+            rv.errors.push_back( ei.name + ": " + error );
+        }
+
+        std::lock_guard< std::mutex > lock( mutex );
+        rv.entries += entries;
+        rv.bytes += bytes;
+    };
+
+    std::vector< std::thread > helpers;
+    for ( unsigned i = 1; i < threads; ++i )
+        helpers.push_back( std::thread( worker ) );
+    worker();
+    for ( std::thread & t : helpers )
+        t.join();
+
+    std::sort( rv.errors.begin(), rv.errors.end() );
+    rv.seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+    return rv;
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
@@ -0,0 +1,127 @@
+#ifndef COM_FOIANI_Z64S_ZIP64READER_HPP
+#define COM_FOIANI_Z64S_ZIP64READER_HPP 1
+
+/**
+ * @file Zip64Reader.hpp
+ *
+ * Companion reader for the archives Zip64Streamer and
+ * Zip64ParallelWriter produce (and ordinary zip files generally):
+ * finds the ZIP64 end records, reads the central directory from a
+ * read-only mapping of the whole archive, then verifies or extracts
+ * entries on several threads at once.
+ *
+ * Every entry is checked against its CRC-32 and sizes, and, where it
+ * has one, its data descriptor.  Stored data is checksummed straight
+ * out of the mapping; deflated data is inflated in place.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <sys/types.h>
+
+// standard C++ headers
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Format.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Read, verify and extract a ZIP64 archive. */
+class Zip64Reader
+{
+
+public:
+
+    typedef std::vector< Zip64EntryInfo > EntryVec;
+
+    /** Receives an entry's uncompressed data, a piece at a time. */
+    typedef std::function< void ( const char * data, size_t len ) > Sink;
+
+    /** Outcome of verify() or extract(). */
+    struct Result
+    {
+        uint64_t entries;    // entries that came out intact
+        uint64_t bytes;      // their uncompressed bytes
+        uint64_t failures;   // entries that didn't
+        StringList errors;   // "name: what went wrong", one per failure
+        double seconds;
+    };
+
+    /** Map @a zipFile and read its central directory; throws if that fails. */
+    explicit Zip64Reader( const string & zipFile );
+
+    /** Standard destructor. */
+    ~Zip64Reader();
+
+    /** Entries in central directory order. */
+    const EntryVec & entries() const { return m_entries; }
+
+    uint64_t archiveSize() const { return m_size; }
+
+    /**
+     * Decompress @a ei into @a sink, then check it; throws on any
+     * damage or mismatch.  Safe to call from several threads.
+     */
+    void read( const Zip64EntryInfo & ei, const Sink & sink ) const;
+
+    /** Check every entry using @a threads workers (0 means one per online CPU). */
+    Result verify( unsigned threads = 0 ) const;
+
+    /**
+     * Write every entry under @a destDir ("" means the current
+     * directory), creating directories as needed and restoring
+     * permissions (less the umask's bits) and times.  Entries with
+     * absolute names or ".." components are refused, as are paths
+     * through a symlink under @a destDir.  Of files with the same
+     * name, only the last in the archive is written.
+     */
+    Result extract( const string & destDir, unsigned threads = 0 ) const;
+
+private:
+
+    Zip64Reader( const Zip64Reader & );
+    Zip64Reader & operator=( const Zip64Reader & );
+
+    const string m_sPath;
+    int m_fd;
+    const char * m_base;
+    uint64_t m_size;
+
+    EntryVec m_entries;
+
+    /** Pointer to @a len bytes at @a offset; throws if they run past the end. */
+    const char * at( uint64_t offset, uint64_t len ) const;
+
+    void readCentralDirectory();
+
+    /** Check the descriptor that starts at @a pos against @a ei. */
+    void checkDataDescriptor( const Zip64EntryInfo & ei, uint64_t pos ) const;
+
+    /** Directories made so far by one extract(). */
+    class MadeDirs;
+
+    /** Write @a ei under @a destDir, its mode less the bits in @a mask. */
+    void extractOne( const string & destDir, const Zip64EntryInfo & ei,
+                     mode_t mask, MadeDirs & made ) const;
+
+    /** Run @a fn on the entries at indexes @a order using @a threads workers. */
+    Result forEachEntry( unsigned threads,
+                         std::vector< size_t > order,
+                         const std::function< void ( const Zip64EntryInfo & ) > & fn ) const;
+
+}; // end class Zip64Reader
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64READER_HPP
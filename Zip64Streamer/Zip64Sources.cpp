@@ -0,0 +1,137 @@
+/**
+ * @file Zip64Sources.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard c / posix headers
+#include <errno.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <algorithm>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "Zip64Sources.hpp"
+
+namespace // anonymous
+{
+
+// zlib counts input in 32-bit units, and the tracer's "read" spans
+// are more useful in pieces, so big blocks are handed out in slices.
+const size_t MAX_SLICE_BYTES = 1024 * 1024;
+
+} // end namespace anonymous
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+MemorySource::MemorySource( const void * data, const size_t len )
+    : m_pos( static_cast< const char * >( data ) ),
+      m_left( len )
+{
+}
+
+MemorySource::MemorySource( const CharBuffer & cb )
+    : m_pos( cb.data() ),
+      m_left( cb.size() )
+{
+}
+
+MemorySource::MemorySource( const string & s )
+    : m_pos( s.data() ),
+      m_left( s.size() )
+{
+}
+
+/* virtual */ size_t
+MemorySource::read( const char * & data )
+{
+    const size_t n( std::min( m_left, MAX_SLICE_BYTES ) );
+    data = m_pos;
+    m_pos += n;
+    m_left -= n;
+    return n;
+}
+
+/* virtual */ int64_t
+MemorySource::sizeHint() const
+{
+    return static_cast< int64_t >( m_left );
+}
+
+StreamSource::StreamSource( std::istream & is, const size_t bufferBytes )
+    : m_is( is ),
+      m_buf( std::max< size_t >( bufferBytes, 1 ) )
+{
+}
+
+/* virtual */ size_t
+StreamSource::read( const char * & data )
+{
+    m_is.read( &m_buf[0], m_buf.size() );
+    if ( m_is.bad() )
+        throw std::runtime_error( "stream source: read failed" );
+
+    data = &m_buf[0];
+    return static_cast< size_t >( m_is.gcount() );
+}
+
+FdSource::FdSource( const int fd, const bool owned, const size_t bufferBytes )
+    : m_fd( fd ),
+      m_bOwned( owned ),
+      m_buf( std::max< size_t >( bufferBytes, 1 ) )
+{
+}
+
+/* virtual */
+FdSource::~FdSource()
+{
+    if ( m_bOwned )
+        close( m_fd );
+}
+
+/* virtual */ size_t
+FdSource::read( const char * & data )
+{
+    while ( true )
+    {
+        const ssize_t n( ::read( m_fd, &m_buf[0], m_buf.size() ) );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            throw OSError( "read" );
+        }
+        data = &m_buf[0];
+        return static_cast< size_t >( n );
+    }
+}
+
+CallbackSource::CallbackSource( const Fill & fill, const size_t bufferBytes )
+    : m_fill( fill ),
+      m_buf( std::max< size_t >( bufferBytes, 1 ) )
+{
+}
+
+/* virtual */ size_t
+CallbackSource::read( const char * & data )
+{
+    const size_t n( m_fill( &m_buf[0], m_buf.size() ) );
+    if ( n > m_buf.size() )
+        throw std::length_error( "callback source: filled " + std::to_string( n ) +
+                                 " bytes into a " + std::to_string( m_buf.size() ) +
+                                 " byte buffer" );
+    data = &m_buf[0];
+    return n;
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
@@ -0,0 +1,127 @@
+#ifndef COM_FOIANI_Z64S_ZIP64SOURCES_HPP
+#define COM_FOIANI_Z64S_ZIP64SOURCES_HPP 1
+
+/**
+ * @file Zip64Sources.hpp
+ *
+ * Ready-made Zip64Streamer::Source implementations, for content that
+ * isn't sitting in a file under the streamer's directory: query
+ * results already in memory, another process's output on a pipe, or
+ * a report generated on the fly.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <functional>
+#include <istream>
+
+// local headers
+#include "Compat.hpp"
+#include "Zip64Streamer.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/**
+ * A block of memory, handed to the compressor in place (no copy).
+ * The caller must keep it alive and unchanged until addEntry()
+ * returns.
+ */
+class MemorySource
+    : public Zip64Streamer::Source
+{
+
+public:
+
+    MemorySource( const void * data, size_t len );
+    explicit MemorySource( const CharBuffer & cb );
+    explicit MemorySource( const string & s );
+
+    virtual size_t read( const char * & data );
+    virtual int64_t sizeHint() const;
+
+private:
+
+    const char * m_pos;
+    size_t m_left;
+
+};
+
+/** Everything up to end-of-file on a std::istream. */
+class StreamSource
+    : public Zip64Streamer::Source
+{
+
+public:
+
+    explicit StreamSource( std::istream & is, size_t bufferBytes = 64 * 1024 );
+
+    virtual size_t read( const char * & data );
+
+private:
+
+    std::istream & m_is;
+    CharBuffer m_buf;
+
+};
+
+/**
+ * Everything up to end-of-file on a file descriptor; works for pipes
+ * and sockets as well as regular files.
+ */
+class FdSource
+    : public Zip64Streamer::Source
+{
+
+public:
+
+    /** Read from @a fd; close it on destruction only if @a owned. */
+    explicit FdSource( int fd, bool owned = false, size_t bufferBytes = 64 * 1024 );
+
+    virtual ~FdSource();
+
+    virtual size_t read( const char * & data );
+
+private:
+
+    FdSource( const FdSource & );
+    FdSource & operator=( const FdSource & );
+
+    const int m_fd;
+    const bool m_bOwned;
+    CharBuffer m_buf;
+
+};
+
+/**
+ * Content produced on demand.  The callback fills up to @a len
+ * bytes at @a buf and returns how many it wrote; 0 means done.
+ */
+class CallbackSource
+    : public Zip64Streamer::Source
+{
+
+public:
+
+    typedef std::function< size_t ( char * buf, size_t len ) > Fill;
+
+    explicit CallbackSource( const Fill & fill, size_t bufferBytes = 64 * 1024 );
+
+    virtual size_t read( const char * & data );
+
+private:
+
+    Fill m_fill;
+    CharBuffer m_buf;
+
+};
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64SOURCES_HPP
@@ -5,12 +5,24 @@
  */
 
 // standard c / posix headers
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 // standard C++ headers
-#include <fstream>
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <sstream>
 
 // boost headers
 
@@ -18,6 +30,10 @@
 
 // local headers
 #include "Compat.hpp"
+#include "PatternSet.hpp"
+#include "Zip64Checkpoint.hpp"
+#include "Zip64Format.hpp"
+#include "Zip64Sources.hpp"
 
 // interface
 #include "Zip64Streamer.hpp"
@@ -26,169 +42,285 @@ namespace // anonymous
 {
 
 using namespace com::foiani;
+using namespace com::foiani::zip64;
 
-const uint32_t LOCAL_FILE_HEADER_SIG = 0x04034b50;
+// compressed output is sent in pieces of this size.
+const size_t OUTPUT_CHUNK_BYTES = 32 * 1024;
 
-// need version 4.5 for zip64 support
-const uint16_t VERSION_NEEDED_TO_EXTRACT_4_5 = 45;
-const uint16_t VERSION_CREATED_BY_4_5_UNIX   =
-  ( 3 << 8 |  // unix
-    VERSION_NEEDED_TO_EXTRACT_4_5 );
+// small entries and central directory records are batched up to
+// about this much per send.
+const size_t BATCH_BYTES = 64 * 1024;
 
-// GPB == "general purpose bits"
-const uint16_t GPB_NO_FLAGS = 0;
-const uint16_t GPB_DATA_DESC_FOLLOWS_DATA = 1 << 3;
+const size_t DEFAULT_SMALL_FILE_THRESHOLD = 64 * 1024;
 
-const uint16_t COMPRESSION_METHOD_DEFLATE = 8; // deflate
+// what reproducible mode pins compression to, regardless of
+// Z_DEFAULT_COMPRESSION or anything else that might change.
+const int REPRODUCIBLE_LEVEL = 6;
+const int REPRODUCIBLE_STRATEGY = Z_DEFAULT_STRATEGY;
 
-const uint32_t DEFER_CRC32 = 0;
-const uint32_t DEFER_COMPRESSED_SIZE = 0;
-const uint32_t DEFER_UNCOMPRESSED_SIZE = 0;
+// with an executor, large entries are deflated in pieces of this
+// size, each primed with the window of input before it (as pigz does).
+const size_t EXEC_CHUNK_BYTES = 128 * 1024;
+const size_t EXEC_DICT_BYTES = 32 * 1024;
 
-const uint32_t FORCE_Z64_COMPRESSED_SIZE = 0xffffffff;
-const uint32_t FORCE_Z64_UNCOMPRESSED_SIZE = 0xffffffff;
-const uint32_t FORCE_Z64_OFFSET = 0xffffffff;
-const uint16_t FORCE_Z64_LOCAL_ENTRIES = 0xffff;
-const uint16_t FORCE_Z64_TOTAL_ENTRIES = 0xffff;
-const uint32_t FORCE_Z64_CDIR_SIZE = 0xffffffff;
-const uint32_t FORCE_Z64_CDIR_OFFSET = 0xffffffff;
+// what a chunk holds against the executor's memory cap: its input,
+// its dictionary, and room for output that didn't shrink.
+const size_t EXEC_CHUNK_CHARGE = 2 * EXEC_CHUNK_BYTES + EXEC_DICT_BYTES;
 
-const uint16_t LENGTH_PLACEHOLDER = 0;
+// cap on files read ahead at once when keeping name order, so a
+// directory of tiny files doesn't become one enormous window.
+const size_t MAX_REORDER_FILES = 64 * 1024;
 
-const uint16_t Z64_EXTRA_FIELD_TAG = 0x0001;
-const uint16_t Z64_EXTRA_FIELD_HEADER_LENGTH = 4;
-const uint16_t Z64_EXTRA_FIELD_UNCOMPRESSED_BYTES = 4;
-const uint16_t Z64_EXTRA_FIELD_COMPRESSED_BYTES = 4;
-
-const uint16_t UNIX_EXTRA_FIELD_TAG = 0x000d;
-const uint16_t UNIX_EXTRA_FIELD_LENGTH = 16;
-const uint16_t UNIX_ZIP_UID = 0;
-const uint16_t UNIX_ZIP_GID = 0;
-
-const uint32_t DATA_DESC_SIG = 0x08074b50;
-
-const uint32_t CDIR_FILE_HEADER_SIG = 0x02014b50;
-
-const uint16_t DISK_START_ZERO = 0;
-const uint16_t DISK_NUMBER_ZERO = 0;
-const uint16_t DISK_TOTAL_ONE = 1;
+/**
+ * Disk address of the first extent of @a path, via FIEMAP.  Returns
+ * false if there isn't one (empty or inline files); throws if the
+ * filesystem can't say, so the caller can fall back to inodes.
+ */
+bool
+firstPhysicalExtent( const string & path, uint64_t & physical )
+{
+    const int fd( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "open " + path );
 
-const uint16_t ZERO_COMMENT_LENGTH = 0;
-const uint16_t ZERO_INTERNAL_FILE_ATTR = 0;
-const uint32_t UNIX_EXTERNAL_FILE_ATTR = (
-    ( 0100666 << 16 ) | // regular file, rw by all
-    (       1 << 13 ) | // GMT timestamps
-    (       1 << 12 )   // uid/gid present
-);
+    // the header plus room for exactly one extent
+    union
+    {
+        struct fiemap fm;
+        char space[ sizeof( struct fiemap ) + sizeof( struct fiemap_extent ) ];
+    } u;
+    zeroStruct( u );
+    u.fm.fm_start = 0;
+    u.fm.fm_length = FIEMAP_MAX_OFFSET;
+    u.fm.fm_extent_count = 1;
+
+    const int rc( ioctl( fd, FS_IOC_FIEMAP, &u.fm ) );
+    const int savedErrno( errno );
+    close( fd );
 
-const uint32_t Z64_END_OF_CENTRAL_DIR_REC_SIG = 0x06064b50;
-const uint32_t Z64_END_OF_CENTRAL_DIR_LOC_SIG = 0x07064b50;
+    if ( rc != 0 )
+    {
+        errno = savedErrno;
+        throw OSError( "FIEMAP " + path );
+    }
 
-const uint32_t END_OF_CENTRAL_DIR_SIG = 0x06054b50;
+    if ( u.fm.fm_mapped_extents == 0 )
+        return false;
 
-#if EXTRA_DEBUGGING
+    physical = u.fm.fm_extents[0].fe_physical;
+    return true;
+}
 
+/** Read all of @a path into @a cb, which is replaced. */
 void
-dumpBytes( const string & label,
-           const CharBuffer & buf,
-           const size_t begin,
-           const size_t end )
+readWholeFile( const string & path, const uint64_t sizeHint, CharBuffer & cb )
 {
-    std::ostringstream oss;
-    for ( size_t i = begin; i < end; ++i )
-        oss << " " << std::hex << std::setw( 2 ) << std::setfill( '0' ) << +buf.at(i);
-    FINE( label << "[" << begin << "-" << end << "]:" << oss.str() );
+    const int fd( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "open " + path );
+
+    // one extra byte, so a file that hasn't changed is done in one
+    // read plus the one that sees end-of-file.
+    cb.resize( sizeHint + 1 );
+    size_t have( 0 );
+    while ( true )
+    {
+        if ( have == cb.size() )
+            cb.resize( cb.size() * 2 );
+        const ssize_t n( read( fd, &cb[ have ], cb.size() - have ) );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            const int savedErrno( errno );
+            close( fd );
+            errno = savedErrno;
+            throw OSError( "read " + path );
+        }
+        if ( n == 0 )
+            break;
+        have += static_cast< size_t >( n );
+    }
+    close( fd );
+    cb.resize( have );
 }
 
-#else
-
-void
-dumpBytes( const string &,
-           const CharBuffer &,
-           const size_t,
-           const size_t )
+/** Open @a path for reading; throws if it can't. */
+int
+openForRead( const string & path )
 {
+    const int fd( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "open " + path );
+    return fd;
 }
 
-#endif
+/** CPU time used so far by the calling thread, in seconds. */
+double
+threadCpuSeconds()
+{
+    struct timespec ts;
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) != 0 )
+        return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-void
-fixupExtraFieldLength( CharBuffer & cb )
+/**
+ * Dedup hash of the first @a limit bytes of @a source (all of it if
+ * 0), with their CRC-32 in @a crc if that's non-null.
+ */
+uint64_t
+hashSource( Zip64Streamer::Source & source, const uint64_t limit, uint32_t * crc )
 {
-    if ( cb.size() >= 4 )
+    Zip64DedupCache::Hasher h;
+    uLong c( crc32( 0, Z_NULL, 0 ) );
+    uint64_t done( 0 );
+    while ( limit == 0 || done < limit )
     {
-        const uint64_t size( cb.size() - 4 );
-        dumpBytes( "fefl: before", cb, 0, 4 );
-        cb[2] = static_cast< char >( size      );
-        cb[3] = static_cast< char >( size >> 8 );
-        dumpBytes( "fefl:  after", cb, 0, 4 );
+        const char * data( 0 );
+        size_t n( source.read( data ) );
+        if ( n == 0 )
+            break;
+        if ( limit )
+            n = static_cast< size_t >( std::min< uint64_t >( n, limit - done ) );
+        h.update( data, n );
+        if ( crc )
+            c = crc32( c, reinterpret_cast< const Bytef * >( data ), static_cast< uInt >( n ) );
+        done += n;
     }
+    if ( crc )
+        *crc = static_cast< uint32_t >( c );
+    return h.digest();
 }
 
-void
-fixupRecordLength64( CharBuffer & cb )
+/** Pass a source through, hashing it for the dedup cache on the way. */
+class HashingSource
+    : public Zip64Streamer::Source
 {
-    if ( cb.size() >= 12 )
+
+public:
+
+    explicit HashingSource( Zip64Streamer::Source & inner )
+        : m_inner( inner ), m_firstBytes( 0 ) {}
+
+    virtual size_t read( const char * & data )
     {
-        dumpBytes( "frl64: before", cb, 0, 12 );
-        const uint64_t size( cb.size() - 12 );
-        cb[  4 ] = static_cast< char >( size       );
-        cb[  5 ] = static_cast< char >( size >>  8 );
-        cb[  6 ] = static_cast< char >( size >> 16 );
-        cb[  7 ] = static_cast< char >( size >> 24 );
-        cb[  8 ] = static_cast< char >( size >> 32 );
-        cb[  9 ] = static_cast< char >( size >> 40 );
-        cb[ 10 ] = static_cast< char >( size >> 48 );
-        cb[ 11 ] = static_cast< char >( size >> 56 );
-        dumpBytes( "frl64:  after", cb, 0, 12 );
+        const size_t n( m_inner.read( data ) );
+        if ( m_firstBytes < Zip64DedupCache::FIRST_BLOCK_BYTES )
+        {
+            const size_t k( std::min( n, Zip64DedupCache::FIRST_BLOCK_BYTES - m_firstBytes ) );
+            m_first.update( data, k );
+            m_firstBytes += k;
+        }
+        m_full.update( data, n );
+        return n;
     }
-}
 
-uint16_t
-clampUInt16( const uint64_t val )
-{
-    if ( val < 0xffff )
-        return static_cast< uint16_t >( val );
-    else
-        return 0xffff;
-}
+    virtual int64_t sizeHint() const { return m_inner.sizeHint(); }
 
-uint32_t
-clampUInt32( const uint64_t val )
-{
-    if ( val < 0xffffffff )
-        return static_cast< uint32_t >( val );
-    else
-        return 0xffffffff;
-}
+    uint64_t firstHash() const { return m_first.digest(); }
+    uint64_t fullHash() const  { return m_full.digest(); }
 
-void
-write2( CharBuffer & cb, const uint16_t val )
-{
-    cb.push_back( static_cast< char >( val      ) );
-    cb.push_back( static_cast< char >( val >> 8 ) );
-}
+private:
 
-void
-write4( CharBuffer & cb, const uint32_t val )
+    Zip64Streamer::Source & m_inner;
+    Zip64DedupCache::Hasher m_first;
+    size_t m_firstBytes;
+    Zip64DedupCache::Hasher m_full;
+
+};
+
+/** One piece of an entry being deflated on an executor. */
+struct Chunk
 {
-    cb.push_back( static_cast< char >( val       ) );
-    cb.push_back( static_cast< char >( val >>  8 ) );
-    cb.push_back( static_cast< char >( val >> 16 ) );
-    cb.push_back( static_cast< char >( val >> 24 ) );
-}
+    CharBuffer dict;     // up to 32 KiB of input just before this chunk
+    CharBuffer input;
+    CharBuffer output;
+    bool last;
+    uLong crc;
+    std::future< void > done;
+};
 
+/**
+ * Deflate @a c on the calling (worker) thread.  Every chunk but the
+ * last ends with a sync flush, so the pieces concatenate into one
+ * valid deflate stream.
+ */
 void
-write8( CharBuffer & cb, const uint64_t val )
+deflateChunk( Chunk & c, const int level )
 {
-    cb.push_back( static_cast< char >( val       ) );
-    cb.push_back( static_cast< char >( val >>  8 ) );
-    cb.push_back( static_cast< char >( val >> 16 ) );
-    cb.push_back( static_cast< char >( val >> 24 ) );
-    cb.push_back( static_cast< char >( val >> 32 ) );
-    cb.push_back( static_cast< char >( val >> 40 ) );
-    cb.push_back( static_cast< char >( val >> 48 ) );
-    cb.push_back( static_cast< char >( val >> 56 ) );
+    struct Deflater
+    {
+        Deflater() : level( Z_DEFAULT_COMPRESSION )
+        {
+            zeroStruct( zs );
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+            const int rc = deflateInit2(
+                &zs,
+                level,
+                Z_DEFLATED,
+                -15 /* ZLIB_WINDOW_BITS, negative = raw deflate data */,
+                8   /* ZLIB_MEMORY_LEVEL */,
+                Z_DEFAULT_STRATEGY
+            );
+
+#pragma GCC diagnostic pop
+
+            if ( rc != Z_OK )
+                throw std::runtime_error( "initializing compression, rc=" + std::to_string( rc ) );
+        }
+        ~Deflater() { deflateEnd( &zs ); }
+
+        z_stream zs;
+        int level;
+    };
+
+    thread_local std::unique_ptr< Deflater > t_deflater;
+    if ( ! t_deflater )
+        t_deflater.reset( new Deflater );
+    else
+        deflateReset( &t_deflater->zs );
+    z_stream & zs( t_deflater->zs );
+
+    if ( level != t_deflater->level )
+    {
+        deflateParams( &zs, level, Z_DEFAULT_STRATEGY );
+        t_deflater->level = level;
+    }
+
+    Bytef * const in( reinterpret_cast< Bytef * >( c.input.data() ) );
+    const uInt inBytes( static_cast< uInt >( c.input.size() ) );
+
+    c.crc = crc32( crc32( 0, Z_NULL, 0 ), in, inBytes );
+
+    if ( ! c.dict.empty() )
+        deflateSetDictionary( &zs, reinterpret_cast< const Bytef * >( c.dict.data() ),
+                              static_cast< uInt >( c.dict.size() ) );
+
+    const int flag( c.last ? Z_FINISH : Z_SYNC_FLUSH );
+
+    // deflateBound() doesn't count the sync flush marker; allow for
+    // it, and go round again in the unlikely case that's not enough.
+    c.output.resize( deflateBound( &zs, inBytes ) + 16 );
+    zs.next_in = in;
+    zs.avail_in = inBytes;
+    size_t used( 0 );
+    while ( true )
+    {
+        zs.next_out = reinterpret_cast< Bytef * >( &c.output[ used ] );
+        zs.avail_out = static_cast< uInt >( c.output.size() - used );
+        const int rc( deflate( &zs, flag ) );
+        if ( rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR )
+            throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
+        used = c.output.size() - zs.avail_out;
+        if ( rc == Z_STREAM_END || ( ! c.last && zs.avail_out > 0 ) )
+            break;
+        c.output.resize( c.output.size() * 2 );
+    }
+    c.output.resize( used );
 }
 
 } // end namespace anonymous
@@ -204,7 +336,27 @@ Zip64Streamer::Zip64Streamer( const string & directory,
     : m_sDir( directory ),
       m_sender( sender ),
       m_offset( 0 ),
-      m_bZStreamNeedsReset( false )
+      m_tracer( 0 ),
+      m_bFinished( false ),
+      m_bReproducible( false ),
+      m_hashCrc( crc32( 0, Z_NULL, 0 ) ),
+      m_hashAdler( adler32( 0, Z_NULL, 0 ) ),
+      m_readOrder( READ_BY_NAME ),
+      m_bKeepNameOrder( false ),
+      m_reorderBytes( 0 ),
+      m_changedSince( 0 ),
+      m_bHaveChangedSince( false ),
+      m_smallFileThreshold( DEFAULT_SMALL_FILE_THRESHOLD ),
+      m_bZStreamNeedsReset( false ),
+      m_executor( 0 ),
+      m_tenant( 0 ),
+      m_checkpoint( 0 ),
+      m_checkpointBytes( 0 ),
+      m_checkpointSeconds( 0 ),
+      m_lastCheckpointOffset( 0 ),
+      m_lastCheckpointTime( 0 ),
+      m_resumedOffset( 0 ),
+      m_bCapturing( false )
 {
     DEBUG( "ctor: initializing zlib" );
 
@@ -236,187 +388,409 @@ Zip64Streamer::Zip64Streamer( const string & directory,
 
 Zip64Streamer::~Zip64Streamer()
 {
-    DEBUG( "dtor: finishing zip file" );
+    try
+    {
+        finish();
+    }
+    catch ( const std::exception & e )
+    {
+        ERROR( "dtor: " << e.what() );
+    }
+
+    if ( m_executor )
+        m_executor->removeTenant( m_tenant );
+
+    DEBUG( "dtor: finalizing zlib" );
+    deflateEnd( &m_zs );
+
+    DEBUG( "dtor: done" );
+}
+
+void
+Zip64Streamer::finish()
+{
+    if ( m_bFinished )
+        return;
+    m_bFinished = true;
+
+    DEBUG( "fin: finishing zip file" );
+
+    Zip64Tracer::Span span( m_tracer, "central_dir" );
 
     // save start of central directory
     const uint64_t centralDirOffset( m_offset );
 
-    // emit a central directory record for each file
+    // emit a central directory record for each file, batched so
+    // that the sender isn't called once per tiny record.
+    CharBuffer cd;
     for ( const FileInfo & fi : m_fileInfo )
     {
-        FINE( "dtor: adding central dir record for " << QS( fi.name ) );
-
-        CharBuffer z64;
-        write2( z64, Z64_EXTRA_FIELD_TAG );
-        write2( z64, LENGTH_PLACEHOLDER );
-        write8( z64, fi.uncompressed );
-        write8( z64, fi.compressed );
-        write8( z64, fi.offset );
-        fixupExtraFieldLength( z64 );
-
-        CharBuffer unix;
-        write2( unix, UNIX_EXTRA_FIELD_TAG );
-        write2( unix, LENGTH_PLACEHOLDER );
-        write4( unix, fi.stat_atime );
-        write4( unix, fi.stat_mtime );
-        write2( unix, UNIX_ZIP_UID );
-        write2( unix, UNIX_ZIP_GID );
-        fixupExtraFieldLength( unix );
-
-        CharBuffer cd;
-        write4( cd, CDIR_FILE_HEADER_SIG );
-        write2( cd, VERSION_CREATED_BY_4_5_UNIX );
-        write2( cd, VERSION_NEEDED_TO_EXTRACT_4_5 );
-        write2( cd, GPB_DATA_DESC_FOLLOWS_DATA );
-        write2( cd, COMPRESSION_METHOD_DEFLATE );
-        write2( cd, fi.msdos_time );
-        write2( cd, fi.msdos_date );
-        write4( cd, fi.crc32 );
-        write4( cd, FORCE_Z64_COMPRESSED_SIZE );
-        write4( cd, FORCE_Z64_UNCOMPRESSED_SIZE );
-        write2( cd, static_cast< uint16_t >( fi.name.size() ) );
-        write2( cd, static_cast< uint16_t >( z64.size() + unix.size() ) );
-        write2( cd, ZERO_COMMENT_LENGTH );
-        write2( cd, DISK_START_ZERO );
-        write2( cd, ZERO_INTERNAL_FILE_ATTR );
-        write4( cd, UNIX_EXTERNAL_FILE_ATTR );
-        write4( cd, FORCE_Z64_OFFSET );
+        FINE( "fin: adding central dir record for " << QS( fi.name ) );
 
-        emit( cd );
-        emitCopy( fi.name );
-        emit( z64 );
-        emit( unix );
+        appendCentralDirRecord( cd, fi );
+        if ( cd.size() >= BATCH_BYTES )
+        {
+            emit( cd );
+            cd.clear();
+        }
     }
+    if ( ! cd.empty() )
+        emit( cd );
 
     // how many bytes did that use?
     const uint64_t centralDirBytes( m_offset - centralDirOffset );
 
-    // and where are we now?
-    const uint64_t z64EndOfCentralDirLoc( m_offset );
-
-    FINE( "dtor: central dir: "
-          "bytes=" << centralDirBytes << ", "
-          "offset=" << centralDirOffset );
-
-    DEBUG( "dtor: adding z64 end of central directory record @ " << m_offset );
-    CharBuffer z64;
-    write4( z64, Z64_END_OF_CENTRAL_DIR_REC_SIG );
-    write8( z64, LENGTH_PLACEHOLDER );
-    write2( z64, VERSION_CREATED_BY_4_5_UNIX );
-    write2( z64, VERSION_NEEDED_TO_EXTRACT_4_5 );
-    write4( z64, DISK_NUMBER_ZERO );
-    write4( z64, DISK_START_ZERO );
-    write8( z64, m_fileInfo.size() ); // # dir entries on this disk
-    write8( z64, m_fileInfo.size() ); // # dir entries total
-    write8( z64, centralDirBytes );
-    write8( z64, centralDirOffset );
-    fixupRecordLength64( z64 );
-    emit( z64 );
-
-    DEBUG( "dtor: adding z64 end of central directory locator @ " << m_offset );
-    CharBuffer loc;
-    write4( loc, Z64_END_OF_CENTRAL_DIR_LOC_SIG );
-    write4( loc, DISK_NUMBER_ZERO );
-    write8( loc, z64EndOfCentralDirLoc );
-    write4( loc, DISK_TOTAL_ONE );
-    emit( loc );
-
-    DEBUG( "dtor: adding end of central directory record @ " << m_offset);
     CharBuffer end;
-    write4( end, END_OF_CENTRAL_DIR_SIG );
-    write2( end, DISK_NUMBER_ZERO );
-    write2( end, DISK_START_ZERO );
-    write2( end, FORCE_Z64_LOCAL_ENTRIES );
-    write2( end, FORCE_Z64_TOTAL_ENTRIES );
-    write4( end, FORCE_Z64_CDIR_SIZE );
-    write4( end, FORCE_Z64_CDIR_OFFSET );
-    write2( end, ZERO_COMMENT_LENGTH );
+    appendEndRecords( end, m_fileInfo.size(),
+                      centralDirOffset, centralDirBytes, m_offset );
     emit( end );
 
-    DEBUG( "dtor: finalizing zlib" );
-    deflateEnd( &m_zs );
+    m_sender.flush();
 
-    DEBUG( "dtor: done" );
+    if ( m_checkpoint )
+        m_checkpoint->complete();
+
+    DEBUG( "fin: done, " << m_offset << " bytes" );
+}
+
+string
+Zip64Streamer::contentHash() const
+{
+    if ( ! m_bFinished || ! m_bReproducible )
+        throw std::logic_error( "content hash needs reproducible mode and finish()" );
+
+    std::ostringstream oss;
+    oss << "z64s-" << std::hex << std::setfill( '0' )
+        << m_offset << "-"
+        << std::setw( 8 ) << m_hashCrc << "-"
+        << std::setw( 8 ) << m_hashAdler;
+    return oss.str();
+}
+
+Zip64Streamer::EntryAttributes::EntryAttributes()
+    : mtime( time( 0 ) ),
+      atime( mtime ),
+      mode( DEFAULT_FILE_MODE )
+{
 }
 
 bool
 Zip64Streamer::addFile( const string & file )
 {
     DEBUG( "af: adding file " << QS( file ) );
+    requireOpen();
+
+    if ( alreadyWritten( file ) )
+        return false;
+
+    Zip64Tracer::Span span( m_tracer, "entry", file );
 
     FileInfo fi;
     fi.path = m_sDir + "/" + file;
     fi.name = file;
-    fi.offset = m_offset;
+    fi.mode = DEFAULT_FILE_MODE;
 
-    fillDateTime( fi );
+    struct stat st;
+    const uint64_t size( statFile( fi, st ) );
 
-    CharBuffer z64;
-    write2( z64, Z64_EXTRA_FIELD_TAG );
-    write2( z64, LENGTH_PLACEHOLDER );
-    write8( z64, DEFER_UNCOMPRESSED_SIZE );
-    write8( z64, DEFER_COMPRESSED_SIZE );
-    fixupExtraFieldLength( z64 );
+    if ( skipUnchanged( fi, size ) )
+        return false;
 
-    CharBuffer unix;
-    write2( unix, UNIX_EXTRA_FIELD_TAG );
-    write2( unix, LENGTH_PLACEHOLDER );
-    write4( unix, fi.stat_atime );
-    write4( unix, fi.stat_mtime );
-    write2( unix, UNIX_ZIP_UID );
-    write2( unix, UNIX_ZIP_GID );
-    fixupExtraFieldLength( unix );
+    emitFile( fi, size );
 
-    CharBuffer lh; // local header
-    write4( lh, LOCAL_FILE_HEADER_SIG );
-    write2( lh, VERSION_NEEDED_TO_EXTRACT_4_5 );
-    write2( lh, GPB_DATA_DESC_FOLLOWS_DATA );
-    write2( lh, COMPRESSION_METHOD_DEFLATE );
-    write2( lh, fi.msdos_time );
-    write2( lh, fi.msdos_date );
-    write4( lh, DEFER_CRC32 );
-    write4( lh, FORCE_Z64_COMPRESSED_SIZE );
-    write4( lh, FORCE_Z64_UNCOMPRESSED_SIZE );
-    write2( lh, static_cast< uint16_t >( fi.name.size() ) );
-    write2( lh, static_cast< uint16_t >( z64.size() + unix.size() ) );
-
-    FINE( "af: " << file << ": writing header" );
+    span.bytes( fi.uncompressed );
 
-    emit( lh );
-    emitCopy( fi.name );
-    emit( z64 );
-    emit( unix );
+    return true;
+}
 
-    emitCompressedData( fi );
+size_t
+Zip64Streamer::addFileByPattern( const string & pattern )
+{
+    DEBUG( "afbp: adding pattern " << QS( pattern ) );
+    requireOpen();
 
-    FINE( "af: " << file << ": writing descriptor" );
-    CharBuffer dd; // data descriptor
-    write4( dd, DATA_DESC_SIG );
-    write4( dd, fi.crc32 );
-    write8( dd, fi.compressed );
-    write8( dd, fi.uncompressed );
-    emit( dd );
+    StringList files( globFiles( m_sDir, pattern ) );
 
-    // save info for eventual use in central directory
-    m_fileInfo.push_back( fi );
+    // glob() collates by locale; reproducible output can't depend on that.
+    if ( m_bReproducible )
+        std::sort( files.begin(), files.end() );
 
-    return true;
+    return addMatched( files );
 }
 
 size_t
-Zip64Streamer::addFileByPattern( const string & pattern )
+Zip64Streamer::addFilesByPatterns( const StringList & patterns )
 {
-    DEBUG( "afbp: adding pattern " << QS( pattern ) );
+    DEBUG( "afbps: adding " << patterns.size() << " patterns" );
+    requireOpen();
 
-    const StringList files( globFiles( m_sDir, pattern ) );
+    const PatternSet ps( patterns );
+    return addMatched( ps.match( m_sDir ) );
+}
+
+size_t
+Zip64Streamer::addMatched( const StringList & files )
+{
+    if ( m_readOrder != READ_BY_NAME )
+        return addInReadOrder( files );
+
+    size_t added( 0 );
     for ( const string & file : files )
-        addFile( file );
-    return files.size();
+        if ( addFile( file ) )
+            ++added;
+    return added;
+}
+
+bool
+Zip64Streamer::addEntry( const string & name,
+                         Source & source,
+                         const EntryAttributes & attrs )
+{
+    DEBUG( "ae: adding entry " << QS( name ) );
+    requireOpen();
+
+    if ( alreadyWritten( name ) )
+        return false;
+
+    Zip64Tracer::Span span( m_tracer, "entry", name );
+
+    FileInfo fi;
+    fi.name = name;
+    fi.mode = attrs.mode;
+    zip64::fillDateTime( fi, attrs.mtime, attrs.atime );
+
+    emitEntry( fi, source, source.sizeHint() );
+
+    span.bytes( fi.uncompressed );
+
+    return true;
+}
+
+void
+Zip64Streamer::setReproducible( const bool on )
+{
+    requireOpen();
+    if ( m_offset != m_resumedOffset )
+        throw std::logic_error( "reproducible mode must be set before adding entries" );
+
+    m_bReproducible = on;
+    if ( on )
+    {
+        // FastDeflater's and the chunked form's output may change
+        // from release to release; plain zlib on one stream is pinned.
+        m_fast.reset();
+        const int rc( deflateParams( &m_zs, REPRODUCIBLE_LEVEL, REPRODUCIBLE_STRATEGY ) );
+        if ( rc != Z_OK )
+            throw std::runtime_error( "setting compression level, rc=" + std::to_string( rc ) );
+    }
+}
+
+void
+Zip64Streamer::setCompressor( const Compressor compressor )
+{
+    if ( compressor == COMPRESS_FAST && m_bReproducible )
+        WARN( "sc: reproducible mode, keeping zlib" );
+    else if ( compressor == COMPRESS_FAST && ! m_fast )
+        m_fast.reset( new FastDeflater );
+    else if ( compressor == COMPRESS_ZLIB )
+        m_fast.reset();
+}
+
+void
+Zip64Streamer::setExecutor( Zip64Executor * executor,
+                            const double weight,
+                            const Zip64Executor::Priority priority )
+{
+    requireOpen();
+    if ( m_offset != m_resumedOffset )
+        throw std::logic_error( "executor must be set before adding entries" );
+
+    if ( m_executor )
+        m_executor->removeTenant( m_tenant );
+    m_executor = executor;
+    m_tenant = executor ? executor->addTenant( weight, priority ) : 0;
+}
+
+void
+Zip64Streamer::setDeduplication( const bool on,
+                                 const size_t memoryBytes,
+                                 const uint64_t spillBytes )
+{
+    requireOpen();
+    if ( m_offset != m_resumedOffset )
+        throw std::logic_error( "deduplication must be set before adding entries" );
+
+    m_dedup.reset( on ? new Zip64DedupCache( memoryBytes, spillBytes ) : 0 );
+}
+
+Zip64DedupCache::Stats
+Zip64Streamer::dedupStats() const
+{
+    if ( m_dedup )
+        return m_dedup->stats();
+    Zip64DedupCache::Stats none;
+    zeroStruct( none );
+    return none;
+}
+
+void
+Zip64Streamer::setCheckpoint( Zip64CheckpointFile * file,
+                              const uint64_t everyBytes,
+                              const unsigned everySeconds )
+{
+    requireOpen();
+    if ( m_offset != 0 )
+        throw std::logic_error( "checkpointing must be set before adding entries" );
+
+    m_checkpoint = file;
+    m_checkpointBytes = everyBytes;
+    m_checkpointSeconds = everySeconds;
+    m_lastCheckpointTime = time( 0 );
+    if ( ! file || ! file->resuming() )
+        return;
+
+    // carry on from the last commit, as if we'd just written it all.
+    const Zip64CheckpointFile::State & state( file->state() );
+    for ( const Zip64EntryInfo & ei : state.entries )
+    {
+        FileInfo fi;
+        static_cast< Zip64EntryInfo & >( fi ) = ei;
+        fi.device = 0;
+        fi.inode = 0;
+        m_fileInfo.push_back( fi );
+        m_resumedNames.insert( ei.name );
+    }
+    m_offset = state.length;
+    m_lastCheckpointOffset = m_offset;
+    m_resumedOffset = m_offset;
+    m_hashCrc = state.outputCrc;
+    m_hashAdler = state.outputAdler;
+
+    DEBUG( "scp: resuming after " << m_fileInfo.size() << " entries, " <<
+           m_offset << " bytes" );
+}
+
+void
+Zip64Streamer::setReadOrder( const ReadOrder order,
+                             const bool keepNameOrder,
+                             const size_t reorderBytes )
+{
+    m_readOrder = order;
+    m_bKeepNameOrder = keepNameOrder;
+    m_reorderBytes = reorderBytes;
+}
+
+void
+Zip64Streamer::setChangedSince( const time_t since )
+{
+    m_changedSince = since;
+    m_bHaveChangedSince = true;
+}
+
+void
+Zip64Streamer::setPreviousManifest( const Zip64Manifest & prev )
+{
+    m_previous = prev;
+}
+
+Zip64Manifest
+Zip64Streamer::manifest() const
+{
+    Zip64Manifest::EntryVec all( m_skipped );
+    all.reserve( m_skipped.size() + m_fileInfo.size() );
+
+    for ( const FileInfo & fi : m_fileInfo )
+    {
+        Zip64Manifest::Entry e;
+        e.name = fi.name;
+        e.size = fi.uncompressed;
+        e.mtime = fi.stat_mtime;
+        e.crc32 = fi.crc32;
+        e.bCrcKnown = true;
+        all.push_back( e );
+    }
+
+    // name order, so that successive manifests diff cleanly.
+    std::stable_sort( all.begin(), all.end(),
+                      []( const Zip64Manifest::Entry & a, const Zip64Manifest::Entry & b )
+                      { return a.name < b.name; } );
+
+    Zip64Manifest rv;
+    for ( const Zip64Manifest::Entry & e : all )
+        rv.add( e );
+    return rv;
+}
+
+void
+Zip64Streamer::setSmallFileThreshold( const size_t bytes )
+{
+    m_smallFileThreshold = bytes;
+}
+
+void
+Zip64Streamer::setTracer( Zip64Tracer * tracer )
+{
+    m_tracer = tracer;
+}
+
+void
+Zip64Streamer::requireOpen() const
+{
+    if ( m_bFinished )
+        throw std::logic_error( "zip streamer already finished" );
+}
+
+bool
+Zip64Streamer::alreadyWritten( const string & name ) const
+{
+    if ( m_resumedNames.find( name ) == m_resumedNames.end() )
+        return false;
+
+    FINE( "aw: " << name << ": written before resuming, skipping" );
+    return true;
+}
+
+void
+Zip64Streamer::addToDirectory( const FileInfo & fi )
+{
+    m_fileInfo.push_back( fi );
+
+    if ( ! m_checkpoint )
+        return;
+
+    m_checkpoint->addEntry( fi );
+
+    const time_t now( time( 0 ) );
+    if ( m_offset - m_lastCheckpointOffset < m_checkpointBytes &&
+         now - m_lastCheckpointTime < static_cast< time_t >( m_checkpointSeconds ) )
+        return;
+
+    // everything up to here has to reach the file before it's committed.
+    flushPending();
+    m_sender.flush();
+    m_checkpoint->commit( m_offset,
+                          static_cast< uint32_t >( m_hashCrc ),
+                          static_cast< uint32_t >( m_hashAdler ) );
+    m_lastCheckpointOffset = m_offset;
+    m_lastCheckpointTime = now;
+}
+
+void
+Zip64Streamer::hashOutput( const char * data, const size_t len )
+{
+    const Bytef * p( reinterpret_cast< const Bytef * >( data ) );
+    m_hashCrc = crc32( m_hashCrc, p, static_cast< uInt >( len ) );
+    m_hashAdler = adler32( m_hashAdler, p, static_cast< uInt >( len ) );
 }
 
 void
 Zip64Streamer::emit( CharBuffer & cb )
 {
+    flushPending();
+    if ( m_bReproducible )
+        hashOutput( cb.data(), cb.size() );
+    Zip64Tracer::Span span( m_tracer, "send" );
+    span.bytes( cb.size() );
     m_offset += cb.size();
     m_sender.send( cb );
 }
@@ -424,120 +798,726 @@ Zip64Streamer::emit( CharBuffer & cb )
 void
 Zip64Streamer::emit( string & s )
 {
+    flushPending();
+    if ( m_bReproducible )
+        hashOutput( s.data(), s.size() );
+    Zip64Tracer::Span span( m_tracer, "send" );
+    span.bytes( s.size() );
     m_offset += s.size();
     m_sender.send( s );
 }
 
 void
-Zip64Streamer::emitCopy( const string & s )
+Zip64Streamer::flushPending()
 {
-    string tmp( s );
-    emit( tmp );
+    if ( m_pending.empty() )
+        return;
+
+    if ( m_bReproducible )
+        hashOutput( m_pending.data(), m_pending.size() );
+    Zip64Tracer::Span span( m_tracer, "send" );
+    span.bytes( m_pending.size() );
+    m_sender.send( m_pending );
+    m_pending.clear();
+}
+
+bool
+Zip64Streamer::skipUnchanged( const FileInfo & fi, const uint64_t size )
+{
+    const Zip64Manifest::Entry * prev( m_previous.find( fi.name ) );
+    const bool sameAsPrevious( prev &&
+                               prev->size == size &&
+                               prev->mtime == fi.stat_mtime );
+    const bool tooOld( m_bHaveChangedSince &&
+                       static_cast< time_t >( fi.stat_mtime ) < m_changedSince );
+
+    if ( ! sameAsPrevious && ! tooOld )
+        return false;
+
+    FINE( "su: " << fi.name << ": unchanged, skipping" );
+
+    Zip64Manifest::Entry e;
+    e.name = fi.name;
+    e.size = size;
+    e.mtime = fi.stat_mtime;
+    e.crc32 = sameAsPrevious ? prev->crc32 : 0;
+    e.bCrcKnown = sameAsPrevious && prev->bCrcKnown;
+    m_skipped.push_back( e );
+
+    return true;
+}
+
+uint64_t
+Zip64Streamer::statFile( FileInfo & fi, struct stat & st )
+{
+    {
+        Zip64Tracer::Span span( m_tracer, "stat" );
+        int rc = stat( fi.path.c_str(), &st );
+        if ( rc != 0 )
+            throw OSError( "stat" );
+    }
+
+    zip64::fillDateTime( fi, st );
+    fi.device = st.st_dev;
+    fi.inode = st.st_ino;
+
+    return static_cast< uint64_t >( st.st_size );
 }
 
 void
-Zip64Streamer::fillDateTime( FileInfo & fi )
+Zip64Streamer::emitFile( FileInfo & fi, const uint64_t size )
 {
-    struct stat st;
-    int rc = stat( fi.path.c_str(), &st );
-    if ( rc != 0 )
-        throw OSError( "stat" );
+    if ( m_dedup && size > 0 && emitDuplicate( fi, size, 0 ) )
+        return;
+
+    const int fd( open( fi.path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if ( fd < 0 )
+        throw OSError( "open" );
+    // no point in a full-sized read buffer for a tiny file.
+    FdSource source( fd, true /* owned */,
+                     std::min< uint64_t >( size + 1, OUTPUT_CHUNK_BYTES ) );
+
+    if ( m_dedup && size > 0 )
+        emitAndCache( fi, source, static_cast< int64_t >( size ) );
+    else
+        emitEntry( fi, source, static_cast< int64_t >( size ) );
+}
 
-    fi.stat_atime = static_cast< uint32_t >( st.st_atime );
-    fi.stat_mtime = static_cast< uint32_t >( st.st_mtime );
+size_t
+Zip64Streamer::addInReadOrder( const StringList & files )
+{
+    DEBUG( "airo: ordering " << files.size() << " files by " <<
+           ( m_readOrder == READ_BY_EXTENT ? "extent" : "inode" ) <<
+           ( m_bKeepNameOrder ? ", keeping name order" : "" ) );
 
-    // yes, this is a little insane.  these are the bits:
-    //   date = YYYYYYYM MMMDDDDD   time = HHHHHMMM MMMSSSSS
-    // notes:
-    //   year starts at 1980, month is 1-12, day is 1-31
-    //   hour is 0-23, minute is 0-59, seconds is 0-29 (times 2)
+    PendingFileVec pending;
+    pending.reserve( files.size() );
 
-    struct tm mtm;
-    gmtime_r( &st.st_mtime, &mtm );
+    bool byExtent( m_readOrder == READ_BY_EXTENT );
 
-    fi.msdos_date = static_cast< uint16_t >(
-        ( mtm.tm_year - 80 ) << 9 |
-        ( mtm.tm_mon  +  1 ) << 5 |
-        ( mtm.tm_mday      )
-    );
-    fi.msdos_time = static_cast< uint16_t >(
-        mtm.tm_hour << 11 |
-        mtm.tm_min  <<  5 |
-        mtm.tm_sec  >>  1
-    );
+    for ( const string & file : files )
+    {
+        if ( alreadyWritten( file ) )
+            continue;
+
+        PendingFile pf;
+        pf.fi.path = m_sDir + "/" + file;
+        pf.fi.name = file;
+        pf.fi.mode = DEFAULT_FILE_MODE;
+
+        struct stat st;
+        pf.size = statFile( pf.fi, st );
+        if ( skipUnchanged( pf.fi, pf.size ) )
+            continue;
+
+        pf.inode = st.st_ino;
+        pf.physical = 0;
+        if ( byExtent && pf.size > 0 )
+        {
+            try
+            {
+                firstPhysicalExtent( pf.fi.path, pf.physical );
+            }
+            catch ( const std::exception & e )
+            {
+                WARN( "airo: " << e.what() << "; ordering by inode instead" );
+                byExtent = false;
+            }
+        }
+
+        pending.push_back( pf );
+    }
 
-    FINE( "fdt: unix=["
-          "y=" << mtm.tm_year << ", "
-          "m=" << mtm.tm_mon << ", "
-          "d=" << mtm.tm_mday << "; "
-          "h=" << mtm.tm_hour << ", "
-          "m=" << mtm.tm_min << ", "
-          "s=" << mtm.tm_sec << "]" );
-    FINE( "fdt: msdos=["
-          "y=" << ( ( fi.msdos_date >>  9 ) & 0x007f ) << ", "
-          "m=" << ( ( fi.msdos_date >>  5 ) & 0x000f ) << ", "
-          "d=" << ( ( fi.msdos_date       ) & 0x001f ) << "; "
-          "h=" << ( ( fi.msdos_time >> 11 ) & 0x001f ) << ", "
-          "m=" << ( ( fi.msdos_time >>  5 ) & 0x003f ) << ", "
-          "s=" << ( ( fi.msdos_time <<  1 ) & 0x003e ) << "]" );
+    if ( ! m_bKeepNameOrder && ! m_bReproducible )
+    {
+        std::stable_sort( pending.begin(), pending.end(),
+                          [byExtent]( const PendingFile & a, const PendingFile & b )
+                          { return byExtent ? a.physical < b.physical : a.inode < b.inode; } );
+
+        for ( PendingFile & pf : pending )
+        {
+            Zip64Tracer::Span span( m_tracer, "entry", pf.fi.name );
+            emitFile( pf.fi, pf.size );
+            span.bytes( pf.fi.uncompressed );
+        }
+
+        return pending.size();
+    }
+
+    // keep name order: carve the list into windows that fit in the
+    // reorder buffer; big files get a window to themselves and are
+    // streamed.
+    for ( size_t i = 0; i < pending.size(); )
+    {
+        size_t j( i );
+        uint64_t bytes( 0 );
+        while ( j < pending.size() &&
+                j - i < MAX_REORDER_FILES &&
+                ( j == i || bytes + pending[j].size <= m_reorderBytes ) )
+            bytes += pending[ j++ ].size;
+
+        if ( pending[i].size > m_reorderBytes )
+        {
+            PendingFile & pf( pending[i] );
+            Zip64Tracer::Span span( m_tracer, "entry", pf.fi.name );
+            emitFile( pf.fi, pf.size );
+            span.bytes( pf.fi.uncompressed );
+        }
+        else
+        {
+            PendingFileVec window( std::make_move_iterator( pending.begin() + i ),
+                                   std::make_move_iterator( pending.begin() + j ) );
+            emitReordered( window, byExtent );
+        }
+
+        i = j;
+    }
+
+    return pending.size();
 }
 
 void
-Zip64Streamer::emitCompressedData( FileInfo & fi )
+Zip64Streamer::emitReordered( PendingFileVec & window, const bool byExtent )
 {
-    DEBUG( "ecd: " << fi.name << ": writing compressed data" );
+    std::vector< size_t > readOrder( window.size() );
+    for ( size_t k = 0; k < readOrder.size(); ++k )
+        readOrder[k] = k;
+    std::stable_sort( readOrder.begin(), readOrder.end(),
+                      [&]( const size_t a, const size_t b )
+                      { return byExtent ? window[a].physical < window[b].physical
+                                        : window[a].inode < window[b].inode; } );
+
+    std::vector< CharBuffer > contents( window.size() );
+    for ( const size_t k : readOrder )
+    {
+        Zip64Tracer::Span span( m_tracer, "read", window[k].fi.name );
+        readWholeFile( window[k].fi.path, window[k].size, contents[k] );
+        span.bytes( contents[k].size() );
+    }
 
-    std::ifstream ifs( fi.path );
+    for ( size_t k = 0; k < window.size(); ++k )
+    {
+        Zip64Tracer::Span span( m_tracer, "entry", window[k].fi.name );
+        FileInfo & fi( window[k].fi );
+        MemorySource source( contents[k] );
+        if ( ! m_dedup || contents[k].empty() )
+            emitEntry( fi, source, source.sizeHint() );
+        else if ( ! emitDuplicate( fi, contents[k].size(), &contents[k] ) )
+            emitAndCache( fi, source, source.sizeHint() );
+        span.bytes( fi.uncompressed );
+        CharBuffer().swap( contents[k] );
+    }
+}
 
-    uLong crc = crc32( 0, Z_NULL, 0 );
+void
+Zip64Streamer::emitEntry( FileInfo & fi, Source & source, const int64_t sizeHint )
+{
+    // when the file was last read says nothing about its content.
+    if ( m_bReproducible )
+        fi.stat_atime = fi.stat_mtime;
 
-    if ( m_bZStreamNeedsReset )
-        deflateReset( &m_zs );
+    if ( m_smallFileThreshold > 0 && sizeHint >= 0 &&
+         static_cast< uint64_t >( sizeHint ) <= m_smallFileThreshold )
+    {
+        emitSmallEntry( fi, source );
+        return;
+    }
+
+    fi.offset = m_offset;
+    fi.flags = GPB_DATA_DESC_FOLLOWS_DATA;
+    fi.method = COMPRESSION_METHOD_DEFLATE;
+
+    CharBuffer lh; // local header
+    appendLocalHeader( lh, fi );
+
+    FINE( "ee: " << fi.name << ": writing header" );
+
+    emit( lh );
+
+    if ( m_executor && ! m_bReproducible )
+        emitChunkedData( fi, source );
+    else
+        emitCompressedData( fi, source );
+
+    FINE( "ee: " << fi.name << ": writing descriptor" );
+    CharBuffer dd; // data descriptor
+    appendDataDescriptor( dd, fi );
+    emit( dd );
+
+    // save info for eventual use in central directory
+    addToDirectory( fi );
+}
+
+void
+Zip64Streamer::emitSmallEntry( FileInfo & fi, Source & source )
+{
+    DEBUG( "ese: " << fi.name << ": compressing in memory" );
 
+    // the size was only a hint; take whatever the source really has.
+    m_smallInput.clear();
     while ( true )
     {
-        CharBuffer input;
-        input.resize( 32 * 1024 );
-        ifs.read( &input[0], input.size() );
-        const std::streamsize nRead = ifs.gcount();
+        const char * data( 0 );
+        size_t nRead;
+        {
+            Zip64Tracer::Span span( m_tracer, "read" );
+            nRead = source.read( data );
+            span.bytes( nRead );
+        }
+        if ( nRead == 0 )
+            break;
+        m_smallInput.insert( m_smallInput.end(), data, data + nRead );
+    }
 
-        m_zs.next_in = reinterpret_cast< unsigned char * >( &input[0] );
-        m_zs.avail_in = static_cast< unsigned int >( nRead );
-        crc = crc32( crc, m_zs.next_in, m_zs.avail_in );
+    unsigned char * in( reinterpret_cast< unsigned char * >( m_smallInput.data() ) );
+    const uLong inBytes( m_smallInput.size() );
 
-        CharBuffer output;
-        output.resize( 32 * 1024 );
-        m_zs.next_out  = reinterpret_cast< unsigned char * >( &output[0] );
-        m_zs.avail_out = static_cast< unsigned int >( output.size() );
+    fi.crc32 = static_cast< uint32_t >( crc32( crc32( 0, Z_NULL, 0 ), in, inBytes ) );
+    fi.uncompressed = inBytes;
 
-        const int flag = ( nRead > 0 ? Z_NO_FLUSH : Z_FINISH );
-        const int rc = deflate( &m_zs, flag );
+    if ( m_fast )
+    {
+        m_fast->reset();
+        m_smallOutput.clear();
+        m_smallOutput.reserve( inBytes + inBytes / 8 + 64 );
+
+        Zip64Tracer::Span span( m_tracer, "deflate" );
+        span.bytes( inBytes );
+        runDeflate( inBytes, inBytes + m_smallOutput.capacity(),
+                    [&]{ m_fast->compress( m_smallInput.data(), inBytes, true, m_smallOutput ); } );
+        fi.compressed = m_fast->totalOut();
+    }
+    else
+    {
+        if ( m_bZStreamNeedsReset )
+            deflateReset( &m_zs );
+        m_bZStreamNeedsReset = true;
+
+        // deflateBound() guarantees a single Z_FINISH call will complete.
+        m_smallOutput.resize( deflateBound( &m_zs, inBytes ) );
+        m_zs.next_in = in;
+        m_zs.avail_in = static_cast< unsigned int >( inBytes );
+        m_zs.next_out = reinterpret_cast< unsigned char * >( m_smallOutput.data() );
+        m_zs.avail_out = static_cast< unsigned int >( m_smallOutput.size() );
+
+        int rc;
+        {
+            Zip64Tracer::Span span( m_tracer, "deflate" );
+            span.bytes( inBytes );
+            runDeflate( inBytes, inBytes + m_smallOutput.size(),
+                        [&]{ rc = deflate( &m_zs, Z_FINISH ); } );
+        }
+        if ( rc != Z_STREAM_END )
+            throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
+        fi.compressed = m_zs.total_out;
+    }
 
-        const size_t used( output.size() - m_zs.avail_out );
+    // with everything in hand, we can also just store anything that
+    // didn't shrink.
+    const CharBuffer * payload( &m_smallOutput );
+    fi.method = COMPRESSION_METHOD_DEFLATE;
+    if ( fi.compressed >= fi.uncompressed )
+    {
+        payload = &m_smallInput;
+        fi.compressed = fi.uncompressed;
+        fi.method = COMPRESSION_METHOD_STORE;
+    }
 
-        FINE( "af: compressing: read " << nRead << ", got " << used );
+    fi.flags = GPB_NO_FLAGS;
+    fi.offset = m_offset;
 
-        if ( ( flag == Z_NO_FLUSH && rc != Z_OK         ) ||
-             ( flag == Z_FINISH   && rc != Z_STREAM_END ) )
-            throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
+    if ( m_bCapturing )
+        m_dedup->capture( payload->data(), fi.compressed );
+
+    const size_t before( m_pending.size() );
+    appendCompactLocalHeader( m_pending, fi );
+    m_pending.insert( m_pending.end(),
+                      payload->begin(), payload->begin() + fi.compressed );
+    m_offset += m_pending.size() - before;
+
+    FINE( "ese: " << fi.name << ": " << fi.uncompressed << " -> " << fi.compressed <<
+          ( fi.method == COMPRESSION_METHOD_STORE ? " (stored)" : "" ) );
+
+    addToDirectory( fi );
+
+    if ( m_pending.size() >= BATCH_BYTES )
+        flushPending();
+}
+
+void
+Zip64Streamer::emitCompressedData( FileInfo & fi, Source & source )
+{
+    DEBUG( "ecd: " << fi.name << ": writing compressed data" );
+
+    uLong crc = crc32( 0, Z_NULL, 0 );
+
+    if ( m_fast )
+        m_fast->reset();
+    else if ( m_bZStreamNeedsReset )
+        deflateReset( &m_zs );
+
+    // the sender may take 'output' by swapping, and may hand back a
+    // spare buffer in its place; either way, resize() before use.
+    CharBuffer output;
 
-        if ( used )
+    while ( true )
+    {
+        const char * data( 0 );
+        size_t nRead;
         {
-            output.resize( used );
-            emit( output );
+            Zip64Tracer::Span span( m_tracer, "read" );
+            nRead = source.read( data );
+            span.bytes( nRead );
         }
 
-        if ( nRead == 0 )
+        crc = crc32( crc, reinterpret_cast< const Bytef * >( data ), static_cast< uInt >( nRead ) );
+
+        if ( m_fast )
+        {
+            // it holds back input until it has a whole block, so
+            // each call yields a block's output or nothing.
+            output.clear();
+            {
+                Zip64Tracer::Span span( m_tracer, "deflate" );
+                span.bytes( nRead );
+                m_fast->compress( data, nRead, nRead == 0, output );
+            }
+            FINE( "ecd: fast: read " << nRead << ", got " << output.size() );
+            if ( ! output.empty() )
+                emitData( output );
+            if ( nRead == 0 )
+                break;
+            continue;
+        }
+
+        m_zs.next_in = reinterpret_cast< unsigned char * >( const_cast< char * >( data ) );
+        m_zs.avail_in = static_cast< unsigned int >( nRead );
+
+        const int flag = ( nRead > 0 ? Z_NO_FLUSH : Z_FINISH );
+
+        // keep going until deflate has taken all the input (or, at
+        // the end, written everything out); either can need more
+        // than one output chunk.
+        int rc;
+        bool full;
+        size_t spanBytes( nRead );
+        do
+        {
+            output.resize( OUTPUT_CHUNK_BYTES );
+            m_zs.next_out  = reinterpret_cast< unsigned char * >( &output[0] );
+            m_zs.avail_out = static_cast< unsigned int >( output.size() );
+
+            {
+                Zip64Tracer::Span span( m_tracer, "deflate" );
+                span.bytes( spanBytes );
+                spanBytes = 0;
+                rc = deflate( &m_zs, flag );
+            }
+
+            if ( rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR )
+                throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
+
+            full = ( m_zs.avail_out == 0 );
+            const size_t used( output.size() - m_zs.avail_out );
+
+            FINE( "ecd: compressing: read " << nRead << ", got " << used );
+
+            if ( used )
+            {
+                output.resize( used );
+                emitData( output );
+            }
+        }
+        while ( full );
+
+        if ( flag == Z_FINISH )
+        {
+            if ( rc != Z_STREAM_END )
+                throw std::runtime_error( "compressing, rc=" + std::to_string( rc ) );
             break;
+        }
     }
 
     fi.crc32 = static_cast< uint32_t >( crc );
+    if ( m_fast )
+    {
+        fi.compressed = m_fast->totalOut();
+        fi.uncompressed = m_fast->totalIn();
+        return;
+    }
+
     fi.compressed = m_zs.total_out;
     fi.uncompressed = m_zs.total_in;
 
     m_bZStreamNeedsReset = true;
 }
 
+void
+Zip64Streamer::runDeflate( const size_t cost, const size_t bytes,
+                           const std::function< void () > & work )
+{
+    if ( ! m_executor )
+    {
+        work();
+        return;
+    }
+
+    m_executor->acquire( bytes );
+    try
+    {
+        m_executor->submit( m_tenant, cost, work ).get();
+    }
+    catch ( ... )
+    {
+        m_executor->release( bytes );
+        throw;
+    }
+    m_executor->release( bytes );
+}
+
+void
+Zip64Streamer::emitChunkedData( FileInfo & fi, Source & source )
+{
+    DEBUG( "ecd: " << fi.name << ": writing compressed data in chunks" );
+
+    // enough chunks in flight to keep every worker busy on this one
+    // entry, if fair queueing lets it have them.
+    const size_t maxInFlight( 2 * m_executor->threads() );
+    const int level( m_bReproducible ? REPRODUCIBLE_LEVEL : Z_DEFAULT_COMPRESSION );
+
+    typedef std::shared_ptr< Chunk > ChunkPtr;
+    std::deque< ChunkPtr > inFlight;
+
+    uLong crc( crc32( 0, Z_NULL, 0 ) );
+    fi.compressed = 0;
+    fi.uncompressed = 0;
+
+    // send the oldest chunk once it's done; output stays in order.
+    auto drainOldest = [&]()
+    {
+        Chunk & c( *inFlight.front() );
+        {
+            Zip64Tracer::Span span( m_tracer, "deflate" );
+            span.bytes( c.input.size() );
+            c.done.get();
+        }
+        crc = crc32_combine( crc, c.crc, static_cast< z_off_t >( c.input.size() ) );
+        fi.uncompressed += c.input.size();
+        fi.compressed += c.output.size();
+        FINE( "ecd: chunk: " << c.input.size() << " -> " << c.output.size() );
+        emitData( c.output );
+        inFlight.pop_front();
+        m_executor->release( EXEC_CHUNK_CHARGE );
+    };
+
+    try
+    {
+        // always one run ahead, so each chunk knows if it's the last.
+        const char * data( 0 );
+        size_t avail;
+        {
+            Zip64Tracer::Span span( m_tracer, "read" );
+            avail = source.read( data );
+            span.bytes( avail );
+        }
+
+        CharBuffer dict;
+        bool last( false );
+        while ( ! last )
+        {
+            // send what we can before waiting on anyone else's memory.
+            bool charged( false );
+            while ( ! charged )
+            {
+                if ( inFlight.size() < maxInFlight && m_executor->tryAcquire( EXEC_CHUNK_CHARGE ) )
+                    charged = true;
+                else if ( ! inFlight.empty() )
+                    drainOldest();
+                else
+                {
+                    m_executor->acquire( EXEC_CHUNK_CHARGE );
+                    charged = true;
+                }
+            }
+
+            ChunkPtr c( std::make_shared< Chunk >() );
+            inFlight.push_back( c );
+            c->dict.swap( dict );
+            c->input.reserve( EXEC_CHUNK_BYTES );
+            while ( avail && c->input.size() < EXEC_CHUNK_BYTES )
+            {
+                const size_t n( std::min( avail, EXEC_CHUNK_BYTES - c->input.size() ) );
+                c->input.insert( c->input.end(), data, data + n );
+                data += n;
+                avail -= n;
+                if ( avail == 0 )
+                {
+                    Zip64Tracer::Span span( m_tracer, "read" );
+                    avail = source.read( data );
+                    span.bytes( avail );
+                }
+            }
+            last = c->last = ( avail == 0 );
+
+            // every chunk but the last is full, so its tail is a whole window.
+            if ( ! last )
+                dict.assign( c->input.end() - EXEC_DICT_BYTES, c->input.end() );
+
+            Chunk * const raw( c.get() );
+            c->done = m_executor->submit( m_tenant, c->input.size(),
+                                          [raw, level]{ deflateChunk( *raw, level ); } );
+        }
+
+        while ( ! inFlight.empty() )
+            drainOldest();
+    }
+    catch ( ... )
+    {
+        // workers may still be using the chunks; wait them out.
+        for ( const ChunkPtr & c : inFlight )
+        {
+            if ( c->done.valid() )
+                c->done.wait();
+            m_executor->release( EXEC_CHUNK_CHARGE );
+        }
+        throw;
+    }
+
+    fi.crc32 = static_cast< uint32_t >( crc );
+}
+
+void
+Zip64Streamer::emitData( CharBuffer & cb )
+{
+    if ( m_bCapturing )
+        m_dedup->capture( cb.data(), cb.size() );
+    emit( cb );
+}
+
+bool
+Zip64Streamer::emitDuplicate( FileInfo & fi, const uint64_t size, const CharBuffer * contents )
+{
+    const double cpuStart( threadCpuSeconds() );
+
+    const Zip64DedupCache::Entry * e( m_dedup->findLink( fi.device, fi.inode ) );
+    const bool hardLink( e && e->size == size );
+    if ( ! hardLink )
+    {
+        // the first block is cheap to check; only read the whole
+        // thing if something cached starts the same way.
+        Zip64Tracer::Span span( m_tracer, "dedup", fi.name );
+        uint64_t firstHash;
+        if ( contents )
+        {
+            MemorySource ms( *contents );
+            firstHash = hashSource( ms, Zip64DedupCache::FIRST_BLOCK_BYTES, 0 );
+        }
+        else
+        {
+            FdSource fs( openForRead( fi.path ), true /* owned */,
+                         Zip64DedupCache::FIRST_BLOCK_BYTES );
+            firstHash = hashSource( fs, Zip64DedupCache::FIRST_BLOCK_BYTES, 0 );
+        }
+
+        if ( ! m_dedup->hasCandidates( size, firstHash ) )
+            return false;
+
+        uint64_t fullHash;
+        uint32_t crc;
+        if ( contents )
+        {
+            MemorySource ms( *contents );
+            fullHash = hashSource( ms, 0, &crc );
+        }
+        else
+        {
+            FdSource fs( openForRead( fi.path ), true /* owned */ );
+            fullHash = hashSource( fs, 0, &crc );
+        }
+        span.bytes( size );
+
+        e = m_dedup->find( size, firstHash, fullHash, crc );
+        if ( ! e )
+            return false;
+    }
+
+    DEBUG( "dup: " << fi.name << ": same " << ( hardLink ? "inode" : "content" ) <<
+           " as an earlier entry, replaying " << e->compressed << " bytes" );
+
+    emitCached( fi, *e );
+    m_dedup->noteDuplicate( *e, hardLink, threadCpuSeconds() - cpuStart );
+    return true;
+}
+
+void
+Zip64Streamer::emitCached( FileInfo & fi, const Zip64DedupCache::Entry & e )
+{
+    if ( m_bReproducible )
+        fi.stat_atime = fi.stat_mtime;
+
+    fi.crc32 = e.crc32;
+    fi.uncompressed = e.size;
+    fi.compressed = e.compressed;
+    fi.method = e.method;
+    fi.flags = GPB_NO_FLAGS;
+    fi.offset = m_offset;
+
+    if ( e.compressed < BATCH_BYTES )
+    {
+        // batch it up like any other small entry
+        const size_t before( m_pending.size() );
+        appendCompactLocalHeader( m_pending, fi );
+        m_dedup->replay( e, [this]( CharBuffer & cb )
+                         { m_pending.insert( m_pending.end(), cb.begin(), cb.end() ); } );
+        m_offset += m_pending.size() - before;
+        addToDirectory( fi );
+        if ( m_pending.size() >= BATCH_BYTES )
+            flushPending();
+        return;
+    }
+
+    CharBuffer lh; // local header
+    appendCompactLocalHeader( lh, fi );
+    emit( lh );
+    m_dedup->replay( e, [this]( CharBuffer & cb ) { emit( cb ); } );
+
+    addToDirectory( fi );
+}
+
+void
+Zip64Streamer::emitAndCache( FileInfo & fi, Source & source, const int64_t sizeHint )
+{
+    const double cpuStart( threadCpuSeconds() );
+
+    HashingSource hs( source );
+    m_dedup->beginCapture();
+    m_bCapturing = true;
+    try
+    {
+        emitEntry( fi, hs, sizeHint );
+    }
+    catch ( ... )
+    {
+        m_bCapturing = false;
+        m_dedup->abandonCapture();
+        throw;
+    }
+    m_bCapturing = false;
+
+    Zip64DedupCache::Entry meta;
+    meta.size = fi.uncompressed;
+    meta.firstHash = hs.firstHash();
+    meta.fullHash = hs.fullHash();
+    meta.crc32 = fi.crc32;
+    meta.method = fi.method;
+    meta.compressed = fi.compressed;
+    meta.cpuSeconds = threadCpuSeconds() - cpuStart;
+    meta.bSpilled = false;
+    meta.spillOffset = 0;
+
+    m_dedup->commitCapture( meta, fi.device, fi.inode );
+}
+
 } // end namespace com::foiani
 
 } // end namespace com
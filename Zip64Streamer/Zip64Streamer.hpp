@@ -8,10 +8,15 @@
  */
 
 // standard C / Unix / library headers
+#include <sys/stat.h>
+#include <time.h>
 #include <zlib.h>
 
 // standard C++ headers
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_set>
 #include <vector>
 
 // boost headers
@@ -20,6 +25,12 @@
 
 // local headers
 #include "Compat.hpp"
+#include "FastDeflate.hpp"
+#include "Zip64Dedup.hpp"
+#include "Zip64Executor.hpp"
+#include "Zip64Format.hpp"
+#include "Zip64Manifest.hpp"
+#include "Zip64Trace.hpp"
 
 namespace com
 {
@@ -27,6 +38,8 @@ namespace com
 namespace /* com:: */ foiani
 {
 
+class Zip64CheckpointFile;
+
 /** Stream zero or more files as a ZIP64 archive. */
 class Zip64Streamer
 {
@@ -36,25 +49,260 @@ public:
     /** Abstract base for sending data to its destination. */
     struct Sender
     {
+        virtual ~Sender() {}
+
         // these are non-constant, to allow consumers to use 'swap' or
-        // other constant-time methods to grab the data.
+        // other constant-time methods to grab the data.  whatever is
+        // left in the argument afterwards belongs to the caller again,
+        // so a sender may hand back a spare buffer for reuse.
 
         virtual void send( CharBuffer & b ) = 0;
         virtual void send( string & s ) = 0;
+
+        /** Push out anything the sender is holding back; called at the end of the archive. */
+        virtual void flush() {}
+
+        /**
+         * Send @a length bytes of the open file @a fd, starting at
+         * @a offset, without them passing through user space (e.g. by
+         * sendfile(2)), after anything already given to send().
+         * Returns how many went; the caller reads and send()s the
+         * rest.  Fewer than @a length can mean the file ended early.
+         * The default sends nothing.
+         */
+        virtual uint64_t sendFile( int /* fd */, uint64_t /* offset */, uint64_t /* length */ )
+        {
+            return 0;
+        }
+    };
+
+    /** Abstract base for entry content that doesn't live under the directory. */
+    struct Source
+    {
+        virtual ~Source() {}
+
+        /**
+         * Point @a data at the next run of content and return its
+         * length, or 0 at the end.  The bytes only have to stay valid
+         * until the next call, so a source can reuse one buffer or
+         * hand out views of memory it doesn't own.
+         */
+        virtual size_t read( const char * & data ) = 0;
+
+        /** Total bytes this source will produce, if known up front; else -1. */
+        virtual int64_t sizeHint() const { return -1; }
+    };
+
+    /** What the archive records about an entry built from a Source. */
+    struct EntryAttributes
+    {
+        /** Modified and accessed now, with the same mode as files. */
+        EntryAttributes();
+
+        time_t mtime;
+        time_t atime;
+        uint32_t mode;   // unix type and permission bits, e.g. 0100644
+    };
+
+    /** Order in which addFileByPattern() reads the files it matched. */
+    enum ReadOrder
+    {
+        /** As matched, which is sorted by name. */
+        READ_BY_NAME,
+
+        /** By inode number; cheap, and close to allocation order on most filesystems. */
+        READ_BY_INODE,
+
+        /** By disk address of each file's first extent (FIEMAP), else by inode. */
+        READ_BY_EXTENT
+    };
+
+    /** What deflates entry data. */
+    enum Compressor
+    {
+        /** zlib at its default level. */
+        COMPRESS_ZLIB,
+
+        /** FastDeflater: several times quicker, somewhat bigger output. */
+        COMPRESS_FAST
     };
 
     /** Start the streamer in directory @a dir.  */
     Zip64Streamer( const string & dir, Sender & sender );
 
-    /** Standard destructor. */
+    /** Standard destructor; calls finish() if the caller didn't. */
     ~Zip64Streamer();
 
-    /** Add a single @a file (relative to dir given in constructor). */
+    /**
+     * Write the central directory and trailer, and flush the sender.
+     * Nothing can be added afterwards.
+     */
+    void finish();
+
+    /**
+     * Add a single @a file (relative to dir given in constructor).
+     * Returns false if it was skipped as unchanged (see
+     * setChangedSince() and setPreviousManifest()), or as already
+     * written before a resume (see setCheckpoint()).
+     */
     bool addFile( const string & file );
 
-    /** Add all files that match @a pattern (relative to dir given in constructor). */
+    /**
+     * Add all files that match @a pattern (relative to dir given in
+     * constructor).  Returns how many were added, not skipped.
+     */
     size_t addFileByPattern( const string & pattern );
 
+    /**
+     * Add all files that match any of @a patterns, each once, reading
+     * the directory tree once for the lot (see PatternSet) instead of
+     * once per pattern.  Files come in the order a sequence of
+     * addFileByPattern() calls would add them (in the C locale),
+     * leaving out repeats.  Returns how many were added, not skipped.
+     */
+    size_t addFilesByPatterns( const StringList & patterns );
+
+    /**
+     * Add an entry called @a name whose content is pulled from
+     * @a source until it runs dry.  Nothing touches the disk.  If an
+     * entry of that name was written before a resume, @a source is
+     * left alone and false is returned.
+     */
+    bool addEntry( const string & name,
+                   Source & source,
+                   const EntryAttributes & attrs = EntryAttributes() );
+
+    /**
+     * Have addFileByPattern() read files in @a order, to cut seeking
+     * on spinning disks.  Entries normally appear in the archive in
+     * the order they were read; with @a keepNameOrder they stay in
+     * name order, and each run of files totalling up to
+     * @a reorderBytes is read in @a order into memory, then emitted.
+     * Files bigger than that are streamed in name order as usual.
+     */
+    void setReadOrder( ReadOrder order,
+                       bool keepNameOrder = false,
+                       size_t reorderBytes = 64 * 1024 * 1024 );
+
+    /**
+     * Skip files last modified before @a since.  Files modified in
+     * that same second are still added, so a run started at @a since
+     * can't miss anything.
+     */
+    void setChangedSince( time_t since );
+
+    /**
+     * Skip files whose size and mtime match their entry in @a prev
+     * (typically the manifest() of the last run).  Skipped files are
+     * never opened.
+     */
+    void setPreviousManifest( const Zip64Manifest & prev );
+
+    /**
+     * Everything seen so far: files and entries added, plus skipped
+     * files (with the crc from the previous manifest, where known).
+     * Build it once all files are added, and save it for the next run.
+     */
+    Zip64Manifest manifest() const;
+
+    /** Files skipped as unchanged so far. */
+    size_t skipped() const { return m_skipped.size(); }
+
+    /**
+     * Entries of at most @a bytes (when the size is known up front)
+     * are read and compressed in memory, then written with their crc
+     * and sizes in the local header and no data descriptor; several
+     * go out in one send.  Anything bigger is streamed.  0 turns this
+     * off, even for empty entries, so every entry is streamed with a
+     * data descriptor as before this existed.  The default is 64 KiB,
+     * so default archives aren't byte-for-byte what they used to be.
+     */
+    void setSmallFileThreshold( size_t bytes );
+
+    /**
+     * Make the archive a pure function of what is added: each entry's
+     * name, content, mtime and mode, in the order added.  Access
+     * times are recorded as the mtime, patterns are expanded in byte
+     * order (not the locale's), reordered reads keep name order, and
+     * compression stays at zlib's level 6 with the default strategy,
+     * whatever the tree's defaults become.  Every entry is deflated by
+     * zlib as one stream: setCompressor( COMPRESS_FAST ) is ignored,
+     * and an executor (see setExecutor()) doesn't chunk.  A hash of
+     * every byte is kept as it goes out; see contentHash().
+     */
+    void setReproducible( bool on );
+
+    /**
+     * After finish() in reproducible mode: archive length, CRC-32 and
+     * Adler-32 of every byte sent, as one string, suitable for an
+     * ETag.  Not cryptographic; it spots changes, not tampering.
+     */
+    string contentHash() const;
+
+    /**
+     * Deflate with @a compressor from now on.  Entries compressed on
+     * an executor (see setExecutor()) are always done by zlib, since
+     * each chunk needs priming with the data before it.  Reproducible
+     * mode (see setReproducible()) always uses zlib.
+     */
+    void setCompressor( Compressor compressor );
+
+    /**
+     * Do all compression on @a executor's workers, as a tenant with
+     * @a weight and @a priority, instead of on the calling thread.
+     * Large entries are cut into 128 KiB chunks deflated in parallel,
+     * each primed with the 32 KiB before it; the output is a little
+     * different from (and very slightly bigger than) the single-stream
+     * form, but just as deterministic.  In reproducible mode entries
+     * aren't chunked; small ones still run on the executor, big ones
+     * on the calling thread.  Must be set before anything is
+     * added; the executor must outlive the streamer.
+     */
+    void setExecutor( Zip64Executor * executor,
+                      double weight = 1.0,
+                      Zip64Executor::Priority priority = Zip64Executor::BULK );
+
+    /**
+     * Compress each distinct file content once.  A file that is a
+     * hard link to one already added, or whose content matches one
+     * (same size and hash of the first 4 KiB, then the same CRC-32
+     * and 64-bit hash over all of it), gets its own entry holding the
+     * earlier entry's compressed bytes, replayed rather than read and
+     * deflated again.  Those bytes are kept in up to @a memoryBytes of
+     * memory, then up to @a spillBytes in a temporary file; once both
+     * are full, later files aren't kept.  Only files are considered,
+     * not addEntry() sources.  Must be set before anything is added.
+     */
+    void setDeduplication( bool on,
+                           size_t memoryBytes = 64 * 1024 * 1024,
+                           uint64_t spillBytes = 1024 * 1024 * 1024 );
+
+    /** What deduplication has found and saved so far (all zero if off). */
+    Zip64DedupCache::Stats dedupStats() const;
+
+    /**
+     * Make the archive resumable: @a file, which must also be the
+     * sender (or what a flush() of the sender ends up at), journals
+     * each entry as it's finished, and once at least @a everyBytes
+     * have gone out or @a everySeconds have passed since the last
+     * time, the next finished entry commits the journal.  A job that
+     * dies loses at most the entries since that commit.  If @a file
+     * found an earlier run's journal, the streamer picks up after its
+     * last commit, and adding anything of the same name again is a
+     * no-op.  Set this before adding anything; the other modes
+     * (reproducible, executor, deduplication) may go before or after
+     * it, and should match the earlier run's.
+     */
+    void setCheckpoint( Zip64CheckpointFile * file,
+                        uint64_t everyBytes = 16 * 1024 * 1024,
+                        unsigned everySeconds = 10 );
+
+    /**
+     * Record spans into @a tracer (or stop, if null).  The tracer
+     * must outlive the streamer, including its destructor.
+     */
+    void setTracer( Zip64Tracer * tracer );
+
 private:
 
     const string m_sDir;
@@ -62,18 +310,14 @@ private:
 
     uint64_t m_offset;
 
+    Zip64Tracer * m_tracer;
+
     struct FileInfo
+        : public Zip64EntryInfo
     {
         string path;
-        string name;
-        uint64_t offset;
-        uint64_t uncompressed;
-        uint64_t compressed;
-        uint32_t crc32;
-        uint16_t msdos_time;
-        uint16_t msdos_date;
-        uint32_t stat_atime;
-        uint32_t stat_mtime;
+        uint64_t device;
+        uint64_t inode;
     };
 
     typedef std::vector< FileInfo > FileInfoVec;
@@ -83,13 +327,108 @@ private:
     void emit( CharBuffer & cb );
     void emit( string & s );
 
-    void emitCopy( const string & s );
+    bool m_bFinished;
+    void requireOpen() const;
+
+    bool m_bReproducible;
+    uLong m_hashCrc;
+    uLong m_hashAdler;
+    void hashOutput( const char * data, size_t len );
+
+    // small entries are collected here (already counted in
+    // m_offset) and go out ahead of the next emit().
+    CharBuffer m_pending;
+    void flushPending();
+
+    /** Fill in @a st and the times for @a fi from its file; returns its size. */
+    uint64_t statFile( FileInfo & fi, struct stat & st );
+
+    /** Stream an already-stat'ed file of @a size bytes. */
+    void emitFile( FileInfo & fi, uint64_t size );
+
+    ReadOrder m_readOrder;
+    bool m_bKeepNameOrder;
+    size_t m_reorderBytes;
+
+    struct PendingFile
+    {
+        FileInfo fi;
+        uint64_t size;
+        uint64_t inode;
+        uint64_t physical;
+    };
+
+    typedef std::vector< PendingFile > PendingFileVec;
+
+    /** Add @a files, as matched by a pattern, in the configured read order. */
+    size_t addMatched( const StringList & files );
 
-    void fillDateTime( FileInfo & fi );
+    size_t addInReadOrder( const StringList & files );
+    void emitReordered( PendingFileVec & window, bool byExtent );
+
+    time_t m_changedSince;
+    bool m_bHaveChangedSince;
+    Zip64Manifest m_previous;
+    Zip64Manifest::EntryVec m_skipped;
+
+    /** If @a fi (of @a size bytes) is unchanged, note it as skipped and return true. */
+    bool skipUnchanged( const FileInfo & fi, uint64_t size );
+
+    void emitEntry( FileInfo & fi, Source & source, int64_t sizeHint );
+
+    size_t m_smallFileThreshold;
+    CharBuffer m_smallInput;
+    CharBuffer m_smallOutput;
+    void emitSmallEntry( FileInfo & fi, Source & source );
 
     struct z_stream_s m_zs;
     bool m_bZStreamNeedsReset;
-    void emitCompressedData( FileInfo & fi );
+    std::unique_ptr< FastDeflater > m_fast;  // set for COMPRESS_FAST
+    void emitCompressedData( FileInfo & fi, Source & source );
+
+    Zip64Executor * m_executor;
+    Zip64Executor::TenantId m_tenant;
+
+    /** Run @a work on the executor (if any) for @a cost, holding @a bytes of its memory cap. */
+    void runDeflate( size_t cost, size_t bytes, const std::function< void () > & work );
+
+    void emitChunkedData( FileInfo & fi, Source & source );
+
+    Zip64CheckpointFile * m_checkpoint;
+    uint64_t m_checkpointBytes;
+    unsigned m_checkpointSeconds;
+    uint64_t m_lastCheckpointOffset;
+    time_t m_lastCheckpointTime;
+    std::unordered_set< string > m_resumedNames;
+
+    // where this run started: the other setters compare m_offset
+    // with this, not 0, so they still work after a resume.
+    uint64_t m_resumedOffset;
+
+    /** Whether @a name was written before a resume. */
+    bool alreadyWritten( const string & name ) const;
+
+    /** Record @a fi for the central directory (and the journal), committing if it's time. */
+    void addToDirectory( const FileInfo & fi );
+
+    std::unique_ptr< Zip64DedupCache > m_dedup;
+    bool m_bCapturing;
+
+    /** Send compressed entry data @a cb, keeping a copy for dedup if capturing. */
+    void emitData( CharBuffer & cb );
+
+    /**
+     * If @a fi's content (@a size bytes, in @a contents if non-null,
+     * else in the file) is already in the archive, add it again from
+     * the dedup cache and return true.
+     */
+    bool emitDuplicate( FileInfo & fi, uint64_t size, const CharBuffer * contents );
+
+    /** Add @a fi as an entry whose data is cached entry @a e's. */
+    void emitCached( FileInfo & fi, const Zip64DedupCache::Entry & e );
+
+    /** emitEntry(), keeping the compressed result in the dedup cache. */
+    void emitAndCache( FileInfo & fi, Source & source, int64_t sizeHint );
 
 }; // end class Zip64Streamer
 
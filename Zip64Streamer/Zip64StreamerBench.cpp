@@ -0,0 +1,947 @@
+/**
+ * @file Zip64StreamerBench.cpp
+ *
+ * Throughput benchmark for Zip64Streamer.  Generates reproducible
+ * synthetic corpora on disk (once; they are reused on later runs),
+ * then streams each corpus through each sender and reports one JSON
+ * object per run on stdout.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <new>
+#include <sstream>
+
+// local headers
+#include "Compat.hpp"
+
+// headers under test
+#include "AsyncSender.hpp"
+#include "FanoutSender.hpp"
+#include "Zip64ParallelWriter.hpp"
+#include "Zip64Reader.hpp"
+#include "Zip64Streamer.hpp"
+
+// ---------------------------------------------------------------------
+// allocation accounting; these replace the global operators for the
+// whole program, so they count every allocation the streamer makes.
+
+namespace // anonymous
+{
+
+std::atomic< uint64_t > g_allocCount( 0 );
+std::atomic< uint64_t > g_allocBytes( 0 );
+
+} // end namespace [anonymous]
+
+// gcc pairs up the new and delete it inlines into std::function and
+// the like, and sees free() on memory from operator new; here that's
+// exactly right, since these are the operators behind both.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *
+operator new( std::size_t size )
+{
+    ++g_allocCount;
+    g_allocBytes += size;
+    if ( void * p = std::malloc( size ? size : 1 ) )
+        return p;
+    throw std::bad_alloc();
+}
+
+void *
+operator new[]( std::size_t size )
+{
+    return operator new( size );
+}
+
+void
+operator delete( void * p ) noexcept
+{
+    std::free( p );
+}
+
+void
+operator delete[]( void * p ) noexcept
+{
+    std::free( p );
+}
+
+void
+operator delete( void * p, std::size_t ) noexcept
+{
+    std::free( p );
+}
+
+void
+operator delete[]( void * p, std::size_t ) noexcept
+{
+    std::free( p );
+}
+
+#pragma GCC diagnostic pop
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+// ---------------------------------------------------------------------
+// senders
+
+/** Common base that counts calls and bytes. */
+class CountingSender
+    : public Zip64Streamer::Sender
+{
+
+public:
+
+    CountingSender() : m_sends( 0 ), m_bytes( 0 ) {}
+
+    uint64_t sends() const { return m_sends; }
+    uint64_t bytes() const { return m_bytes; }
+
+protected:
+
+    void count( const size_t n ) { ++m_sends; m_bytes += n; }
+
+private:
+
+    uint64_t m_sends;
+    uint64_t m_bytes;
+
+};
+
+/** Throw everything away; measures the streamer alone. */
+class NullSender
+    : public CountingSender
+{
+
+public:
+
+    virtual void send( CharBuffer & b ) { count( b.size() ); }
+    virtual void send( string & s )     { count( s.size() ); }
+
+};
+
+/**
+ * Copy everything into a fixed-size memory region, wrapping around
+ * when it fills up.  Measures the cost of one copy per byte without
+ * needing memory for the whole archive.
+ */
+class MemorySender
+    : public CountingSender
+{
+
+public:
+
+    MemorySender( const size_t capacity );
+
+    virtual void send( CharBuffer & b ) { append( b.data(), b.size() ); }
+    virtual void send( string & s )     { append( s.data(), s.size() ); }
+
+private:
+
+    CharBuffer m_buf;
+    size_t m_pos;
+
+    void append( const char * p, size_t n );
+
+};
+
+MemorySender::MemorySender( const size_t capacity )
+    : m_buf( capacity ),
+      m_pos( 0 )
+{
+}
+
+void
+MemorySender::append( const char * p, size_t n )
+{
+    count( n );
+    while ( n > 0 )
+    {
+        if ( m_pos == m_buf.size() )
+            m_pos = 0;
+        const size_t chunk( std::min( n, m_buf.size() - m_pos ) );
+        memcpy( &m_buf[ m_pos ], p, chunk );
+        m_pos += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+/** Same behavior as the sender in Zip64StreamerTest. */
+class FileSender
+    : public CountingSender
+{
+
+public:
+
+    FileSender( const string & filename ) : m_ofs( filename ) {}
+
+    virtual void send( CharBuffer & b );
+    virtual void send( string & s );
+
+private:
+
+    std::ofstream m_ofs;
+
+};
+
+/* virtual */ void
+FileSender::send( CharBuffer & b )
+{
+    count( b.size() );
+    CharBuffer tmp;
+    tmp.swap( b );
+    m_ofs.write( tmp.data(), tmp.size() );
+}
+
+/* virtual */ void
+FileSender::send( string & s )
+{
+    count( s.size() );
+    string tmp;
+    tmp.swap( s );
+    m_ofs.write( tmp.data(), tmp.size() );
+}
+
+// ---------------------------------------------------------------------
+// corpus generation
+
+/** Small, fast, seedable generator; output must never change. */
+struct SplitMix64
+{
+    explicit SplitMix64( const uint64_t seed ) : state( seed ) {}
+
+    uint64_t operator()()
+    {
+        uint64_t z = ( state += 0x9e3779b97f4a7c15ULL );
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+        return z ^ ( z >> 31 );
+    }
+
+    uint64_t state;
+};
+
+const char * const WORDS[] = {
+    "GET", "POST", "PUT", "DELETE", "/api/v1/items", "/api/v1/users",
+    "/static/app.js", "/index.html", "200", "201", "204", "304", "404",
+    "500", "user=", "session=", "latency_ms=", "bytes=", "INFO", "WARN",
+    "ERROR", "DEBUG", "cache", "hit", "miss", "upstream", "timeout",
+    "request", "response", "completed", "started", "worker", "shard"
+};
+const size_t NUM_WORDS = sizeof( WORDS ) / sizeof( WORDS[0] );
+
+/** Append one log-like line to @a out. */
+void
+appendLogLine( SplitMix64 & rng, uint64_t & clock, string & out )
+{
+    clock += rng() % 5000;
+
+    char stamp[ 64 ];
+    snprintf( stamp, sizeof( stamp ), "%llu.%03llu [%02u] ",
+              static_cast< unsigned long long >( clock / 1000 ),
+              static_cast< unsigned long long >( clock % 1000 ),
+              static_cast< unsigned >( rng() % 32 ) );
+    out += stamp;
+
+    const unsigned words( 4 + static_cast< unsigned >( rng() % 12 ) );
+    for ( unsigned i = 0; i < words; ++i )
+    {
+        const uint64_t r( rng() );
+        out += WORDS[ r % NUM_WORDS ];
+        if ( r & 0x100 )
+            out += std::to_string( ( r >> 16 ) % 100000 );
+        out += ' ';
+    }
+    out += '\n';
+}
+
+/** Write @a bytes of log-like (compressible) text to @a path. */
+void
+writeTextFile( const string & path, const uint64_t bytes, const uint64_t seed )
+{
+    std::ofstream ofs( path );
+    if ( ! ofs )
+        throw OSError( "creating " + path );
+
+    SplitMix64 rng( seed );
+    uint64_t clock( seed % 1000000000 );
+    uint64_t written( 0 );
+    string buf;
+    while ( written < bytes )
+    {
+        buf.clear();
+        while ( buf.size() < 1024 * 1024 )
+            appendLogLine( rng, clock, buf );
+        const size_t n( std::min< uint64_t >( buf.size(), bytes - written ) );
+        ofs.write( buf.data(), n );
+        written += n;
+    }
+}
+
+/** Write @a bytes of incompressible data to @a path. */
+void
+writeRandomFile( const string & path, const uint64_t bytes, const uint64_t seed )
+{
+    std::ofstream ofs( path );
+    if ( ! ofs )
+        throw OSError( "creating " + path );
+
+    SplitMix64 rng( seed );
+    std::vector< uint64_t > buf( 128 * 1024 );
+    uint64_t written( 0 );
+    while ( written < bytes )
+    {
+        for ( uint64_t & w : buf )
+            w = rng();
+        const size_t n( std::min< uint64_t >( buf.size() * sizeof( uint64_t ),
+                                              bytes - written ) );
+        ofs.write( reinterpret_cast< const char * >( buf.data() ), n );
+        written += n;
+    }
+}
+
+/** Description of one corpus; @a generate fills @a dir. */
+struct Corpus
+{
+    string name;
+    string description;
+    void ( * generate )( const string & dir, double scale );
+};
+
+void
+makeDir( const string & dir )
+{
+    if ( mkdir( dir.c_str(), 0777 ) != 0 && errno != EEXIST )
+        throw OSError( "mkdir " + dir );
+}
+
+/**
+ * The names of the files in @a dir (corpora are flat), read directly
+ * rather than by globFiles(), whose logging would end up in the run.
+ */
+StringList
+listDir( const string & dir )
+{
+    StringList rv;
+    DIR * const d( opendir( dir.c_str() ) );
+    if ( ! d )
+    {
+        if ( errno == ENOENT )
+            return rv;
+        throw OSError( "opendir " + dir );
+    }
+    while ( const struct dirent * de = readdir( d ) )
+    {
+        const string name( de->d_name );
+        if ( name != "." && name != ".." )
+            rv.push_back( name );
+    }
+    closedir( d );
+    return rv;
+}
+
+/** Remove @a dir and the files in it, if it exists. */
+void
+removeDir( const string & dir )
+{
+    for ( const string & file : listDir( dir ) )
+        if ( unlink( ( dir + "/" + file ).c_str() ) != 0 && errno != ENOENT )
+            throw OSError( "unlink " + dir + "/" + file );
+    if ( rmdir( dir.c_str() ) != 0 && errno != ENOENT )
+        throw OSError( "rmdir " + dir );
+}
+
+uint64_t
+scaled( const uint64_t full, const double scale )
+{
+    return std::max< uint64_t >( 1, static_cast< uint64_t >( full * scale ) );
+}
+
+void
+generateBig( const string & dir, const double scale )
+{
+    writeTextFile( dir + "/big.log", scaled( 10ULL << 30, scale ), 1 );
+}
+
+void
+generateTiny( const string & dir, const double scale )
+{
+    SplitMix64 rng( 2 );
+    const uint64_t n( scaled( 1000000, scale ) );
+    string body;
+    for ( uint64_t i = 0; i < n; ++i )
+    {
+        std::ostringstream name;
+        name << dir << "/t" << std::setw( 7 ) << std::setfill( '0' ) << i;
+        std::ofstream ofs( name.str() );
+        if ( ! ofs )
+            throw OSError( "creating " + name.str() );
+        body.clear();
+        const size_t len( rng() % 256 );
+        while ( body.size() < len )
+            body += WORDS[ rng() % NUM_WORDS ];
+        ofs.write( body.data(), len );
+    }
+}
+
+void
+generateRandom( const string & dir, const double scale )
+{
+    writeRandomFile( dir + "/random.bin", scaled( 1ULL << 30, scale ), 3 );
+}
+
+void
+generateLogs( const string & dir, const double scale )
+{
+    // a spread of sizes, the way a real log directory looks: a few
+    // big ones, more medium ones, and a tail of small ones.
+    SplitMix64 rng( 4 );
+    for ( unsigned i = 0; i < 64; ++i )
+    {
+        const uint64_t full( i < 4 ? ( 128ULL << 20 ) :
+                             i < 20 ? ( 16ULL << 20 ) :
+                             ( 64ULL << 10 ) + rng() % ( 1ULL << 20 ) );
+        std::ostringstream name;
+        name << dir << "/app-" << std::setw( 2 ) << std::setfill( '0' ) << i << ".log";
+        if ( i % 8 == 7 )
+            writeRandomFile( name.str(), scaled( full / 16, scale ), 100 + i );
+        else
+            writeTextFile( name.str(), scaled( full, scale ), 100 + i );
+    }
+}
+
+const Corpus CORPORA[] = {
+    { "big",    "one compressible file (10 GiB)",     generateBig    },
+    { "tiny",   "1M files of 0-255 bytes",            generateTiny   },
+    { "random", "incompressible data (1 GiB)",        generateRandom },
+    { "logs",   "mixed log files with some binaries", generateLogs   }
+};
+
+/**
+ * Make sure @a corpus exists in @a root at @a scale; a stamp file
+ * records the scale so that a change forces regeneration.  That
+ * starts from an empty directory, so nothing from another scale (or
+ * an interrupted run, which leaves no stamp) is left behind.
+ */
+string
+ensureCorpus( const string & root, const Corpus & corpus, const double scale )
+{
+    const string dir( root + "/" + corpus.name );
+    const string stampPath( root + "/." + corpus.name + ".stamp" );
+
+    std::ostringstream want;
+    want << "v1 scale=" << scale;
+
+    {
+        std::ifstream stamp( stampPath );
+        string have;
+        std::getline( stamp, have );
+        if ( have == want.str() )
+            return dir;
+    }
+
+    DEBUG( "generating corpus " << QS( corpus.name ) << ": " << corpus.description );
+    if ( unlink( stampPath.c_str() ) != 0 && errno != ENOENT )
+        throw OSError( "unlink " + stampPath );
+    removeDir( dir );
+    makeDir( dir );
+    corpus.generate( dir, scale );
+
+    std::ofstream stamp( stampPath );
+    stamp << want.str() << "\n";
+    return dir;
+}
+
+// ---------------------------------------------------------------------
+// measurement
+
+typedef std::chrono::steady_clock Clock;
+
+/** Reset the kernel's peak-RSS counter, if it lets us. */
+void
+resetPeakRss()
+{
+    std::ofstream ofs( "/proc/self/clear_refs" );
+    ofs << "5" << std::endl;
+}
+
+/** Peak resident set size in KiB since the last reset. */
+long
+peakRssKiB()
+{
+    std::ifstream ifs( "/proc/self/status" );
+    string line;
+    while ( std::getline( ifs, line ) )
+        if ( line.compare( 0, 6, "VmHWM:" ) == 0 )
+            return std::atol( line.c_str() + 6 );
+
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+    return ru.ru_maxrss;
+}
+
+uint64_t
+inputBytes( const string & dir )
+{
+    uint64_t total( 0 );
+    for ( const string & file : listDir( dir ) )
+    {
+        struct stat st;
+        if ( stat( ( dir + "/" + file ).c_str(), &st ) == 0 )
+            total += st.st_size;
+    }
+    return total;
+}
+
+/** What one run produced. */
+struct RunResult
+{
+    size_t entries;
+    uint64_t bytesOut;
+    uint64_t sends;
+    string extra; // additional JSON members, if any
+};
+
+typedef std::function< RunResult () > RunFunc;
+
+/** A --read-order choice: how the streamer orders its reads. */
+struct ReadPolicy
+{
+    string name;
+    Zip64Streamer::ReadOrder order;
+    bool keepNameOrder;
+};
+
+const ReadPolicy READ_POLICIES[] = {
+    { "name",              Zip64Streamer::READ_BY_NAME,   false },
+    { "inode",             Zip64Streamer::READ_BY_INODE,  false },
+    { "extent",            Zip64Streamer::READ_BY_EXTENT, false },
+    { "extent-keep-names", Zip64Streamer::READ_BY_EXTENT, true  }
+};
+
+/** Evict @a dir's files from the page cache, so reads go to the disk. */
+void
+dropCache( const string & dir )
+{
+    for ( const string & file : listDir( dir ) )
+    {
+        const int fd( open( ( dir + "/" + file ).c_str(), O_RDONLY | O_CLOEXEC ) );
+        if ( fd < 0 )
+            continue;
+        fdatasync( fd );
+        posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+        close( fd );
+    }
+}
+
+/** Stream @a corpusDir into @a sender; @a counter sees what comes out the far end. */
+RunResult
+streamInto( const string & corpusDir,
+            Zip64Streamer::Sender & sender,
+            const CountingSender & counter,
+            const ReadPolicy & policy,
+            Zip64Tracer * tracer )
+{
+    RunResult rv;
+    {
+        Zip64Streamer z64s( corpusDir, sender );
+        z64s.setTracer( tracer );
+        z64s.setReadOrder( policy.order, policy.keepNameOrder );
+        rv.entries = z64s.addFileByPattern( "*" );
+    }
+    rv.bytesOut = counter.bytes();
+    rv.sends = counter.sends();
+    return rv;
+}
+
+RunResult
+runStreamer( const string & corpusDir,
+             CountingSender & sender,
+             const ReadPolicy & policy,
+             Zip64Tracer * tracer )
+{
+    return streamInto( corpusDir, sender, sender, policy, tracer );
+}
+
+RunResult
+runAsync( const string & corpusDir,
+          CountingSender & sender,
+          const ReadPolicy & policy,
+          Zip64Tracer * tracer )
+{
+    AsyncSender async( sender );
+    RunResult rv( streamInto( corpusDir, async, sender, policy, tracer ) );
+
+    const AsyncSender::Stats s( async.stats() );
+    std::ostringstream oss;
+    oss << ", \"queue_avg_depth\": " << s.averageDepth()
+        << ", \"queue_max_depth\": " << s.maxDepth
+        << ", \"queue_full_stalls\": " << s.fullStalls
+        << ", \"queue_stall_ms\": " << s.stallNanos / 1000000
+        << ", \"queue_empty_waits\": " << s.emptyWaits;
+    rv.extra = oss.str();
+    return rv;
+}
+
+RunResult
+runFanout( const string & corpusDir,
+           const string & output,
+           const ReadPolicy & policy,
+           Zip64Tracer * tracer )
+{
+    FileSender file( output );
+    MemorySender memory( 64 * 1024 * 1024 );
+    NullSender null;
+
+    FanoutSender fanout;
+    fanout.addBranch( file, "file" );
+    fanout.addBranch( memory, "memory" );
+    fanout.addBranch( null, "null", 1024 * 1024, FanoutSender::DETACH );
+
+    RunResult rv( streamInto( corpusDir, fanout, file, policy, tracer ) );
+
+    std::ostringstream oss;
+    oss << ", \"branches\": [";
+    for ( size_t i = 0; i < fanout.branches(); ++i )
+    {
+        const FanoutSender::BranchStatus st( fanout.status( i ) );
+        oss << ( i ? ", " : "" )
+            << "{ \"label\": \"" << st.label << "\""
+            << ", \"attached\": " << ( st.attached ? "true" : "false" )
+            << ", \"bytes\": " << st.bytesSent
+            << ", \"max_queued\": " << st.maxQueuedBytes
+            << ", \"stalls\": " << st.stalls << " }";
+    }
+    oss << "]";
+    rv.extra = oss.str();
+    return rv;
+}
+
+RunResult
+runParallel( const string & corpusDir,
+             const string & output,
+             const Zip64ParallelWriter::Method method )
+{
+    Zip64ParallelWriter writer( corpusDir, output, method );
+    RunResult rv;
+    rv.entries = writer.addFileByPattern( "*" );
+    rv.bytesOut = writer.finish();
+    rv.sends = 0;
+    return rv;
+}
+
+void
+measure( const string & corpusName,
+         const uint64_t inBytes,
+         const string & senderName,
+         const string & readOrder,
+         const bool cold,
+         const RunFunc & run,
+         bool & first )
+{
+    DEBUG( "running " << corpusName << " -> " << senderName );
+
+    resetPeakRss();
+    const uint64_t allocCount0( g_allocCount );
+    const uint64_t allocBytes0( g_allocBytes );
+    const Clock::time_point start( Clock::now() );
+
+    const RunResult result( run() );
+
+    const double secs( std::chrono::duration< double >( Clock::now() - start ).count() );
+    const uint64_t allocs( g_allocCount - allocCount0 );
+    const uint64_t allocBytes( g_allocBytes - allocBytes0 );
+    const size_t entries( result.entries );
+
+    std::cout << ( first ? "[\n" : ",\n" ) << std::fixed << std::setprecision( 3 )
+              << "  { \"corpus\": \"" << corpusName << "\""
+              << ", \"sender\": \"" << senderName << "\""
+              << ", \"read_order\": \"" << readOrder << "\""
+              << ", \"cold_cache\": " << ( cold ? "true" : "false" )
+              << ", \"entries\": " << entries
+              << ", \"bytes_in\": " << inBytes
+              << ", \"bytes_out\": " << result.bytesOut
+              << ", \"seconds\": " << secs
+              << ", \"mb_per_s\": " << inBytes / 1e6 / secs
+              << ", \"entries_per_s\": " << entries / secs
+              << ", \"allocations\": " << allocs
+              << ", \"alloc_bytes\": " << allocBytes
+              << ", \"peak_rss_kib\": " << peakRssKiB()
+              << ", \"sends\": " << result.sends
+              << ", \"sends_per_entry\": "
+              << ( entries ? static_cast< double >( result.sends ) / entries : 0.0 )
+              << result.extra
+              << " }" << std::flush;
+    first = false;
+}
+
+void
+usage( const char * argv0 )
+{
+    std::cerr <<
+        "usage: " << argv0 << " [options]\n"
+        "  --dir DIR        corpus directory (default: z64s-corpus)\n"
+        "  --scale X        scale all corpus sizes by X (default: 1.0)\n"
+        "  --corpus NAME    only run this corpus (repeatable)\n"
+        "  --sender NAME    only run this sender (repeatable): null, memory, file,\n"
+        "                   async-file (file behind an AsyncSender), fanout\n"
+        "                   (file + memory + null from one streamer), or\n"
+        "                   parallel / parallel-store for Zip64ParallelWriter\n"
+        "  --output FILE    archive path for file output (default: DIR/out.zip)\n"
+        "  --trace FILE     write a Chrome trace-event timeline of all runs to FILE\n"
+        "  --verify         check every archive written to --output with Zip64Reader\n"
+        "  --read-order O   streamer read order (repeatable): name, inode, extent,\n"
+        "                   or extent-keep-names (extent order reads, name order archive)\n"
+        "  --cold           evict the corpus from the page cache before each run\n"
+        "  --verbose        keep the streamer's logging enabled\n"
+        "corpora:\n";
+    for ( const Corpus & c : CORPORA )
+        std::cerr << "  " << std::setw( 8 ) << std::left << c.name << c.description << "\n";
+}
+
+} // end namespace [anonymous]
+
+int
+main( int argc, char * argv [] )
+{
+    string root( "z64s-corpus" );
+    string output;
+    string tracePath;
+    double scale( 1.0 );
+    StringList corpora;
+    StringList senders;
+    bool verbose( false );
+    bool verify( false );
+    bool cold( false );
+    StringList readOrders;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        const bool hasValue( i + 1 < argc );
+        if ( arg == "--dir" && hasValue )
+            root = argv[++i];
+        else if ( arg == "--scale" && hasValue )
+            scale = std::atof( argv[++i] );
+        else if ( arg == "--corpus" && hasValue )
+            corpora.push_back( argv[++i] );
+        else if ( arg == "--sender" && hasValue )
+            senders.push_back( argv[++i] );
+        else if ( arg == "--output" && hasValue )
+            output = argv[++i];
+        else if ( arg == "--trace" && hasValue )
+            tracePath = argv[++i];
+        else if ( arg == "--verbose" )
+            verbose = true;
+        else if ( arg == "--verify" )
+            verify = true;
+        else if ( arg == "--read-order" && hasValue )
+            readOrders.push_back( argv[++i] );
+        else if ( arg == "--cold" )
+            cold = true;
+        else
+        {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+
+    if ( scale <= 0 )
+    {
+        ERROR( "scale must be positive" );
+        return 1;
+    }
+
+    if ( corpora.empty() )
+        for ( const Corpus & c : CORPORA )
+            corpora.push_back( c.name );
+
+    if ( senders.empty() )
+        senders = StringList{ "null", "memory", "file", "async-file", "fanout",
+                              "parallel", "parallel-store" };
+
+    if ( output.empty() )
+        output = root + "/out.zip";
+
+    if ( readOrders.empty() )
+        readOrders.push_back( "name" );
+
+    std::vector< ReadPolicy > policies;
+    for ( const string & name : readOrders )
+    {
+        const ReadPolicy * policy( 0 );
+        for ( const ReadPolicy & p : READ_POLICIES )
+            if ( p.name == name )
+                policy = &p;
+        if ( ! policy )
+        {
+            ERROR( "unknown read order " << QS( name ) );
+            return 1;
+        }
+        policies.push_back( *policy );
+    }
+
+    try
+    {
+        makeDir( root );
+
+        std::streambuf * const clogBuf( std::clog.rdbuf() );
+
+        std::unique_ptr< Zip64Tracer > tracer;
+        if ( ! tracePath.empty() )
+            tracer.reset( new Zip64Tracer );
+
+        bool first( true );
+        for ( const string & name : corpora )
+        {
+            const Corpus * corpus( 0 );
+            for ( const Corpus & c : CORPORA )
+                if ( c.name == name )
+                    corpus = &c;
+            if ( ! corpus )
+            {
+                ERROR( "unknown corpus " << QS( name ) );
+                return 1;
+            }
+
+            const string dir( ensureCorpus( root, *corpus, scale ) );
+            const uint64_t inBytes( inputBytes( dir ) );
+
+            for ( const string & senderName : senders )
+            {
+                for ( const ReadPolicy & policy : policies )
+                {
+                    // the parallel writer has no read order; run it once.
+                    const bool isParallel( senderName.compare( 0, 8, "parallel" ) == 0 );
+                    if ( isParallel && &policy != &policies.front() )
+                        continue;
+                    const string readOrder( isParallel ? "name" : policy.name );
+
+                    if ( cold )
+                        dropCache( dir );
+
+                    // per-chunk logging would dominate the numbers
+                    if ( ! verbose )
+                        std::clog.rdbuf( 0 );
+
+                    if ( senderName == "null" )
+                    {
+                        NullSender sender;
+                        measure( name, inBytes, senderName, readOrder, cold,
+                                 std::bind( runStreamer, dir, std::ref( sender ),
+                                            std::cref( policy ), tracer.get() ),
+                                 first );
+                    }
+                    else if ( senderName == "memory" )
+                    {
+                        MemorySender sender( 64 * 1024 * 1024 );
+                        measure( name, inBytes, senderName, readOrder, cold,
+                                 std::bind( runStreamer, dir, std::ref( sender ),
+                                            std::cref( policy ), tracer.get() ),
+                                 first );
+                    }
+                    else if ( senderName == "file" )
+                    {
+                        FileSender sender( output );
+                        measure( name, inBytes, senderName, readOrder, cold,
+                                 std::bind( runStreamer, dir, std::ref( sender ),
+                                            std::cref( policy ), tracer.get() ),
+                                 first );
+                    }
+                    else if ( senderName == "async-file" )
+                    {
+                        FileSender sender( output );
+                        measure( name, inBytes, senderName, readOrder, cold,
+                                 std::bind( runAsync, dir, std::ref( sender ),
+                                            std::cref( policy ), tracer.get() ),
+                                 first );
+                    }
+                    else if ( senderName == "fanout" )
+                    {
+                        measure( name, inBytes, senderName, readOrder, cold,
+                                 std::bind( runFanout, dir, output,
+                                            std::cref( policy ), tracer.get() ),
+                                 first );
+                    }
+                    else if ( senderName == "parallel" || senderName == "parallel-store" )
+                    {
+                        const Zip64ParallelWriter::Method method(
+                            senderName == "parallel" ? Zip64ParallelWriter::DEFLATE
+                                                     : Zip64ParallelWriter::STORE );
+                        measure( name, inBytes, senderName, readOrder, cold,
+                                 std::bind( runParallel, dir, output, method ),
+                                 first );
+                    }
+                    else
+                    {
+                        std::clog.rdbuf( clogBuf );
+                        std::clog.clear();
+                        ERROR( "unknown sender " << QS( senderName ) );
+                        return 1;
+                    }
+
+                    std::clog.rdbuf( clogBuf );
+                    std::clog.clear();
+
+                    if ( verify && senderName != "null" && senderName != "memory" )
+                    {
+                        const Zip64Reader::Result r( Zip64Reader( output ).verify() );
+                        for ( const string & e : r.errors )
+                            ERROR( senderName << ": " << e );
+                        if ( r.failures || r.bytes != inBytes )
+                        {
+                            ERROR( name << " -> " << senderName << ": archive failed verification" );
+                            return 1;
+                        }
+                        DEBUG( name << " -> " << senderName << ": verified " << r.entries << " entries" );
+                    }
+                }
+            }
+        }
+
+        if ( ! first )
+            std::cout << "\n]" << std::endl;
+
+        if ( tracer )
+        {
+            std::ofstream ofs( tracePath );
+            tracer->writeJson( ofs );
+            if ( ! ofs )
+                throw OSError( "writing " + tracePath );
+            DEBUG( "wrote trace to " << QS( tracePath ) <<
+                   " (" << tracer->dropped() << " spans dropped)" );
+        }
+    }
+    catch ( const std::exception & e )
+    {
+        std::clog.clear();
+        ERROR( e.what() );
+        return 1;
+    }
+
+    return 0;
+}
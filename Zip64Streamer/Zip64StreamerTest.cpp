@@ -6,12 +6,15 @@
 
 // standard C++ headers
 #include <fstream>
+#include <memory>
 
 // local headers
 #include "Compat.hpp"
 
 // header under test
+#include "Zip64Checkpoint.hpp"
 #include "Zip64Streamer.hpp"
+#include "Zip64Sources.hpp"
 
 namespace // anonymous
 {
@@ -69,25 +72,160 @@ main( int argc, char * argv [] )
 {
     if ( argc < 3 )
     {
-        ERROR( "usage: " << argv[0] << " ZIPFILE [FILE/PATTERN...]" );
+        ERROR( "usage: " << argv[0] << " ZIPFILE "
+               "[--since SECS] [--previous MANIFEST] [--manifest MANIFEST] "
+               "[--read-order name|inode|extent] [--keep-names] [--reproducible] [--executor THREADS] [--fast] [--dedup] [--checkpoint] "
+               "[FILE/PATTERN | --stdin NAME]..." );
         return 1;
     }
 
     const string zipFile( argv[1] );
+
+    // a checkpointed archive resumes from its journal, if any, so
+    // that has to be opened before the streamer exists.
+    bool checkpoint( false );
+    for ( int i = 2; i < argc; ++i )
+        if ( string( argv[i] ) == "--checkpoint" )
+            checkpoint = true;
+
     DEBUG( "creating file sender for " << QS( zipFile ) );
-    FileSender sender( argv[1] );
+    std::unique_ptr< Zip64Streamer::Sender > sender;
+    Zip64CheckpointFile * checkpointFile( 0 );
+    if ( checkpoint )
+        sender.reset( checkpointFile = new Zip64CheckpointFile( zipFile ) );
+    else
+        sender.reset( new FileSender( zipFile ) );
 
     const string dir( "." );
+    // must outlive the streamer
+    std::unique_ptr< Zip64Executor > executor;
+
     DEBUG( "creating zip streamer in dir " << QS( dir ) );
-    Zip64Streamer z64s( dir, sender );
+    Zip64Streamer z64s( dir, *sender );
+
+    string manifestFile;
+    Zip64Streamer::ReadOrder readOrder( Zip64Streamer::READ_BY_NAME );
+    bool keepNames( false );
+    bool reproducible( false );
+    bool dedup( false );
+
+    // consecutive patterns are matched together, in one pass.
+    StringList patterns;
+
+    // the checkpoint goes on just before the first entry, so every
+    // option ahead of it is already set, wherever --checkpoint was.
+    bool checkpointSet( false );
+    auto startCheckpoint = [&]()
+    {
+        if ( checkpointFile && ! checkpointSet )
+            z64s.setCheckpoint( checkpointFile );
+        checkpointSet = true;
+    };
 
     for ( int i = 2; i < argc; ++i )
     {
         const string pat( argv[i] );
+        if ( pat.compare( 0, 2, "--" ) == 0 && ! patterns.empty() )
+        {
+            startCheckpoint();
+            z64s.addFilesByPatterns( patterns );
+            patterns.clear();
+        }
+        if ( pat == "--since" && i + 1 < argc )
+        {
+            z64s.setChangedSince( static_cast< time_t >( std::stoll( argv[++i] ) ) );
+            continue;
+        }
+        if ( pat == "--previous" && i + 1 < argc )
+        {
+            std::ifstream ifs( argv[++i] );
+            if ( ! ifs )
+                throw OSError( "open previous manifest" );
+            Zip64Manifest prev;
+            prev.load( ifs );
+            z64s.setPreviousManifest( prev );
+            continue;
+        }
+        if ( pat == "--read-order" && i + 1 < argc )
+        {
+            const string order( argv[++i] );
+            readOrder = ( order == "inode"  ? Zip64Streamer::READ_BY_INODE :
+                          order == "extent" ? Zip64Streamer::READ_BY_EXTENT :
+                                              Zip64Streamer::READ_BY_NAME );
+            z64s.setReadOrder( readOrder, keepNames );
+            continue;
+        }
+        if ( pat == "--keep-names" )
+        {
+            keepNames = true;
+            z64s.setReadOrder( readOrder, keepNames );
+            continue;
+        }
+        if ( pat == "--executor" && i + 1 < argc )
+        {
+            executor.reset( new Zip64Executor( static_cast< unsigned >( std::stoul( argv[++i] ) ) ) );
+            z64s.setExecutor( executor.get() );
+            continue;
+        }
+        if ( pat == "--fast" )
+        {
+            z64s.setCompressor( Zip64Streamer::COMPRESS_FAST );
+            continue;
+        }
+        if ( pat == "--dedup" )
+        {
+            z64s.setDeduplication( true );
+            dedup = true;
+            continue;
+        }
+        if ( pat == "--checkpoint" )
+            continue;
+        if ( pat == "--reproducible" )
+        {
+            z64s.setReproducible( true );
+            reproducible = true;
+            continue;
+        }
+        if ( pat == "--manifest" && i + 1 < argc )
+        {
+            manifestFile = argv[++i];
+            continue;
+        }
+        if ( pat == "--stdin" && i + 1 < argc )
+        {
+            const string name( argv[++i] );
+            FINE( "adding stdin as " << QS( name ) );
+            FdSource source( 0 );
+            startCheckpoint();
+            z64s.addEntry( name, source );
+            continue;
+        }
         FINE( "adding pattern " << QS( pat ) );
-        z64s.addFileByPattern( pat );
+        patterns.push_back( pat );
+    }
+    startCheckpoint();
+    if ( ! patterns.empty() )
+        z64s.addFilesByPatterns( patterns );
+    DEBUG( "done adding patterns, skipped " << z64s.skipped() << " unchanged" );
+
+    if ( ! manifestFile.empty() )
+    {
+        std::ofstream ofs( manifestFile );
+        z64s.manifest().save( ofs );
+    }
+
+    z64s.finish();
+    if ( reproducible )
+        std::cout << z64s.contentHash() << std::endl;
+    if ( dedup )
+    {
+        const Zip64DedupCache::Stats st( z64s.dedupStats() );
+        std::cout << "dedup: " << st.hardLinks << " hard links, "
+                  << st.sameContent << " same content, "
+                  << st.bytesDeduped << " bytes not recompressed, "
+                  << st.bytesReplayed << " replayed, "
+                  << st.cpuSecondsSaved << "s cpu saved" << std::endl;
     }
-    DEBUG( "done adding patterns" );
 
     return 0;
 }
@@ -0,0 +1,234 @@
+/**
+ * @file Zip64Trace.cpp
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C / Unix headers
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// standard C++ headers
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ostream>
+
+// local headers
+#include "Compat.hpp"
+
+// interface
+#include "Zip64Trace.hpp"
+
+namespace // anonymous
+{
+
+using namespace com::foiani;
+
+std::atomic< uint64_t > g_nextTracerId( 1 );
+
+/** The calling thread's buffer for the tracer it last used. */
+struct ThreadCache
+{
+    uint64_t tracerId;
+    void * buffer;
+};
+
+thread_local ThreadCache t_cache = { 0, 0 };
+
+uint32_t
+currentTid()
+{
+    thread_local uint32_t tid( static_cast< uint32_t >( syscall( SYS_gettid ) ) );
+    return tid;
+}
+
+void
+writeJsonString( std::ostream & os, const string & s )
+{
+    os << '"';
+    for ( const char c : s )
+    {
+        switch ( c )
+        {
+        case '"':  os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n";  break;
+        case '\t': os << "\\t";  break;
+        default:
+            if ( static_cast< unsigned char >( c ) < 0x20 )
+            {
+                char buf[ 8 ];
+                snprintf( buf, sizeof( buf ), "\\u%04x", c );
+                os << buf;
+            }
+            else
+                os << c;
+        }
+    }
+    os << '"';
+}
+
+/** Nanoseconds as fractional microseconds, which is what the format wants. */
+void
+writeMicros( std::ostream & os, const uint64_t ns )
+{
+    char buf[ 32 ];
+    snprintf( buf, sizeof( buf ), "%llu.%03u",
+              static_cast< unsigned long long >( ns / 1000 ),
+              static_cast< unsigned >( ns % 1000 ) );
+    os << buf;
+}
+
+} // end namespace [anonymous]
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+Zip64Tracer::Zip64Tracer( const size_t maxEventsPerThread )
+    : m_id( g_nextTracerId++ ),
+      m_maxEventsPerThread( maxEventsPerThread ),
+      m_origin( now() )
+{
+}
+
+Zip64Tracer::~Zip64Tracer()
+{
+}
+
+/* static */ uint64_t
+Zip64Tracer::now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast< uint64_t >( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+/* static */ bool
+Zip64Tracer::shouldSample( const double fraction )
+{
+    if ( fraction <= 0 )
+        return false;
+    if ( fraction >= 1 )
+        return true;
+
+    // xorshift; quality barely matters here, cost does.
+    thread_local uint64_t state( ( now() ^ ( uint64_t( currentTid() ) << 32 ) ) | 1 );
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return ( state >> 11 ) * ( 1.0 / 9007199254740992.0 ) < fraction;
+}
+
+Zip64Tracer::ThreadBuffer &
+Zip64Tracer::threadBuffer()
+{
+    if ( t_cache.tracerId == m_id )
+        return *static_cast< ThreadBuffer * >( t_cache.buffer );
+
+    // first span from this thread, or the thread has used another
+    // tracer since; this is the only locked step.
+    const uint32_t tid( currentTid() );
+    ThreadBuffer * rv( 0 );
+    {
+        std::lock_guard< std::mutex > lock( m_registryMutex );
+        ThreadBuffer * & known( m_buffersByTid[tid] );
+        if ( ! known )
+        {
+            std::unique_ptr< ThreadBuffer > buf( new ThreadBuffer );
+            buf->tid = tid;
+            buf->dropped = 0;
+            buf->events.reserve( std::min< size_t >( m_maxEventsPerThread, 4096 ) );
+            known = buf.get();
+            m_buffers.push_back( std::move( buf ) );
+        }
+        rv = known;
+    }
+
+    t_cache.tracerId = m_id;
+    t_cache.buffer = rv;
+    return *rv;
+}
+
+void
+Zip64Tracer::record( const char * name,
+                     const uint64_t beginNs,
+                     const uint64_t endNs,
+                     const uint64_t bytes,
+                     const string & detail )
+{
+    ThreadBuffer & buf( threadBuffer() );
+    if ( buf.events.size() >= m_maxEventsPerThread )
+    {
+        ++buf.dropped;
+        return;
+    }
+
+    buf.events.push_back( Event() );
+    Event & ev( buf.events.back() );
+    ev.name = name;
+    ev.begin = beginNs;
+    ev.end = endNs;
+    ev.bytes = bytes;
+    ev.detail = detail;
+}
+
+uint64_t
+Zip64Tracer::dropped() const
+{
+    std::lock_guard< std::mutex > lock( m_registryMutex );
+    uint64_t rv( 0 );
+    for ( const std::unique_ptr< ThreadBuffer > & buf : m_buffers )
+        rv += buf->dropped;
+    return rv;
+}
+
+void
+Zip64Tracer::writeJson( std::ostream & os ) const
+{
+    std::lock_guard< std::mutex > lock( m_registryMutex );
+
+    const long pid( getpid() );
+    bool first( true );
+
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for ( const std::unique_ptr< ThreadBuffer > & buf : m_buffers )
+    {
+        for ( const Event & ev : buf->events )
+        {
+            os << ( first ? "\n" : ",\n" );
+            first = false;
+
+            os << "{\"ph\":\"X\",\"cat\":\"z64s\",\"name\":\"" << ev.name << "\""
+               << ",\"pid\":" << pid << ",\"tid\":" << buf->tid << ",\"ts\":";
+            writeMicros( os, ev.begin - std::min( ev.begin, m_origin ) );
+            os << ",\"dur\":";
+            writeMicros( os, ev.end - ev.begin );
+            os << ",\"args\":{\"bytes\":" << ev.bytes;
+            if ( ! ev.detail.empty() )
+            {
+                os << ",\"entry\":";
+                writeJsonString( os, ev.detail );
+            }
+            os << "}}";
+        }
+
+        if ( buf->dropped )
+        {
+            os << ( first ? "\n" : ",\n" );
+            first = false;
+            os << "{\"ph\":\"i\",\"s\":\"t\",\"name\":\"dropped\",\"pid\":" << pid
+               << ",\"tid\":" << buf->tid << ",\"ts\":0"
+               << ",\"args\":{\"count\":" << buf->dropped << "}}";
+        }
+    }
+    os << "\n]}\n";
+}
+
+} // end namespace com::foiani
+
+} // end namespace com
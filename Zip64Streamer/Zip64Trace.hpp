@@ -0,0 +1,151 @@
+#ifndef COM_FOIANI_Z64S_ZIP64TRACE_HPP
+#define COM_FOIANI_Z64S_ZIP64TRACE_HPP 1
+
+/**
+ * @file Zip64Trace.hpp
+ *
+ * Lightweight span recorder for archive generation, exported as
+ * Chrome trace-event JSON (load it in Perfetto or chrome://tracing).
+ *
+ * Each thread records into its own buffer, so recording a span takes
+ * no locks; only the first span a thread records against a given
+ * tracer registers that thread's buffer.  When no tracer is attached,
+ * a span costs one pointer test.
+ *
+ * @author Anthony Foiani <anthony@foiani.com>
+ */
+
+// standard C++ headers
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// local headers
+#include "Compat.hpp"
+
+namespace com
+{
+
+namespace /* com:: */ foiani
+{
+
+/** Collects timed spans from any number of threads. */
+class Zip64Tracer
+{
+
+public:
+
+    /** Keep at most @a maxEventsPerThread spans per thread; later ones are dropped. */
+    explicit Zip64Tracer( size_t maxEventsPerThread = 1 << 20 );
+
+    /** Standard destructor. */
+    ~Zip64Tracer();
+
+    /** Monotonic clock in nanoseconds. */
+    static uint64_t now();
+
+    /** Returns true for roughly @a fraction of calls; for sampling requests. */
+    static bool shouldSample( double fraction );
+
+    /** Record a completed span on the calling thread. */
+    void record( const char * name,
+                 uint64_t beginNs,
+                 uint64_t endNs,
+                 uint64_t bytes,
+                 const string & detail );
+
+    /** Spans dropped because a thread's buffer was full. */
+    uint64_t dropped() const;
+
+    /**
+     * Write everything recorded so far as trace-event JSON.  Threads
+     * that recorded spans must be finished (or quiescent) first.
+     */
+    void writeJson( std::ostream & os ) const;
+
+    /** Times the enclosing scope; does nothing if the tracer is null. */
+    class Span
+    {
+
+    public:
+
+        Span( Zip64Tracer * tracer, const char * name )
+            : m_tracer( tracer ), m_name( name ), m_bytes( 0 ),
+              m_begin( tracer ? now() : 0 )
+        {
+        }
+
+        Span( Zip64Tracer * tracer, const char * name, const string & detail )
+            : m_tracer( tracer ), m_name( name ), m_bytes( 0 ),
+              m_begin( tracer ? now() : 0 )
+        {
+            if ( tracer )
+                m_detail = detail;
+        }
+
+        ~Span()
+        {
+            if ( m_tracer )
+                m_tracer->record( m_name, m_begin, now(), m_bytes, m_detail );
+        }
+
+        /** Attach a byte count to the span. */
+        void bytes( const uint64_t n ) { m_bytes = n; }
+
+    private:
+
+        Span( const Span & );
+        Span & operator=( const Span & );
+
+        Zip64Tracer * const m_tracer;
+        const char * const m_name;
+        uint64_t m_bytes;
+        const uint64_t m_begin;
+        string m_detail;
+
+    };
+
+private:
+
+    Zip64Tracer( const Zip64Tracer & );
+    Zip64Tracer & operator=( const Zip64Tracer & );
+
+    struct Event
+    {
+        const char * name;
+        uint64_t begin;
+        uint64_t end;
+        uint64_t bytes;
+        string detail;
+    };
+
+    struct ThreadBuffer
+    {
+        uint32_t tid;
+        uint64_t dropped;
+        std::vector< Event > events;
+    };
+
+    ThreadBuffer & threadBuffer();
+
+    const uint64_t m_id;
+    const size_t m_maxEventsPerThread;
+    const uint64_t m_origin;
+
+    mutable std::mutex m_registryMutex;
+    std::vector< std::unique_ptr< ThreadBuffer > > m_buffers;
+
+    // the same buffers by thread, so a thread that goes back and forth
+    // between tracers gets its own one back rather than a new one.
+    std::unordered_map< uint32_t, ThreadBuffer * > m_buffersByTid;
+
+}; // end class Zip64Tracer
+
+} // end namespace com::foiani
+
+} // end namespace com
+
+#endif // COM_FOIANI_Z64S_ZIP64TRACE_HPP